@@ -0,0 +1,545 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "CPU.h"
+#include "WideCPU.h"
+#include "Framebuffer.h"
+
+// Lanes of the WideCPU row, counted per lane
+#define BENCH_LANES 32
+// Timed repetitions per program and backend, and the host time each takes
+#define BENCH_REPETITIONS 10
+#define BENCH_REPETITION_MS 100
+// Slowdown against a baseline, in percent, that counts as a regression
+// when it is also well outside the noise of both runs
+#define BENCH_THRESHOLD 5.0
+
+#ifdef _WIN32
+	#define BENCH_NULL_FILE "NUL"
+#else
+	#define BENCH_NULL_FILE "/dev/null"
+#endif
+
+// Guest programs run by both interpreter backends and, when built in, the JIT.
+// Each one is checked against the single-step execute() path before it is
+// timed.
+struct Program {
+	const char *name;
+	std::vector<u8> code;
+	// Draws through a framebuffer device at fbs. WideCPU has no devices, so
+	// these skip the wide row.
+	bool framebuffer = false;
+};
+
+static const std::vector<Program> s_programs = {
+	{ "arith", {
+		0xA0, 0x7F, 0xFF,			// D000: LR0 0x7FFF
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0x00, 0x00,			// D006: LR2 0
+		0xB3, 0xA0, 0xA0, 0xA1,		// D009: SUB R0, R0, R1
+		0xB1, 0xA3, 0xA3, 0xA1,		// D00D: ADD R3, R3, R1
+		0xC0, 0xA0, 0xA2,			// D011: EQU R0, R2
+		0xC1, 0xD0, 0x09,			// D014: JZ 0xD009
+		0xFF,						// D017: HLT
+	} },
+	{ "fill", {
+		0xA9, 0x80, 0x00,			// D000: LDI 0x8000
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0x90, 0x00,			// D006: LR2 0x9000
+		0xA4, 0x55,					// D009: LB0 0x55
+		0xAC, 0xA5, 0xA1, 0xB5,		// D00B: STB RI, B0
+		0xB1, 0xA5, 0xA5, 0xA1,		// D00F: ADD RI, RI, R1
+		0xC0, 0xA5, 0xA2,			// D013: EQU RI, R2
+		0xC1, 0xD0, 0x0B,			// D016: JZ 0xD00B
+		0xFF,						// D019: HLT
+	} },
+	{ "copy", {
+		0xA0, 0x40, 0x00,			// D000: LR0 0x4000
+		0xA1, 0x00, 0x02,			// D003: LR1 2
+		0xA2, 0x50, 0x00,			// D006: LR2 0x5000
+		0xA9, 0x60, 0x00,			// D009: LDI 0x6000
+		0xAF, 0xA3, 0xA0,			// D00C: LDW R3, R0
+		0xAD, 0xA5, 0xA1, 0xA3,		// D00F: STW RI, R3
+		0xB1, 0xA0, 0xA0, 0xA1,		// D013: ADD R0, R0, R1
+		0xB1, 0xA5, 0xA5, 0xA1,		// D017: ADD RI, RI, R1
+		0xC0, 0xA0, 0xA2,			// D01B: EQU R0, R2
+		0xC1, 0xD0, 0x0C,			// D01E: JZ 0xD00C
+		0xFF,						// D021: HLT
+	} },
+	{ "stack", {
+		0xA0, 0x10, 0x00,			// D000: LR0 0x1000
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0x00, 0x00,			// D006: LR2 0
+		0xAA, 0xA1, 0x12, 0x34,		// D009: PUSH WORD 0x1234
+		0xAB, 0xA1, 0xA3,			// D00D: POP WORD R3
+		0xB3, 0xA0, 0xA0, 0xA1,		// D010: SUB R0, R0, R1
+		0xC0, 0xA0, 0xA2,			// D014: EQU R0, R2
+		0xC1, 0xD0, 0x09,			// D017: JZ 0xD009
+		0xFF,						// D01A: HLT
+	} },
+	{ "branchy", {
+		0xA0, 0x10, 0x01,			// D000: LR0 0x1001
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0x01, 0x00,			// D006: LR2 0x0100
+		0xA3, 0x12, 0x34,			// D009: LR3 0x1234
+		0xA8, 0x62, 0x55,			// D00C: LDA 0x6255
+		0xA5, 0x01,					// D00F: LB1 1
+		0xB5, 0xA3, 0xA3, 0xA4,		// D011: MUL R3, R3, RA (LCG step)
+		0xB1, 0xA3, 0xA3, 0xA1,		// D015: ADD R3, R3, R1
+		0xE0, 0xA1, 0xA5, 0xA3, 0xA2,	// D019: AND RI, R3, R2
+		0xC0, 0xA5, 0xA2,			// D01E: EQU RI, R2
+		0xC2, 0xD0, 0x2B,			// D021: JNZ 0xD02B (bit 8 set)
+		0xB7, 0xB5, 0xB5, 0xB6,		// D024: ADDB B0, B0, B1
+		0xC3, 0xD0, 0x34,			// D028: JMP 0xD034
+		0xB7, 0xB7, 0xB7, 0xB6,		// D02B: ADDB B2, B2, B1
+		0xE2, 0xA1, 0xA3, 0xA3, 0xA0,	// D02F: XOR R3, R3, R0
+		0xB3, 0xA0, 0xA0, 0xA1,		// D034: SUB R0, R0, R1
+		0xC0, 0xA0, 0xA1,			// D038: EQU R0, R1
+		0xC1, 0xD0, 0x11,			// D03B: JZ 0xD011
+		0xFF,						// D03E: HLT
+	} },
+	{ "selfmod", {
+		0xA0, 0x03, 0xFF,			// D000: LR0 0x03FF
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0x00, 0x00,			// D006: LR2 0
+		0xA5, 0x01,					// D009: LB1 1
+		0xA9, 0xD0, 0x1E,			// D00B: LDI 0xD01E
+		0xB3, 0xA0, 0xA0, 0xA1,		// D00E: SUB R0, R0, R1
+		0xB7, 0xB5, 0xB5, 0xB6,		// D012: ADDB B0, B0, B1
+		0xAC, 0xA5, 0xA1, 0xB5,		// D016: STB RI, B0 (patches the LR3 below)
+		0xC0, 0xA0, 0xA2,			// D01A: EQU R0, R2
+		0xA3, 0x00, 0x00,			// D01D: LR3 0x0000
+		0xC1, 0xD0, 0x0E,			// D020: JZ 0xD00E
+		0xFF,						// D023: HLT
+	} },
+	// Reads R0 without setting it, so the lanes WideConforms seeds differently
+	// loop different counts, branch different ways and some divide by zero.
+	// R0 stays 0 across timed runs.
+	{ "lanes", {
+		0xA1, 0x00, 0x01,			// D000: LR1 1
+		0xA2, 0x00, 0x07,			// D003: LR2 7
+		0xE0, 0xA1, 0xA3, 0xA0, 0xA2,	// D006: AND R3, R0, R2
+		0xE2, 0xA1, 0xA3, 0xA3, 0xA1,	// D00B: XOR R3, R3, R1 (0 when R0 & 7 is 1)
+		0xA8, 0x0F, 0xFF,			// D010: LDA 0x0FFF
+		0xB6, 0xA5, 0xA4, 0xA3,		// D013: DIV RI, RA, R3
+		0xA2, 0x00, 0x00,			// D017: LR2 0
+		0xA5, 0x01,					// D01A: LB1 1
+		0xE2, 0xA1, 0xA3, 0xA5, 0xA0,	// D01C: XOR R3, RI, R0
+		0xE0, 0xA1, 0xA3, 0xA3, 0xA1,	// D021: AND R3, R3, R1
+		0xC0, 0xA3, 0xA1,			// D026: EQU R3, R1
+		0xC2, 0xD0, 0x30,			// D029: JNZ 0xD030
+		0xB7, 0xB5, 0xB5, 0xB6,		// D02C: ADDB B0, B0, B1
+		0xB3, 0xA5, 0xA5, 0xA1,		// D030: SUB RI, RI, R1
+		0xC0, 0xA5, 0xA2,			// D034: EQU RI, R2
+		0xC1, 0xD0, 0x1C,			// D037: JZ 0xD01C
+		0xFF,						// D03A: HLT
+	} },
+	{ "framebuffer", {
+		0xA9, 0x80, 0x00,			// D000: LDI 0x8000
+		0xA1, 0x00, 0x01,			// D003: LR1 1
+		0xA2, 0xB0, 0x00,			// D006: LR2 0xB000
+		0xA5, 0x03,					// D009: LB1 3
+		0xAC, 0xA5, 0xA1, 0xB5,		// D00B: STB RI, B0
+		0xB7, 0xB5, 0xB5, 0xB6,		// D00F: ADDB B0, B0, B1
+		0xB1, 0xA5, 0xA5, 0xA1,		// D013: ADD RI, RI, R1
+		0xC0, 0xA5, 0xA2,			// D017: EQU RI, R2
+		0xC1, 0xD0, 0x0B,			// D01A: JZ 0xD00B
+		0xB7, 0xB5, 0xB5, 0xB6,		// D01D: ADDB B0, B0, B1 (next run draws new colours)
+		0xFF,						// D021: HLT
+	}, true },
+};
+
+struct Options {
+	unsigned repetitions = BENCH_REPETITIONS;
+	unsigned repetition_ms = BENCH_REPETITION_MS;
+	std::string only;
+	bool json = false;
+	std::string baseline;
+	double threshold = BENCH_THRESHOLD;
+};
+
+// Rates of the repetitions of one measurement
+struct Stats {
+	double median;
+	double min;
+	double max;
+	// Median absolute deviation as a percentage of the median; unlike the
+	// standard deviation it ignores the odd repetition a context switch hit
+	double mad_pct;
+};
+
+// Shared by every CPU that runs a framebuffer program; frames are never
+// emitted, so only the device writes are timed
+static std::unique_ptr<Framebuffer> s_framebuffer;
+
+// The interpreter rows keep the JIT off so they time the interpreter alone
+static std::unique_ptr<CPU> Load(const Program &program, CPU::JitMode jit = CPU::JIT_OFF) {
+	auto cpu = std::make_unique<CPU>();
+	cpu->reset();
+	cpu->set_jit_mode(jit);
+
+	for (size_t i = 0; i < program.code.size(); i++) {
+		cpu->load_addr(cpu->pc + i, program.code[i]);
+	}
+
+	if (program.framebuffer) {
+		if (!s_framebuffer) s_framebuffer = std::make_unique<Framebuffer>(BENCH_NULL_FILE);
+		cpu->map_device(cpu->fbs, FRAMEBUFFER_SIZE, *s_framebuffer);
+	}
+
+	return cpu;
+}
+
+static bool SameState(const CPU &a, const CPU &b) {
+	return a.pc == b.pc && a.sp == b.sp
+		&& a.r0 == b.r0 && a.r1 == b.r1 && a.r2 == b.r2 && a.r3 == b.r3
+		&& a.ra == b.ra && a.ri == b.ri
+		&& a.b0 == b.b0 && a.b1 == b.b1 && a.b2 == b.b2 && a.b3 == b.b3
+		&& a.equal == b.equal && a.zero == b.zero && a.sign == b.sign
+		&& a.carry == b.carry && a.overflow == b.overflow;
+}
+
+// JIT_DIFFERENTIAL also checks every translated block against the
+// interpreter as it runs, and aborts on the first mismatch
+template <CPU::Dispatch D>
+static bool Conforms(const Program &program, CPU::JitMode jit, const CPU &reference, size_t reference_cycles) {
+	auto cpu = Load(program, jit);
+
+	size_t cycles = std::numeric_limits<size_t>::max();
+	if (cpu->run<D>(cycles) != CPU::HALTED) return false;
+
+	return SameState(*cpu, reference) && std::numeric_limits<size_t>::max() - cycles == reference_cycles;
+}
+
+static std::unique_ptr<WideCPU<BENCH_LANES>> LoadWide(const Program &program) {
+	auto cpu = std::make_unique<WideCPU<BENCH_LANES>>();
+	cpu->reset();
+
+	for (size_t i = 0; i < program.code.size(); i++) {
+		cpu->load_addr(cpu->pc[0] + i, program.code[i]);
+	}
+
+	return cpu;
+}
+
+// R0 of a WideConforms lane; R0 & 7 takes every value across 8 lanes
+static u16 LaneSeed(size_t lane) {
+	return (u16)(lane * 0x9E37);
+}
+
+// Each lane starts with its own R0 and every fourth one with a budget that
+// runs out partway, and must match CPU::run from the same state
+static bool WideConforms(const Program &program) {
+	auto cpu = LoadWide(program);
+
+	size_t cycles[BENCH_LANES];
+	CPU::StopReason reasons[BENCH_LANES];
+	for (size_t lane = 0; lane < BENCH_LANES; lane++) {
+		cpu->regs_u16[0][lane] = LaneSeed(lane);
+		cycles[lane] = lane % 4 == 2 ? 5000 + lane * 7 : std::numeric_limits<size_t>::max();
+	}
+	size_t budgets[BENCH_LANES];
+	std::copy_n(cycles, BENCH_LANES, budgets);
+	cpu->run(cycles, reasons);
+
+	for (size_t lane = 0; lane < BENCH_LANES; lane++) {
+		auto reference = Load(program);
+		reference->r0 = LaneSeed(lane);
+		size_t reference_cycles = budgets[lane];
+		CPU::StopReason reason = reference->run(reference_cycles);
+
+		if (reasons[lane] != reason || cycles[lane] != reference_cycles) return false;
+		if (reason == CPU::FAULT && cpu->fault(lane) != reference->fault()) return false;
+
+		bool same = cpu->pc[lane] == reference->pc && cpu->sp[lane] == reference->sp
+			&& cpu->regs_u16[0][lane] == reference->r0 && cpu->regs_u16[1][lane] == reference->r1
+			&& cpu->regs_u16[2][lane] == reference->r2 && cpu->regs_u16[3][lane] == reference->r3
+			&& cpu->regs_u16[4][lane] == reference->ra && cpu->regs_u16[5][lane] == reference->ri
+			&& cpu->regs_u8[0][lane] == reference->b0 && cpu->regs_u8[1][lane] == reference->b1
+			&& cpu->regs_u8[2][lane] == reference->b2 && cpu->regs_u8[3][lane] == reference->b3
+			&& cpu->equal[lane] == reference->equal && cpu->zero[lane] == reference->zero
+			&& cpu->sign[lane] == reference->sign && cpu->carry[lane] == reference->carry
+			&& cpu->overflow[lane] == reference->overflow;
+		if (!same) return false;
+
+		for (u32 addr = 0; addr < MEMORY_CAPACITY; addr++) {
+			if (cpu->read_byte(lane, (u16)addr) != reference->read_addr((u16)addr)) return false;
+		}
+	}
+
+	return true;
+}
+
+template <CPU::Dispatch D>
+static void RunFromEntry(CPU &cpu) {
+	cpu.pc = 0xD000;
+	size_t cycles = std::numeric_limits<size_t>::max();
+	cpu.run<D>(cycles);
+}
+
+// Runs of `run` per host second, once per repetition. A warm-up doubles the
+// runs until they take a noticeable time, which also settles caches, branch
+// predictors and the CPU clock before anything is recorded.
+template <typename Run>
+static std::vector<double> Measure(Run &&run, const Options &options) {
+	using Clock = std::chrono::steady_clock;
+
+	double target = options.repetition_ms / 1000.0;
+	size_t runs = 1;
+	for (;;) {
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < runs; i++) run();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (seconds >= target / 4) {
+			runs = std::max<size_t>(1, (size_t)(runs * target / seconds));
+			break;
+		}
+		runs *= 2;
+	}
+
+	std::vector<double> rates;
+	for (unsigned repetition = 0; repetition < options.repetitions; repetition++) {
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < runs; i++) run();
+		rates.push_back(runs / std::chrono::duration<double>(Clock::now() - start).count());
+	}
+
+	return rates;
+}
+
+static double Median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static Stats Summarize(const std::vector<double> &rates) {
+	Stats stats;
+	stats.median = Median(rates);
+	stats.min = *std::min_element(rates.begin(), rates.end());
+	stats.max = *std::max_element(rates.begin(), rates.end());
+
+	std::vector<double> deviations;
+	for (double rate : rates) {
+		deviations.push_back(std::abs(rate - stats.median));
+	}
+	stats.mad_pct = Median(deviations) / stats.median * 100;
+	return stats;
+}
+
+// The value of `"name":` in one of our own JSON lines
+static bool JsonField(const std::string &line, const std::string &name, std::string &value) {
+	size_t at = line.find("\"" + name + "\":");
+	if (at == std::string::npos) return false;
+
+	at += name.size() + 3;
+	size_t end = line.find_first_of(",}", at);
+	value = line.substr(at, end - at);
+	if (value.size() >= 2 && value.front() == '"') {
+		value = value.substr(1, value.size() - 2);
+	}
+
+	return true;
+}
+
+// Baseline median rate and noise of each program/backend row
+static std::unordered_map<std::string, std::pair<double, double>> LoadBaseline(const std::string &path) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "Failed to open baseline: " << path << std::endl;
+		exit(1);
+	}
+
+	std::unordered_map<std::string, std::pair<double, double>> baseline;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::string program, backend, mips, mad;
+		if (JsonField(line, "program", program) && JsonField(line, "backend", backend)
+			&& JsonField(line, "mips", mips) && JsonField(line, "mad_pct", mad)) {
+			baseline[program + "/" + backend] = { std::stod(mips), std::stod(mad) };
+		}
+	}
+
+	return baseline;
+}
+
+static char *Shift(int &argc, char ***argv) {
+	char *result = **argv;
+	argc -= 1;
+	*argv += 1;
+	return result;
+}
+
+static void Usage(char *program) {
+	std::cerr << "Usage: " << program << " [--program <name>] [--repetitions <n>] [--ms <per repetition>] [--json] [--compare <baseline.jsonl> [--threshold <percent>]]" << std::endl;
+}
+
+static Options ParseOptions(int argc, char **argv) {
+	char *program = Shift(argc, &argv);
+	Options options;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (flag == "--json") {
+			options.json = true;
+		} else if (argc > 0 && flag == "--program") {
+			options.only = Shift(argc, &argv);
+		} else if (argc > 0 && flag == "--repetitions") {
+			options.repetitions = std::max(1, std::atoi(Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--ms") {
+			options.repetition_ms = std::max(1, std::atoi(Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--compare") {
+			options.baseline = Shift(argc, &argv);
+		} else if (argc > 0 && flag == "--threshold") {
+			options.threshold = std::atof(Shift(argc, &argv));
+		} else {
+			Usage(program);
+			std::cerr << "Invalid argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	return options;
+}
+
+// Exits 1 when a backend disagrees with execute(), 2 when a row regressed
+// against the baseline
+int main(int argc, char **argv) {
+	Options options = ParseOptions(argc, argv);
+
+	std::unordered_map<std::string, std::pair<double, double>> baseline;
+	if (!options.baseline.empty()) {
+		baseline = LoadBaseline(options.baseline);
+	}
+
+#if !R828_HAS_THREADED_DISPATCH
+	std::cerr << "note: threaded dispatch not compiled in, both rows use the switch" << std::endl;
+#endif
+#if !R828_HAS_JIT
+	std::cerr << "note: JIT not compiled in, no jit row" << std::endl;
+#endif
+
+	bool ok = true;
+	bool regressed = false;
+	if (!options.json) {
+		std::cout << std::left << std::setw(12) << "program" << std::setw(10) << "backend"
+			<< std::right << std::setw(10) << "MIPS"
+			<< std::setw(8) << "MAD%"
+			<< std::setw(10) << "ns/inst"
+			<< std::setw(12) << "Mcycles/s";
+		if (!baseline.empty()) std::cout << std::setw(10) << "vs base";
+		std::cout << std::endl;
+	}
+
+	for (const Program &program : s_programs) {
+		if (!options.only.empty() && options.only != program.name) continue;
+
+		// Reference run: count instructions and cycles one step at a time
+		auto reference = Load(program);
+		size_t instructions = 0;
+		size_t cycles_used = 0;
+		size_t cycles = std::numeric_limits<size_t>::max();
+		while (cycles > 0) {
+			size_t before = cycles;
+			reference->execute(cycles);
+			instructions++;
+
+			// With an unbounded budget only HLT empties it; run() charges HLT
+			// its single cycle instead
+			cycles_used += cycles == 0 ? 1 : before - cycles;
+		}
+
+		if (!Conforms<CPU::DISPATCH_SWITCH>(program, CPU::JIT_OFF, *reference, cycles_used)
+			|| !Conforms<CPU::DISPATCH_THREADED>(program, CPU::JIT_OFF, *reference, cycles_used)
+			|| (R828_HAS_JIT && !Conforms<CPU::DISPATCH_THREADED>(program, CPU::JIT_DIFFERENTIAL, *reference, cycles_used))
+			|| (R828_HAS_JIT && !Conforms<CPU::DISPATCH_THREADED>(program, CPU::JIT_ON, *reference, cycles_used))
+			|| (!program.framebuffer && !WideConforms(program))) {
+			std::cerr << program.name << ": backend state differs from execute()" << std::endl;
+			ok = false;
+			continue;
+		}
+
+		// Each row times whole runs from the entry point; registers carry
+		// over, but every program sets up its own before looping
+		auto report = [&](const char *backend, const std::vector<double> &runs_per_second, size_t lanes) {
+			Stats stats = Summarize(runs_per_second);
+			double per_run = (double)instructions * lanes;
+			double mips = stats.median * per_run / 1e6;
+			double ns_per_inst = 1e9 / (stats.median * per_run);
+			double mcycles = stats.median * cycles_used * lanes / 1e6;
+
+			double delta = 0;
+			auto base = baseline.find(std::string(program.name) + "/" + backend);
+			bool compared = base != baseline.end();
+			if (compared) {
+				delta = (mips / base->second.first - 1) * 100;
+				double noise = 3 * std::max(stats.mad_pct, base->second.second);
+				if (delta < -std::max(options.threshold, noise)) {
+					regressed = true;
+				}
+			}
+
+			if (options.json) {
+				std::cout << std::setprecision(6)
+					<< "{\"program\":\"" << program.name << "\",\"backend\":\"" << backend << "\""
+					<< ",\"lanes\":" << lanes
+					<< ",\"instructions\":" << instructions
+					<< ",\"cycles\":" << cycles_used
+					<< ",\"repetitions\":" << runs_per_second.size()
+					<< ",\"mips\":" << mips
+					<< ",\"mips_min\":" << stats.min * per_run / 1e6
+					<< ",\"mips_max\":" << stats.max * per_run / 1e6
+					<< ",\"mad_pct\":" << stats.mad_pct
+					<< ",\"ns_per_inst\":" << ns_per_inst
+					<< ",\"mcycles_per_s\":" << mcycles;
+				if (compared) std::cout << ",\"delta_pct\":" << delta;
+				std::cout << "}" << std::endl;
+				return;
+			}
+
+			std::cout << std::left << std::setw(12) << program.name << std::setw(10) << backend
+				<< std::right << std::fixed << std::setprecision(1)
+				<< std::setw(10) << mips
+				<< std::setw(8) << stats.mad_pct
+				<< std::setprecision(2) << std::setw(10) << ns_per_inst
+				<< std::setprecision(1) << std::setw(12) << mcycles;
+			if (compared) std::cout << std::showpos << std::setw(9) << delta << "%" << std::noshowpos;
+			std::cout << std::endl;
+		};
+
+		auto cpu = Load(program);
+		report("switch", Measure([&] { RunFromEntry<CPU::DISPATCH_SWITCH>(*cpu); }, options), 1);
+		report("threaded", Measure([&] { RunFromEntry<CPU::DISPATCH_THREADED>(*cpu); }, options), 1);
+
+#if R828_HAS_JIT
+		auto jit = Load(program, CPU::JIT_ON);
+		report("jit", Measure([&] { RunFromEntry<CPU::DISPATCH_THREADED>(*jit); }, options), 1);
+#endif
+
+		if (!program.framebuffer) {
+			auto wide = LoadWide(program);
+			size_t wide_cycles[BENCH_LANES];
+			CPU::StopReason reasons[BENCH_LANES];
+			auto run_wide = [&] {
+				std::fill_n(wide->pc, BENCH_LANES, 0xD000);
+				std::fill_n(wide_cycles, BENCH_LANES, std::numeric_limits<size_t>::max());
+				wide->run(wide_cycles, reasons);
+			};
+			report("wide", Measure(run_wide, options), BENCH_LANES);
+		}
+	}
+
+	if (!ok) return 1;
+	return regressed ? 2 : 0;
+}
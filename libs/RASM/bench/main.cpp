@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <sys/resource.h>
+#endif
+
+#include "RASM.h"
+#include "ISA.h"
+
+// Timed repetitions per case, and the host time each takes
+#define BENCH_REPETITIONS 10
+#define BENCH_REPETITION_MS 100
+// Slowdown against a baseline, in percent, that counts as a regression when
+// it is also well outside the noise of both runs
+#define BENCH_THRESHOLD 5.0
+
+// A generated program, assembled and linked from 0 as one or more sources.
+// Every case stays below 64 KiB of output so it links into the address space.
+struct Case {
+	std::string name;
+	std::vector<std::string> sources = {};
+	size_t lines = 0;
+};
+
+// Instructions cycled through by the generated programs, a mix of operand
+// kinds and encodings
+static const char *s_Instructions[] = {
+	"LR0 0x1234",
+	"ADD R0, R1, R2",
+	"STB RI, B0",
+	"LB1 7",
+	"EQU R0, R1",
+	"AND RI, R3, R2",
+	"LDW R3, R0",
+	"ADDB B0, B0, B1",
+	"PUSH 0x1234",
+	"POP R3",
+	"STW RI, 4660",
+	"SHR R2, R2, R1",
+};
+
+// Straight-line code: lexing and encoding with no symbols
+static Case Straight(size_t lines) {
+	Case result { "straight" };
+	std::string source;
+	for (size_t i = 0; i < lines; i++) {
+		source += '\t';
+		source += s_Instructions[i % std::size(s_Instructions)];
+		source += '\n';
+	}
+
+	result.sources.push_back(std::move(source));
+	return result;
+}
+
+// A label on every other line and a jump to the next one: symbol definition
+// and forward references
+static Case Labels(size_t lines) {
+	Case result { "labels" };
+	std::string source;
+	for (size_t i = 0; i < lines / 2; i++) {
+		source += "L" + std::to_string(i) + ":\n";
+		source += "\tJZ L" + std::to_string(i + 1) + "\n";
+	}
+	source += "L" + std::to_string(lines / 2) + ":\n\tHLT\n";
+
+	result.sources.push_back(std::move(source));
+	return result;
+}
+
+// Many small sources, each jumping into the next: per-source overhead and
+// relocations resolved by the linker
+static Case Sources(size_t count, size_t lines) {
+	Case result { "sources" };
+	for (size_t i = 0; i < count; i++) {
+		std::string source = "S" + std::to_string(i) + ":\n";
+		for (size_t line = 2; line < lines; line++) {
+			source += '\t';
+			source += s_Instructions[line % std::size(s_Instructions)];
+			source += '\n';
+		}
+		source += i + 1 < count ? "\tJMP S" + std::to_string(i + 1) + "\n" : "\tJMP S0\n";
+		result.sources.push_back(std::move(source));
+	}
+
+	return result;
+}
+
+// Assembles every R828_FORMS row from the text ISA::Disassemble() writes
+// for it and checks that exactly the form's bytes disassemble back to that
+// text, and one byte fewer to nothing
+static bool FormsRoundTrip() {
+	bool ok = true;
+	for (const ISA::Form &form : ISA::FORMS) {
+		std::string text(form.mnemonic);
+		size_t reg8 = 0, reg16 = 0;
+		for (uint8_t i = 0; i < form.operand_count; i++) {
+			text += i == 0 ? " " : ", ";
+			switch (form.operands[i]) {
+			case ISA::OPERAND_REG8:
+			case ISA::OPERAND_REG16: {
+				// A different register for each operand of the kind
+				size_t &skip = form.operands[i] == ISA::OPERAND_REG8 ? reg8 : reg16;
+				size_t seen = 0;
+				for (const ISA::Register &reg : ISA::REGISTERS) {
+					if (reg.kind == form.operands[i] && seen++ == skip) text += reg.name;
+				}
+				skip++;
+			} break;
+			case ISA::OPERAND_IMM8: text += "0x5A"; break;
+			case ISA::OPERAND_IMM16:
+			case ISA::OPERAND_DATA16: text += "0x1234"; break;
+			case ISA::OPERAND_NONE: break;
+			}
+		}
+
+		std::vector<uint8_t> bytes;
+		try {
+			bytes = RASM::AssembleProgram("\t" + text + "\n", 0).segments.at(0).data;
+		} catch (const std::exception &error) {
+			std::cerr << text << ": " << error.what() << std::endl;
+			ok = false;
+			continue;
+		}
+
+		std::string back;
+		bool same = bytes.size() == form.length && bytes[0] == form.opcode
+			&& ISA::Disassemble(bytes.data(), bytes.size(), back) == form.length && back == text
+			&& ISA::Disassemble(bytes.data(), bytes.size() - 1, back) == 0;
+		if (!same) {
+			std::cerr << text << ": does not disassemble back from its " << (unsigned)form.length << " bytes" << std::endl;
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+// The process's peak resident memory so far, in KiB
+static size_t PeakMemoryKiB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+	#else
+		return usage.ru_maxrss;
+	#endif
+#endif
+}
+
+struct Options {
+	unsigned repetitions = BENCH_REPETITIONS;
+	unsigned repetitionMs = BENCH_REPETITION_MS;
+	std::string only;
+	bool json = false;
+	std::string baseline;
+	double threshold = BENCH_THRESHOLD;
+};
+
+// Assemblies per second, once per repetition, after a warm-up that also
+// finds how many assemblies fill a repetition
+static std::vector<double> Measure(const std::function<void()> &assemble, const Options &options) {
+	using Clock = std::chrono::steady_clock;
+
+	double target = options.repetitionMs / 1000.0;
+	size_t runs = 1;
+	for (;;) {
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < runs; i++) assemble();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (seconds >= target / 4) {
+			runs = std::max<size_t>(1, (size_t)(runs * target / seconds));
+			break;
+		}
+		runs *= 2;
+	}
+
+	std::vector<double> rates;
+	for (unsigned repetition = 0; repetition < options.repetitions; repetition++) {
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < runs; i++) assemble();
+		rates.push_back(runs / std::chrono::duration<double>(Clock::now() - start).count());
+	}
+
+	return rates;
+}
+
+static double Median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+// Median absolute deviation as a percentage of the median
+static double MadPercent(const std::vector<double> &values, double median) {
+	std::vector<double> deviations;
+	for (double value : values) deviations.push_back(std::abs(value - median));
+	return Median(deviations) / median * 100;
+}
+
+// The value of `"name":` in a line this tool wrote with --json
+static bool JsonField(const std::string &line, const std::string &name, std::string &value) {
+	size_t at = line.find("\"" + name + "\":");
+	if (at == std::string::npos) return false;
+
+	at += name.size() + 3;
+	size_t end = line.find_first_of(",}", at);
+	value = line.substr(at, end - at);
+	if (value.size() >= 2 && value.front() == '"') value = value.substr(1, value.size() - 2);
+	return true;
+}
+
+static char *Shift(int &argc, char ***argv) {
+	char *result = **argv;
+	argc -= 1;
+	*argv += 1;
+	return result;
+}
+
+static void Usage(char *program) {
+	std::cerr << "Usage: " << program << " [--case straight|labels|sources] [--repetitions <n>] [--ms <per repetition>] [--json] [--compare <baseline.jsonl> [--threshold <percent>]]" << std::endl;
+	std::cerr << "Peak memory is the process high-water mark after each case, so it never falls; --case measures one case alone." << std::endl;
+}
+
+// Exits 2 when a case regressed against the baseline
+int main(int argc, char **argv) {
+	char *program = Shift(argc, &argv);
+	Options options;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (flag == "--json") {
+			options.json = true;
+		} else if (argc > 0 && flag == "--case") {
+			options.only = Shift(argc, &argv);
+		} else if (argc > 0 && flag == "--repetitions") {
+			options.repetitions = std::max(1, std::atoi(Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--ms") {
+			options.repetitionMs = std::max(1, std::atoi(Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--compare") {
+			options.baseline = Shift(argc, &argv);
+		} else if (argc > 0 && flag == "--threshold") {
+			options.threshold = std::atof(Shift(argc, &argv));
+		} else {
+			Usage(program);
+			std::cerr << "Invalid argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	// Baseline median rate and noise of each case
+	std::unordered_map<std::string, std::pair<double, double>> baseline;
+	if (!options.baseline.empty()) {
+		std::ifstream file(options.baseline);
+		if (!file) {
+			std::cerr << "Failed to open baseline: " << options.baseline << std::endl;
+			exit(1);
+		}
+
+		std::string line, name, rate, mad;
+		while (std::getline(file, line)) {
+			if (JsonField(line, "case", name) && JsonField(line, "lines_per_s", rate) && JsonField(line, "mad_pct", mad)) {
+				baseline[name] = { std::stod(rate), std::stod(mad) };
+			}
+		}
+	}
+
+	if (!FormsRoundTrip()) return 1;
+
+	std::vector<Case> cases;
+	cases.push_back(Sources(64, 256));
+	cases.push_back(Labels(16384));
+	cases.push_back(Straight(16384));
+
+	if (!options.json) {
+		std::cout << std::left << std::setw(10) << "case"
+			<< std::right << std::setw(8) << "lines"
+			<< std::setw(10) << "bytes"
+			<< std::setw(14) << "Klines/s"
+			<< std::setw(8) << "MAD%"
+			<< std::setw(12) << "peak KiB";
+		if (!baseline.empty()) std::cout << std::setw(10) << "vs base";
+		std::cout << std::endl;
+	}
+
+	bool regressed = false;
+	for (Case &test : cases) {
+		if (!options.only.empty() && options.only != test.name) continue;
+
+		std::vector<std::string_view> views(test.sources.begin(), test.sources.end());
+		test.lines = 0;
+		for (std::string_view source : views) test.lines += std::count(source.begin(), source.end(), '\n');
+
+		size_t bytes = 0;
+		RASM::Object linked;
+		try {
+			linked = RASM::AssembleProgram(views, 0);
+		} catch (const RASM::Error &error) {
+			std::cerr << test.name << ": " << error.what() << std::endl;
+			return 1;
+		}
+		for (const RASM::Segment &segment : linked.segments) bytes += segment.data.size();
+
+		size_t peakBefore = PeakMemoryKiB();
+		std::vector<double> rates = Measure([&] { RASM::AssembleProgram(views, 0); }, options);
+		size_t peak = PeakMemoryKiB();
+
+		double median = Median(rates);
+		double linesPerSecond = median * test.lines;
+		double mad = MadPercent(rates, median);
+
+		double delta = 0;
+		auto base = baseline.find(test.name);
+		bool compared = base != baseline.end();
+		if (compared) {
+			delta = (linesPerSecond / base->second.first - 1) * 100;
+			if (delta < -std::max(options.threshold, 3 * std::max(mad, base->second.second))) regressed = true;
+		}
+
+		if (options.json) {
+			std::cout << std::setprecision(6)
+				<< "{\"case\":\"" << test.name << "\""
+				<< ",\"sources\":" << test.sources.size()
+				<< ",\"lines\":" << test.lines
+				<< ",\"bytes\":" << bytes
+				<< ",\"repetitions\":" << rates.size()
+				<< ",\"lines_per_s\":" << linesPerSecond
+				<< ",\"lines_per_s_min\":" << *std::min_element(rates.begin(), rates.end()) * test.lines
+				<< ",\"lines_per_s_max\":" << *std::max_element(rates.begin(), rates.end()) * test.lines
+				<< ",\"mad_pct\":" << mad
+				<< ",\"peak_kib\":" << peak
+				<< ",\"peak_growth_kib\":" << peak - peakBefore;
+			if (compared) std::cout << ",\"delta_pct\":" << delta;
+			std::cout << "}" << std::endl;
+			continue;
+		}
+
+		std::cout << std::left << std::setw(10) << test.name
+			<< std::right << std::setw(8) << test.lines
+			<< std::setw(10) << bytes
+			<< std::fixed << std::setprecision(1)
+			<< std::setw(14) << linesPerSecond / 1e3
+			<< std::setw(8) << mad
+			<< std::setw(12) << peak;
+		if (compared) std::cout << std::showpos << std::setw(9) << delta << "%" << std::noshowpos;
+		std::cout << std::endl;
+	}
+
+	return regressed ? 2 : 0;
+}
@@ -1,24 +1,85 @@
-project "RASM"
-	kind "ConsoleApp"
+-- The assembler itself, for the command line tool and for programs that
+-- assemble in-process through RASM.h
+project "RASMLib"
+	kind "StaticLib"
 	language "C++"
     cppdialect "C++20"
 	targetdir "bin/%{cfg.buildcfg}"
-	objdir "bin/obj/%{cfg.buildcfg}"
+	objdir "bin/obj/%{cfg.buildcfg}/%{prj.name}"
 
 	files {
 		"src/**.h",
 		"src/**.cpp",
 	}
+	removefiles { "src/main.cpp" }
+
+	includedirs {
+		"src",
+		"../../src",
+		"libs/spdlog/include"
+	}
+
+	filter "configurations:Debug"
+        defines { "RASM_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "RASM_RELEASE" }
+        optimize "On"
+
+project "RASM"
+	kind "ConsoleApp"
+	language "C++"
+    cppdialect "C++20"
+	targetdir "bin/%{cfg.buildcfg}"
+	objdir "bin/obj/%{cfg.buildcfg}/%{prj.name}"
+
+	files { "src/main.cpp" }
+	links { "RASMLib" }
 
 	includedirs {
 		"src",
+		"../../src",
 		"libs/spdlog/include"
 	}
 
+	filter "system:linux"
+		links { "pthread" }
+
+	filter "configurations:Debug"
+        defines { "RASM_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "RASM_RELEASE" }
+        optimize "On"
+
+-- Assembler throughput and peak memory on generated programs
+project "RASMbench"
+	kind "ConsoleApp"
+	language "C++"
+    cppdialect "C++20"
+	targetdir "bin/%{cfg.buildcfg}"
+	objdir "bin/obj/%{cfg.buildcfg}/%{prj.name}"
+
+	files { "bench/**.cpp" }
+	links { "RASMLib" }
+
+	includedirs {
+		"src",
+		"../../src",
+		"libs/spdlog/include"
+	}
+
+	filter "system:linux"
+		links { "pthread" }
+	filter "system:windows"
+		links { "psapi" }
+
 	filter "configurations:Debug"
         defines { "RASM_DEBUG" }
         symbols "On"
 
     filter "configurations:Release"
         defines { "RASM_RELEASE" }
-        optimize "On"
\ No newline at end of file
+        optimize "On"
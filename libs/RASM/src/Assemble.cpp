@@ -1,231 +1,333 @@
 #include "Assemble.h"
 
-#include <fstream>
+#include <charconv>
 
-#include "Defines.h"
+#include "Error.h"
+#include "ISA.h"
 
 namespace RASM {
 
-	uint16_t StringToU16H(std::string number) {
-		char *end;
-		uint16_t value = (uint16_t)std::stoul(number, nullptr, 16);
-
+	// Digits up to the first invalid character, as strtol would read them
+	static unsigned long ParseNumber(std::string_view number, int base) {
+		unsigned long value = 0;
+		std::from_chars(number.data(), number.data() + number.size(), value, base);
 		return value;
 	}
 
+	static std::string_view HexDigits(std::string_view number) {
+		if (number.size() > 1 && number[0] == '0' && (number[1] == 'x' || number[1] == 'X')) {
+			number.remove_prefix(2);
+		}
+
+		return number;
+	}
+
+	uint16_t StringToU16H(std::string_view number) {
+		return (uint16_t)ParseNumber(HexDigits(number), 16);
+	}
+
+	static unsigned long NumberValue(const Token &tok) {
+		return tok.type == HEX ? ParseNumber(HexDigits(tok.value), 16) : ParseNumber(tok.value, 10);
+	}
+
 	void PushU16(std::vector<uint8_t> &binSource, uint16_t number) {
 		binSource.push_back((number >> 8) & 0xFF);
 		binSource.push_back(number & 0xFF);
 	}
 
-	void PushNumberU16(std::vector<uint8_t> &binSource, std::string number) {
-		char *end;
-		uint16_t value = (uint16_t)std::strtol(number.c_str(), &end, 10);
-		binSource.push_back((value >> 8) & 0xFF);
-		binSource.push_back(value & 0xFF);
-	}
-	
-	void PushNumberU8(std::vector<uint8_t> &binSource, std::string number) {
-		char *end;
-		uint8_t value = (uint8_t)std::strtol(number.c_str(), &end, 10);
-		binSource.push_back(value);
+	// A hex literal is as wide as it is written, so `PUSH 0x05` pushes a byte
+	// and `PUSH 0x0005` a word, the way the disassembler prints them
+	static bool OperandMatches(const Token &tok, ISA::OperandKind kind) {
+		switch (kind) {
+		case ISA::OPERAND_REG8:
+		case ISA::OPERAND_REG16:
+			return tok.type == REG && ISA::REGISTERS[tok.id].kind == kind;
+		case ISA::OPERAND_IMM8:
+			if (tok.type == HEX) return HexDigits(tok.value).size() <= 2;
+			return tok.type == NUMBER && NumberValue(tok) <= 0xFF;
+		case ISA::OPERAND_IMM16:
+		case ISA::OPERAND_DATA16:
+			return tok.type == IDENT || ((tok.type == NUMBER || tok.type == HEX) && NumberValue(tok) <= 0xFFFF);
+		default:
+			return false;
+		}
 	}
 
-	uint8_t RegToU8(std::string reg) {
-		if (reg == "R0") return R0;
-		if (reg == "R1") return R1;
-		if (reg == "R2") return R2;
-		if (reg == "R3") return R3;
-		if (reg == "RA") return RA;
-		if (reg == "RI") return RI;
-		if (reg == "B0") return B0;
-		if (reg == "B1") return B1;
-		if (reg == "B2") return B2;
-		if (reg == "B3") return B3;
+	// The form of the opcode at `index` its operand tokens fit, tried in
+	// ISA::FORMS order
+	static const ISA::Form &SelectForm(const std::vector<Token> &tokens, size_t index) {
+		const Token &tok = tokens[index];
+		const ISA::Form &first = ISA::FORMS[tok.id];
+		if (index + first.operand_count >= tokens.size()) {
+			FAIL("{0}:{1}: Unexpected end of input after {2}", tok.line, tok.column, tok.value);
+		}
+
+		const ISA::OpcodeForms &entry = ISA::OPCODE_FORMS[first.opcode];
+		for (size_t i = entry.first; i < (size_t)entry.first + entry.count; i++) {
+			const ISA::Form &form = ISA::FORMS[i];
+			bool matches = true;
+			for (uint8_t j = 0; j < form.operand_count && matches; j++) {
+				matches = OperandMatches(tokens[index + 1 + j], form.operands[j]);
+			}
+
+			if (matches) return form;
+		}
+
+		FAIL("{0}:{1}: Invalid operands for {2}", tok.line, tok.column, tok.value);
 	}
 
 	static Token NextToken(int &iter, std::vector<Token> &tokens) {
 		if (iter + 1 >= tokens.size()) {
-			ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-			exit(1);
+			FAIL("{0}:{1}: Unexpected end of input after {2}", tokens[iter].line, tokens[iter].column, TokenTypeToString(tokens[iter].type));
 		} else iter++;
 		return tokens[iter];
 	}
 
 	static Token ExpectNextToken(int &iter, std::vector<Token> &tokens, TokenType expect) {
 		if (iter + 1 >= tokens.size()) {
-			ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-			exit(1);
+			FAIL("{0}:{1}: Unexpected end of input after {2}", tokens[iter].line, tokens[iter].column, TokenTypeToString(tokens[iter].type));
 		} else iter++;
 
 		if (tokens[iter].type != expect) {
-			ERROR("Expected: {0}, got: {1}", TokenTypeToString(expect), TokenTypeToString(tokens[iter].type));
-			exit(1);
+			FAIL("{0}:{1}: Expected: {2}, got: {3}", tokens[iter].line, tokens[iter].column,
+				TokenTypeToString(expect), TokenTypeToString(tokens[iter].type));
 		}
 		return tokens[iter];
 	}
 
 	static void ExpectNextTokenV(int &iter, std::vector<Token> &tokens, TokenType expect) {
 		if (iter + 1 >= tokens.size()) {
-			ERROR("NextToken: Out of range! last token: {0}", TokenTypeToString(tokens[iter].type));
-			exit(1);
+			FAIL("{0}:{1}: Unexpected end of input after {2}", tokens[iter].line, tokens[iter].column, TokenTypeToString(tokens[iter].type));
 		}
 
 		if (tokens[iter + 1].type == expect) {
 			return;
 		} else {
-			ERROR("Expected: {0}, got: {1}", TokenTypeToString(expect), TokenTypeToString(tokens[iter].type));
-			exit(1);
+			FAIL("{0}:{1}: Expected: {2}, got: {3}", tokens[iter + 1].line, tokens[iter + 1].column,
+				TokenTypeToString(expect), TokenTypeToString(tokens[iter + 1].type));
 		}
 	}
 
-	Assemble::Assemble(std::string contents) {
-		std::vector<Token> tokens;
+	// Tokens a statement starting at `tok` spans
+	static size_t StatementLength(const Token &tok) {
+		switch (tok.type) {
+		case SECTION:
+		case ORG:
+		case IDENT:
+			return 2;
+		case OPCODE:
+			return 1 + ISA::FORMS[tok.id].operand_count;
+		default:
+			return 1;
+		}
+	}
+
+	Assemble::Assemble(std::string_view source) {
+		Source text(source);
+		AssembleSource(text);
+	}
+
+	Assemble::Assemble(Source &source) {
+		AssembleSource(source);
+	}
+
+	void Assemble::AssembleSource(Source &source) {
+		AssemblePass(source);
+
+		m_Emitting = true;
+		AssemblePass(source);
+
+		ResolveFixups();
+
+		auto entry = m_SymbolIndex.find("ENTRY");
+		if (entry != m_SymbolIndex.end() && m_Object.symbols[entry->second].segment != OBJECT_NONE) {
+			m_Object.entrySegment = m_Object.symbols[entry->second].segment;
+			m_Object.entryOffset = m_Object.symbols[entry->second].offset;
+		}
+	}
+
+	Segment &Assemble::CurrentSegment() {
+		if (m_Segment == OBJECT_NONE) {
+			StartSegment("text", 0, 0);
+		}
+
+		return m_Object.segments[m_Segment];
+	}
+
+	// Pass two reopens the segments pass one created, in the same order and
+	// already sized to fit
+	void Assemble::StartSegment(std::string name, uint16_t flags, uint16_t base) {
+		m_Segment = m_NextSegment++;
+		if (m_Emitting) {
+			m_Object.segments[m_Segment].data.reserve(m_SegmentSizes[m_Segment]);
+			return;
+		}
+
+		if (m_Segment == OBJECT_NONE) {
+			FAIL("Too many segments");
+		}
+
+		m_Object.segments.push_back(Segment { .name = std::move(name), .flags = flags, .base = base, .data = {} });
+		m_SegmentSizes.push_back(0);
+	}
+
+	size_t Assemble::SegmentOffset() {
+		return m_Emitting ? CurrentSegment().data.size() : m_SegmentSizes[m_Segment];
+	}
+
+	uint16_t Assemble::FindSymbol(std::string_view name) {
+		auto it = m_SymbolIndex.find(name);
+		if (it != m_SymbolIndex.end()) return it->second;
+
+		uint16_t index = (uint16_t)m_Object.symbols.size();
+		if (index == OBJECT_NONE) {
+			FAIL("Too many symbols");
+		}
+
+		m_Object.symbols.push_back(Symbol { .name = std::string(name), .segment = OBJECT_NONE, .offset = 0 });
+		m_SymbolIndex.emplace(m_Object.symbols.back().name, index);
+		return index;
+	}
+
+	void Assemble::DefineSymbol(std::string_view name) {
+		CurrentSegment();
+		Symbol &symbol = m_Object.symbols[FindSymbol(name)];
+		if (symbol.segment != OBJECT_NONE) {
+			FAIL("Label defined more than once: {0}", name);
+		}
+
+		symbol.segment = m_Segment;
+		symbol.offset = (uint16_t)m_SegmentSizes[m_Segment];
+	}
+
+	void Assemble::EmitReference(std::string_view name) {
+		std::vector<uint8_t> &data = CurrentSegment().data;
+		m_Fixups.push_back(Relocation {
+			.segment = m_Segment,
+			.offset = (uint16_t)data.size(),
+			.symbol = FindSymbol(name),
+			.kind = RELOC_ABS16,
+		});
+
+		PushU16(data, 0x0000);
+	}
+
+	void Assemble::ResolveFixups() {
+		for (const Relocation &fixup : m_Fixups) {
+			const Symbol &symbol = m_Object.symbols[fixup.symbol];
+			if (symbol.segment == OBJECT_NONE || !(m_Object.segments[symbol.segment].flags & SEGMENT_ABSOLUTE)) {
+				m_Object.relocations.push_back(fixup);
+				continue;
+			}
 
-		Lexer lexer(tokens, contents);
-		m_Tokens = tokens;
+			uint16_t addr = m_Object.segments[symbol.segment].base + symbol.offset;
+			uint8_t *field = m_Object.segments[fixup.segment].data.data() + fixup.offset;
+			field[0] = (addr >> 8) & 0xFF;
+			field[1] = addr & 0xFF;
+		}
+	}
 
-		AssembleFromTokens(tokens);
+	// Pass one only tracks segment sizes and defines labels; pass two checks
+	// operands and encodes
+	void Assemble::AssemblePass(Source &source) {
+		m_Segment = OBJECT_NONE;
+		m_NextSegment = 0;
+		source.Rewind();
+
+		std::vector<Token> tokens;
+		std::string_view chunk;
+		size_t keep = 0;
+		uint32_t line = 1;
+		uint32_t column = 1;
+		while (source.NextChunk(chunk, keep)) {
+			tokens.clear();
+			Lexer lexer(tokens, chunk, line, column);
+
+			size_t consumed = AssembleTokens(tokens, source.AtEnd());
+			if (consumed < tokens.size()) {
+				const Token &rest = tokens[consumed];
+				keep = chunk.data() + chunk.size() - rest.value.data();
+				line = rest.line;
+				column = rest.column;
+			} else {
+				// Chunks end on a line break
+				keep = 0;
+				line = lexer.GetLine();
+				column = 1;
+			}
+		}
 	}
 
-	void Assemble::AssembleFromTokens(std::vector<Token>& tokens) {
-		std::vector<uint8_t> binSource;
-		
+	size_t Assemble::AssembleTokens(std::vector<Token> &tokens, bool final) {
 		int tokIndex = 0;
 		while (tokIndex < tokens.size()) {
-			Token tok = tokens[tokIndex];
+			const Token &tok = tokens[tokIndex];
+			if (!final && tokIndex + StatementLength(tok) > tokens.size()) return tokIndex;
+
 			switch (tok.type) {
+			case SECTION: {
+				Token name = ExpectNextToken(tokIndex, tokens, IDENT);
+				StartSegment(std::string(name.value), 0, 0);
+			} break;
 			case ORG: {
 				Token value = ExpectNextToken(tokIndex, tokens, HEX);
-				m_PointAddr = StringToU16H(value.value);
+				uint16_t base = StringToU16H(value.value);
+
+				// An ORG right after SECTION places that section, anywhere
+				// else it opens a new segment of the same name
+				if (m_Segment != OBJECT_NONE && SegmentOffset() == 0) {
+					CurrentSegment().flags |= SEGMENT_ABSOLUTE;
+					CurrentSegment().base = base;
+				} else {
+					StartSegment(m_Segment == OBJECT_NONE ? "text" : CurrentSegment().name, SEGMENT_ABSOLUTE, base);
+				}
 			} break;
 			case IDENT: {
 				ExpectNextTokenV(tokIndex, tokens, COLON);
-				m_Labels.push_back(Label { .name = tokens[tokIndex].value, .addr = m_PointAddr });
+				if (!m_Emitting) DefineSymbol(tok.value);
 				NextToken(tokIndex, tokens);
 			} break;
 			case OPCODE: {
-				if (tok.value == "LR0") {
-					binSource.push_back(LR0);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LR1") {
-					binSource.push_back(LR1);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LR2") {
-					binSource.push_back(LR2);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LR3") {
-					binSource.push_back(LR3);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LB0") {
-					binSource.push_back(LB0);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU8(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LB1") {
-					binSource.push_back(LB1);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU8(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LB2") {
-					binSource.push_back(LB2);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU8(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LB3") {
-					binSource.push_back(LB3);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU8(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LDA") {
-					binSource.push_back(LDA);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "LDI") {
-					binSource.push_back(LDI);
-					Token value = ExpectNextToken(tokIndex, tokens, NUMBER);
-					PushNumberU16(binSource, value.value);
-					m_PointAddr++;
-				} else if (tok.value == "JMP") {
-					binSource.push_back(JMP);
-					Token value = ExpectNextToken(tokIndex, tokens, IDENT);
-					bool found = false;
-					for (Label label : m_Labels) {
-						INFO("label: {0}", label.name);
-						if (label.name == value.value) {
-							PushU16(binSource, label.addr);
-							found = true;
-						}
+				const ISA::Form &form = SelectForm(tokens, tokIndex);
+				if (!m_Emitting) {
+					Segment &segment = CurrentSegment();
+					size_t &size = m_SegmentSizes[m_Segment];
+					if (segment.base + size + form.length > 0x10000) {
+						FAIL("Segment {0} does not fit in memory", segment.name);
 					}
 
-					if (!found) {
-						ERROR("Invalid label: {0}", value.value);
-						exit(1);
+					size += form.length;
+					tokIndex += form.operand_count;
+					break;
+				}
+
+				std::vector<uint8_t> &binSource = CurrentSegment().data;
+				binSource.push_back(form.opcode);
+				for (uint8_t i = 0; i < form.operand_count; i++) {
+					if (form.mode != ISA::NO_MODE && i == form.mode_at) binSource.push_back(form.mode);
+
+					const Token &operand = tokens[++tokIndex];
+					switch (form.operands[i]) {
+					case ISA::OPERAND_REG8:
+					case ISA::OPERAND_REG16:
+						binSource.push_back(ISA::REGISTERS[operand.id].code);
+						break;
+					case ISA::OPERAND_IMM8:
+						binSource.push_back((uint8_t)NumberValue(operand));
+						break;
+					default:
+						if (operand.type == IDENT) EmitReference(operand.value);
+						else PushU16(binSource, (uint16_t)NumberValue(operand));
+						break;
 					}
-				} else if (tok.value == "ADD" ) {
-					binSource.push_back(ADD);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "ADC") {
-					binSource.push_back(ADC);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "SUB") {
-					binSource.push_back(SUB);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "SBB") {
-					binSource.push_back(SBB);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "MUL") {
-					binSource.push_back(MUL);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "DIV") {
-					binSource.push_back(DIV);
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					binSource.push_back(RegToU8(ExpectNextToken(tokIndex, tokens, REG).value));
-					m_PointAddr++;
-				} else if (tok.value == "HLT") { binSource.push_back(HLT); m_PointAddr++; }
+				}
 			} break;
 			}
 
 			tokIndex++;
 		}
 
-		std::string name = "output.bin";
-		std::ofstream outfile(name, std::ios::binary);
-		if (!outfile) {
-			ERROR("Error opening file: {0}", name);
-			exit(1);
-		}
-		
-		for (uint8_t byte : binSource) {
-			outfile.write(reinterpret_cast<const char*>(&byte), sizeof(uint8_t));
-		}
-
-		outfile.close();
+		return tokens.size();
 	}
 
 }
\ No newline at end of file
@@ -1,25 +1,61 @@
 #pragma once
 
+#include <unordered_map>
+
 #include "Log/Log.h"
 #include "Lexer.h"
+#include "Object.h"
+#include "Source.h"
 
 namespace RASM {
 
-	struct Label {
-		std::string name;
-		uint16_t addr;
-	};
-
+	// Assembles into a relocatable object in two passes, each streaming the
+	// source a chunk at a time, so memory is bounded by the chunk, the
+	// symbol table and the output rather than the size of the source. Code goes into the
+	// segment opened by the last SECTION or ORG, or "text" before either.
+	// Pass one sizes every instruction and defines every label, pass two
+	// encodes; label operands are then patched in place when the label sits
+	// in an absolute segment and left to the linker as relocations otherwise,
+	// so labels may be used before they are defined or come from another
+	// object. A label named ENTRY marks the entry point.
 	class Assemble {
 	public:
-		Assemble(std::string contents);
+		Assemble(std::string_view source);
+		Assemble(Source &source);
+
+		const Object &GetObject() const { return m_Object; }
 	private:
-		void AssembleFromTokens(std::vector<Token> &tokens);
+		void AssembleSource(Source &source);
+		void AssemblePass(Source &source);
+		// Returns how many tokens were consumed; unless `final`, a statement
+		// cut off by the end of the chunk is left for the next one
+		size_t AssembleTokens(std::vector<Token> &tokens, bool final);
+		void ResolveFixups();
+
+		Segment &CurrentSegment();
+		void StartSegment(std::string name, uint16_t flags, uint16_t base);
+		// Bytes laid out (pass one) or emitted (pass two) in the current segment
+		size_t SegmentOffset();
+
+		// Index of the symbol, added as undefined if it is new
+		uint16_t FindSymbol(std::string_view name);
+		void DefineSymbol(std::string_view name);
+		void EmitReference(std::string_view name);
 	private:
-		std::vector<Token> m_Tokens;
-		std::vector<Label> m_Labels;
-		
-		uint16_t m_PointAddr = 0x0000;
+		// Looked up by the token's view, without building a string
+		struct SymbolHash {
+			using is_transparent = void;
+			size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+		};
+
+		Object m_Object;
+		uint16_t m_Segment = OBJECT_NONE;
+		uint16_t m_NextSegment = 0;
+		std::vector<size_t> m_SegmentSizes;
+
+		bool m_Emitting = false;
+		std::unordered_map<std::string, uint16_t, SymbolHash, std::equal_to<>> m_SymbolIndex;
+		std::vector<Relocation> m_Fixups;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "Build.h"
+
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+#include "Log/Log.h"
+#include "Error.h"
+#include "Assemble.h"
+#include "Source.h"
+
+namespace RASM {
+
+	// The whole file, so the text hashed is the text assembled even if the
+	// file changes meanwhile
+	static std::string ReadSource(const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			FAIL("Error opening file: {0}", path);
+		}
+
+		return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	static unsigned long ProcessId() {
+	#ifdef _WIN32
+		return (unsigned long)_getpid();
+	#else
+		return (unsigned long)getpid();
+	#endif
+	}
+
+	// FNV-1a over the source text and the versions that decide its encoding
+	static uint64_t HashSource(std::string_view text) {
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&](const char *data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+			}
+		};
+
+		const uint16_t versions[] = { BUILD_CACHE_VERSION, OBJECT_VERSION };
+		mix(reinterpret_cast<const char *>(versions), sizeof(versions));
+
+		mix(text.data(), text.size());
+		return hash;
+	}
+
+	Build::Build(const std::vector<std::string> &inputs, const std::string &cacheDir, unsigned threads)
+		: m_Inputs(inputs), m_CacheDir(cacheDir), m_Objects(inputs.size()), m_Cached(inputs.size()) {
+		std::error_code error;
+		std::filesystem::create_directories(m_CacheDir, error);
+		if (error) {
+			FAIL("Error creating cache directory {0}: {1}", m_CacheDir, error.message());
+		}
+
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = (unsigned)std::min<size_t>(threads, inputs.size());
+
+		// Workers take the next unbuilt input until none are left or one
+		// fails. Errors are handed back here and the first input's rethrown,
+		// so the caller sees the same one whatever the thread timing.
+		std::atomic<size_t> next = 0;
+		std::vector<std::exception_ptr> errors(inputs.size());
+		std::vector<std::thread> workers;
+		for (unsigned i = 0; i < threads; i++) {
+			workers.emplace_back([&] {
+				for (size_t index = next++; index < m_Inputs.size(); index = next++) {
+					try {
+						BuildInput(index);
+					} catch (...) {
+						Log::SetContext("");
+						errors[index] = std::current_exception();
+						next = m_Inputs.size();
+					}
+				}
+			});
+		}
+
+		for (std::thread &worker : workers) worker.join();
+
+		for (const std::exception_ptr &error : errors) {
+			if (error) std::rethrow_exception(error);
+		}
+
+		for (uint8_t cached : m_Cached) m_CachedCount += cached;
+	}
+
+	void Build::BuildInput(size_t index) {
+		const std::string &input = m_Inputs[index];
+		Log::SetContext(input + ": ");
+
+		std::string text = ReadSource(input);
+		std::ostringstream name;
+		name << std::hex << HashSource(text) << ".o";
+		std::filesystem::path cached = std::filesystem::path(m_CacheDir) / name.str();
+
+		if (std::filesystem::exists(cached)) {
+			m_Objects[index] = ReadObject(cached.string());
+			m_Cached[index] = 1;
+		} else {
+			Source source { std::string_view(text) };
+			Assemble assemble(source);
+			m_Objects[index] = assemble.GetObject();
+
+			// Written aside and renamed into place, so an interrupted build or
+			// another worker or process assembling the same text never leaves
+			// half an object
+			std::ostringstream temp;
+			temp << cached.string() << "." << ProcessId() << "." << std::this_thread::get_id() << ".tmp";
+			WriteObject(m_Objects[index], temp.str());
+
+			std::error_code error;
+			std::filesystem::rename(temp.str(), cached, error);
+			if (error) {
+				FAIL("Error writing file: {0}", cached.string());
+			}
+		}
+
+		Log::SetContext("");
+	}
+
+}
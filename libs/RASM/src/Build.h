@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Object.h"
+
+// Bumped whenever the assembler would encode the same source differently,
+// so objects cached by an older RASM are not reused
+#define BUILD_CACHE_VERSION 1
+
+namespace RASM {
+
+	// Assembles many sources at once, one per worker thread. Each object is
+	// kept in the cache directory under a hash of its source text, so a
+	// source that has not changed since it was last built is read back
+	// instead of assembled again. Errors name the source they come from and
+	// are thrown from the constructor once every worker has stopped.
+	class Build {
+	public:
+		// `threads` of 0 uses every core
+		Build(const std::vector<std::string> &inputs, const std::string &cacheDir, unsigned threads);
+
+		// In the order of the inputs
+		const std::vector<Object> &GetObjects() const { return m_Objects; }
+		size_t GetCachedCount() const { return m_CachedCount; }
+	private:
+		void BuildInput(size_t index);
+	private:
+		const std::vector<std::string> &m_Inputs;
+		std::string m_CacheDir;
+
+		std::vector<Object> m_Objects;
+		std::vector<uint8_t> m_Cached;
+		size_t m_CachedCount = 0;
+	};
+
+}
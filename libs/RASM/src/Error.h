@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include "Log/Log.h"
+
+namespace RASM {
+
+	// Thrown by the library for source it cannot assemble, objects it cannot
+	// link and files it cannot read or write. what() is the diagnostic the
+	// command line tool prints.
+	class Error : public std::runtime_error {
+	public:
+		explicit Error(const std::string &message) : std::runtime_error(message) {}
+	};
+
+}
+
+// Throws an Error prefixed with the calling thread's Log context, as ERROR
+// would have logged it
+#define FAIL(...)		throw ::RASM::Error(::RASM::Log::GetContext() + fmt::format(__VA_ARGS__))
@@ -1,106 +1,186 @@
 #include "Lexer.h"
+
+#include <array>
+#include <cctype>
+
 #include "Log/Log.h"
+#include "ISA.h"
 
 namespace RASM {
-	
-	Lexer::Lexer(std::vector<Token> &tokens, const std::string& source) {
-		m_Input = source;
-		m_Pos = 0;
 
-		while (m_Pos < m_Input.size()) {
-			tokens.push_back(FetchToken());
+	struct Keyword {
+		std::string_view name;
+		TokenType type;
+		uint16_t id;
+	};
+
+	static constexpr size_t CountMnemonics() {
+		size_t count = 0;
+		for (size_t i = 0; i < ISA::FORM_COUNT; i++) {
+			if (i == 0 || ISA::FORMS[i].mnemonic != ISA::FORMS[i - 1].mnemonic) count++;
+		}
+
+		return count;
+	}
+
+	// Every mnemonic and register in the ISA, plus the directives
+	static constexpr auto s_Keywords = [] {
+		std::array<Keyword, CountMnemonics() + std::size(ISA::REGISTERS) + 2> keywords {};
+		size_t count = 0;
+		for (size_t i = 0; i < ISA::FORM_COUNT; i++) {
+			if (i == 0 || ISA::FORMS[i].mnemonic != ISA::FORMS[i - 1].mnemonic) {
+				keywords[count++] = { ISA::FORMS[i].mnemonic, OPCODE, (uint16_t)i };
+			}
 		}
 
-		for (Token &tok : tokens) {
-			INFO("{0} -> {1}", TokenTypeToString(tok.type), tok.value);
+		for (size_t i = 0; i < std::size(ISA::REGISTERS); i++) {
+			keywords[count++] = { ISA::REGISTERS[i].name, REG, (uint16_t)i };
+		}
+
+		keywords[count++] = { "SECTION", SECTION, 0 };
+		keywords[count++] = { "ORG", ORG, 0 };
+		return keywords;
+	}();
+
+	// Keywords are classified through a perfect hash built at compile time:
+	// the seed is searched for until no two keywords share a slot, so a word
+	// takes one probe and at most one compare
+	constexpr size_t KEYWORD_TABLE_BITS = 8;
+	constexpr size_t KEYWORD_TABLE_SIZE = 1 << KEYWORD_TABLE_BITS;
+
+	static constexpr size_t KeywordSlot(std::string_view word, uint32_t seed) {
+		uint32_t hash = seed;
+		for (char c : word) {
+			hash = (hash ^ (uint8_t)c) * 16777619u;
+		}
+
+		// The top bits, which every byte and the whole seed feed into
+		return hash >> (32 - KEYWORD_TABLE_BITS);
+	}
+
+	static constexpr uint32_t FindKeywordSeed() {
+		for (uint32_t seed = 2166136261u;; seed++) {
+			bool used[KEYWORD_TABLE_SIZE] = {};
+			bool perfect = true;
+			for (const Keyword &keyword : s_Keywords) {
+				size_t slot = KeywordSlot(keyword.name, seed);
+				if (used[slot]) {
+					perfect = false;
+					break;
+				}
+				used[slot] = true;
+			}
+
+			if (perfect) return seed;
 		}
 	}
 
-	Token Lexer::FetchToken() {
+	static constexpr uint32_t s_KeywordSeed = FindKeywordSeed();
+
+	static constexpr std::array<uint8_t, KEYWORD_TABLE_SIZE> s_KeywordTable = [] {
+		std::array<uint8_t, KEYWORD_TABLE_SIZE> table {};
+		table.fill(0xFF);
+		for (size_t i = 0; i < std::size(s_Keywords); i++) {
+			table[KeywordSlot(s_Keywords[i].name, s_KeywordSeed)] = (uint8_t)i;
+		}
+
+		return table;
+	}();
+
+	static_assert(std::size(s_Keywords) < 0xFF);
+
+	static const Keyword *FindKeyword(std::string_view word) {
+		uint8_t index = s_KeywordTable[KeywordSlot(word, s_KeywordSeed)];
+		if (index != 0xFF && s_Keywords[index].name == word) return &s_Keywords[index];
+
+		return nullptr;
+	}
+
+	Lexer::Lexer(std::vector<Token> &tokens, std::string_view source, uint32_t line, uint32_t column) {
+		m_Input = source;
+		m_Line = line;
+		m_LineStart = -(ptrdiff_t)(column - 1);
+
+		Token token;
+		while (FetchToken(token)) {
+			tokens.push_back(token);
+		}
+	}
+
+	Token Lexer::MakeToken(TokenType type, size_t start) {
+		return {
+			.type = type,
+			.value = m_Input.substr(start, m_Pos - start),
+			.line = m_Line,
+			.column = (uint32_t)((ptrdiff_t)start - m_LineStart + 1),
+			.id = 0,
+		};
+	}
+
+	bool Lexer::FetchToken(Token &token) {
 		while (m_Pos < m_Input.size()) {
 			char current = m_Input[m_Pos];
-			if (std::isspace(current)) { m_Pos++; continue; }
+			if (current == '\n') {
+				m_Line++;
+				m_LineStart = (ptrdiff_t)m_Pos + 1;
+			}
+			if (std::isspace((unsigned char)current)) { m_Pos++; continue; }
 
-			if (std::isalpha(current)) {
-				return LexKI();
+			if (std::isalpha((unsigned char)current)) {
+				token = LexKI();
+				return true;
 			}
 
-			if (std::isdigit(current)) {
-				return LexNumber();
+			if (std::isdigit((unsigned char)current)) {
+				token = LexNumber();
+				return true;
 			}
 
+			TokenType type = UNKNOWN;
 			switch (current) {
-			case '(': m_Pos++; return { .type = LPAREN, .value = std::string(1, current) };
-			case ')': m_Pos++; return { .type = RPAREN, .value = std::string(1, current) };
-			case '[': m_Pos++; return { .type = LBRACE, .value = std::string(1, current) };
-			case ']': m_Pos++; return { .type = RBRACE, .value = std::string(1, current) };
-			case '{': m_Pos++; return { .type = LCURLYBRACE, .value = std::string(1, current) };
-			case '}': m_Pos++; return { .type = RCURLYBRACE, .value = std::string(1, current) };
-			case ':': m_Pos++; return { .type = COLON, .value = std::string(1, current) };
-			case ';': m_Pos++; return { .type = SEMICOLON, .value = std::string(1, current) };
-			case '_': m_Pos++; return { .type = UNDERSCORE, .value = std::string(1, current) };
+			case '(': type = LPAREN; break;
+			case ')': type = RPAREN; break;
+			case '[': type = LBRACE; break;
+			case ']': type = RBRACE; break;
+			case '{': type = LCURLYBRACE; break;
+			case '}': type = RCURLYBRACE; break;
+			case ':': type = COLON; break;
+			case ';': type = SEMICOLON; break;
+			case '_': type = UNDERSCORE; break;
 			}
 
 			m_Pos++;
+			if (type != UNKNOWN) {
+				token = MakeToken(type, m_Pos - 1);
+				return true;
+			}
 		}
+
+		return false;
 	}
 
 	Token Lexer::LexKI() {
-		int start = m_Pos;
-		while (m_Pos < m_Input.size() && std::isalnum(m_Input[m_Pos])) { m_Pos++; }
-		std::string value = m_Input.substr(start, m_Pos - start);
-
-		if (value == "LR0"
-			|| value == "LR1"
-			|| value == "LR2"
-			|| value == "LR3"
-			|| value == "LB0"
-			|| value == "LB1"
-			|| value == "LB2"
-			|| value == "LB3"
-			|| value == "LDA"
-			|| value == "LDI"
-			|| value == "LDW"
-			|| value == "ADD"
-			|| value == "ADC"
-			|| value == "SUB"
-			|| value == "SBB"
-			|| value == "MUL"
-			|| value == "DIV"
-			|| value == "JMP"
-			|| value == "HLT")
-			return { .type = OPCODE, .value = value };
-
-		if (value == "SECTION")
-			return { .type = SECTION, .value = value };
-
-		if (value == "ORG")
-			return { .type = ORG, .value = value };
-
-		if (value == "R0"
-			|| value == "R1"
-			|| value == "R2"
-			|| value == "R3"
-			|| value == "RA"
-			|| value == "RI"
-			|| value == "B0"
-			|| value == "B1"
-			|| value == "B2"
-			|| value == "B3")
-			return { .type = REG, .value = value };
-
-		return { .type = IDENT, .value = value };
+		size_t start = m_Pos;
+		while (m_Pos < m_Input.size() && std::isalnum((unsigned char)m_Input[m_Pos])) { m_Pos++; }
+
+		Token token = MakeToken(IDENT, start);
+		if (const Keyword *keyword = FindKeyword(token.value)) {
+			token.type = keyword->type;
+			token.id = keyword->id;
+		}
+
+		return token;
 	}
 
 	Token Lexer::LexNumber() {
-		int start = m_Pos;
-		while (m_Pos < m_Input.size() && std::isdigit(m_Input[m_Pos]) || std::isalpha(m_Input[m_Pos])) { m_Pos++; }
-		std::string value = m_Input.substr(start, m_Pos - start);
+		size_t start = m_Pos;
+		while (m_Pos < m_Input.size() && std::isalnum((unsigned char)m_Input[m_Pos])) { m_Pos++; }
 
-		if (value[1] == 'x' || value[1] == 'X')
-			return { .type = HEX, .value = value };
+		Token token = MakeToken(NUMBER, start);
+		if (token.value.size() > 1 && (token.value[1] == 'x' || token.value[1] == 'X'))
+			token.type = HEX;
 
-		return { .type = NUMBER, .value = value };
+		return token;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,23 +1,32 @@
 #pragma once
 
+#include <string_view>
 #include <vector>
 
 #include "Token.h"
 
 namespace RASM {
 
+	// Tokens are views into `source`, which must outlive them. A chunk of a
+	// larger source starts at the `line` and `column` where it was cut.
 	class Lexer {
 	public:
-		Lexer(std::vector<Token> &tokens, const std::string &source);
+		Lexer(std::vector<Token> &tokens, std::string_view source, uint32_t line = 1, uint32_t column = 1);
+
+		// Line the lexer stopped on
+		uint32_t GetLine() const { return m_Line; }
 	private:
-		Token FetchToken();
+		bool FetchToken(Token &token);
+		Token MakeToken(TokenType type, size_t start);
 
-		Token LexLabel();
 		Token LexKI();
 		Token LexNumber();
 	private:
-		std::string m_Input;
-		int m_Pos;
+		std::string_view m_Input;
+		size_t m_Pos = 0;
+
+		uint32_t m_Line;
+		ptrdiff_t m_LineStart;
 	};
 
-}
\ No newline at end of file
+}
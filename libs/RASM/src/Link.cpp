@@ -0,0 +1,124 @@
+#include "Link.h"
+
+#include <algorithm>
+
+#include "Error.h"
+
+namespace RASM {
+
+	Link::Link(const std::vector<Object> &objects, uint16_t base) {
+		for (const Object &object : objects) {
+			std::vector<uint16_t> &map = m_SegmentMap.emplace_back();
+			for (const Segment &segment : object.segments) {
+				map.push_back((uint16_t)m_Object.segments.size());
+				m_Object.segments.push_back(segment);
+			}
+		}
+
+		if (m_Object.segments.size() >= OBJECT_NONE) {
+			FAIL("Too many segments to link");
+		}
+
+		PlaceSegments(base);
+		DefineSymbols(objects);
+		ApplyRelocations(objects);
+		SetEntry(objects);
+
+		m_Object.flags = OBJECT_EXECUTABLE;
+	}
+
+	void Link::PlaceSegments(uint16_t base) {
+		struct Range { size_t start, end; const std::string *name; };
+		std::vector<Range> used;
+
+		auto overlap = [&](size_t start, size_t end) -> const Range * {
+			for (const Range &range : used) {
+				if (start < range.end && range.start < end) return &range;
+			}
+			return nullptr;
+		};
+
+		for (const Segment &segment : m_Object.segments) {
+			if (!(segment.flags & SEGMENT_ABSOLUTE)) continue;
+
+			size_t end = segment.base + segment.data.size();
+			if (const Range *other = overlap(segment.base, end)) {
+				FAIL("Segment {0} overlaps segment {1}", segment.name, *other->name);
+			}
+			used.push_back({ segment.base, end, &segment.name });
+		}
+
+		size_t next = base;
+		for (Segment &segment : m_Object.segments) {
+			if (segment.flags & SEGMENT_ABSOLUTE) continue;
+
+			while (const Range *other = overlap(next, next + std::max<size_t>(segment.data.size(), 1))) {
+				next = other->end;
+			}
+
+			if (next + segment.data.size() > 0x10000) {
+				FAIL("Segment {0} does not fit in memory", segment.name);
+			}
+
+			segment.base = (uint16_t)next;
+			segment.flags |= SEGMENT_ABSOLUTE;
+			used.push_back({ next, next + segment.data.size(), &segment.name });
+			next += segment.data.size();
+		}
+	}
+
+	void Link::DefineSymbols(const std::vector<Object> &objects) {
+		for (size_t i = 0; i < objects.size(); i++) {
+			for (const Symbol &symbol : objects[i].symbols) {
+				if (symbol.segment == OBJECT_NONE) continue;
+
+				auto [it, inserted] = m_SymbolIndex.try_emplace(symbol.name, (uint16_t)m_Object.symbols.size());
+				if (!inserted) {
+					FAIL("Symbol defined more than once: {0}", symbol.name);
+				}
+
+				m_Object.symbols.push_back(Symbol { symbol.name, m_SegmentMap[i][symbol.segment], symbol.offset });
+			}
+		}
+	}
+
+	void Link::ApplyRelocations(const std::vector<Object> &objects) {
+		for (size_t i = 0; i < objects.size(); i++) {
+			for (const Relocation &relocation : objects[i].relocations) {
+				const Symbol &reference = objects[i].symbols[relocation.symbol];
+
+				auto it = m_SymbolIndex.find(reference.name);
+				if (it == m_SymbolIndex.end()) {
+					FAIL("Undefined symbol: {0}", reference.name);
+				}
+
+				const Symbol &symbol = m_Object.symbols[it->second];
+				uint16_t addr = m_Object.segments[symbol.segment].base + symbol.offset;
+
+				std::vector<uint8_t> &data = m_Object.segments[m_SegmentMap[i][relocation.segment]].data;
+				data[relocation.offset] = (addr >> 8) & 0xFF;
+				data[relocation.offset + 1] = addr & 0xFF;
+			}
+		}
+	}
+
+	void Link::SetEntry(const std::vector<Object> &objects) {
+		for (size_t i = 0; i < objects.size(); i++) {
+			if (objects[i].entrySegment == OBJECT_NONE) continue;
+
+			if (m_Object.entrySegment != OBJECT_NONE) {
+				FAIL("More than one object has an entry point");
+			}
+
+			m_Object.entrySegment = m_SegmentMap[i][objects[i].entrySegment];
+			m_Object.entryOffset = objects[i].entryOffset;
+		}
+
+		// Without an ENTRY label execution starts at the first segment
+		if (m_Object.entrySegment == OBJECT_NONE && !m_Object.segments.empty()) {
+			m_Object.entrySegment = 0;
+			m_Object.entryOffset = 0;
+		}
+	}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "Object.h"
+
+namespace RASM {
+
+	// Combines relocatable objects into one executable. Absolute segments stay
+	// where ORG put them; the others are laid out in order from `base`,
+	// skipping over absolute ones. Every symbol is global, so a name may only
+	// be defined once across all objects.
+	class Link {
+	public:
+		Link(const std::vector<Object> &objects, uint16_t base);
+
+		const Object &GetObject() const { return m_Object; }
+	private:
+		void PlaceSegments(uint16_t base);
+		void DefineSymbols(const std::vector<Object> &objects);
+		void ApplyRelocations(const std::vector<Object> &objects);
+		void SetEntry(const std::vector<Object> &objects);
+	private:
+		Object m_Object;
+
+		// Output segment of each input segment, per object
+		std::vector<std::vector<uint16_t>> m_SegmentMap;
+		std::unordered_map<std::string, uint16_t> m_SymbolIndex;
+	};
+
+}
@@ -1,5 +1,7 @@
 #include "Log.h"
 
+#include <mutex>
+
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 namespace RASM {
@@ -7,9 +9,12 @@ namespace RASM {
 	std::shared_ptr<spdlog::logger> Log::s_Logger;
 	
 	void Log::Init() {
-		spdlog::set_pattern("%^[%l]: %v%$");
-		s_Logger = spdlog::stdout_color_mt("MAGNO_COMPILER");
-		s_Logger->set_level(spdlog::level::trace);
+		static std::once_flag s_Initialized;
+		std::call_once(s_Initialized, [] {
+			spdlog::set_pattern("%^[%l]: %v%$");
+			s_Logger = spdlog::stdout_color_mt("MAGNO_COMPILER");
+			s_Logger->set_level(spdlog::level::trace);
+		});
 	}
 
 }
\ No newline at end of file
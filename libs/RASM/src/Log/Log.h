@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <stdio.h>
 
 #include <spdlog/spdlog.h>
@@ -9,11 +10,18 @@ namespace RASM {
 
 	class Log {
 	public:
+		// Safe to call more than once, as the library entry points do
 		static void Init();
 
 		inline static std::shared_ptr<spdlog::logger>& GetLogger() { return s_Logger; }
+
+		// Prefixed to errors logged from the calling thread, such as the file
+		// it is assembling
+		inline static void SetContext(std::string context) { s_Context = std::move(context); }
+		inline static const std::string &GetContext() { return s_Context; }
 	private:
 		static std::shared_ptr<spdlog::logger> s_Logger;
+		inline static thread_local std::string s_Context;
 	};
 
 }
@@ -21,4 +29,4 @@ namespace RASM {
 #define TRACE(...)		::RASM::Log::GetLogger()->trace(__VA_ARGS__)
 #define INFO(...)		::RASM::Log::GetLogger()->info(__VA_ARGS__)
 #define WARN(...)		::RASM::Log::GetLogger()->warn(__VA_ARGS__)
-#define ERROR(...)		::RASM::Log::GetLogger()->error(__VA_ARGS__)
\ No newline at end of file
+#define ERROR(...)		::RASM::Log::GetLogger()->error("{0}{1}", ::RASM::Log::GetContext(), fmt::format(__VA_ARGS__))
\ No newline at end of file
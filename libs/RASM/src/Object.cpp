@@ -0,0 +1,176 @@
+#include "Object.h"
+
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+
+#include "Error.h"
+
+namespace RASM {
+
+	static void Put16(std::vector<uint8_t> &out, uint16_t value) {
+		out.push_back(value & 0xFF);
+		out.push_back(value >> 8);
+	}
+
+	static void Put32(std::vector<uint8_t> &out, uint32_t value) {
+		for (int i = 0; i < 4; i++) out.push_back((value >> (i * 8)) & 0xFF);
+	}
+
+	static uint16_t Get16(const uint8_t *in) {
+		return (uint16_t)(in[0] | (in[1] << 8));
+	}
+
+	static uint32_t Get32(const uint8_t *in) {
+		return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+	}
+
+	[[noreturn]] static void Malformed(const std::string &path, const char *what) {
+		FAIL("Malformed object {0}: {1}", path, what);
+	}
+
+	Object ReadObject(const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			FAIL("Error opening file: {0}", path);
+		}
+
+		std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (bytes.size() < OBJECT_HEADER_SIZE || std::string(bytes.begin(), bytes.begin() + 4) != OBJECT_MAGIC) {
+			Malformed(path, "not an R828 object");
+		}
+
+		const uint8_t *header = bytes.data();
+		if (Get16(header + 4) != OBJECT_VERSION) Malformed(path, "unsupported version");
+
+		Object object;
+		object.flags = Get16(header + 6);
+		uint16_t segmentCount = Get16(header + 8);
+		uint16_t symbolCount = Get16(header + 10);
+		uint16_t relocationCount = Get16(header + 12);
+		object.entrySegment = Get16(header + 14);
+		object.entryOffset = Get16(header + 16);
+		uint32_t stringsSize = Get32(header + 20);
+
+		size_t pos = OBJECT_HEADER_SIZE;
+		size_t tables = (size_t)segmentCount * OBJECT_SEGMENT_SIZE
+			+ (size_t)symbolCount * OBJECT_SYMBOL_SIZE
+			+ (size_t)relocationCount * OBJECT_RELOCATION_SIZE;
+		if (bytes.size() < pos + tables + stringsSize) Malformed(path, "truncated tables");
+
+		const char *strings = reinterpret_cast<const char *>(bytes.data() + pos + tables);
+		auto name = [&](uint32_t offset) -> std::string {
+			for (uint32_t end = offset; end < stringsSize; end++) {
+				if (strings[end] == '\0') return std::string(strings + offset, end - offset);
+			}
+			Malformed(path, "bad name");
+			return {};
+		};
+
+		for (uint16_t i = 0; i < segmentCount; i++, pos += OBJECT_SEGMENT_SIZE) {
+			const uint8_t *entry = bytes.data() + pos;
+			uint32_t dataOffset = Get32(entry + 8);
+			uint32_t size = Get32(entry + 12);
+
+			Segment segment { name(Get32(entry)), Get16(entry + 4), Get16(entry + 6), {} };
+			if ((size_t)dataOffset + size > bytes.size() || segment.base + (size_t)size > 0x10000) {
+				Malformed(path, "bad segment");
+			}
+
+			segment.data.assign(bytes.begin() + dataOffset, bytes.begin() + dataOffset + size);
+			object.segments.push_back(std::move(segment));
+		}
+
+		for (uint16_t i = 0; i < symbolCount; i++, pos += OBJECT_SYMBOL_SIZE) {
+			const uint8_t *entry = bytes.data() + pos;
+			Symbol symbol { name(Get32(entry)), Get16(entry + 4), Get16(entry + 6) };
+			if (symbol.segment != OBJECT_NONE && symbol.segment >= segmentCount) Malformed(path, "bad symbol");
+
+			object.symbols.push_back(std::move(symbol));
+		}
+
+		for (uint16_t i = 0; i < relocationCount; i++, pos += OBJECT_RELOCATION_SIZE) {
+			const uint8_t *entry = bytes.data() + pos;
+			Relocation relocation { Get16(entry), Get16(entry + 2), Get16(entry + 4), Get16(entry + 6) };
+			if (relocation.segment >= segmentCount || relocation.symbol >= symbolCount
+				|| relocation.kind != RELOC_ABS16
+				|| relocation.offset + (size_t)2 > object.segments[relocation.segment].data.size()) {
+				Malformed(path, "bad relocation");
+			}
+
+			object.relocations.push_back(relocation);
+		}
+
+		if (object.entrySegment != OBJECT_NONE && object.entrySegment >= segmentCount) Malformed(path, "bad entry");
+
+		return object;
+	}
+
+	void WriteObject(const Object &object, const std::string &path) {
+		// Names are stored once however often they appear
+		std::vector<uint8_t> strings;
+		std::unordered_map<std::string, uint32_t> nameOffsets;
+		auto intern = [&](const std::string &name) -> uint32_t {
+			auto [it, inserted] = nameOffsets.try_emplace(name, (uint32_t)strings.size());
+			if (inserted) {
+				strings.insert(strings.end(), name.begin(), name.end());
+				strings.push_back('\0');
+			}
+			return it->second;
+		};
+
+		for (const Segment &segment : object.segments) intern(segment.name);
+		for (const Symbol &symbol : object.symbols) intern(symbol.name);
+
+		size_t dataOffset = OBJECT_HEADER_SIZE
+			+ object.segments.size() * OBJECT_SEGMENT_SIZE
+			+ object.symbols.size() * OBJECT_SYMBOL_SIZE
+			+ object.relocations.size() * OBJECT_RELOCATION_SIZE
+			+ strings.size();
+
+		std::vector<uint8_t> out;
+		out.insert(out.end(), OBJECT_MAGIC, OBJECT_MAGIC + 4);
+		Put16(out, OBJECT_VERSION);
+		Put16(out, object.flags);
+		Put16(out, (uint16_t)object.segments.size());
+		Put16(out, (uint16_t)object.symbols.size());
+		Put16(out, (uint16_t)object.relocations.size());
+		Put16(out, object.entrySegment);
+		Put16(out, object.entryOffset);
+		Put16(out, 0);
+		Put32(out, (uint32_t)strings.size());
+
+		for (const Segment &segment : object.segments) {
+			Put32(out, intern(segment.name));
+			Put16(out, segment.flags);
+			Put16(out, segment.base);
+			Put32(out, (uint32_t)dataOffset);
+			Put32(out, (uint32_t)segment.data.size());
+			dataOffset += segment.data.size();
+		}
+
+		for (const Symbol &symbol : object.symbols) {
+			Put32(out, intern(symbol.name));
+			Put16(out, symbol.segment);
+			Put16(out, symbol.offset);
+		}
+
+		for (const Relocation &relocation : object.relocations) {
+			Put16(out, relocation.segment);
+			Put16(out, relocation.offset);
+			Put16(out, relocation.symbol);
+			Put16(out, relocation.kind);
+		}
+
+		out.insert(out.end(), strings.begin(), strings.end());
+		for (const Segment &segment : object.segments) {
+			out.insert(out.end(), segment.data.begin(), segment.data.end());
+		}
+
+		std::ofstream outfile(path, std::ios::binary);
+		if (!outfile || !outfile.write(reinterpret_cast<const char *>(out.data()), out.size())) {
+			FAIL("Error writing file: {0}", path);
+		}
+	}
+
+}
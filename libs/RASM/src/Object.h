@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// R828 object file, everything little-endian:
+//
+//   header       "R8OB", u16 version, u16 flags, u16 segment count,
+//                u16 symbol count, u16 relocation count, u16 entry segment,
+//                u16 entry offset, u16 0, u32 string table size
+//   segments     u32 name, u16 flags, u16 base, u32 data offset, u32 size
+//   symbols      u32 name, u16 segment, u16 offset
+//   relocations  u16 segment, u16 offset, u16 symbol, u16 kind
+//   strings      NUL-terminated names, referenced by offset
+//   data         segment contents at their data offsets
+//
+// `rasm build` writes relocatable objects, `rasm link` executables: every
+// segment placed and every relocation applied, which the emulator loads
+// segment by segment straight from the file.
+#define OBJECT_MAGIC "R8OB"
+#define OBJECT_VERSION 1
+
+#define OBJECT_HEADER_SIZE 24
+#define OBJECT_SEGMENT_SIZE 16
+#define OBJECT_SYMBOL_SIZE 8
+#define OBJECT_RELOCATION_SIZE 8
+
+// Segment/entry index meaning "none"; a symbol in no segment is undefined
+#define OBJECT_NONE 0xFFFF
+
+namespace RASM {
+
+	enum ObjectFlags : uint16_t {
+		// Linked: all segments absolute, no relocations, no undefined symbols
+		OBJECT_EXECUTABLE = 1 << 0,
+	};
+
+	enum SegmentFlags : uint16_t {
+		// Placed at `base` by ORG; the linker keeps it there
+		SEGMENT_ABSOLUTE = 1 << 0,
+	};
+
+	enum RelocationKind : uint16_t {
+		// Big-endian 16-bit address, as in JMP operands
+		RELOC_ABS16 = 0,
+	};
+
+	struct Segment {
+		std::string name;
+		uint16_t flags;
+		uint16_t base;
+		std::vector<uint8_t> data;
+	};
+
+	struct Symbol {
+		std::string name;
+		uint16_t segment;
+		uint16_t offset;
+	};
+
+	struct Relocation {
+		uint16_t segment;
+		uint16_t offset;
+		uint16_t symbol;
+		uint16_t kind;
+	};
+
+	struct Object {
+		uint16_t flags = 0;
+		std::vector<Segment> segments;
+		std::vector<Symbol> symbols;
+		std::vector<Relocation> relocations;
+
+		uint16_t entrySegment = OBJECT_NONE;
+		uint16_t entryOffset = 0;
+	};
+
+	// Both throw Error on I/O failures or a malformed object
+	Object ReadObject(const std::string &path);
+	void WriteObject(const Object &object, const std::string &path);
+
+}
@@ -0,0 +1,49 @@
+#include "RASM.h"
+
+#include <cstring>
+
+#include "Error.h"
+#include "Assemble.h"
+#include "Link.h"
+
+namespace RASM {
+
+	Object AssembleProgram(std::span<const std::string_view> sources, uint16_t base) {
+		Log::Init();
+
+		std::vector<Object> objects;
+		objects.reserve(sources.size());
+		for (std::string_view source : sources) {
+			Assemble assemble(source);
+			objects.push_back(assemble.GetObject());
+		}
+
+		Link link(objects, base);
+		return link.GetObject();
+	}
+
+	uint16_t ProgramEntry(const Object &program, uint16_t base) {
+		if (program.entrySegment == OBJECT_NONE) return base;
+
+		return program.segments[program.entrySegment].base + program.entryOffset;
+	}
+
+	void LoadProgram(const Object &program, std::span<uint8_t> memory) {
+		Log::Init();
+
+		for (const Segment &segment : program.segments) {
+			if ((size_t)segment.base + segment.data.size() > memory.size()) {
+				FAIL("Segment {0} does not fit in memory", segment.name);
+			}
+
+			std::memcpy(memory.data() + segment.base, segment.data.data(), segment.data.size());
+		}
+	}
+
+	uint16_t AssembleInto(std::string_view source, std::span<uint8_t> memory, uint16_t base) {
+		Object program = AssembleProgram(source, base);
+		LoadProgram(program, memory);
+		return ProgramEntry(program, base);
+	}
+
+}
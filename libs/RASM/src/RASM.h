@@ -0,0 +1,56 @@
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "Error.h"
+#include "Object.h"
+
+// RASM as a library: assembles source text held in memory and places the
+// program straight into the caller's memory, with no files and no process
+// in between. Errors throw RASM::Error with the diagnostic the command line
+// tool would print. Calls are independent and may run on several threads at
+// once.
+namespace RASM {
+
+	// Assembles each source and links them into one program: segments placed
+	// by ORG stay there, the others are laid out from `base`
+	Object AssembleProgram(std::span<const std::string_view> sources, uint16_t base = 0xD000);
+
+	inline Object AssembleProgram(std::string_view source, uint16_t base = 0xD000) {
+		return AssembleProgram(std::span<const std::string_view>(&source, 1), base);
+	}
+
+	// The address execution of a linked program starts at
+	uint16_t ProgramEntry(const Object &program, uint16_t base = 0xD000);
+
+	// Copies every segment of a linked program into `memory`, which holds the
+	// address space from 0; throws if a segment lies past its end
+	void LoadProgram(const Object &program, std::span<uint8_t> memory);
+
+	// AssembleProgram() then LoadProgram(); returns the entry address
+	uint16_t AssembleInto(std::string_view source, std::span<uint8_t> memory, uint16_t base = 0xD000);
+
+	// AssembleProgram() then `load(address, data, size)` for each segment,
+	// such as CPU::load() to assemble into an emulator's memory; returns the
+	// entry address
+	template <typename Load>
+		requires std::invocable<Load &, uint16_t, const uint8_t *, size_t>
+	uint16_t AssembleInto(std::span<const std::string_view> sources, Load &&load, uint16_t base = 0xD000) {
+		Object program = AssembleProgram(sources, base);
+		for (const Segment &segment : program.segments) {
+			load(segment.base, segment.data.data(), segment.data.size());
+		}
+
+		return ProgramEntry(program, base);
+	}
+
+	template <typename Load>
+		requires std::invocable<Load &, uint16_t, const uint8_t *, size_t>
+	uint16_t AssembleInto(std::string_view source, Load &&load, uint16_t base = 0xD000) {
+		return AssembleInto(std::span<const std::string_view>(&source, 1), load, base);
+	}
+
+}
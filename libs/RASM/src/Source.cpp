@@ -0,0 +1,74 @@
+#include "Source.h"
+
+#include <cstring>
+
+#include "Error.h"
+
+namespace RASM {
+
+	Source::Source(const std::string &path, size_t chunkSize)
+		: m_Streaming(true), m_File(path, std::ios::binary), m_ChunkSize(chunkSize) {
+		if (!m_File) {
+			FAIL("Error opening file: {0}", path);
+		}
+	}
+
+	Source::Source(std::string_view text)
+		: m_Streaming(false), m_Text(text), m_End(text.size()), m_Eof(true) {}
+
+	void Source::Rewind() {
+		m_Cut = 0;
+		m_AtEnd = false;
+
+		if (m_Streaming) {
+			m_File.clear();
+			m_File.seekg(0);
+			m_End = 0;
+			m_Eof = false;
+		}
+	}
+
+	bool Source::NextChunk(std::string_view &chunk, size_t keep) {
+		if (m_AtEnd) return false;
+
+		size_t begin = m_Cut - keep;
+		if (m_Streaming) {
+			// Slide the kept tail and the partial line to the front, then read
+			// until there is a line break to cut at
+			if (begin > 0) {
+				std::memmove(m_Buffer.data(), m_Buffer.data() + begin, m_End - begin);
+				m_Cut -= begin;
+				m_End -= begin;
+				begin = 0;
+			}
+
+			size_t cut = 0;
+			while (!m_Eof && !cut) {
+				if (m_Buffer.size() < m_End + m_ChunkSize) {
+					m_Buffer.resize(m_End + m_ChunkSize);
+				}
+
+				m_File.read(m_Buffer.data() + m_End, m_ChunkSize);
+				size_t count = (size_t)m_File.gcount();
+				m_Eof = count < m_ChunkSize;
+
+				for (size_t i = m_End + count; i > m_End; i--) {
+					if (m_Buffer[i - 1] == '\n') {
+						cut = i;
+						break;
+					}
+				}
+				m_End += count;
+			}
+
+			m_Cut = m_Eof ? m_End : cut;
+		} else {
+			m_Cut = m_End;
+		}
+
+		m_AtEnd = m_Eof && m_Cut == m_End;
+		chunk = std::string_view(Data() + begin, m_Cut - begin);
+		return true;
+	}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define SOURCE_CHUNK_SIZE (256 * 1024)
+
+namespace RASM {
+
+	// Assembly text handed to the assembler a chunk of whole lines at a
+	// time, so a file is never held in memory at once. Each chunk may start
+	// with the tail of the previous one, for a statement it cut in half.
+	class Source {
+	public:
+		// Streams `path` in reads of `chunkSize` bytes
+		Source(const std::string &path, size_t chunkSize = SOURCE_CHUNK_SIZE);
+		// Borrows `text` as a single chunk
+		Source(std::string_view text);
+
+		// Starts again from the beginning of the input
+		void Rewind();
+
+		// Replaces `chunk` with the last `keep` bytes of the previous chunk
+		// followed by the next run of whole lines. Returns false once the
+		// input is exhausted.
+		bool NextChunk(std::string_view &chunk, size_t keep);
+
+		// True when the current chunk runs to the end of the input
+		bool AtEnd() const { return m_AtEnd; }
+	private:
+		const char *Data() const { return m_Streaming ? m_Buffer.data() : m_Text.data(); }
+	private:
+		bool m_Streaming;
+		std::string_view m_Text;
+		std::ifstream m_File;
+		size_t m_ChunkSize = 0;
+		std::vector<char> m_Buffer;
+
+		// Chunks end at m_Cut; m_Cut..m_End is a partial line already read
+		size_t m_Cut = 0;
+		size_t m_End = 0;
+		bool m_Eof = false;
+		bool m_AtEnd = false;
+	};
+
+}
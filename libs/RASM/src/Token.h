@@ -1,9 +1,10 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
 
-#include "Log/Log.h"
+#include "Error.h"
 
 namespace RASM {
 
@@ -32,9 +33,15 @@ namespace RASM {
 		UNKNOWN,
 	};
 
+	// `value` is a view into the lexed source; `line` and `column` are 1-based.
+	// `id` is the first ISA::FORMS entry of an OPCODE and the ISA::REGISTERS
+	// entry of a REG.
 	struct Token {
 		TokenType type;
-		std::string value;
+		std::string_view value;
+		uint32_t line;
+		uint32_t column;
+		uint16_t id;
 	};
 
 	inline std::string TokenTypeToString(TokenType type) {
@@ -68,8 +75,8 @@ namespace RASM {
 
 	static Token ExpectToken(std::vector<Token> &tokens, TokenType expect, int &pos) {
 		Token token = FetchToken(tokens, pos);
-		if (token.type == expect) { ERROR("Unexpected token, expected: {0} got: {1}",
-			TokenTypeToString(expect), TokenTypeToString(token.type)); exit(1); }
+		if (token.type == expect) { FAIL("Unexpected token, expected: {0} got: {1}",
+			TokenTypeToString(expect), TokenTypeToString(token.type)); }
 
 		return token;
 	}
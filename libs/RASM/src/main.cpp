@@ -1,21 +1,53 @@
+#include <cstdio>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 
 #include "Log/Log.h"
-#include "Assemble.h"
-
-static std::string GetFileContents(std::string path) {
-	std::ifstream file(path);
-	std::stringstream buffer;
-
-	buffer << file.rdbuf();
-	return buffer.str();
-}
+#include "Error.h"
+#include "Build.h"
+#include "Link.h"
+#include "ISA.h"
 
 static void Usage(char *programFile) {
 	WARN("Usage: {0} <SUBCOMMAND> [ARGS]", programFile);
+	WARN("    build <input>... [-o <output>] [-j <threads>] [--cache <dir>] [--base <addr>]");
+	WARN("        one input builds an object, several are linked into an executable");
+	WARN("    link <object>... [-o <executable>] [--base <addr>]");
+	WARN("    disasm <object>");
+}
+
+// Lists each segment an instruction per line after its address, with the
+// symbol a relocated operand refers to; bytes that do not decode are ??
+static void Disassemble(const RASM::Object &object) {
+	char text[16];
+	for (size_t i = 0; i < object.segments.size(); i++) {
+		const RASM::Segment &segment = object.segments[i];
+		std::cout << "SECTION " << segment.name << std::endl;
+		if (segment.flags & RASM::SEGMENT_ABSOLUTE) {
+			std::snprintf(text, sizeof(text), "0x%04X", segment.base);
+			std::cout << "ORG " << text << std::endl;
+		}
+
+		for (size_t offset = 0; offset < segment.data.size();) {
+			std::string line;
+			size_t length = ISA::Disassemble(segment.data.data() + offset, segment.data.size() - offset, line);
+			if (length == 0) {
+				std::snprintf(text, sizeof(text), "?? 0x%02X", segment.data[offset]);
+				line = text;
+				length = 1;
+			}
+
+			for (const RASM::Relocation &relocation : object.relocations) {
+				if (relocation.segment == i && relocation.offset >= offset && relocation.offset < offset + length) {
+					line += " <- " + object.symbols[relocation.symbol].name;
+				}
+			}
+
+			std::snprintf(text, sizeof(text), "%04zX", (size_t)segment.base + offset);
+			std::cout << text << "\t" << line << std::endl;
+			offset += length;
+		}
+	}
 }
 
 static char *Shift(int &argc, char ***argv) {
@@ -25,26 +57,108 @@ static char *Shift(int &argc, char ***argv) {
 	return result;
 }
 
-int main(int argc, char **argv) {
-	RASM::Log::Init();
-	char *program = Shift(argc, &argv);
-	if (argc < 1) {
-		Usage(program);
-		ERROR("Invalid Arguments");
+static unsigned long ParseValue(const char *what, const char *text, unsigned long max) {
+	char *end;
+	unsigned long value = std::strtoul(text, &end, 0);
+	if (*text == '\0' || *text == '-' || *end != '\0' || value > max) {
+		ERROR("Invalid {0}: {1}", what, text);
 		exit(1);
 	}
 
+	return value;
+}
+
+static void RunSubcommand(char *program, int argc, char **argv) {
 	char *subcommand = Shift(argc, &argv);
 	if (std::string(subcommand) == "build") {
+		std::vector<std::string> inputs;
+		std::string output;
+		std::string cacheDir = ".rasm-cache";
+		unsigned threads = 0;
+		uint16_t base = 0xD000;
+
+		while (argc > 0) {
+			std::string arg = Shift(argc, &argv);
+			if (argc > 0 && arg == "-o") {
+				output = Shift(argc, &argv);
+			} else if (argc > 0 && arg == "-j") {
+				threads = (unsigned)ParseValue("thread count", Shift(argc, &argv), 1024);
+			} else if (argc > 0 && arg == "--cache") {
+				cacheDir = Shift(argc, &argv);
+			} else if (argc > 0 && arg == "--base") {
+				base = (uint16_t)ParseValue("base address", Shift(argc, &argv), 0xFFFF);
+			} else {
+				inputs.push_back(arg);
+			}
+		}
+
+		if (inputs.empty()) {
+			Usage(program);
+			ERROR("Missing subcommand arguments!");
+			exit(1);
+		}
+
+		RASM::Build build(inputs, cacheDir, threads);
+		INFO("Assembled {0} of {1} sources, {2} unchanged", inputs.size() - build.GetCachedCount(), inputs.size(), build.GetCachedCount());
+
+		if (inputs.size() == 1) {
+			RASM::WriteObject(build.GetObjects()[0], output.empty() ? "output.o" : output);
+		} else {
+			RASM::Link link(build.GetObjects(), base);
+			RASM::WriteObject(link.GetObject(), output.empty() ? "output.r8x" : output);
+		}
+	} else if (std::string(subcommand) == "link") {
+		std::vector<RASM::Object> objects;
+		std::string output = "output.r8x";
+		uint16_t base = 0xD000;
+
+		while (argc > 0) {
+			std::string arg = Shift(argc, &argv);
+			if (argc > 0 && arg == "-o") {
+				output = Shift(argc, &argv);
+			} else if (argc > 0 && arg == "--base") {
+				base = (uint16_t)ParseValue("base address", Shift(argc, &argv), 0xFFFF);
+			} else {
+				objects.push_back(RASM::ReadObject(arg));
+			}
+		}
+
+		if (objects.empty()) {
+			Usage(program);
+			ERROR("Missing subcommand arguments!");
+			exit(1);
+		}
+
+		RASM::Link link(objects, base);
+		RASM::WriteObject(link.GetObject(), output);
+	} else if (std::string(subcommand) == "disasm") {
 		if (argc < 1) {
 			Usage(program);
 			ERROR("Missing subcommand arguments!");
 			exit(1);
 		}
-		char *input = Shift(argc, &argv);
-		RASM::Assemble assemble(GetFileContents(input));
+
+		Disassemble(RASM::ReadObject(Shift(argc, &argv)));
 	} else {
 		ERROR("Invalid subcommand: {0}", subcommand);
 		exit(1);
 	}
+}
+
+int main(int argc, char **argv) {
+	RASM::Log::Init();
+	char *program = Shift(argc, &argv);
+	if (argc < 1) {
+		Usage(program);
+		ERROR("Invalid Arguments");
+		exit(1);
+	}
+
+	// Every error the library reports ends the tool here
+	try {
+		RunSubcommand(program, argc, argv);
+	} catch (const RASM::Error &error) {
+		ERROR("{0}", error.what());
+		exit(1);
+	}
 }
\ No newline at end of file
@@ -1,7 +1,36 @@
+newoption {
+	trigger = "dispatch",
+	value = "BACKEND",
+	description = "Interpreter dispatch used by CPU::run",
+	default = "threaded",
+	allowed = {
+		{ "threaded", "Direct-threaded computed goto (GCC/Clang, switch elsewhere)" },
+		{ "switch", "Portable switch dispatch" },
+	}
+}
+
+newoption {
+	trigger = "jit",
+	description = "Translate hot guest blocks to native x86-64"
+}
+
+newoption {
+	trigger = "avx2",
+	description = "Build the WideCPU lane kernels for AVX2 instead of SSE2"
+}
+
 workspace "R828em"
 	architecture "x86_64"
 	configurations { "Debug", "Release" }
 
+	filter "options:dispatch=threaded"
+		defines { "R828_THREADED_DISPATCH" }
+	filter "options:jit"
+		defines { "R828_JIT" }
+	filter "options:avx2"
+		vectorextensions "AVX2"
+	filter {}
+
 group "libs"
 	include "libs/RASM"
 group ""
@@ -13,11 +42,41 @@ project "R828em"
 	targetdir "bin/%{cfg.buildcfg}"
 	objdir "bin/obj/%{cfg.buildcfg}"
 
-	files { "src/**.h", "src/**.cpp" }
+	files { "src/**.h", "src/**.inl", "src/**.cpp" }
+	includedirs { "libs/RASM/src" }
+	links { "RASMLib" }
+
+	filter "system:linux"
+		links { "pthread" }
+	filter "system:windows"
+		links { "ws2_32" }
+
+	filter "configurations:Debug"
+        defines { "R828_DEBUG" }
+        symbols "On"
+    filter "configurations:Release"
+        defines { "R828_RELEASE" }
+        optimize "On"
+
+project "R828bench"
+	kind "ConsoleApp"
+	language "C++"
+    cppdialect "C++20"
+	targetdir "bin/%{cfg.buildcfg}"
+	objdir "bin/obj/%{cfg.buildcfg}/%{prj.name}"
+
+	files { "src/**.h", "src/**.inl", "src/**.cpp", "bench/**.cpp" }
+	removefiles { "src/main.cpp" }
+	includedirs { "src", "libs/RASM/src" }
+
+	filter "system:linux"
+		links { "pthread" }
+	filter "system:windows"
+		links { "ws2_32" }
 
 	filter "configurations:Debug"
         defines { "R828_DEBUG" }
         symbols "On"
     filter "configurations:Release"
         defines { "R828_RELEASE" }
-        optimize "On"
\ No newline at end of file
+        optimize "On"
@@ -0,0 +1,479 @@
+#include "Batch.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace {
+
+	// A worker's share of the jobs. The owner takes from the front, thieves
+	// from the back, so they only meet on the last job.
+	class WorkQueue {
+	public:
+		void push(u32 job) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(job);
+		}
+
+		bool pop(u32 &job) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_jobs.empty()) return false;
+			job = m_jobs.front();
+			m_jobs.pop_front();
+			return true;
+		}
+
+		bool steal(u32 &job) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_jobs.empty()) return false;
+			job = m_jobs.back();
+			m_jobs.pop_back();
+			return true;
+		}
+	private:
+		std::mutex m_mutex;
+		std::deque<u32> m_jobs;
+	};
+
+	bool ParseNumber(const std::string &text, u64 &value) {
+		if (text.empty() || !std::isdigit((unsigned char)text[0])) return false;
+
+		size_t end = 0;
+		try {
+			value = std::stoull(text, &end, 0);
+		} catch (...) {
+			return false;
+		}
+
+		return end == text.size();
+	}
+
+	void Put16(u8 *&out, u16 value) {
+		*out++ = value & 0xFF;
+		*out++ = value >> 8;
+	}
+
+	void Put32(u8 *&out, u32 value) {
+		for (int i = 0; i < 4; i++) *out++ = (value >> (i * 8)) & 0xFF;
+	}
+
+	void Put64(u8 *&out, u64 value) {
+		for (int i = 0; i < 8; i++) *out++ = (value >> (i * 8)) & 0xFF;
+	}
+
+	u16 Get16(const u8 *&in) {
+		u16 value = in[0] | (in[1] << 8);
+		in += 2;
+		return value;
+	}
+
+	u32 Get32(const u8 *&in) {
+		u32 value = 0;
+		for (int i = 0; i < 4; i++) value |= (u32)*in++ << (i * 8);
+		return value;
+	}
+
+	u64 Get64(const u8 *&in) {
+		u64 value = 0;
+		for (int i = 0; i < 8; i++) value |= (u64)*in++ << (i * 8);
+		return value;
+	}
+
+	const char *ReasonName(CPU::StopReason reason) {
+		switch (reason) {
+		case CPU::HALTED: return "halted";
+		case CPU::BUDGET_EXHAUSTED: return "budget_exhausted";
+		case CPU::BREAKPOINT: return "breakpoint";
+		case CPU::FAULT: return "fault";
+		case CPU::WATCHPOINT: return "watchpoint";
+		}
+		return "unknown";
+	}
+
+	const char *FaultName(CPU::Fault fault) {
+		switch (fault) {
+		case CPU::FAULT_NONE: return "none";
+		case CPU::FAULT_INVALID_INST: return "invalid_inst";
+		case CPU::FAULT_INVALID_REG: return "invalid_reg";
+		case CPU::FAULT_INVALID_MODE: return "invalid_mode";
+		case CPU::FAULT_DIVIDE_BY_ZERO: return "divide_by_zero";
+		}
+		return "unknown";
+	}
+
+	const char *s_names_u16[] = { "r0", "r1", "r2", "r3", "ra", "ri" };
+	const char *s_names_u8[] = { "b0", "b1", "b2", "b3" };
+
+}
+
+void Batch::load_jobs(const std::string &path, size_t default_cycles) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "Failed to open job file: " << path << std::endl;
+		exit(1);
+	}
+
+	std::filesystem::path base = std::filesystem::path(path).parent_path();
+
+	std::string line;
+	for (size_t line_number = 1; std::getline(file, line); line_number++) {
+		std::istringstream fields(line);
+		std::string image;
+		if (!(fields >> image) || image[0] == '#') continue;
+
+		BatchJob job {};
+		job.image = load_image((base / image).string());
+		job.load = 0xD000;
+		job.cycles = default_cycles;
+		job.sp = 0xB000;
+
+		bool has_pc = false;
+		std::string field;
+		while (fields >> field) {
+			size_t equals = field.find('=');
+			std::string name = field.substr(0, equals);
+			u64 value;
+
+			if (equals == std::string::npos || !ParseNumber(field.substr(equals + 1), value)) {
+				std::cerr << path << ":" << line_number << ": Invalid job field: " << field << std::endl;
+				exit(1);
+			}
+
+			u64 limit = 0xFFFF;
+			bool known = true;
+
+			if (name == "cycles") {
+				job.cycles = value;
+				limit = ~(u64)0;
+			} else if (name == "load") {
+				job.load = (u16)value;
+			} else if (name == "pc") {
+				job.pc = (u16)value;
+				has_pc = true;
+			} else if (name == "sp") {
+				job.sp = (u16)value;
+			} else {
+				known = false;
+				for (int i = 0; i < 6; i++) {
+					if (name == s_names_u16[i]) {
+						job.regs_u16[i] = (u16)value;
+						known = true;
+					}
+				}
+				for (int i = 0; i < 4; i++) {
+					if (name == s_names_u8[i]) {
+						job.regs_u8[i] = (u8)value;
+						limit = 0xFF;
+						known = true;
+					}
+				}
+			}
+
+			if (!known || value > limit) {
+				std::cerr << path << ":" << line_number << ": Invalid job field: " << field << std::endl;
+				exit(1);
+			}
+		}
+
+		if (!has_pc) {
+			job.pc = job.load;
+		}
+
+		if (job.load + m_images[job.image].size() > MEMORY_CAPACITY) {
+			std::cerr << path << ":" << line_number << ": Image does not fit at load address: " << image << std::endl;
+			exit(1);
+		}
+
+		m_jobs.push_back(job);
+	}
+}
+
+u32 Batch::load_image(const std::string &path) {
+	auto it = m_image_index.find(path);
+	if (it != m_image_index.end()) {
+		return it->second;
+	}
+
+	MappedFile image;
+	if (!image.open(path)) {
+		std::cerr << "Failed to open image: " << path << std::endl;
+		exit(1);
+	}
+
+	if (image.size() > MEMORY_CAPACITY) {
+		std::cerr << "Image does not fit in memory: " << path << std::endl;
+		exit(1);
+	}
+
+	m_images.push_back(std::move(image));
+	m_image_index[path] = (u32)(m_images.size() - 1);
+	return m_image_index[path];
+}
+
+void Batch::run(unsigned threads, unsigned lanes, std::ostream &out, BatchFormat format) {
+	// A unit is one job, or with lanes a run of consecutive jobs that load
+	// the same image at the same address and so can share a WideCPU
+	std::vector<std::pair<u32, u32>> units;
+	for (u32 i = 0; i < m_jobs.size(); i++) {
+		if (lanes > 0 && !units.empty()) {
+			auto &[first, count] = units.back();
+			if (count < lanes && m_jobs[first].image == m_jobs[i].image && m_jobs[first].load == m_jobs[i].load) {
+				count++;
+				continue;
+			}
+		}
+
+		units.push_back({ i, 1 });
+	}
+
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::min<size_t>(threads, std::max<size_t>(1, units.size()));
+
+	// Interleaved so the front of every queue is near the front of the
+	// output; the writer then rarely waits on a unit nobody has started.
+	std::vector<WorkQueue> queues(threads);
+	for (u32 i = 0; i < units.size(); i++) {
+		queues[i % threads].push(i);
+	}
+
+	std::vector<BatchResult> results(m_jobs.size());
+	std::vector<u8> done(m_jobs.size(), 0);
+	std::mutex done_mutex;
+	std::condition_variable done_changed;
+
+	auto worker = [&](unsigned id) {
+		// Each worker keeps its own CPUs for all its jobs
+		std::unique_ptr<BatchWorker> scalar;
+		std::unique_ptr<WideCPU<8>> wide8;
+		std::unique_ptr<WideCPU<16>> wide16;
+		std::unique_ptr<WideCPU<32>> wide32;
+
+		for (;;) {
+			u32 index;
+			bool found = queues[id].pop(index);
+			for (unsigned i = 1; !found && i < threads; i++) {
+				found = queues[(id + i) % threads].steal(index);
+			}
+
+			// No unit is ever queued after the workers start
+			if (!found) return;
+
+			auto [first, count] = units[index];
+			switch (lanes) {
+			case 8: run_wide(wide8, first, count, results.data()); break;
+			case 16: run_wide(wide16, first, count, results.data()); break;
+			case 32: run_wide(wide32, first, count, results.data()); break;
+			default: {
+				if (!scalar) {
+					scalar = std::make_unique<BatchWorker>();
+					scalar->cpu.set_jit_mode(m_jit_mode);
+				}
+				const MappedFile &image = m_images[m_jobs[first].image];
+				run_job(*scalar, m_jobs[first], image.data(), image.size(), results[first]);
+			} break;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(done_mutex);
+				std::fill_n(done.begin() + first, count, 1);
+			}
+			done_changed.notify_one();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < threads; i++) {
+		workers.emplace_back(worker, i);
+	}
+
+	write_header(out, format);
+	for (u32 i = 0; i < m_jobs.size(); i++) {
+		{
+			std::unique_lock<std::mutex> lock(done_mutex);
+			done_changed.wait(lock, [&] { return done[i] != 0; });
+		}
+		write_result(out, format, i, results[i]);
+	}
+	out.flush();
+
+	for (std::thread &thread : workers) {
+		thread.join();
+	}
+}
+
+void Batch::run_job(BatchWorker &worker, const BatchJob &job, const u8 *image, size_t size, BatchResult &result) {
+	CPU &cpu = worker.cpu;
+
+	if (worker.image == job.image && worker.load == job.load) {
+		cpu.restore(worker.loaded);
+	} else {
+		cpu.reset();
+		cpu.load(job.load, image, size);
+
+		worker.loaded = cpu.snapshot();
+		worker.image = job.image;
+		worker.load = job.load;
+	}
+
+	cpu.pc = job.pc;
+	cpu.sp = job.sp;
+	cpu.r0 = job.regs_u16[0];
+	cpu.r1 = job.regs_u16[1];
+	cpu.r2 = job.regs_u16[2];
+	cpu.r3 = job.regs_u16[3];
+	cpu.ra = job.regs_u16[4];
+	cpu.ri = job.regs_u16[5];
+	cpu.b0 = job.regs_u8[0];
+	cpu.b1 = job.regs_u8[1];
+	cpu.b2 = job.regs_u8[2];
+	cpu.b3 = job.regs_u8[3];
+
+	size_t cycles = job.cycles;
+	result.reason = cpu.run(cycles);
+	result.fault = cpu.fault();
+	result.cycles_used = job.cycles - cycles;
+	read_state(cpu, result);
+}
+
+void Batch::read_state(const CPU &cpu, BatchResult &result) {
+	result.pc = cpu.pc;
+	result.sp = cpu.sp;
+	result.regs_u16[0] = cpu.r0;
+	result.regs_u16[1] = cpu.r1;
+	result.regs_u16[2] = cpu.r2;
+	result.regs_u16[3] = cpu.r3;
+	result.regs_u16[4] = cpu.ra;
+	result.regs_u16[5] = cpu.ri;
+	result.regs_u8[0] = cpu.b0;
+	result.regs_u8[1] = cpu.b1;
+	result.regs_u8[2] = cpu.b2;
+	result.regs_u8[3] = cpu.b3;
+
+	result.equal = cpu.equal;
+	result.zero = cpu.zero;
+	result.sign = cpu.sign;
+	result.carry = cpu.carry;
+	result.overflow = cpu.overflow;
+}
+
+template <size_t N>
+void Batch::run_wide(std::unique_ptr<WideCPU<N>> &cpu, u32 first, u32 count, BatchResult *results) const {
+	if (!cpu) cpu = std::make_unique<WideCPU<N>>();
+	cpu->reset();
+
+	const MappedFile &image = m_images[m_jobs[first].image];
+	cpu->load(m_jobs[first].load, image.data(), image.size());
+
+	// Lanes past `count` get no budget and stop straight away
+	size_t cycles[N] = {};
+	for (u32 lane = 0; lane < count; lane++) {
+		const BatchJob &job = m_jobs[first + lane];
+
+		cpu->pc[lane] = job.pc;
+		cpu->sp[lane] = job.sp;
+		for (int i = 0; i < 6; i++) cpu->regs_u16[i][lane] = job.regs_u16[i];
+		for (int i = 0; i < 4; i++) cpu->regs_u8[i][lane] = job.regs_u8[i];
+		cycles[lane] = job.cycles;
+	}
+
+	CPU::StopReason reasons[N];
+	cpu->run(cycles, reasons);
+
+	for (u32 lane = 0; lane < count; lane++) {
+		BatchResult &result = results[first + lane];
+
+		result.reason = reasons[lane];
+		result.fault = cpu->fault(lane);
+		result.cycles_used = m_jobs[first + lane].cycles - cycles[lane];
+
+		result.pc = cpu->pc[lane];
+		result.sp = cpu->sp[lane];
+		for (int i = 0; i < 6; i++) result.regs_u16[i] = cpu->regs_u16[i][lane];
+		for (int i = 0; i < 4; i++) result.regs_u8[i] = (u8)cpu->regs_u8[i][lane];
+
+		result.equal = (u8)cpu->equal[lane];
+		result.zero = (u8)cpu->zero[lane];
+		result.sign = (u8)cpu->sign[lane];
+		result.carry = (u8)cpu->carry[lane];
+		result.overflow = (u8)cpu->overflow[lane];
+	}
+}
+
+void Batch::write_header(std::ostream &out, BatchFormat format) const {
+	if (format != BATCH_BINARY) return;
+
+	u8 header[12] = { 'R', '8', 'B', 'R' };
+	u8 *cursor = header + 4;
+	Put32(cursor, BATCH_BINARY_VERSION);
+	Put32(cursor, (u32)m_jobs.size());
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+void Batch::write_result(std::ostream &out, BatchFormat format, u32 index, const BatchResult &result) {
+	if (format == BATCH_BINARY) {
+		u8 record[BATCH_RECORD_SIZE];
+		encode_result(record, index, result);
+
+		out.write(reinterpret_cast<const char*>(record), sizeof(record));
+		return;
+	}
+
+	out << "{\"job\":" << index
+		<< ",\"reason\":\"" << ReasonName(result.reason) << "\"";
+	if (result.reason == CPU::FAULT) {
+		out << ",\"fault\":\"" << FaultName(result.fault) << "\"";
+	}
+	out << ",\"cycles\":" << result.cycles_used
+		<< ",\"pc\":" << result.pc
+		<< ",\"sp\":" << result.sp;
+	for (int i = 0; i < 6; i++) out << ",\"" << s_names_u16[i] << "\":" << result.regs_u16[i];
+	for (int i = 0; i < 4; i++) out << ",\"" << s_names_u8[i] << "\":" << (int)result.regs_u8[i];
+	out << ",\"equal\":" << (int)result.equal
+		<< ",\"zero\":" << (int)result.zero
+		<< ",\"sign\":" << (int)result.sign
+		<< ",\"carry\":" << (int)result.carry
+		<< ",\"overflow\":" << (int)result.overflow
+		<< "}\n";
+}
+
+void Batch::encode_result(u8 *record, u32 index, const BatchResult &result) {
+	Put32(record, index);
+	*record++ = (u8)result.reason;
+	*record++ = (u8)result.fault;
+	*record++ = result.equal | (result.zero << 1) | (result.sign << 2) | (result.carry << 3) | (result.overflow << 4);
+	*record++ = 0;
+	Put64(record, result.cycles_used);
+	Put16(record, result.pc);
+	Put16(record, result.sp);
+	for (int i = 0; i < 6; i++) Put16(record, result.regs_u16[i]);
+	for (int i = 0; i < 4; i++) *record++ = result.regs_u8[i];
+}
+
+void Batch::decode_result(const u8 *record, u32 &index, BatchResult &result) {
+	index = Get32(record);
+	result.reason = (CPU::StopReason)*record++;
+	result.fault = (CPU::Fault)*record++;
+	u8 flags = *record++;
+	record++;
+	result.cycles_used = Get64(record);
+	result.pc = Get16(record);
+	result.sp = Get16(record);
+	for (int i = 0; i < 6; i++) result.regs_u16[i] = Get16(record);
+	for (int i = 0; i < 4; i++) result.regs_u8[i] = *record++;
+
+	result.equal = flags & 1;
+	result.zero = (flags >> 1) & 1;
+	result.sign = (flags >> 2) & 1;
+	result.carry = (flags >> 3) & 1;
+	result.overflow = (flags >> 4) & 1;
+}
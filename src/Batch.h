@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#include <memory>
+
+#include "Core.h"
+#include "CPU.h"
+#include "WideCPU.h"
+#include "MappedFile.h"
+
+// One program run of a batch. The CPU is reset() before every job, so
+// anything not given in the job file keeps its reset value.
+struct BatchJob {
+	u32 image;
+	u16 load;
+	size_t cycles;
+
+	u16 pc;
+	u16 sp;
+	u16 regs_u16[6];
+	u8 regs_u8[4];
+};
+
+struct BatchResult {
+	CPU::StopReason reason;
+	CPU::Fault fault;
+	size_t cycles_used;
+
+	u16 pc;
+	u16 sp;
+	u16 regs_u16[6];
+	u8 regs_u8[4];
+
+	u8 equal;
+	u8 zero;
+	u8 sign;
+	u8 carry;
+	u8 overflow;
+};
+
+enum BatchFormat {
+	// One JSON object per job and line
+	BATCH_JSONL,
+	// "R8BR", u32 version, u32 job count, then one BATCH_RECORD_SIZE record
+	// per job, all little-endian:
+	//   u32 job, u8 reason, u8 fault, u8 flags (equal, zero, sign, carry,
+	//   overflow from bit 0), u8 0, u64 cycles used, u16 pc, u16 sp,
+	//   u16 r0 r1 r2 r3 ra ri, u8 b0 b1 b2 b3
+	BATCH_BINARY,
+};
+
+// A worker's CPU and its state right after loading the last job's image. The
+// next job on the same image restores that state, which only touches the
+// pages the previous job wrote.
+struct BatchWorker {
+	CPU cpu;
+
+	CPU::Snapshot loaded;
+	u32 image = UINT32_MAX;
+	u16 load = 0;
+};
+
+#define BATCH_BINARY_VERSION 1
+#define BATCH_RECORD_SIZE 36
+
+// Runs many independent programs on a pool of CPUs, one per worker thread.
+// Every worker starts on its own share of the jobs and steals from the others
+// once it runs dry. Results are written in job order as they complete.
+class Batch {
+public:
+	// Job file: one job per line, `<image> [name=value ...]`. Names are
+	// r0-r3, ra, ri, b0-b3, pc, sp, load (the address the image is copied
+	// to, default 0xD000; pc defaults to it) and cycles. Values are decimal
+	// or 0x-prefixed hex. Image paths are relative to the job file; each
+	// image is mapped once no matter how many jobs use it. Blank lines and
+	// lines starting with '#' are skipped.
+	void load_jobs(const std::string &path, size_t default_cycles);
+
+	// `threads` == 0 uses every hardware thread. With `lanes` (8, 16 or 32)
+	// consecutive jobs on the same image run together on a WideCPU; 0 runs
+	// every job on its own CPU.
+	void run(unsigned threads, unsigned lanes, std::ostream &out, BatchFormat format);
+
+	// Applies to jobs run on their own CPU; WideCPU lanes always interpret
+	void set_jit_mode(CPU::JitMode mode) { m_jit_mode = mode; }
+
+	size_t job_count() const { return m_jobs.size(); }
+	const std::vector<BatchJob> &jobs() const { return m_jobs; }
+	size_t image_count() const { return m_images.size(); }
+	const MappedFile &image(u32 index) const { return m_images[index]; }
+
+	// Runs `job` on `worker`'s CPU. `image` holds the `size` bytes of the
+	// image `job.image` names; the worker reuses its loaded state while that
+	// name and the load address stay the same.
+	static void run_job(BatchWorker &worker, const BatchJob &job, const u8 *image, size_t size, BatchResult &result);
+
+	// Copies registers, flags, pc and sp of `cpu` into `result`
+	static void read_state(const CPU &cpu, BatchResult &result);
+
+	// One record of `format`; `index` is the job number it is reported as
+	static void write_result(std::ostream &out, BatchFormat format, u32 index, const BatchResult &result);
+
+	// Convert between a result and its BATCH_BINARY record
+	static void encode_result(u8 *record, u32 index, const BatchResult &result);
+	static void decode_result(const u8 *record, u32 &index, BatchResult &result);
+private:
+	u32 load_image(const std::string &path);
+
+	template <size_t N>
+	void run_wide(std::unique_ptr<WideCPU<N>> &cpu, u32 first, u32 count, BatchResult *results) const;
+
+	void write_header(std::ostream &out, BatchFormat format) const;
+private:
+	std::unordered_map<std::string, u32> m_image_index;
+	std::vector<MappedFile> m_images;
+	std::vector<BatchJob> m_jobs;
+	CPU::JitMode m_jit_mode = R828_HAS_JIT ? CPU::JIT_ON : CPU::JIT_OFF;
+};
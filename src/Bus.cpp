@@ -0,0 +1,15 @@
+#include "Bus.h"
+
+#include "Memory.h"
+
+bool Bus::map(u16 start, size_t length, Device &device) {
+	u32 end = start + (u32)length;
+	if (length == 0 || end > MEMORY_CAPACITY) return false;
+
+	for (const Mapping &mapping : m_mappings) {
+		if (start < mapping.end && mapping.start < end) return false;
+	}
+
+	m_mappings.push_back({ start, end, &device });
+	return true;
+}
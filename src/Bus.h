@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include "Core.h"
+
+// Something the CPU reaches through loads and stores instead of RAM
+class Device {
+public:
+	virtual ~Device() = default;
+
+	// `offset` counts from the start of the range the device is mapped at
+	virtual u8 read(u16 offset) = 0;
+	virtual void write(u16 offset, u8 value) = 0;
+};
+
+// Address ranges claimed by devices. The CPU only consults it for pages a
+// device claims part of; everything else is a plain RAM access.
+class Bus {
+public:
+	// Returns false if [start, start + length) overlaps a claimed range or
+	// runs past the end of memory
+	bool map(u16 start, size_t length, Device &device);
+
+	// The device claiming `addr` and the offset into its range, or nullptr
+	Device *find(u16 addr, u16 &offset) const {
+		for (const Mapping &mapping : m_mappings) {
+			if (addr >= mapping.start && addr < mapping.end) {
+				offset = (u16)(addr - mapping.start);
+				return mapping.device;
+			}
+		}
+
+		return nullptr;
+	}
+private:
+	struct Mapping {
+		u32 start;
+		u32 end;
+		Device *device;
+	};
+
+	std::vector<Mapping> m_mappings;
+};
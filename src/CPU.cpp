@@ -0,0 +1,906 @@
+#include "CPU.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <sstream>
+
+static u16 CPU::* const s_regs_u16[] = { &CPU::r0, &CPU::r1, &CPU::r2, &CPU::r3, &CPU::ra, &CPU::ri };
+static u8 CPU::* const s_regs_u8[] = { &CPU::b0, &CPU::b1, &CPU::b2, &CPU::b3 };
+
+// Handler of each ISA::FORMS entry
+static constexpr u8 s_form_handlers[] = {
+#define X(name, mode, mode_at, a, b, c, extra, implied, handler) CPU::handler,
+	R828_FORMS(X)
+#undef X
+};
+
+static_assert(std::size(s_form_handlers) == ISA::FORM_COUNT);
+static_assert(ISA::MAX_LENGTH == MAX_INST_LENGTH);
+
+CPU::CPU() {}
+
+CPU::CPU(const Memory &mem)
+	: memory(mem) {}
+
+void CPU::reset() {
+	pc = 0xD000;
+	sp = 0xB000;
+	fbs = 0x8000;
+
+	r0 = 0x0000;
+	r1 = 0x0000;
+	r2 = 0x0000;
+	r3 = 0x0000;
+
+	ra = 0x0000;
+	ri = 0x0000;
+
+	b0 = 0x00;
+	b1 = 0x00;
+	b2 = 0x00;
+	b3 = 0x00;
+
+	equal		= 0;
+	zero		= 0;
+	decimal		= 0;
+	sign		= 0;
+	carry		= 0;
+	overflow	= 0;
+	interrupt	= 0;
+	breakf		= 0;
+
+	m_fault = FAULT_NONE;
+	m_cycle = 0;
+	m_irq_pending = 0;
+	m_block_rest = 0;
+
+	load_memory(reset_memory());
+}
+
+const PagedMemory &CPU::reset_memory() {
+	static const PagedMemory memory = [] {
+		PagedMemory memory;
+		// fbs after reset
+		memory.fill(0x8000, FRAMEBUFFER_SIZE, 0xFF);
+		return memory;
+	}();
+
+	return memory;
+}
+
+void CPU::load_addr(u16 addr, u8 byte_value) {
+	write_byte(addr, byte_value);
+}
+
+void CPU::load(u16 addr, const u8 *data, size_t size) {
+	memory.write(addr, data, size);
+
+	if (m_decoded.empty()) return;
+	for (size_t i = 0; i < size; i++) {
+		if (m_code_bytes[addr + i]) {
+			invalidate_code(addr + i);
+		}
+	}
+}
+
+void CPU::map_device(u16 start, size_t length, Device &device) {
+	if (!m_bus.map(start, length, device)) {
+		std::cerr << "Device at " << std::hex << start << " overlaps another or runs past the end of memory" << std::dec << std::endl;
+		exit(1);
+	}
+
+	for (size_t page = start / MEMORY_PAGE_SIZE; page <= (start + length - 1) / MEMORY_PAGE_SIZE; page++) {
+		m_page_traps[page] |= TRAP_DEVICE;
+	}
+}
+
+u8 CPU::read_trapped(u16 addr) {
+	u8 value;
+	u16 offset;
+	if (Device *device = m_bus.find(addr, offset)) {
+		value = device->read(offset);
+	} else {
+		value = memory.read(addr);
+	}
+
+	if (m_read_watches[addr]) {
+		watched(addr, value, WATCH_READ);
+	}
+
+	return value;
+}
+
+void CPU::write_trapped(u16 addr, u8 value) {
+	if (m_write_watches[addr]) {
+		watched(addr, value, WATCH_WRITE);
+	}
+
+	u16 offset;
+	if (Device *device = m_bus.find(addr, offset)) {
+		device->write(offset, value);
+		return;
+	}
+
+	memory.write(addr, value);
+	if (m_code_bytes[addr]) {
+		invalidate_code(addr);
+	}
+}
+
+void CPU::watched(u16 addr, u8 value, WatchAccess access) {
+	if (!m_watch_stop) {
+		m_watch_hit = { addr, value, access };
+		m_watch_stop = true;
+	}
+
+	m_stop_block = true;
+}
+
+void CPU::execute(size_t &cycles) {
+	if (cycles > 0) {
+		const DecodedInst &inst = decode(pc);
+		charge(cycles, inst.cycles);
+		m_cycle += inst.cycles;
+
+		if (inst.handler == H_HLT) {
+			cycles = 0;
+		}
+
+		exec(inst);
+
+		if (m_fault != FAULT_NONE) {
+			std::cerr << fault_message() << std::endl;
+			exit(1);
+		}
+	}
+}
+
+template <typename P>
+const DecodedInst *CPU::run_block_stepped(const DecodedInst *inst, const DecodedInst *end, P &profile) {
+	for (; inst != end; inst++) {
+		u16 addr = pc;
+		profile.executing(addr, *this);
+		exec(*inst);
+		profile.executed(addr, inst, inst + 1, *this);
+
+		if (m_stop_block) return inst;
+	}
+
+	return end;
+}
+
+template <CPU::Dispatch D, typename P>
+CPU::StopReason CPU::run(size_t &cycles, P &profile) {
+	m_counted = cycles;
+	if (m_scheduler || m_irq_pending) {
+		m_service_at = SIZE_MAX;
+	}
+
+	StopReason reason = run_blocks<D>(cycles, profile);
+
+	m_cycle += m_counted - cycles + m_overshoot;
+	m_service_at = 0;
+	return reason;
+}
+
+template <CPU::Dispatch D, typename P>
+CPU::StopReason CPU::run_blocks(size_t &cycles, P &profile) {
+	bool resumed = true;
+	m_fault = FAULT_NONE;
+	m_watch_stop = false;
+	m_overshoot = 0;
+	m_stop_block = false;
+
+	// Finish the block a watchpoint or the budget stopped in before
+	// servicing anything, so stopping there moves no event or interrupt
+	if (pc != m_rest_pc) {
+		m_block_rest = 0;
+	}
+	for (; m_block_rest > 0 && cycles > 0 && !m_stop_block; m_block_rest--) {
+		DecodedInst inst = decode(pc);
+		u16 addr = pc;
+		if (inst.cycles > cycles) m_overshoot = inst.cycles - cycles;
+		charge(cycles, inst.cycles);
+		if constexpr (P::per_instruction) {
+			profile.executing(addr, *this);
+		}
+		exec(inst);
+		profile.executed(addr, &inst, &inst + 1, *this);
+
+		if (inst.handler == H_HLT) {
+			m_block_rest = 0;
+			return HALTED;
+		}
+		if (m_fault != FAULT_NONE) {
+			m_block_rest = 0;
+			return FAULT;
+		}
+		if (m_watch_stop) {
+			m_block_rest = m_code_written ? 0 : m_block_rest - 1;
+			m_rest_pc = pc;
+			return WATCHPOINT;
+		}
+	}
+	if (m_block_rest > 0 && !m_stop_block) {
+		// Out of budget again, still inside the block
+		m_rest_pc = pc;
+		return BUDGET_EXHAUSTED;
+	}
+	m_block_rest = 0;
+
+	while (cycles > 0) {
+		// One compare per block while nothing is due
+		if (cycles <= m_service_at) {
+			service(cycles);
+			// Delivering an interrupt pushes onto the stack
+			if (m_watch_stop) return WATCHPOINT;
+		}
+
+		if (m_code_written) {
+			flush_blocks();
+		}
+		m_stop_block = false;
+
+		if (!resumed && m_breakpoints[pc]) {
+			return BREAKPOINT;
+		}
+		resumed = false;
+
+		Block &block = lookup_block(pc);
+		const DecodedInst *inst = &m_blocks.insts[block.first];
+		const DecodedInst *end = inst + block.count;
+		profile.dispatched(block.start);
+
+		if (block.cycles > cycles) {
+			// Not enough budget for the whole block, finish it one
+			// instruction at a time like execute() would
+			for (; inst != end && cycles > 0; inst++) {
+				u16 addr = pc;
+				if (inst->cycles > cycles) m_overshoot = inst->cycles - cycles;
+				charge(cycles, inst->cycles);
+				if constexpr (P::per_instruction) {
+					profile.executing(addr, *this);
+				}
+				exec(*inst);
+				profile.executed(addr, inst, inst + 1, *this);
+
+				if (inst->handler == H_HLT) return HALTED;
+				if (m_fault != FAULT_NONE) return FAULT;
+				if (m_watch_stop) {
+					// A code write ends the block anyway
+					m_block_rest = m_code_written ? 0 : (u16)(end - inst - 1);
+					m_rest_pc = pc;
+					return WATCHPOINT;
+				}
+				if (m_stop_block) break;
+			}
+
+			// Out of budget partway through: the next run() finishes the
+			// block before servicing anything, as one longer run() would
+			if (inst != end && !m_stop_block) {
+				m_block_rest = (u16)(end - inst);
+				m_rest_pc = pc;
+			}
+			continue;
+		}
+
+		cycles -= block.cycles;
+
+#if R828_HAS_JIT
+		// Profiled runs stay in the interpreter
+		if constexpr (!P::enabled) {
+			if (m_jit_mode != JIT_OFF && !block.jit && ++block.hits == JIT_THRESHOLD && JIT::can_compile(inst, block.count)) {
+				// A breakpoint on the block start must stop every iteration
+				block.jit = m_blocks.jit.compile(block.start, inst, block.count, block.cycles, !m_breakpoints[block.start]);
+			}
+
+			if (block.jit) {
+				// A block that loops on itself stops iterating once events are due
+				size_t reserved = std::min(m_service_at, cycles);
+				cycles -= reserved;
+				run_jit(block, cycles);
+				cycles += reserved;
+
+				if (m_fault != FAULT_NONE) return FAULT;
+				continue;
+			}
+		}
+#endif
+
+		if constexpr (P::per_instruction) {
+			inst = run_block_stepped(inst, end, profile);
+		} else {
+			const DecodedInst *first = inst;
+			if constexpr (D == DISPATCH_THREADED) {
+				inst = run_block_threaded(inst, end);
+			} else {
+				inst = run_block_switch(inst, end);
+			}
+			profile.executed(block.start, first, inst == end ? end : inst + 1, *this);
+		}
+
+		if (inst != end) {
+			// The block faulted, hit a watchpoint or may have rewritten
+			// itself; give back the cycles of everything not yet executed
+			// and redispatch
+			u16 rest = (u16)(end - inst - 1);
+			for (inst++; inst != end; inst++) {
+				cycles += inst->cycles;
+			}
+
+			if (m_fault != FAULT_NONE) return FAULT;
+			if (m_watch_stop) {
+				m_block_rest = m_code_written ? 0 : rest;
+				m_rest_pc = pc;
+				return WATCHPOINT;
+			}
+			continue;
+		}
+
+		if (end[-1].handler == H_HLT) {
+			return HALTED;
+		}
+	}
+
+	return BUDGET_EXHAUSTED;
+}
+
+template CPU::StopReason CPU::run<CPU::DISPATCH_SWITCH>(size_t &cycles, NoProfile &profile);
+template CPU::StopReason CPU::run<CPU::DISPATCH_THREADED>(size_t &cycles, NoProfile &profile);
+template CPU::StopReason CPU::run<CPU::DISPATCH_SWITCH>(size_t &cycles, Profiler &profile);
+template CPU::StopReason CPU::run<CPU::DISPATCH_THREADED>(size_t &cycles, Profiler &profile);
+template CPU::StopReason CPU::run<CPU::DISPATCH_SWITCH>(size_t &cycles, Tracer &profile);
+template CPU::StopReason CPU::run<CPU::DISPATCH_THREADED>(size_t &cycles, Tracer &profile);
+
+void CPU::service(size_t cycles) {
+	m_cycle += m_counted - cycles;
+	m_counted = cycles;
+
+	if (m_scheduler) {
+		m_scheduler->run_until(m_cycle);
+	}
+
+	if (m_irq_pending && !interrupt) {
+		deliver_irq();
+	}
+
+	m_service_at = 0;
+	if (m_irq_pending && !interrupt) {
+		m_service_at = SIZE_MAX;
+	} else if (m_scheduler) {
+		u64 next = m_scheduler->next();
+		if (next <= m_cycle) {
+			m_service_at = SIZE_MAX;
+		} else if (next - m_cycle <= cycles) {
+			m_service_at = cycles - (size_t)(next - m_cycle);
+		}
+	}
+}
+
+void CPU::deliver_irq() {
+	u8 line = (u8)std::countr_zero(m_irq_pending);
+	m_irq_pending &= ~(1 << line);
+
+	write_byte(sp, pc >> 8);
+	write_byte(sp + 1, pc & 0xFF);
+	write_byte(sp + 2, equal | (zero << 1) | (sign << 2) | (carry << 3) | (overflow << 4));
+	sp += 3;
+
+	interrupt = 1;
+	pc = m_irq_vectors[line];
+}
+
+void CPU::set_scheduler(Scheduler *scheduler) {
+	m_scheduler = scheduler;
+	events_changed();
+}
+
+void CPU::set_irq_vector(u8 line, u16 addr) {
+	m_irq_vectors[line] = addr;
+}
+
+void CPU::raise_irq(u8 line) {
+	m_irq_pending |= 1 << line;
+	m_service_at = SIZE_MAX;
+}
+
+CPU::Snapshot CPU::snapshot() const {
+	Snapshot snapshot {
+		.pc = pc,
+		.sp = sp,
+		.fbs = fbs,
+		.regs_u16 = { r0, r1, r2, r3, ra, ri },
+		.regs_u8 = { b0, b1, b2, b3 },
+		.equal = equal,
+		.zero = zero,
+		.decimal = decimal,
+		.sign = sign,
+		.carry = carry,
+		.overflow = overflow,
+		.interrupt = interrupt,
+		.breakf = breakf,
+		.irq_pending = m_irq_pending,
+		.cycle = m_cycle,
+		.block_rest = pc == m_rest_pc ? m_block_rest : (u16)0,
+		.memory = memory,
+	};
+
+	return snapshot;
+}
+
+void CPU::restore(const Snapshot &snapshot) {
+	pc = snapshot.pc;
+	sp = snapshot.sp;
+	fbs = snapshot.fbs;
+	for (u8 i = 0; i < 6; i++) reg_u16(i) = snapshot.regs_u16[i];
+	for (u8 i = 0; i < 4; i++) reg_u8(i) = snapshot.regs_u8[i];
+
+	equal = snapshot.equal;
+	zero = snapshot.zero;
+	decimal = snapshot.decimal;
+	sign = snapshot.sign;
+	carry = snapshot.carry;
+	overflow = snapshot.overflow;
+	interrupt = snapshot.interrupt;
+	breakf = snapshot.breakf;
+
+	load_memory(snapshot.memory);
+	m_fault = FAULT_NONE;
+	m_irq_pending = snapshot.irq_pending;
+	m_cycle = snapshot.cycle;
+	m_block_rest = snapshot.block_rest;
+	m_rest_pc = pc;
+}
+
+std::unique_ptr<CPU> CPU::fork() const {
+	auto cpu = std::make_unique<CPU>();
+	cpu->restore(snapshot());
+
+	cpu->m_jit_mode = m_jit_mode;
+	cpu->m_breakpoints = m_breakpoints;
+	cpu->m_read_watches = m_read_watches;
+	cpu->m_write_watches = m_write_watches;
+	for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		cpu->m_page_traps[page] = m_page_traps[page] & (TRAP_WATCH_READ | TRAP_WATCH_WRITE);
+	}
+
+	return cpu;
+}
+
+void CPU::set_breakpoint(u16 addr) {
+	m_breakpoints[addr] = true;
+	flush_blocks();
+}
+
+void CPU::clear_breakpoint(u16 addr) {
+	m_breakpoints[addr] = false;
+	flush_blocks();
+}
+
+void CPU::set_watchpoint(u16 addr, size_t length, u8 access) {
+	for (size_t i = 0; i < length && addr + i < MEMORY_CAPACITY; i++) {
+		if (access & WATCH_READ) m_read_watches[addr + i] = true;
+		if (access & WATCH_WRITE) m_write_watches[addr + i] = true;
+	}
+
+	for (size_t page = addr / MEMORY_PAGE_SIZE; page < MEMORY_PAGE_COUNT && page * MEMORY_PAGE_SIZE < addr + length; page++) {
+		update_watch_traps(page);
+	}
+}
+
+void CPU::clear_watchpoint(u16 addr, size_t length, u8 access) {
+	for (size_t i = 0; i < length && addr + i < MEMORY_CAPACITY; i++) {
+		if (access & WATCH_READ) m_read_watches[addr + i] = false;
+		if (access & WATCH_WRITE) m_write_watches[addr + i] = false;
+	}
+
+	for (size_t page = addr / MEMORY_PAGE_SIZE; page < MEMORY_PAGE_COUNT && page * MEMORY_PAGE_SIZE < addr + length; page++) {
+		update_watch_traps(page);
+	}
+}
+
+void CPU::update_watch_traps(size_t page) {
+	bool reads = false;
+	bool writes = false;
+	for (size_t addr = page * MEMORY_PAGE_SIZE; addr < (page + 1) * MEMORY_PAGE_SIZE; addr++) {
+		reads = reads || m_read_watches[addr];
+		writes = writes || m_write_watches[addr];
+	}
+
+	m_page_traps[page] &= ~(TRAP_WATCH_READ | TRAP_WATCH_WRITE);
+	if (reads) m_page_traps[page] |= TRAP_WATCH_READ;
+	if (writes) m_page_traps[page] |= TRAP_WATCH_WRITE;
+}
+
+void CPU::set_jit_mode(JitMode mode) {
+	m_jit_mode = mode;
+	flush_blocks();
+}
+
+void CPU::run_jit(Block &block, size_t &cycles) {
+	JitState state;
+
+	if (m_jit_mode == JIT_DIFFERENTIAL) {
+		// One iteration only, then replay the block through the interpreter
+		// from the same starting state
+		load_jit_state(state, 0);
+		JitState expected = state;
+
+		block.jit(&state);
+
+		u16 start = pc;
+		store_jit_state(expected);
+		run_block_switch(&m_blocks.insts[block.first], &m_blocks.insts[block.first] + block.count);
+		load_jit_state(expected, 0);
+
+		// The JIT leaves a divide by zero to the interpreter, so it stops on
+		// the DIV and refunds the rest of the block
+		if (m_fault != FAULT_NONE) {
+			expected.pc = state.pc;
+			expected.bailout = state.bailout;
+			expected.cycles = state.cycles;
+
+			cycles += state.cycles;
+			charge(cycles, decode(m_fault_pc).cycles);
+		}
+
+		if (std::memcmp(&state, &expected, sizeof(JitState)) != 0) {
+			std::cerr << "JIT mismatch in block 0x" << std::hex << std::uppercase << start
+				<< ": pc 0x" << state.pc << " (interpreter 0x" << expected.pc << ")" << std::endl;
+			exit(1);
+		}
+
+		return;
+	}
+
+	load_jit_state(state, cycles);
+	block.jit(&state);
+	store_jit_state(state);
+	cycles = state.cycles;
+
+	if (state.bailout) {
+		// Stopped in front of an instruction only the interpreter handles
+		const DecodedInst &inst = decode(pc);
+		charge(cycles, inst.cycles);
+		exec(inst);
+	}
+}
+
+void CPU::load_jit_state(JitState &state, size_t cycles) {
+	std::memset(&state, 0, sizeof(JitState));
+
+	state.cycles = cycles;
+	for (u8 i = 0; i < 6; i++) state.regs_u16[i] = reg_u16(i);
+	for (u8 i = 0; i < 4; i++) state.regs_u8[i] = reg_u8(i);
+	state.equal = equal;
+	state.zero = zero;
+	state.sign = sign;
+	state.carry = carry;
+	state.overflow = overflow;
+	state.pc = pc;
+}
+
+void CPU::store_jit_state(const JitState &state) {
+	for (u8 i = 0; i < 6; i++) reg_u16(i) = state.regs_u16[i];
+	for (u8 i = 0; i < 4; i++) reg_u8(i) = state.regs_u8[i];
+	equal = state.equal;
+	zero = state.zero;
+	sign = state.sign;
+	carry = state.carry;
+	overflow = state.overflow;
+	pc = state.pc;
+}
+
+u16 &CPU::reg_u16(u8 index) {
+	return this->*s_regs_u16[index];
+}
+
+u8 &CPU::reg_u8(u8 index) {
+	return this->*s_regs_u8[index];
+}
+
+const DecodedInst &CPU::decode(u16 addr) {
+	if (m_decoded.empty()) {
+		m_decoded.resize(MEMORY_CAPACITY);
+	}
+
+	DecodedInst &inst = m_decoded[addr];
+	if (inst.handler == H_UNDECODED) {
+		decode_into(addr, inst);
+	}
+
+	return inst;
+}
+
+void CPU::decode_into(u16 addr, DecodedInst &inst) {
+	decode_at(memory, addr, inst);
+
+	for (u16 i = 0; i < inst.length; i++) {
+		m_code_bytes[(u16)(addr + i)] = true;
+	}
+}
+
+template <typename M>
+void CPU::decode_at(const M &memory, u16 addr, DecodedInst &inst) {
+	u16 pos = addr;
+	u8 cycles = 0;
+
+	inst = {};
+
+	// One cycle per byte, word or register fetched, as ISA.h describes
+	auto fetch_byte = [&]() -> u8 {
+		u8 byte = memory.read(pos);
+		pos++;
+
+		cycles++;
+		return byte;
+	};
+
+	u8 *slots[] = { &inst.a, &inst.b, &inst.c };
+	u8 slot = 0;
+
+	auto fetch_operand = [&](ISA::OperandKind kind) -> bool {
+		switch (kind) {
+		case ISA::OPERAND_REG8:
+		case ISA::OPERAND_REG16: {
+			u8 code = fetch_byte();
+			u8 reg = (kind == ISA::OPERAND_REG8 ? ISA::REG8_CODES : ISA::REG16_CODES)[code];
+			if (reg == ISA::NO_REG) {
+				inst.handler = H_INVALID_REG;
+				inst.imm = code;
+				return false;
+			}
+
+			*slots[slot++] = ISA::REGISTERS[reg].index;
+		} break;
+		case ISA::OPERAND_IMM8: {
+			inst.imm = fetch_byte();
+		} break;
+		case ISA::OPERAND_IMM16: {
+			u8 high_byte = memory.read(pos);
+			u8 low_byte = memory.read(pos + 1);
+			pos += 2;
+
+			cycles++;
+			inst.imm = ((u16)high_byte << 8) | (u16)low_byte;
+		} break;
+		case ISA::OPERAND_DATA16: {
+			*slots[slot++] = fetch_byte();
+			*slots[slot++] = fetch_byte();
+		} break;
+		case ISA::OPERAND_NONE: break;
+		}
+
+		return true;
+	};
+
+	u8 op = fetch_byte();
+	const ISA::OpcodeForms &entry = ISA::OPCODE_FORMS[op];
+	if (entry.count == 0) {
+		inst.imm = op;
+		inst.handler = H_INVALID_INST;
+	} else {
+		u8 form = entry.first;
+		if (ISA::FORMS[form].implied != ISA::NO_REG) {
+			inst.a = ISA::FORMS[form].implied;
+			slot = 1;
+		}
+
+		// Operands ahead of the mode byte are the same in every form
+		bool valid = true;
+		for (u8 i = 0; i < ISA::FORMS[form].operand_count && valid; i++) {
+			if (ISA::FORMS[form].mode != ISA::NO_MODE && i == ISA::FORMS[form].mode_at) {
+				u8 mode = fetch_byte();
+				cycles += ISA::FORMS[form].extra_cycles;
+
+				u8 match = entry.first;
+				while (match < entry.first + entry.count && ISA::FORMS[match].mode != mode) match++;
+				if (match == entry.first + entry.count) {
+					if (entry.bad_mode == ISA::BAD_MODE_FAULT) {
+						inst.imm = mode;
+						inst.handler = H_INVALID_MODE;
+					} else {
+						inst.handler = H_NOP;
+					}
+					valid = false;
+					break;
+				}
+
+				form = match;
+			}
+
+			valid = fetch_operand(ISA::FORMS[form].operands[i]);
+		}
+
+		if (valid) {
+			inst.handler = s_form_handlers[form];
+		}
+	}
+
+	inst.length = (u16)(pos - addr);
+	inst.cycles = cycles;
+}
+
+template void CPU::decode_at(const Memory &memory, u16 addr, DecodedInst &inst);
+template void CPU::decode_at(const PagedMemory &memory, u16 addr, DecodedInst &inst);
+
+Block &CPU::lookup_block(u16 addr) {
+	if (m_blocks.index.empty()) {
+		m_blocks.index.resize(MEMORY_CAPACITY);
+	}
+
+	u32 index = m_blocks.index[addr];
+	if (index >= m_blocks.blocks.size() || m_blocks.blocks[index].start != addr) {
+		build_block(addr);
+		index = m_blocks.index[addr];
+	}
+
+	return m_blocks.blocks[index];
+}
+
+void CPU::build_block(u16 addr) {
+	Block block {
+		.start = addr,
+		.count = 0,
+		.first = (u32)m_blocks.insts.size(),
+		.cycles = 0,
+		.hits = 0,
+		.jit = nullptr,
+	};
+
+	u16 pos = addr;
+	while (block.count < MAX_BLOCK_INSTS) {
+		const DecodedInst &inst = decode(pos);
+		m_blocks.insts.push_back(inst);
+		block.count++;
+		block.cycles += inst.cycles;
+		pos += inst.length;
+
+		bool ends_block = inst.handler == H_JZ
+			|| inst.handler == H_JNZ
+			|| inst.handler == H_JMP
+			|| inst.handler == H_RTI
+			|| inst.handler == H_HLT
+			|| inst.handler >= H_INVALID_INST;
+
+		// Breakpoints are only checked between blocks, so one must start at
+		// every breakpoint address
+		if (ends_block || m_breakpoints[pos]) {
+			break;
+		}
+	}
+
+	m_blocks.index[addr] = (u32)m_blocks.blocks.size();
+	m_blocks.blocks.push_back(block);
+}
+
+void CPU::flush_blocks() {
+	m_blocks.clear();
+	m_code_written = false;
+}
+
+void CPU::raise_fault(Fault fault, const DecodedInst &inst) {
+	m_fault = fault;
+	m_fault_value = (u8)inst.imm;
+	m_fault_pc = pc - inst.length;
+	m_stop_block = true;
+}
+
+std::string CPU::fault_message() const {
+	std::stringstream message;
+	message << std::hex << std::uppercase;
+
+	switch (m_fault) {
+	case FAULT_NONE: break;
+	case FAULT_INVALID_INST: {
+		message << "Invalid CPU instruction: 0x" << static_cast<int>(m_fault_value);
+	} break;
+	case FAULT_INVALID_REG: {
+		message << "Register code does not exist: 0x" << static_cast<int>(m_fault_value);
+	} break;
+	case FAULT_INVALID_MODE: {
+		message << "Invalid value mode: 0x" << static_cast<int>(m_fault_value);
+	} break;
+	case FAULT_DIVIDE_BY_ZERO: {
+		message << "Division by zero";
+	} break;
+	}
+
+	message << " (pc 0x" << m_fault_pc << ")";
+	return message.str();
+}
+
+void CPU::invalidate_code(u16 addr) {
+	// Any instruction starting up to MAX_INST_LENGTH - 1 bytes earlier may
+	// cover this address
+	for (u16 i = 0; i < MAX_INST_LENGTH; i++) {
+		m_decoded[(u16)(addr - i)].handler = H_UNDECODED;
+	}
+
+	m_code_written = true;
+	m_stop_block = true;
+}
+
+void CPU::invalidate_page(size_t page) {
+	u16 start = (u16)(page * MEMORY_PAGE_SIZE);
+	for (u16 i = 0; i < MEMORY_PAGE_SIZE; i++) {
+		if (m_code_bytes[(u16)(start + i)]) {
+			invalidate_code(start + i);
+			m_code_bytes[(u16)(start + i)] = false;
+		}
+	}
+}
+
+void CPU::load_memory(const PagedMemory &image) {
+	for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		if (!memory.shares_page(image, page)) {
+			// Nothing is decoded yet in a fresh CPU or fork
+			if (!m_decoded.empty()) {
+				invalidate_page(page);
+			}
+			memory.share_page(image, page);
+		}
+	}
+}
+
+void CPU::exec(DecodedInst inst) {
+	pc += inst.length;
+
+	switch (inst.handler) {
+#define HANDLER(name) case name:
+#define NEXT break
+#define NEXT_CHECKED break
+#include "CPUHandlers.inl"
+#undef HANDLER
+#undef NEXT
+#undef NEXT_CHECKED
+	}
+}
+
+const DecodedInst *CPU::run_block_switch(const DecodedInst *inst, const DecodedInst *end) {
+	for (; inst != end; inst++) {
+		exec(*inst);
+
+		if (m_stop_block) return inst;
+	}
+
+	return end;
+}
+
+#if R828_HAS_THREADED_DISPATCH
+const DecodedInst *CPU::run_block_threaded(const DecodedInst *ip, const DecodedInst *end) {
+	static const void *const labels[] = {
+#define X(name) &&L_##name,
+		CPU_HANDLERS(X)
+#undef X
+	};
+
+	// Every handler ends in its own indirect jump to the next one
+	DecodedInst inst = *ip;
+	pc += inst.length;
+	goto *labels[inst.handler];
+
+#define HANDLER(name) L_##name:
+#define NEXT \
+	if (++ip == end) return end; \
+	inst = *ip; \
+	pc += inst.length; \
+	goto *labels[inst.handler]
+#define NEXT_CHECKED \
+	if (m_stop_block) return ip; \
+	NEXT
+#include "CPUHandlers.inl"
+#undef HANDLER
+#undef NEXT
+#undef NEXT_CHECKED
+}
+#else
+const DecodedInst *CPU::run_block_threaded(const DecodedInst *inst, const DecodedInst *end) {
+	return run_block_switch(inst, end);
+}
+#endif
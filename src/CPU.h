@@ -0,0 +1,545 @@
+#pragma once
+
+#include <vector>
+#include <bitset>
+#include <string>
+#include <memory>
+
+#include "Core.h"
+#include "ISA.h"
+#include "Memory.h"
+#include "JIT.h"
+#include "Bus.h"
+
+// Maximum encoded length of any R828 instruction (STW reg, 0xA0, lo, hi).
+#define MAX_INST_LENGTH 5
+// Longest straight-line run cached as a single block
+#define MAX_BLOCK_INSTS 64
+
+// Framebuffer at fbs, 3 bytes per pixel, filled with 0xFF by CPU::reset
+#define FRAMEBUFFER_WIDTH 64
+#define FRAMEBUFFER_HEIGHT 64
+#define FRAMEBUFFER_SIZE (FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 3)
+
+// An instruction decoded once per address. Operands are register indices
+// (see CPU::reg_u16/CPU::reg_u8) rather than pointers so the cache stays valid
+// when a CPU is copied.
+struct DecodedInst {
+	u8 handler;
+	u8 length;
+	u8 cycles;
+	u8 a;
+	u8 b;
+	u8 c;
+	u16 imm;
+};
+
+// A straight-line run of instructions ending at JMP/JZ/JNZ/HLT, executed per
+// dispatch by CPU::run. The instructions are copied into BlockCache::insts.
+struct Block {
+	u16 start;
+	u16 count;
+	u32 first;
+	size_t cycles;
+
+	// Dispatches so far, and the native translation once it is hot
+	u32 hits;
+	JitBlockFn jit;
+};
+
+// Everything CPU::run derives from guest code. It is rebuilt on demand, so a
+// copied CPU starts with a cold cache and never shares translated code.
+struct BlockCache {
+	BlockCache() = default;
+	BlockCache(const BlockCache &)
+		: BlockCache() {}
+	BlockCache &operator=(const BlockCache &) { clear(); return *this; }
+
+	void clear() {
+		blocks.clear();
+		insts.clear();
+		jit.flush();
+	}
+
+	// Maps a start address to an index into blocks; entries are only trusted
+	// if the block's start matches, so clear() just empties the vectors.
+	// Sized to MEMORY_CAPACITY on the first lookup.
+	std::vector<u32> index;
+	std::vector<Block> blocks;
+	std::vector<DecodedInst> insts;
+
+	JIT jit;
+};
+
+// What a DecodedInst does once its operands are resolved. Mode bytes
+// (PUSH/POP/STB/STW and the logic ops) are folded into the handler. The order
+// here is the order of the threaded dispatch table.
+//
+// H_NOP covers an unknown mode byte on STB/STW and the logic ops: the operands
+// are skipped and nothing happens. Decode errors (H_INVALID_*) fault when the
+// instruction executes, not when it is decoded.
+#define CPU_HANDLERS(X) \
+	X(H_UNDECODED) \
+	X(H_LOAD_U16) \
+	X(H_LOAD_U8) \
+	X(H_PUSH_BYTE) \
+	X(H_PUSH_WORD) \
+	X(H_POP_BYTE) \
+	X(H_POP_WORD) \
+	X(H_STB_IMM) \
+	X(H_STB_REG) \
+	X(H_STW_IMM) \
+	X(H_STW_REG) \
+	X(H_LDB) \
+	X(H_LDW) \
+	X(H_ADD) \
+	X(H_ADC) \
+	X(H_SUB) \
+	X(H_SBB) \
+	X(H_MUL) \
+	X(H_DIV) \
+	X(H_ADDB) \
+	X(H_ADCB) \
+	X(H_SUBB) \
+	X(H_SBBB) \
+	X(H_MULB) \
+	X(H_DIVB) \
+	X(H_AND_U8) \
+	X(H_AND_U16) \
+	X(H_OR_U8) \
+	X(H_OR_U16) \
+	X(H_XOR_U8) \
+	X(H_XOR_U16) \
+	X(H_NOT_U8) \
+	X(H_NOT_U16) \
+	X(H_SHL_U8) \
+	X(H_SHL_U16) \
+	X(H_SHR_U8) \
+	X(H_SHR_U16) \
+	X(H_EQU) \
+	X(H_JZ) \
+	X(H_JNZ) \
+	X(H_JMP) \
+	X(H_RTI) \
+	X(H_HLT) \
+	X(H_NOP) \
+	X(H_INVALID_INST) \
+	X(H_INVALID_REG) \
+	X(H_INVALID_MODE)
+
+// Labels-as-values are a GCC/Clang extension; everything else uses the switch
+#if defined(R828_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+	#define R828_HAS_THREADED_DISPATCH 1
+#else
+	#define R828_HAS_THREADED_DISPATCH 0
+#endif
+
+struct CPU;
+class Scheduler;
+
+// Interrupt lines; a lower line is delivered first
+#define CPU_IRQ_LINES 8
+
+// Profiling policy for CPU::run that records nothing; every hook is empty and
+// inlined away, so an unprofiled run costs exactly what it did before hooks
+// existed. See Profiler.h for the one that counts and Trace.h for one that
+// records every instruction.
+struct NoProfile {
+	static constexpr bool enabled = false;
+	// Report each instruction to executed() on its own, after it has run, and
+	// to executing(addr, cpu) just before
+	static constexpr bool per_instruction = false;
+
+	void dispatched(u16) {}
+	void executed(u16, const DecodedInst *, const DecodedInst *, const CPU &) {}
+};
+
+struct CPU {
+public:
+	// Zeroed memory
+	CPU();
+	explicit CPU(const Memory &mem);
+
+	// Registers to their power-on values and memory to reset_memory(). Only
+	// pages written since the last reset or restore are replaced, and
+	// decoded code outside them stays valid.
+	void reset();
+
+	// Memory contents right after reset(), shared by every CPU
+	static const PagedMemory &reset_memory();
+
+	void load_addr(u16 addr, u8 byte_value);
+
+	// Copies `size` bytes to `addr` in bulk; the range must fit in memory
+	void load(u16 addr, const u8 *data, size_t size);
+
+	u8 read_addr(u16 addr) const { return memory.read(addr); }
+
+	// Loads and stores in [start, start + length) go to `device` instead of
+	// memory from now on; instruction fetches, load() and snapshots still see
+	// memory. Exits if the range overlaps another device's. Forks start
+	// without devices.
+	void map_device(u16 start, size_t length, Device &device);
+
+	void execute(size_t &cycles);
+
+	enum StopReason {
+		HALTED,
+		BUDGET_EXHAUSTED,
+		BREAKPOINT,
+		// See fault()/fault_message(); pc is past the faulting instruction
+		FAULT,
+		// See watch_hit(); pc is past the instruction that made the access,
+		// or at the vector if delivering an interrupt did
+		WATCHPOINT,
+	};
+
+	enum Fault {
+		FAULT_NONE,
+		FAULT_INVALID_INST,
+		FAULT_INVALID_REG,
+		FAULT_INVALID_MODE,
+		FAULT_DIVIDE_BY_ZERO,
+	};
+
+	enum Dispatch {
+		DISPATCH_SWITCH,
+		// Falls back to DISPATCH_SWITCH when R828_HAS_THREADED_DISPATCH is 0
+		DISPATCH_THREADED,
+	};
+
+	// Runs whole basic blocks until HLT, a breakpoint or the budget runs out.
+	// Instruction costs are charged exactly as execute() charges them, but
+	// HLT leaves the remaining budget in `cycles` so callers can tell how
+	// much was used. A breakpoint on the current pc is ignored on entry so
+	// calling run() again resumes past it.
+	StopReason run(size_t &cycles) {
+#if R828_HAS_THREADED_DISPATCH
+		return run<DISPATCH_THREADED>(cycles);
+#else
+		return run<DISPATCH_SWITCH>(cycles);
+#endif
+	}
+
+	// run() with an explicit interpreter backend, for benchmarking both in
+	// one binary
+	template <Dispatch D>
+	StopReason run(size_t &cycles) {
+		NoProfile profile;
+		return run<D>(cycles, profile);
+	}
+
+	// run() reporting every block dispatch and executed instruction to
+	// `profile`, a policy like NoProfile. A policy that is enabled keeps the
+	// run in the interpreter, so the JIT never hides instructions from it.
+	template <typename P>
+	StopReason run(size_t &cycles, P &profile) {
+#if R828_HAS_THREADED_DISPATCH
+		return run<DISPATCH_THREADED>(cycles, profile);
+#else
+		return run<DISPATCH_SWITCH>(cycles, profile);
+#endif
+	}
+
+	template <Dispatch D, typename P>
+	StopReason run(size_t &cycles, P &profile);
+
+	// Cycles the last instruction of the last run() took beyond its budget.
+	// Continuing with that much less budget executes exactly what a single
+	// longer run() would have.
+	size_t overshoot() const { return m_overshoot; }
+
+	// Breakpoints stop run() before the instruction at `addr`. Blocks end
+	// at them, so they are checked once per block.
+	void set_breakpoint(u16 addr);
+	void clear_breakpoint(u16 addr);
+
+	enum WatchAccess : u8 {
+		WATCH_READ = 1 << 0,
+		WATCH_WRITE = 1 << 1,
+	};
+
+	// The first watched access of the last run() that returned WATCHPOINT
+	struct WatchHit {
+		u16 addr;
+		u8 value;
+		WatchAccess access;
+	};
+
+	// Watchpoints stop run() once a load or store (per `access`, a mask of
+	// WatchAccess) touches [addr, addr + length) and its instruction has
+	// completed. Only pages holding a watched byte leave the inline memory
+	// path. Instruction fetches are not watched.
+	void set_watchpoint(u16 addr, size_t length, u8 access);
+	// Clears the watchpoints of the kinds in `access` on [addr, addr + length)
+	void clear_watchpoint(u16 addr, size_t length, u8 access = WATCH_READ | WATCH_WRITE);
+	const WatchHit &watch_hit() const { return m_watch_hit; }
+
+	// Cycles run() and execute() have executed since the CPU was created or
+	// reset. While run() is going it is up to date whenever events fire.
+	u64 cycle() const { return m_cycle; }
+
+	// Events on `scheduler` fire as run() reaches them, at block boundaries.
+	// nullptr detaches it; forks start without one.
+	void set_scheduler(Scheduler *scheduler);
+	// Call after scheduling on the attached scheduler from anywhere but one
+	// of its own callbacks, so run() looks up the next deadline again
+	void events_changed() { m_service_at = SIZE_MAX; }
+
+	// Where interrupts on `line` are delivered
+	void set_irq_vector(u8 line, u16 addr);
+	u16 irq_vector(u8 line) const { return m_irq_vectors[line]; }
+	// Marks `line` pending. run() delivers it at the next block boundary
+	// unless an interrupt is being handled, by pushing pc (high byte first)
+	// and a flags byte (equal, zero, sign, carry, overflow from bit 0),
+	// setting `interrupt` and jumping to the line's vector. RTI pops both
+	// and clears `interrupt` again.
+	void raise_irq(u8 line);
+
+	enum JitMode {
+		JIT_OFF,
+		JIT_ON,
+		// Every translated block is also interpreted from the same state and
+		// the emulator aborts if registers, flags or pc differ
+		JIT_DIFFERENTIAL,
+	};
+
+	// Only takes effect when built with the JIT (R828_HAS_JIT)
+	void set_jit_mode(JitMode mode);
+
+	// Set when run() returns FAULT. execute() reports faults and exits.
+	Fault fault() const { return m_fault; }
+	std::string fault_message() const;
+
+	// Decodes the instruction at `addr` without touching any cache. Defined
+	// for Memory and PagedMemory.
+	template <typename M>
+	static void decode_at(const M &memory, u16 addr, DecodedInst &inst);
+
+	// Registers, flags and memory at one point in time. The memory shares its
+	// pages with the CPU it was taken from until either side writes them.
+	struct Snapshot {
+		u16 pc;
+		u16 sp;
+		u16 fbs;
+		u16 regs_u16[6];
+		u8 regs_u8[4];
+
+		u8 equal;
+		u8 zero;
+		u8 decimal;
+		u8 sign;
+		u8 carry;
+		u8 overflow;
+		u8 interrupt;
+		u8 breakf;
+
+		// Lines raised but not yet delivered, cycle(), and the instructions
+		// left of a block run() stopped partway through, so a restored CPU
+		// services events where the original would have
+		u8 irq_pending;
+		u64 cycle;
+		u16 block_rest;
+
+		PagedMemory memory;
+	};
+
+	Snapshot snapshot() const;
+
+	// Returns to `snapshot`. Decoded code survives in every page the snapshot
+	// still shares with this CPU.
+	void restore(const Snapshot &snapshot);
+
+	// A new CPU in the same state, sharing all memory pages with this one.
+	// Breakpoints and the JIT mode carry over; the decode and block caches
+	// start cold, so a fork costs about as much as a snapshot.
+	std::unique_ptr<CPU> fork() const;
+private:
+	const DecodedInst &decode(u16 addr);
+	void decode_into(u16 addr, DecodedInst &inst);
+	void exec(DecodedInst inst);
+
+	template <Dispatch D, typename P>
+	StopReason run_blocks(size_t &cycles, P &profile);
+
+	// Fires due events and delivers a pending interrupt
+	void service(size_t cycles);
+	void deliver_irq();
+
+	// Execute [inst, end) with the budget already charged. Returns end, or
+	// the instruction after which a store hit decoded code.
+	const DecodedInst *run_block_switch(const DecodedInst *inst, const DecodedInst *end);
+	const DecodedInst *run_block_threaded(const DecodedInst *inst, const DecodedInst *end);
+	// run_block_switch() reporting each instruction to `profile` as it runs
+	template <typename P>
+	const DecodedInst *run_block_stepped(const DecodedInst *inst, const DecodedInst *end, P &profile);
+
+	Block &lookup_block(u16 addr);
+	void build_block(u16 addr);
+	void flush_blocks();
+
+	void run_jit(Block &block, size_t &cycles);
+	void load_jit_state(JitState &state, size_t cycles);
+	void store_jit_state(const JitState &state);
+
+	u8 read_byte(u16 addr) {
+		if (m_page_traps[addr / MEMORY_PAGE_SIZE] & (TRAP_DEVICE | TRAP_WATCH_READ)) {
+			return read_trapped(addr);
+		}
+
+		return memory.read(addr);
+	}
+
+	void write_byte(u16 addr, u8 value) {
+		if (m_page_traps[addr / MEMORY_PAGE_SIZE] & (TRAP_DEVICE | TRAP_WATCH_WRITE)) {
+			write_trapped(addr, value);
+			return;
+		}
+
+		memory.write(addr, value);
+		if (m_code_bytes[addr]) {
+			invalidate_code(addr);
+		}
+	}
+
+	// read_byte()/write_byte() on a page with a m_page_traps bit that
+	// concerns them
+	u8 read_trapped(u16 addr);
+	void write_trapped(u16 addr, u8 value);
+	void watched(u16 addr, u8 value, WatchAccess access);
+	// Brings the watch bits of m_page_traps for `page` up to date
+	void update_watch_traps(size_t page);
+
+	void invalidate_code(u16 addr);
+	void invalidate_page(size_t page);
+
+	// Takes every page of `image` that memory does not already share
+	void load_memory(const PagedMemory &image);
+
+	void raise_fault(Fault fault, const DecodedInst &inst);
+
+	static void charge(size_t &cycles, size_t cost) {
+		cycles = cost < cycles ? cycles - cost : 0;
+	}
+
+	u16 &reg_u16(u8 index);
+	u8 &reg_u8(u8 index);
+public:
+	// Encodings, operands and costs are described in ISA.h
+	enum Inst {
+#define X(name, code, bad_mode) name = code,
+		R828_OPCODES(X)
+#undef X
+	};
+
+	enum RegCode {
+#define X(name, code, kind, index) name = code,
+		R828_REGISTERS(X)
+#undef X
+	};
+
+	enum ValueCode {
+		BYTE	= 0xA0,
+		WORD	= 0xA1,
+	};
+
+	// See CPU_HANDLERS
+	enum Handler : u8 {
+#define X(name) name,
+		CPU_HANDLERS(X)
+#undef X
+	};
+public:
+	u16 pc;
+	u16 sp;
+	u16 fbs;
+
+	// 16-bit registers
+	u16 r0;
+	u16 r1;
+	u16 r2;
+	u16 r3;
+
+	// Special Purpose Accumulator Register
+	u16 ra;
+
+	// Special Purpose All-Intermediate Register
+	// Typically recommended for memory addresses
+	u16 ri;
+
+	// 8-bit registers
+	u8 b0;
+	u8 b1;
+	u8 b2;
+	u8 b3;
+
+	u8 equal		: 1;
+
+	u8 zero			: 1;
+	u8 decimal		: 1;
+	u8 sign			: 1;
+	u8 carry		: 1;
+	u8 overflow		: 1;
+	u8 interrupt	: 1;
+	u8 breakf		: 1;
+private:
+	PagedMemory memory;
+
+	// Decoded instruction per address, filled on first execution. Sized to
+	// MEMORY_CAPACITY by the first decode so an idle fork stays small.
+	std::vector<DecodedInst> m_decoded;
+	// Bytes covered by at least one decoded instruction; writes elsewhere
+	// skip invalidation entirely
+	std::bitset<MEMORY_CAPACITY> m_code_bytes;
+	// Set when a store hits decoded code; the block cache is flushed before
+	// the next dispatch
+	bool m_code_written = false;
+	// Set on code writes and faults; the block being executed stops after
+	// the current instruction
+	bool m_stop_block = false;
+	size_t m_overshoot = 0;
+
+	u64 m_cycle = 0;
+	// Budget left in the current run() when m_cycle was last brought up to
+	// date
+	size_t m_counted = 0;
+	// run() services events and interrupts once its budget is down to this,
+	// so SIZE_MAX means at the next block boundary and 0 never
+	size_t m_service_at = 0;
+	Scheduler *m_scheduler = nullptr;
+
+	u8 m_irq_pending = 0;
+	u16 m_irq_vectors[CPU_IRQ_LINES] = {};
+
+	Fault m_fault = FAULT_NONE;
+	u8 m_fault_value = 0;
+	u16 m_fault_pc = 0;
+
+	BlockCache m_blocks;
+	JitMode m_jit_mode = R828_HAS_JIT ? JIT_ON : JIT_OFF;
+
+	std::bitset<MEMORY_CAPACITY> m_breakpoints;
+	std::bitset<MEMORY_CAPACITY> m_read_watches;
+	std::bitset<MEMORY_CAPACITY> m_write_watches;
+	// Set by the first watched access of a run()
+	bool m_watch_stop = false;
+	WatchHit m_watch_hit {};
+	// Instructions left in the block a watchpoint or the end of the budget
+	// stopped at m_rest_pc; the next run() from there executes them before
+	// servicing events, as an unstopped run would
+	u16 m_block_rest = 0;
+	u16 m_rest_pc = 0;
+
+	enum PageTrap : u8 {
+		// Part of the page belongs to a device on m_bus
+		TRAP_DEVICE = 1 << 0,
+		// The page has bytes in m_read_watches/m_write_watches
+		TRAP_WATCH_READ = 1 << 1,
+		TRAP_WATCH_WRITE = 1 << 2,
+	};
+
+	// PageTrap bits per page. Loads and stores on pages with none set never
+	// leave the inline RAM path.
+	std::array<u8, MEMORY_PAGE_COUNT> m_page_traps {};
+	Bus m_bus;
+};
@@ -0,0 +1,292 @@
+// Handler bodies shared by the switch and threaded dispatch loops in CPU.cpp.
+// The includer defines HANDLER(name), NEXT and NEXT_CHECKED and provides
+// `inst`, the DecodedInst being executed with pc already advanced past it.
+// NEXT_CHECKED ends handlers that can stop the block: stores that may hit
+// decoded code, loads and stores that may hit a watchpoint, and faults.
+
+HANDLER(H_LOAD_U16) {
+	reg_u16(inst.a) = inst.imm;
+} NEXT;
+HANDLER(H_LOAD_U8) {
+	reg_u8(inst.a) = (u8)inst.imm;
+} NEXT;
+HANDLER(H_PUSH_BYTE) {
+	write_byte(sp, (u8)inst.imm);
+	sp++;
+} NEXT_CHECKED;
+HANDLER(H_PUSH_WORD) {
+	write_byte(sp, inst.a);
+	write_byte(sp + 1, inst.b);
+	sp += 2;
+} NEXT_CHECKED;
+HANDLER(H_POP_BYTE) {
+	u8 *dest = &reg_u8(inst.a);
+	*dest = read_byte((u16)(sp - 1));
+	write_byte(sp - 1, 0x00);
+	sp--;
+} NEXT_CHECKED;
+HANDLER(H_POP_WORD) {
+	u16 *dest = &reg_u16(inst.a);
+	*dest = ((u16)read_byte((u16)(sp - 2)) << 8) | (u16)read_byte((u16)(sp - 1));
+	write_byte(sp - 2, 0x00);
+	write_byte(sp - 1, 0x00);
+	sp -= 2;
+} NEXT_CHECKED;
+HANDLER(H_STB_IMM) {
+	write_byte(reg_u16(inst.a), (u8)inst.imm);
+} NEXT_CHECKED;
+HANDLER(H_STB_REG) {
+	write_byte(reg_u16(inst.a), reg_u8(inst.b));
+} NEXT_CHECKED;
+HANDLER(H_STW_IMM) {
+	u16 memory_addr = reg_u16(inst.a);
+	write_byte(memory_addr, inst.b);
+	write_byte(memory_addr + 1, inst.c);
+} NEXT_CHECKED;
+HANDLER(H_STW_REG) {
+	u16 memory_addr = reg_u16(inst.a);
+	u16 value = reg_u16(inst.b);
+	write_byte(memory_addr, value & 0xFF);
+	write_byte(memory_addr + 1, (value >> 8) & 0xFF);
+} NEXT_CHECKED;
+HANDLER(H_LDB) {
+	reg_u8(inst.a) = read_byte(reg_u16(inst.b));
+} NEXT_CHECKED;
+HANDLER(H_LDW) {
+	u16 addr = reg_u16(inst.b);
+	reg_u16(inst.a) = ((u16)read_byte(addr) << 8) | (u16)read_byte((u16)(addr + 1));
+} NEXT_CHECKED;
+HANDLER(H_ADD) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	*dest = *reg1 + *reg2;
+
+	zero = (*dest == 0);
+	sign = (static_cast<i16>(*dest) < 0);
+	carry = (*reg1 > 0xFFFF - *reg2);
+	overflow = (((*reg1 ^ *reg2) & 0x8000) == 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
+} NEXT;
+HANDLER(H_ADC) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	u16 carry_in = carry ? 1 : 0;
+
+	*dest = *reg1 + *reg2 + carry_in;
+
+	zero = (*dest == 0);
+	sign = (static_cast<i16>(*dest) < 0);
+	carry = (*dest < *reg1 || *dest < *reg2 || carry_in);
+	overflow = (((*reg1 ^ *reg2) & 0x8000) == 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
+} NEXT;
+HANDLER(H_SUB) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	*dest = *reg1 - *reg2;
+
+	zero = (*dest == 0);
+	sign = (static_cast<i16>(*dest) < 0);
+	carry = (*reg1 < *reg2);
+	overflow = (((*reg1 ^ *reg2) & 0x8000) != 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
+} NEXT;
+HANDLER(H_SBB) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	u16 carry_in = carry ? 1 : 0;
+
+	*dest = *reg1 - *reg2 - carry_in;
+
+	zero = (*dest == 0);
+	sign = (static_cast<i16>(*dest) < 0);
+	carry = (*reg1 < *reg2 + carry_in);
+	overflow = (((*reg1 ^ *reg2) & 0x8000) != 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
+} NEXT;
+HANDLER(H_MUL) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	*dest = *reg1 * *reg2;
+
+	zero = (*dest == 0);
+	sign = (static_cast<i16>(*dest) < 0);
+	carry = false;
+	overflow = carry;
+} NEXT;
+HANDLER(H_DIV) {
+	u16 *dest = &reg_u16(inst.a);
+	u16 *reg1 = &reg_u16(inst.b);
+	u16 *reg2 = &reg_u16(inst.c);
+	if (*reg2 == 0) {
+		raise_fault(FAULT_DIVIDE_BY_ZERO, inst);
+	} else {
+		*dest = *reg1 / *reg2;
+
+		zero = (*dest == 0);
+		sign = (static_cast<i16>(*dest) < 0);
+		carry = false;
+		overflow = false;
+	}
+} NEXT_CHECKED;
+HANDLER(H_ADDB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	*dest = *reg1 + *reg2;
+
+	zero = (*dest == 0);
+	sign = (*dest & 0x80) != 0;
+	carry = (*reg1 > 0xFF - *reg2);
+	overflow = (((*reg1 ^ *reg2) & 0x80) == 0) && (((*reg1 ^ *dest) & 0x80) != 0);
+} NEXT;
+HANDLER(H_ADCB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	u8 carry_in = carry ? 1 : 0;
+
+	*dest = *reg1 + *reg2 + carry_in;
+
+	zero = (*dest == 0);
+	sign = (*dest & 0x80) != 0;
+	carry = (*dest < *reg1 || *dest < *reg2 || carry_in);
+	overflow = (((*reg1 ^ *reg2) & 0x80) == 0) && (((*reg1 ^ *dest) & 0x80) != 0);
+} NEXT;
+HANDLER(H_SUBB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	*dest = *reg1 - *reg2;
+
+	zero = (*dest == 0);
+	sign = (*dest & 0x80) != 0;
+	carry = (*reg1 < *reg2);
+	overflow = (((*reg1 ^ *reg2) & 0x80) != 0) && (((*reg1 ^ *dest) & 0x80) != 0);
+} NEXT;
+HANDLER(H_SBBB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	u8 carry_in = carry ? 1 : 0;
+
+	*dest = *reg1 - *reg2 - carry_in;
+
+	zero = (*dest == 0);
+	sign = (*dest & 0x80) != 0;
+	carry = (*reg1 < *reg2 + carry_in);
+	overflow = (((*reg1 ^ *reg2) & 0x80) != 0) && (((*reg1 ^ *dest) & 0x80) != 0);
+} NEXT;
+HANDLER(H_MULB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	*dest = *reg1 * *reg2;
+
+	zero = (*dest == 0);
+	sign = (*dest & 0x80) != 0;
+	carry = false;
+	overflow = carry;
+} NEXT;
+HANDLER(H_DIVB) {
+	u8 *dest = &reg_u8(inst.a);
+	u8 *reg1 = &reg_u8(inst.b);
+	u8 *reg2 = &reg_u8(inst.c);
+	if (*reg2 == 0) {
+		raise_fault(FAULT_DIVIDE_BY_ZERO, inst);
+	} else {
+		*dest = *reg1 / *reg2;
+
+		zero = (*dest == 0);
+		sign = (*dest & 0x80) != 0;
+		carry = false;
+		overflow = false;
+	}
+} NEXT_CHECKED;
+HANDLER(H_AND_U8) {
+	reg_u8(inst.a) = reg_u8(inst.b) & reg_u8(inst.c);
+} NEXT;
+HANDLER(H_AND_U16) {
+	reg_u16(inst.a) = reg_u16(inst.b) & reg_u16(inst.c);
+} NEXT;
+HANDLER(H_OR_U8) {
+	reg_u8(inst.a) = reg_u8(inst.b) | reg_u8(inst.c);
+} NEXT;
+HANDLER(H_OR_U16) {
+	reg_u16(inst.a) = reg_u16(inst.b) | reg_u16(inst.c);
+} NEXT;
+HANDLER(H_XOR_U8) {
+	reg_u8(inst.a) = reg_u8(inst.b) ^ reg_u8(inst.c);
+} NEXT;
+HANDLER(H_XOR_U16) {
+	reg_u16(inst.a) = reg_u16(inst.b) ^ reg_u16(inst.c);
+} NEXT;
+HANDLER(H_NOT_U8) {
+	reg_u8(inst.a) = ~reg_u8(inst.b);
+} NEXT;
+HANDLER(H_NOT_U16) {
+	reg_u16(inst.a) = ~reg_u16(inst.b);
+} NEXT;
+// Shift counts are taken mod 32: 8 to 31 shift everything out of a byte,
+// 16 to 31 out of a word, and 32 shifts by 0 again. WideCPU and the JIT
+// implement the same rule.
+HANDLER(H_SHL_U8) {
+	reg_u8(inst.a) = reg_u8(inst.b) << (reg_u8(inst.c) & 31);
+} NEXT;
+HANDLER(H_SHL_U16) {
+	reg_u16(inst.a) = reg_u16(inst.b) << (reg_u16(inst.c) & 31);
+} NEXT;
+HANDLER(H_SHR_U8) {
+	reg_u8(inst.a) = reg_u8(inst.b) >> (reg_u8(inst.c) & 31);
+} NEXT;
+HANDLER(H_SHR_U16) {
+	reg_u16(inst.a) = reg_u16(inst.b) >> (reg_u16(inst.c) & 31);
+} NEXT;
+HANDLER(H_EQU) {
+	equal = reg_u16(inst.a) == reg_u16(inst.b);
+} NEXT;
+HANDLER(H_JZ) {
+	if (equal == 0) {
+		pc = inst.imm;
+	}
+} NEXT;
+HANDLER(H_JNZ) {
+	if (equal != 0) {
+		pc = inst.imm;
+	}
+} NEXT;
+HANDLER(H_JMP) {
+	pc = inst.imm;
+} NEXT;
+HANDLER(H_RTI) {
+	u8 flags = read_byte((u16)(sp - 1));
+	pc = ((u16)read_byte((u16)(sp - 3)) << 8) | (u16)read_byte((u16)(sp - 2));
+	write_byte(sp - 3, 0x00);
+	write_byte(sp - 2, 0x00);
+	write_byte(sp - 1, 0x00);
+	sp -= 3;
+
+	equal = flags & 1;
+	zero = (flags >> 1) & 1;
+	sign = (flags >> 2) & 1;
+	carry = (flags >> 3) & 1;
+	overflow = (flags >> 4) & 1;
+	interrupt = 0;
+	if (m_irq_pending) {
+		m_service_at = SIZE_MAX;
+	}
+} NEXT_CHECKED;
+HANDLER(H_HLT)
+HANDLER(H_NOP) {
+} NEXT;
+HANDLER(H_INVALID_REG) {
+	raise_fault(FAULT_INVALID_REG, inst);
+} NEXT_CHECKED;
+HANDLER(H_INVALID_MODE) {
+	raise_fault(FAULT_INVALID_MODE, inst);
+} NEXT_CHECKED;
+HANDLER(H_UNDECODED)
+HANDLER(H_INVALID_INST) {
+	raise_fault(FAULT_INVALID_INST, inst);
+} NEXT_CHECKED;
@@ -0,0 +1,483 @@
+#include "Daemon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+	void Append16(std::vector<u8> &out, u16 value) {
+		out.push_back(value & 0xFF);
+		out.push_back(value >> 8);
+	}
+
+	void Append32(std::vector<u8> &out, u32 value) {
+		for (int i = 0; i < 4; i++) out.push_back((value >> (i * 8)) & 0xFF);
+	}
+
+	void Append64(std::vector<u8> &out, u64 value) {
+		for (int i = 0; i < 8; i++) out.push_back((value >> (i * 8)) & 0xFF);
+	}
+
+	u16 Get16(const u8 *&in) {
+		u16 value = in[0] | (in[1] << 8);
+		in += 2;
+		return value;
+	}
+
+	u32 Get32(const u8 *&in) {
+		u32 value = 0;
+		for (int i = 0; i < 4; i++) value |= (u32)*in++ << (i * 8);
+		return value;
+	}
+
+	u64 Get64(const u8 *&in) {
+		u64 value = 0;
+		for (int i = 0; i < 8; i++) value |= (u64)*in++ << (i * 8);
+		return value;
+	}
+
+	// Starts a message of `size` payload bytes in `out`
+	void Begin(std::vector<u8> &out, DaemonMessage type, u32 size) {
+		Append32(out, size + 1);
+		out.push_back(type);
+	}
+
+	// Nearest-rank percentile of sorted `values`
+	u64 Percentile(const std::vector<u64> &values, double fraction) {
+		if (values.empty()) return 0;
+		size_t rank = (size_t)(fraction * values.size() + 0.999999);
+		return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+	}
+
+}
+
+bool DaemonInbox::fill(Socket &socket) {
+	if (m_bad) return false;
+
+	if (m_begin > 0) {
+		std::memmove(m_data.data(), m_data.data() + m_begin, m_end - m_begin);
+		m_end -= m_begin;
+		m_begin = 0;
+	}
+
+	// Room for a whole large message once its length is known
+	size_t wanted = m_end + DAEMON_READ_SIZE;
+	if (m_end >= 4) {
+		const u8 *header = m_data.data();
+		wanted = std::max<size_t>(wanted, 4 + Get32(header));
+	}
+	if (m_data.size() < wanted) {
+		m_data.resize(wanted);
+	}
+
+	size_t received = socket.receive(m_data.data() + m_end, m_data.size() - m_end);
+	m_end += received;
+	return received > 0;
+}
+
+bool DaemonInbox::next(DaemonMessage &type, const u8 *&payload, u32 &size) {
+	if (m_end - m_begin < 4) return false;
+
+	const u8 *header = m_data.data() + m_begin;
+	u32 length = Get32(header);
+	if (length == 0 || length > DAEMON_MESSAGE_SIZE) {
+		m_bad = true;
+		return false;
+	}
+	if (m_end - m_begin - 4 < length) return false;
+
+	type = (DaemonMessage)header[0];
+	payload = header + 1;
+	size = length - 1;
+	m_begin += 4 + length;
+	return true;
+}
+
+Daemon::Daemon(unsigned threads) : m_threads(threads) {
+	if (m_threads == 0) {
+		m_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	m_latencies.reserve(DAEMON_LATENCY_WINDOW);
+}
+
+bool Daemon::serve(const std::string &address, std::string &error) {
+	Socket listener;
+	if (!listener.listen(address, error)) return false;
+
+	m_started = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < m_threads; i++) {
+		m_workers.emplace_back(&Daemon::work, this);
+	}
+
+	std::list<std::pair<std::thread, std::shared_ptr<Connection>>> readers;
+	while (!m_stopping) {
+		for (auto it = readers.begin(); it != readers.end();) {
+			if (it->second->done) {
+				it->first.join();
+				it = readers.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		if (!listener.readable(DAEMON_POLL_MS)) continue;
+
+		auto connection = std::make_shared<Connection>();
+		if (!listener.accept(connection->socket)) continue;
+
+		{
+			std::lock_guard<std::mutex> lock(m_queue_mutex);
+			m_connections++;
+		}
+
+		std::vector<u8> hello;
+		Begin(hello, DAEMON_HELLO, 8);
+		hello.insert(hello.end(), { 'R', '8', 'D', 'M' });
+		Append32(hello, DAEMON_VERSION);
+		post(*connection, std::move(hello));
+
+		std::thread reader(&Daemon::read, this, connection);
+		readers.emplace_back(std::move(reader), std::move(connection));
+	}
+
+	listener.close();
+	for (auto &[reader, connection] : readers) {
+		reader.join();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		m_draining = true;
+	}
+	m_queue_changed.notify_all();
+
+	for (std::thread &worker : m_workers) {
+		worker.join();
+	}
+	m_workers.clear();
+
+	return true;
+}
+
+void Daemon::work() {
+	// Made and reset before any job arrives, so the first one does not pay
+	// for it
+	auto worker = std::make_unique<BatchWorker>();
+	worker->cpu.reset();
+
+	std::unique_lock<std::mutex> lock(m_queue_mutex);
+	for (;;) {
+		m_queue_changed.wait(lock, [&] { return !m_queue.empty() || m_draining; });
+		if (m_queue.empty()) return;
+
+		Pending pending = std::move(m_queue.front());
+		m_queue.pop_front();
+		m_running++;
+		lock.unlock();
+
+		BatchResult result;
+		const std::vector<u8> &image = pending.image->bytes;
+		Batch::run_job(*worker, pending.job, image.data(), image.size(), result);
+
+		std::vector<u8> message;
+		Begin(message, DAEMON_RESULT, BATCH_RECORD_SIZE);
+		message.resize(message.size() + BATCH_RECORD_SIZE);
+		Batch::encode_result(message.data() + 5, pending.id, result);
+
+		u64 latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pending.received).count();
+		post(*pending.connection, std::move(message));
+
+		lock.lock();
+		m_running--;
+		m_completed++;
+		if (m_latencies.size() < DAEMON_LATENCY_WINDOW) {
+			m_latencies.push_back(latency);
+		} else {
+			m_latencies[m_latency_at] = latency;
+			m_latency_at = (m_latency_at + 1) % DAEMON_LATENCY_WINDOW;
+		}
+	}
+}
+
+void Daemon::read(std::shared_ptr<Connection> connection) {
+	DaemonInbox inbox;
+	std::vector<Pending> jobs;
+
+	bool open = true;
+	while (open && !m_stopping) {
+		if (!connection->socket.readable(DAEMON_POLL_MS)) continue;
+
+		open = inbox.fill(connection->socket);
+
+		DaemonMessage type;
+		const u8 *payload;
+		u32 size;
+		while (open && inbox.next(type, payload, size)) {
+			open = handle(connection, type, payload, size, jobs);
+		}
+		open = open && !inbox.bad();
+
+		// Every job that arrived in one read is queued at once
+		enqueue(jobs);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		m_connections--;
+	}
+	connection->done = true;
+}
+
+bool Daemon::handle(const std::shared_ptr<Connection> &connection, DaemonMessage type, const u8 *payload, u32 size, std::vector<Pending> &jobs) {
+	switch (type) {
+	case DAEMON_IMAGE: {
+		if (size < 4 || size - 4 > MEMORY_CAPACITY) return false;
+
+		u32 id = Get32(payload);
+		auto image = std::make_shared<Image>();
+		image->key = m_next_image++;
+		image->bytes.assign(payload, payload + size - 4);
+		connection->images[id] = std::move(image);
+	} break;
+	case DAEMON_JOB: {
+		if (size != DAEMON_JOB_SIZE) return false;
+
+		Pending pending;
+		pending.received = std::chrono::steady_clock::now();
+		pending.id = Get32(payload);
+		u32 image = Get32(payload);
+		pending.job.load = Get16(payload);
+		pending.job.cycles = Get64(payload);
+		pending.job.pc = Get16(payload);
+		pending.job.sp = Get16(payload);
+		for (int i = 0; i < 6; i++) pending.job.regs_u16[i] = Get16(payload);
+		for (int i = 0; i < 4; i++) pending.job.regs_u8[i] = *payload++;
+
+		auto it = connection->images.find(image);
+		std::string error;
+		if (it == connection->images.end()) {
+			error = "unknown image " + std::to_string(image);
+		} else if (pending.job.load + it->second->bytes.size() > MEMORY_CAPACITY) {
+			error = "image does not fit at load address";
+		}
+
+		if (!error.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(m_queue_mutex);
+				m_errors++;
+			}
+			post(*connection, error_message(pending.id, error));
+			break;
+		}
+
+		pending.connection = connection;
+		pending.image = it->second;
+		pending.job.image = it->second->key;
+		jobs.push_back(std::move(pending));
+	} break;
+	case DAEMON_STATS: {
+		if (size != 0) return false;
+
+		// Jobs sent before the request count as queued
+		enqueue(jobs);
+
+		std::string text = stats();
+		std::vector<u8> message;
+		Begin(message, DAEMON_STATS, (u32)text.size());
+		message.insert(message.end(), text.begin(), text.end());
+		post(*connection, std::move(message));
+	} break;
+	case DAEMON_SHUTDOWN: {
+		if (size != 0) return false;
+		m_stopping = true;
+	} break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+void Daemon::enqueue(std::vector<Pending> &jobs) {
+	if (jobs.empty()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		for (Pending &pending : jobs) {
+			m_queue.push_back(std::move(pending));
+		}
+		m_max_queued = std::max(m_max_queued, m_queue.size());
+	}
+
+	if (jobs.size() == 1) {
+		m_queue_changed.notify_one();
+	} else {
+		m_queue_changed.notify_all();
+	}
+	jobs.clear();
+}
+
+void Daemon::post(Connection &connection, std::vector<u8> &&message) {
+	std::unique_lock<std::mutex> lock(connection.send_mutex);
+	if (connection.outbox.empty()) {
+		connection.outbox = std::move(message);
+	} else {
+		connection.outbox.insert(connection.outbox.end(), message.begin(), message.end());
+	}
+
+	if (connection.sending) return;
+	connection.sending = true;
+
+	std::vector<u8> sending;
+	while (!connection.outbox.empty()) {
+		sending.swap(connection.outbox);
+		lock.unlock();
+
+		// Replies to a client that went away are dropped
+		connection.socket.send(sending.data(), sending.size());
+		sending.clear();
+
+		lock.lock();
+	}
+
+	connection.sending = false;
+}
+
+std::vector<u8> Daemon::error_message(u32 id, const std::string &text) {
+	std::vector<u8> message;
+	Begin(message, DAEMON_ERROR, 4 + (u32)text.size());
+	Append32(message, id);
+	message.insert(message.end(), text.begin(), text.end());
+	return message;
+}
+
+std::string Daemon::stats() {
+	std::vector<u64> latencies;
+	size_t queued, max_queued, running, connections;
+	u64 completed, errors;
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		latencies = m_latencies;
+		queued = m_queue.size();
+		max_queued = m_max_queued;
+		running = m_running;
+		connections = m_connections;
+		completed = m_completed;
+		errors = m_errors;
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_started).count();
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1)
+		<< "{\"workers\":" << m_threads
+		<< ",\"connections\":" << connections
+		<< ",\"queued\":" << queued
+		<< ",\"max_queued\":" << max_queued
+		<< ",\"running\":" << running
+		<< ",\"completed\":" << completed
+		<< ",\"errors\":" << errors
+		<< ",\"uptime_s\":" << uptime
+		<< ",\"jobs_per_s\":" << (uptime > 0 ? completed / uptime : 0.0)
+		<< ",\"latency_us\":{\"p50\":" << Percentile(latencies, 0.5) / 1000.0
+		<< ",\"p90\":" << Percentile(latencies, 0.9) / 1000.0
+		<< ",\"p99\":" << Percentile(latencies, 0.99) / 1000.0
+		<< ",\"max\":" << (latencies.empty() ? 0 : latencies.back()) / 1000.0
+		<< "}}";
+	return out.str();
+}
+
+bool DaemonClient::connect(const std::string &address, std::string &error) {
+	if (!m_socket.connect(address, error)) return false;
+
+	DaemonMessage type;
+	const u8 *payload;
+	u32 size;
+	while (!m_inbox.next(type, payload, size)) {
+		if (!m_inbox.fill(m_socket)) {
+			error = "connection closed";
+			return false;
+		}
+	}
+
+	if (type != DAEMON_HELLO || size != 8 || std::memcmp(payload, "R8DM", 4) != 0) {
+		error = "not an R828 daemon";
+		return false;
+	}
+
+	payload += 4;
+	if (Get32(payload) != DAEMON_VERSION) {
+		error = "unsupported daemon version";
+		return false;
+	}
+
+	return true;
+}
+
+void DaemonClient::send_image(u32 id, const u8 *data, size_t size) {
+	begin(DAEMON_IMAGE, 4 + (u32)size);
+	Append32(m_output, id);
+	m_output.insert(m_output.end(), data, data + size);
+}
+
+void DaemonClient::send_job(u32 id, const BatchJob &job) {
+	begin(DAEMON_JOB, DAEMON_JOB_SIZE);
+	Append32(m_output, id);
+	Append32(m_output, job.image);
+	Append16(m_output, job.load);
+	Append64(m_output, job.cycles);
+	Append16(m_output, job.pc);
+	Append16(m_output, job.sp);
+	for (int i = 0; i < 6; i++) Append16(m_output, job.regs_u16[i]);
+	for (int i = 0; i < 4; i++) m_output.push_back(job.regs_u8[i]);
+}
+
+void DaemonClient::send_stats() {
+	begin(DAEMON_STATS, 0);
+}
+
+void DaemonClient::send_shutdown() {
+	begin(DAEMON_SHUTDOWN, 0);
+}
+
+bool DaemonClient::flush() {
+	bool sent = m_socket.send(m_output.data(), m_output.size());
+	m_output.clear();
+	return sent;
+}
+
+bool DaemonClient::receive(Reply &reply) {
+	DaemonMessage type;
+	const u8 *payload;
+	u32 size;
+	while (!m_inbox.next(type, payload, size)) {
+		if (!m_inbox.fill(m_socket)) return false;
+	}
+
+	reply.type = type;
+	switch (type) {
+	case DAEMON_RESULT:
+		if (size != BATCH_RECORD_SIZE) return false;
+		Batch::decode_result(payload, reply.id, reply.result);
+		return true;
+	case DAEMON_ERROR:
+		if (size < 4) return false;
+		reply.id = Get32(payload);
+		reply.text.assign(reinterpret_cast<const char *>(payload), size - 4);
+		return true;
+	case DAEMON_STATS:
+		reply.text.assign(reinterpret_cast<const char *>(payload), size);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void DaemonClient::begin(DaemonMessage type, u32 size) {
+	Begin(m_output, type, size);
+}
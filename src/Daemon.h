@@ -0,0 +1,175 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "Core.h"
+#include "Batch.h"
+#include "Socket.h"
+
+#define DAEMON_VERSION 1
+// Largest message either side accepts; an image and its id fit
+#define DAEMON_MESSAGE_SIZE (MEMORY_CAPACITY + 16)
+// Bytes read from a connection at a time
+#define DAEMON_READ_SIZE 0x10000
+// How often blocked threads look for a shutdown, in milliseconds
+#define DAEMON_POLL_MS 100
+// Latencies of this many of the most recent jobs make up the percentiles
+#define DAEMON_LATENCY_WINDOW 65536
+
+// Every message is a u32 length of what follows it, a u8 type and a payload,
+// all little-endian. Clients may send any number of requests without waiting
+// for replies; results come back in the order jobs finish, not the order
+// they were sent.
+enum DaemonMessage : u8 {
+	// Daemon, first on every connection: "R8DM", u32 version
+	DAEMON_HELLO = 'H',
+	// Client: u32 image id, image bytes. Ids are per connection; sending an
+	// id again replaces its image for later jobs.
+	DAEMON_IMAGE = 'I',
+	// Client: u32 job id, u32 image id, u16 load, u64 cycles, u16 pc, u16 sp,
+	// u16 r0 r1 r2 r3 ra ri, u8 b0 b1 b2 b3
+	DAEMON_JOB = 'J',
+	// Daemon: a BATCH_BINARY record whose job field is the job id
+	DAEMON_RESULT = 'R',
+	// Daemon: u32 job id, a message for a job that could not run
+	DAEMON_ERROR = 'E',
+	// Client: no payload. Daemon: the stats as one JSON object.
+	DAEMON_STATS = 'S',
+	// Client: no payload. The daemon stops accepting work, finishes what is
+	// queued and exits.
+	DAEMON_SHUTDOWN = 'Q',
+};
+
+#define DAEMON_JOB_SIZE 38
+
+// Accumulates received bytes and splits them into messages
+class DaemonInbox {
+public:
+	// Receives whatever is available; false once the connection is gone or
+	// bad()
+	bool fill(Socket &socket);
+
+	// The next complete message, valid until the next fill()
+	bool next(DaemonMessage &type, const u8 *&payload, u32 &size);
+
+	// A message was empty or larger than DAEMON_MESSAGE_SIZE
+	bool bad() const { return m_bad; }
+private:
+	std::vector<u8> m_data;
+	bool m_bad = false;
+	size_t m_begin = 0;
+	size_t m_end = 0;
+};
+
+// Runs jobs sent over a socket on a pool of worker threads. Each worker keeps
+// one CPU for its whole life and reuses an image's loaded state across jobs,
+// so a job costs a restore rather than a process start and a reset.
+class Daemon {
+public:
+	// `threads` == 0 uses every hardware thread
+	explicit Daemon(unsigned threads);
+
+	// Serves connections on `address` until a client asks for shutdown
+	bool serve(const std::string &address, std::string &error);
+
+	std::string stats();
+private:
+	struct Image {
+		// Unique across connections, so a worker can tell images apart
+		u32 key;
+		std::vector<u8> bytes;
+	};
+
+	struct Connection {
+		Socket socket;
+		// Only touched by the connection's reader
+		std::unordered_map<u32, std::shared_ptr<const Image>> images;
+
+		std::mutex send_mutex;
+		std::vector<u8> outbox;
+		// A thread is sending; others only add to the outbox
+		bool sending = false;
+
+		std::atomic<bool> done { false };
+	};
+
+	struct Pending {
+		std::shared_ptr<Connection> connection;
+		std::shared_ptr<const Image> image;
+		u32 id;
+		BatchJob job;
+		std::chrono::steady_clock::time_point received;
+	};
+
+	void work();
+	void read(std::shared_ptr<Connection> connection);
+	// Returns false if the message was malformed
+	bool handle(const std::shared_ptr<Connection> &connection, DaemonMessage type, const u8 *payload, u32 size, std::vector<Pending> &jobs);
+	void enqueue(std::vector<Pending> &jobs);
+
+	// Queues `message` for `connection`; whichever thread finds nobody
+	// sending sends everything queued, so replies that pile up go out in
+	// one write
+	static void post(Connection &connection, std::vector<u8> &&message);
+	static std::vector<u8> error_message(u32 id, const std::string &text);
+private:
+	unsigned m_threads;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_queue_mutex;
+	std::condition_variable m_queue_changed;
+	std::deque<Pending> m_queue;
+	bool m_draining = false;
+
+	std::atomic<bool> m_stopping { false };
+	std::atomic<u32> m_next_image { 0 };
+
+	// Guarded by m_queue_mutex
+	size_t m_max_queued = 0;
+	size_t m_running = 0;
+	u64 m_completed = 0;
+	u64 m_errors = 0;
+	size_t m_connections = 0;
+	// Nanoseconds from a job arriving to its result being ready, a ring
+	std::vector<u64> m_latencies;
+	size_t m_latency_at = 0;
+	std::chrono::steady_clock::time_point m_started;
+};
+
+// One connection to a daemon. Requests are buffered until flush().
+class DaemonClient {
+public:
+	bool connect(const std::string &address, std::string &error);
+
+	void send_image(u32 id, const u8 *data, size_t size);
+	// `job.image` is the image id
+	void send_job(u32 id, const BatchJob &job);
+	void send_stats();
+	void send_shutdown();
+	bool flush();
+
+	struct Reply {
+		DaemonMessage type;
+		u32 id;
+		BatchResult result;
+		std::string text;
+	};
+
+	// Blocks for the next reply; false once the connection is gone
+	bool receive(Reply &reply);
+private:
+	void begin(DaemonMessage type, u32 size);
+private:
+	Socket m_socket;
+	DaemonInbox m_inbox;
+	std::vector<u8> m_output;
+};
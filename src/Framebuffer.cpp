@@ -0,0 +1,212 @@
+#include "Framebuffer.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace {
+	void Put16(std::vector<u8> &out, u16 value) {
+		out.push_back(value & 0xFF);
+		out.push_back(value >> 8);
+	}
+
+	void Put64(std::vector<u8> &out, u64 value) {
+		for (int i = 0; i < 8; i++) out.push_back((value >> (i * 8)) & 0xFF);
+	}
+
+	// Appends the runs turning `shown` into `pixels`; nothing if they match
+	void EncodeRow(std::vector<u8> &out, const u8 *pixels, const u8 *shown) {
+		size_t i = 0;
+		while (i < FRAMEBUFFER_ROW_SIZE) {
+			size_t skip = i;
+			while (i < FRAMEBUFFER_ROW_SIZE && pixels[i] == shown[i]) i++;
+			if (i == FRAMEBUFFER_ROW_SIZE) break;
+
+			size_t start = i;
+			while (i < FRAMEBUFFER_ROW_SIZE && pixels[i] != shown[i]) i++;
+
+			out.push_back((u8)(start - skip));
+			out.push_back((u8)(i - start));
+			for (size_t j = start; j < i; j++) out.push_back(pixels[j] ^ shown[j]);
+		}
+	}
+}
+
+Framebuffer::Framebuffer(const std::string &path)
+	: m_file(path, std::ios::binary) {
+	if (!m_file) {
+		std::cerr << "Failed to open frame file: " << path << std::endl;
+		exit(1);
+	}
+
+	std::memset(m_pixels, 0xFF, FRAMEBUFFER_SIZE);
+	std::memset(m_shown, 0xFF, FRAMEBUFFER_SIZE);
+
+	std::vector<u8> header(FRAMEBUFFER_MAGIC, FRAMEBUFFER_MAGIC + 4);
+	Put16(header, FRAMEBUFFER_VERSION);
+	Put16(header, FRAMEBUFFER_WIDTH);
+	Put16(header, FRAMEBUFFER_HEIGHT);
+	Put16(header, 3);
+	m_file.write(reinterpret_cast<const char *>(header.data()), header.size());
+}
+
+Framebuffer::Framebuffer() {
+	std::memset(m_pixels, 0xFF, FRAMEBUFFER_SIZE);
+	std::memset(m_shown, 0xFF, FRAMEBUFFER_SIZE);
+}
+
+void Framebuffer::load_pixels(const u8 *pixels) {
+	for (size_t row = 0; row < FRAMEBUFFER_HEIGHT; row++) {
+		size_t offset = row * FRAMEBUFFER_ROW_SIZE;
+		if (std::memcmp(m_pixels + offset, pixels + offset, FRAMEBUFFER_ROW_SIZE) == 0) continue;
+
+		std::memcpy(m_pixels + offset, pixels + offset, FRAMEBUFFER_ROW_SIZE);
+		m_dirty[row] = true;
+	}
+}
+
+void Framebuffer::emit(u64 cycle) {
+	if (m_dirty.none() || !m_file.is_open()) return;
+
+	m_buffer.clear();
+	Put64(m_buffer, cycle);
+	size_t count_at = m_buffer.size();
+	m_buffer.push_back(0);
+
+	u8 rows = 0;
+	for (size_t row = 0; row < FRAMEBUFFER_HEIGHT; row++) {
+		if (!m_dirty[row]) continue;
+
+		size_t offset = row * FRAMEBUFFER_ROW_SIZE;
+		size_t row_at = m_buffer.size();
+		m_buffer.push_back((u8)row);
+		Put16(m_buffer, 0);
+
+		EncodeRow(m_buffer, m_pixels + offset, m_shown + offset);
+		size_t length = m_buffer.size() - row_at - 3;
+		if (length == 0) {
+			// Written back to what was shown
+			m_buffer.resize(row_at);
+			continue;
+		}
+
+		m_buffer[row_at + 1] = length & 0xFF;
+		m_buffer[row_at + 2] = length >> 8;
+		std::memcpy(m_shown + offset, m_pixels + offset, FRAMEBUFFER_ROW_SIZE);
+		rows++;
+	}
+
+	m_dirty.reset();
+	if (rows == 0) return;
+
+	m_buffer[count_at] = rows;
+	m_file.write(reinterpret_cast<const char *>(m_buffer.data()), m_buffer.size());
+	m_frames++;
+}
+
+void Framebuffer::stream(CPU &cpu, Scheduler &scheduler, u64 interval) {
+	stop();
+	if (interval == 0) return;
+
+	m_scheduler = &scheduler;
+	m_interval = interval;
+	arm(cpu.cycle() + interval);
+	cpu.events_changed();
+}
+
+void Framebuffer::stop() {
+	if (!m_scheduler) return;
+
+	m_scheduler->cancel(m_event);
+	m_scheduler = nullptr;
+}
+
+void Framebuffer::arm(u64 deadline) {
+	m_event = m_scheduler->schedule(deadline, [this](u64 cycle) {
+		emit(cycle);
+		arm(cycle + m_interval);
+	});
+}
+
+bool FrameReader::open(const std::string &path, std::string &error) {
+	m_file.open(path, std::ios::binary);
+	if (!m_file) {
+		error = "cannot open file";
+		return false;
+	}
+
+	u8 header[12];
+	if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header)) || std::memcmp(header, FRAMEBUFFER_MAGIC, 4) != 0) {
+		error = "not a frame file";
+		return false;
+	}
+
+	u16 version = header[4] | (header[5] << 8);
+	if (version != FRAMEBUFFER_VERSION) {
+		error = "unsupported frame file version " + std::to_string(version);
+		return false;
+	}
+
+	u16 width = header[6] | (header[7] << 8);
+	u16 height = header[8] | (header[9] << 8);
+	u16 bpp = header[10] | (header[11] << 8);
+	if (width != FRAMEBUFFER_WIDTH || height != FRAMEBUFFER_HEIGHT || bpp != 3) {
+		error = "unsupported frame size";
+		return false;
+	}
+
+	std::memset(m_pixels, 0xFF, FRAMEBUFFER_SIZE);
+	return true;
+}
+
+bool FrameReader::next() {
+	std::streambuf &in = *m_file.rdbuf();
+	auto byte = [&](u8 &value) {
+		int c = in.sbumpc();
+		value = (u8)c;
+		return c != std::char_traits<char>::eof();
+	};
+	auto word = [&](u16 &value) {
+		u8 lo, hi;
+		if (!byte(lo) || !byte(hi)) return false;
+		value = lo | (hi << 8);
+		return true;
+	};
+
+	u64 cycle = 0;
+	for (int i = 0; i < 8; i++) {
+		u8 b;
+		if (!byte(b)) return false;
+		cycle |= (u64)b << (i * 8);
+	}
+
+	u8 rows;
+	if (!byte(rows)) return false;
+
+	for (u8 r = 0; r < rows; r++) {
+		u8 row;
+		u16 length;
+		if (!byte(row) || !word(length) || row >= FRAMEBUFFER_HEIGHT) return false;
+
+		u8 *pixels = m_pixels + row * FRAMEBUFFER_ROW_SIZE;
+		size_t at = 0;
+		while (length >= 2) {
+			u8 skip, count;
+			if (!byte(skip) || !byte(count)) return false;
+			length -= 2;
+
+			at += skip;
+			if (count > length || at + count > FRAMEBUFFER_ROW_SIZE) return false;
+			for (u8 i = 0; i < count; i++) {
+				u8 delta;
+				if (!byte(delta)) return false;
+				pixels[at++] ^= delta;
+			}
+			length -= count;
+		}
+		if (length != 0) return false;
+	}
+
+	m_cycle = cycle;
+	m_rows_changed = rows;
+	return true;
+}
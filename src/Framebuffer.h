@@ -0,0 +1,104 @@
+#pragma once
+
+#include <bitset>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Core.h"
+#include "Bus.h"
+#include "CPU.h"
+#include "Scheduler.h"
+
+#define FRAMEBUFFER_MAGIC "R8FB"
+#define FRAMEBUFFER_VERSION 1
+#define FRAMEBUFFER_ROW_SIZE (FRAMEBUFFER_WIDTH * 3)
+// Default cycles between frames
+#define FRAMEBUFFER_FRAME_INTERVAL 100'000
+
+// A row's runs count bytes in a u8
+static_assert(FRAMEBUFFER_ROW_SIZE <= 0xFF);
+
+// The framebuffer as a device, so pixels never touch guest RAM and the host
+// learns which rows changed without scanning them. It starts filled with
+// 0xFF like the framebuffer after CPU::reset.
+//
+// Frames stream to a file: FRAMEBUFFER_MAGIC, u16 version, u16 width,
+// u16 height, u16 bytes per pixel, then frames, little-endian:
+//   u64 cycle, u8 row count, then per row: u8 row index, u16 byte count and
+//   that many bytes of runs. A run is u8 unchanged bytes to skip, u8 length
+//   and length bytes XORed with the previous frame's. Bytes past the last
+//   run are unchanged.
+// The frame before the first is all 0xFF. Frames without changes are not
+// written.
+class Framebuffer : public Device {
+public:
+	// Exits if `path` cannot be written
+	explicit Framebuffer(const std::string &path);
+	// Keeps the pixels but writes no frames, for replaying a recording
+	Framebuffer();
+	~Framebuffer() { stop(); }
+
+	Framebuffer(const Framebuffer &) = delete;
+	Framebuffer &operator=(const Framebuffer &) = delete;
+
+	u8 read(u16 offset) override { return m_pixels[offset]; }
+	void write(u16 offset, u8 value) override {
+		if (m_pixels[offset] == value) return;
+
+		m_pixels[offset] = value;
+		m_dirty[offset / FRAMEBUFFER_ROW_SIZE] = true;
+	}
+
+	const u8 *pixels() const { return m_pixels; }
+	// Replaces every pixel, as when restoring a snapshot. Rows that change
+	// go into the next frame.
+	void load_pixels(const u8 *pixels);
+
+	// Writes a frame of the rows changed since the last one, stamped `cycle`
+	void emit(u64 cycle);
+
+	// Emits a frame every `interval` cycles of `cpu` on `scheduler`
+	void stream(CPU &cpu, Scheduler &scheduler, u64 interval);
+	void stop();
+
+	u64 frames() const { return m_frames; }
+private:
+	void arm(u64 deadline);
+private:
+	std::ofstream m_file;
+	std::vector<u8> m_buffer;
+
+	u8 m_pixels[FRAMEBUFFER_SIZE];
+	// As of the last frame written
+	u8 m_shown[FRAMEBUFFER_SIZE];
+	// Rows written to since the last frame
+	std::bitset<FRAMEBUFFER_HEIGHT> m_dirty;
+	u64 m_frames = 0;
+
+	Scheduler *m_scheduler = nullptr;
+	u64 m_interval = 0;
+	u64 m_event = 0;
+};
+
+// Decodes a frame file into whole frames
+class FrameReader {
+public:
+	// Returns false with `error` set if the file is missing or not a frame
+	// file
+	bool open(const std::string &path, std::string &error);
+
+	// False at the end of the file or on a truncated frame
+	bool next();
+
+	// Of the frame last returned by next()
+	u64 cycle() const { return m_cycle; }
+	size_t rows_changed() const { return m_rows_changed; }
+	const u8 *pixels() const { return m_pixels; }
+private:
+	std::ifstream m_file;
+
+	u64 m_cycle = 0;
+	size_t m_rows_changed = 0;
+	u8 m_pixels[FRAMEBUFFER_SIZE];
+};
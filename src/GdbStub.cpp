@@ -0,0 +1,487 @@
+#include "GdbStub.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+
+namespace {
+	const char HEX_DIGITS[] = "0123456789abcdef";
+
+	int HexValue(char c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// Parses hex digits up to the end of `text` or a separator; false if
+	// there are none or they overflow
+	bool ParseHex(std::string_view text, size_t &at, u64 &value) {
+		size_t start = at;
+		value = 0;
+		for (; at < text.size() && HexValue(text[at]) >= 0; at++) {
+			if (value >> 60) return false;
+			value = (value << 4) | (u64)HexValue(text[at]);
+		}
+
+		return at > start;
+	}
+
+	void PutHex(std::string &out, u8 value) {
+		out.push_back(HEX_DIGITS[value >> 4]);
+		out.push_back(HEX_DIGITS[value & 0xF]);
+	}
+
+	struct Register {
+		const char *name;
+		u8 bits;
+		const char *type;
+	};
+
+	// In the order of the 'g' packet and the target description
+	const Register s_registers[] = {
+		{ "pc", 16, "code_ptr" },
+		{ "sp", 16, "data_ptr" },
+		{ "fbs", 16, "data_ptr" },
+		{ "r0", 16, "int16" },
+		{ "r1", 16, "int16" },
+		{ "r2", 16, "int16" },
+		{ "r3", 16, "int16" },
+		{ "ra", 16, "int16" },
+		{ "ri", 16, "int16" },
+		{ "b0", 8, "uint8" },
+		{ "b1", 8, "uint8" },
+		{ "b2", 8, "uint8" },
+		{ "b3", 8, "uint8" },
+		{ "flags", 8, "r828_flags" },
+	};
+
+	u16 ReadRegister(const CPU &cpu, size_t index) {
+		switch (index) {
+		case 0: return cpu.pc;
+		case 1: return cpu.sp;
+		case 2: return cpu.fbs;
+		case 3: return cpu.r0;
+		case 4: return cpu.r1;
+		case 5: return cpu.r2;
+		case 6: return cpu.r3;
+		case 7: return cpu.ra;
+		case 8: return cpu.ri;
+		case 9: return cpu.b0;
+		case 10: return cpu.b1;
+		case 11: return cpu.b2;
+		case 12: return cpu.b3;
+		}
+
+		return cpu.equal | (cpu.zero << 1) | (cpu.decimal << 2) | (cpu.sign << 3)
+			| (cpu.carry << 4) | (cpu.overflow << 5) | (cpu.interrupt << 6) | (cpu.breakf << 7);
+	}
+
+	void WriteRegister(CPU &cpu, size_t index, u16 value) {
+		switch (index) {
+		case 0: cpu.pc = value; return;
+		case 1: cpu.sp = value; return;
+		case 2: cpu.fbs = value; return;
+		case 3: cpu.r0 = value; return;
+		case 4: cpu.r1 = value; return;
+		case 5: cpu.r2 = value; return;
+		case 6: cpu.r3 = value; return;
+		case 7: cpu.ra = value; return;
+		case 8: cpu.ri = value; return;
+		case 9: cpu.b0 = (u8)value; return;
+		case 10: cpu.b1 = (u8)value; return;
+		case 11: cpu.b2 = (u8)value; return;
+		case 12: cpu.b3 = (u8)value; return;
+		}
+
+		cpu.equal = value & 1;
+		cpu.zero = (value >> 1) & 1;
+		cpu.decimal = (value >> 2) & 1;
+		cpu.sign = (value >> 3) & 1;
+		cpu.carry = (value >> 4) & 1;
+		cpu.overflow = (value >> 5) & 1;
+		cpu.interrupt = (value >> 6) & 1;
+		cpu.breakf = (value >> 7) & 1;
+	}
+
+	std::string TargetDescription() {
+		std::string xml =
+			"<?xml version=\"1.0\"?>\n"
+			"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+			"<target version=\"1.0\">\n"
+			"  <feature name=\"org.r828.core\">\n"
+			"    <flags id=\"r828_flags\" size=\"1\">\n";
+
+		const char *flags[] = { "equal", "zero", "decimal", "sign", "carry", "overflow", "interrupt", "break" };
+		for (int bit = 0; bit < 8; bit++) {
+			xml += "      <field name=\"" + std::string(flags[bit]) + "\" start=\"" + std::to_string(bit) + "\" end=\"" + std::to_string(bit) + "\"/>\n";
+		}
+		xml += "    </flags>\n";
+
+		for (const Register &reg : s_registers) {
+			xml += "    <reg name=\"" + std::string(reg.name) + "\" bitsize=\"" + std::to_string(reg.bits) + "\" type=\"" + reg.type + "\"/>\n";
+		}
+
+		xml += "  </feature>\n</target>\n";
+		return xml;
+	}
+}
+
+GdbStub::GdbStub(CPU &cpu, Socket &connection, size_t cycles)
+	: m_cpu(cpu), m_connection(connection), m_remaining(cycles) {}
+
+GdbStub::Outcome GdbStub::serve() {
+	std::string packet;
+	while (read_packet(packet)) {
+		std::string_view args = std::string_view(packet).substr(std::min<size_t>(1, packet.size()));
+		std::string reply;
+
+		switch (packet.empty() ? '\0' : packet[0]) {
+		case '?': reply = stop_reply(); break;
+		case 'g': reply = read_registers(); break;
+		case 'G': {
+			size_t at = 0;
+			reply = "OK";
+			for (size_t i = 0; i < std::size(s_registers); i++) {
+				size_t digits = s_registers[i].bits / 4;
+				if (at + digits > args.size() || !write_register(i, std::string(args.substr(at, digits)))) {
+					reply = "E01";
+					break;
+				}
+				at += digits;
+			}
+		} break;
+		case 'p': {
+			size_t at = 0;
+			u64 index;
+			if (!ParseHex(args, at, index) || index >= std::size(s_registers)) {
+				reply = "E01";
+				break;
+			}
+			u16 value = ReadRegister(m_cpu, index);
+			PutHex(reply, value & 0xFF);
+			if (s_registers[index].bits == 16) PutHex(reply, value >> 8);
+		} break;
+		case 'P': {
+			size_t at = 0;
+			u64 index;
+			bool ok = ParseHex(args, at, index) && at < args.size() && args[at] == '=' && index < std::size(s_registers);
+			reply = ok && write_register(index, std::string(args.substr(at + 1))) ? "OK" : "E01";
+		} break;
+		case 'm': reply = read_memory(std::string(args)); break;
+		case 'M': reply = write_memory(std::string(args), false) ? "OK" : "E01"; break;
+		case 'X': reply = write_memory(std::string(args), true) ? "OK" : "E01"; break;
+		case 'c':
+		case 's': {
+			if (!args.empty()) {
+				size_t at = 0;
+				u64 addr;
+				if (!ParseHex(args, at, addr) || addr > 0xFFFF) {
+					reply = "E01";
+					break;
+				}
+				m_cpu.pc = (u16)addr;
+			}
+
+			resume(packet[0] == 's');
+			if (!send_packet(stop_reply())) return KILLED;
+			if (m_exited) return STOPPED;
+		} continue;
+		case 'Z':
+		case 'z': reply = set_point(std::string(args), packet[0] == 'Z') ? "OK" : "E01"; break;
+		case 'D': {
+			send_packet("OK");
+			return DETACHED;
+		}
+		case 'k': return KILLED;
+		case 'H':
+		case 'T': reply = "OK"; break;
+		case 'q': {
+			if (args.starts_with("Supported")) {
+				char features[128];
+				std::snprintf(features, sizeof(features), "PacketSize=%x;QStartNoAckMode+;qXfer:features:read+;swbreak+;hwbreak+", GDB_PACKET_SIZE);
+				reply = features;
+			} else if (args == "Attached") {
+				reply = "1";
+			} else if (args == "C") {
+				reply = "QC1";
+			} else if (args == "fThreadInfo") {
+				reply = "m1";
+			} else if (args == "sThreadInfo") {
+				reply = "l";
+			} else if (args.starts_with("Xfer:features:read:")) {
+				std::string_view rest = args.substr(19);
+				size_t colon = rest.find(':');
+				reply = colon == std::string_view::npos ? "E01" : read_features(std::string(rest.substr(0, colon)), std::string(rest.substr(colon + 1)));
+			}
+		} break;
+		case 'Q': {
+			if (args == "StartNoAckMode") {
+				if (!send_packet("OK")) return KILLED;
+				m_acks = false;
+				continue;
+			}
+		} break;
+		case 'v': {
+			if (args == "Kill" || args.starts_with("Kill;")) {
+				send_packet("OK");
+				return KILLED;
+			}
+		} break;
+		}
+
+		if (!send_packet(reply)) return KILLED;
+	}
+
+	return KILLED;
+}
+
+bool GdbStub::next_byte(u8 &byte) {
+	if (m_input_at == m_input.size()) {
+		m_input.resize(GDB_PACKET_SIZE);
+		size_t received = m_connection.receive(m_input.data(), m_input.size());
+		m_input.resize(received);
+		m_input_at = 0;
+		if (received == 0) return false;
+	}
+
+	byte = m_input[m_input_at++];
+	return true;
+}
+
+bool GdbStub::read_packet(std::string &packet) {
+	while (true) {
+		// Acks and stray interrupts between packets
+		u8 byte;
+		do {
+			if (!next_byte(byte)) return false;
+		} while (byte != '$');
+
+		packet.clear();
+		u8 sum = 0;
+		while (next_byte(byte) && byte != '#') {
+			packet.push_back((char)byte);
+			sum += byte;
+		}
+
+		u8 high, low;
+		if (!next_byte(high) || !next_byte(low)) return false;
+		bool valid = HexValue(high) >= 0 && HexValue(low) >= 0 && (u8)(HexValue(high) << 4 | HexValue(low)) == sum;
+
+		if (m_acks && !m_connection.send(valid ? "+" : "-")) return false;
+		if (valid || !m_acks) return true;
+	}
+}
+
+bool GdbStub::send_packet(const std::string &data) {
+	u8 sum = 0;
+	for (char c : data) sum += (u8)c;
+
+	std::string framed;
+	framed.reserve(data.size() + 4);
+	framed.push_back('$');
+	framed += data;
+	framed.push_back('#');
+	PutHex(framed, sum);
+
+	// Without acks there is nothing to wait for; with them a '-' asks for
+	// the packet again
+	while (true) {
+		if (!m_connection.send(framed)) return false;
+		if (!m_acks) return true;
+
+		u8 byte;
+		do {
+			if (!next_byte(byte)) return false;
+		} while (byte != '+' && byte != '-');
+
+		if (byte == '+') return true;
+	}
+}
+
+bool GdbStub::interrupted() {
+	if (!m_connection.readable(0)) return false;
+
+	u8 buffer[256];
+	size_t received = m_connection.receive(buffer, sizeof(buffer));
+	if (received == 0) return true;
+
+	// Keep anything else for read_packet()
+	bool interrupt = false;
+	for (size_t i = 0; i < received; i++) {
+		if (buffer[i] == 0x03) {
+			interrupt = true;
+		} else {
+			m_input.push_back(buffer[i]);
+		}
+	}
+
+	return interrupt;
+}
+
+void GdbStub::resume(bool step) {
+	m_interrupted = false;
+
+	while (m_remaining > 0) {
+		size_t slice = step ? 1 : std::min<size_t>(m_remaining, GDB_SLICE_CYCLES);
+		size_t left = slice;
+		m_reason = m_cpu.run(left);
+
+		size_t used = slice - left + m_cpu.overshoot();
+		m_remaining -= std::min(used, m_remaining);
+
+		if (m_reason != CPU::BUDGET_EXHAUSTED || step) break;
+		if (interrupted()) {
+			m_interrupted = true;
+			break;
+		}
+	}
+
+	m_exited = m_reason == CPU::HALTED;
+}
+
+std::string GdbStub::stop_reply() const {
+	char reply[64];
+
+	if (m_interrupted) return "S02";
+
+	switch (m_reason) {
+	case CPU::HALTED: return "W00";
+	case CPU::BREAKPOINT: return "T05swbreak:;";
+	case CPU::FAULT: return m_cpu.fault() == CPU::FAULT_DIVIDE_BY_ZERO ? "S08" : "S04";
+	case CPU::WATCHPOINT: {
+		const CPU::WatchHit &hit = m_cpu.watch_hit();
+		std::snprintf(reply, sizeof(reply), "T05%s:%x;", hit.access == CPU::WATCH_READ ? "rwatch" : "watch", hit.addr);
+		return reply;
+	}
+	case CPU::BUDGET_EXHAUSTED: break;
+	}
+
+	// Out of cycles for good is SIGXCPU; otherwise a step ended
+	return m_remaining == 0 ? "S18" : "S05";
+}
+
+std::string GdbStub::read_registers() const {
+	std::string reply;
+	for (size_t i = 0; i < std::size(s_registers); i++) {
+		u16 value = ReadRegister(m_cpu, i);
+		PutHex(reply, value & 0xFF);
+		if (s_registers[i].bits == 16) PutHex(reply, value >> 8);
+	}
+
+	return reply;
+}
+
+bool GdbStub::write_register(size_t index, const std::string &hex) {
+	size_t digits = s_registers[index].bits / 4;
+	if (hex.size() != digits) return false;
+
+	u16 value = 0;
+	for (size_t i = 0; i < digits; i += 2) {
+		int high = HexValue(hex[i]);
+		int low = HexValue(hex[i + 1]);
+		if (high < 0 || low < 0) return false;
+		// Little endian, low byte first
+		value |= (u16)((high << 4) | low) << (i * 4);
+	}
+
+	WriteRegister(m_cpu, index, value);
+	return true;
+}
+
+std::string GdbStub::read_memory(const std::string &args) const {
+	size_t at = 0;
+	u64 addr, length;
+	if (!ParseHex(args, at, addr) || at >= args.size() || args[at++] != ',' || !ParseHex(args, at, length) || addr >= MEMORY_CAPACITY) {
+		return "E01";
+	}
+
+	// The whole range goes out in one reply, up to what a packet holds
+	length = std::min<u64>({ length, MEMORY_CAPACITY - addr, (GDB_PACKET_SIZE - 4) / 2 });
+
+	std::string reply(length * 2, '0');
+	for (size_t i = 0; i < length; i++) {
+		u8 value = m_cpu.read_addr((u16)(addr + i));
+		reply[i * 2] = HEX_DIGITS[value >> 4];
+		reply[i * 2 + 1] = HEX_DIGITS[value & 0xF];
+	}
+
+	return reply;
+}
+
+bool GdbStub::write_memory(const std::string &args, bool binary) {
+	size_t at = 0;
+	u64 addr, length;
+	if (!ParseHex(args, at, addr) || at >= args.size() || args[at++] != ',' || !ParseHex(args, at, length)) return false;
+	if (at >= args.size() || args[at++] != ':' || addr + length > MEMORY_CAPACITY) return false;
+
+	std::vector<u8> data;
+	data.reserve(length);
+	while (at < args.size() && data.size() < length) {
+		if (binary) {
+			u8 byte = (u8)args[at++];
+			if (byte == '}' && at < args.size()) byte = (u8)args[at++] ^ 0x20;
+			data.push_back(byte);
+		} else {
+			if (at + 1 >= args.size()) return false;
+			int high = HexValue(args[at]);
+			int low = HexValue(args[at + 1]);
+			if (high < 0 || low < 0) return false;
+			data.push_back((u8)((high << 4) | low));
+			at += 2;
+		}
+	}
+
+	if (data.size() != length) return false;
+	if (length > 0) m_cpu.load((u16)addr, data.data(), data.size());
+	return true;
+}
+
+bool GdbStub::set_point(const std::string &args, bool insert) {
+	size_t at = 0;
+	u64 type, addr, kind;
+	if (!ParseHex(args, at, type) || at >= args.size() || args[at++] != ',') return false;
+	if (!ParseHex(args, at, addr) || at >= args.size() || args[at++] != ',' || !ParseHex(args, at, kind)) return false;
+	if (addr >= MEMORY_CAPACITY) return false;
+
+	u8 access;
+	switch (type) {
+	// Software and hardware breakpoints
+	case 0:
+	case 1: {
+		if (insert) {
+			m_cpu.set_breakpoint((u16)addr);
+		} else {
+			m_cpu.clear_breakpoint((u16)addr);
+		}
+	} return true;
+	case 2: access = CPU::WATCH_WRITE; break;
+	case 3: access = CPU::WATCH_READ; break;
+	case 4: access = CPU::WATCH_READ | CPU::WATCH_WRITE; break;
+	default: return false;
+	}
+
+	// For watchpoints `kind` is the length
+	if (insert) {
+		m_cpu.set_watchpoint((u16)addr, (size_t)kind, access);
+	} else {
+		m_cpu.clear_watchpoint((u16)addr, (size_t)kind, access);
+	}
+	return true;
+}
+
+std::string GdbStub::read_features(const std::string &annex, const std::string &range) const {
+	if (annex != "target.xml") return "E00";
+
+	size_t at = 0;
+	u64 offset, length;
+	if (!ParseHex(range, at, offset) || at >= range.size() || range[at++] != ',' || !ParseHex(range, at, length)) return "E01";
+
+	static const std::string xml = TargetDescription();
+	if (offset >= xml.size()) return "l";
+
+	length = std::min<u64>(length, (GDB_PACKET_SIZE - 4));
+	std::string reply = offset + length >= xml.size() ? "l" : "m";
+	reply += xml.substr(offset, length);
+	return reply;
+}
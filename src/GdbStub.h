@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Core.h"
+#include "CPU.h"
+#include "Socket.h"
+
+// Cycles run between checks for an interrupt from the debugger
+#define GDB_SLICE_CYCLES 100'000
+// Largest packet the stub accepts, advertised to the debugger
+#define GDB_PACKET_SIZE 0x4000
+
+// Serves the GDB remote serial protocol for one CPU over one connection.
+// Registers are described to the debugger by a target description in the
+// order pc, sp, fbs, r0-r3, ra, ri, b0-b3, then a flags byte (equal, zero,
+// decimal, sign, carry, overflow, interrupt, break from bit 0), all little
+// endian. Memory reads and writes see RAM, never devices. Software and
+// hardware breakpoints both map to CPU breakpoints, and write, read and
+// access watchpoints to CPU watchpoints.
+class GdbStub {
+public:
+	// `cycles` caps the cycles continuing and stepping may use in total
+	GdbStub(CPU &cpu, Socket &connection, size_t cycles);
+
+	enum Outcome {
+		// The debugger detached; the program should go on running
+		DETACHED,
+		// The debugger killed the program or went away
+		KILLED,
+		// The program halted or faulted with the debugger attached
+		STOPPED,
+	};
+
+	// Serves requests until the session ends
+	Outcome serve();
+
+	// The last stop of the CPU, for the caller to report after STOPPED
+	CPU::StopReason reason() const { return m_reason; }
+	size_t remaining() const { return m_remaining; }
+private:
+	// Return false once the connection is gone
+	bool next_byte(u8 &byte);
+	bool read_packet(std::string &packet);
+	bool send_packet(const std::string &data);
+	// A 0x03 arrived while the CPU was running
+	bool interrupted();
+
+	// The stop reply for how the CPU last stopped
+	std::string stop_reply() const;
+	// Runs until something stops the CPU; a budget of 1 steps
+	void resume(bool step);
+
+	std::string read_registers() const;
+	bool write_register(size_t index, const std::string &hex);
+	std::string read_memory(const std::string &args) const;
+	bool write_memory(const std::string &args, bool binary);
+	bool set_point(const std::string &args, bool insert);
+	std::string read_features(const std::string &annex, const std::string &range) const;
+private:
+	CPU &m_cpu;
+	Socket &m_connection;
+	size_t m_remaining;
+
+	std::vector<u8> m_input;
+	size_t m_input_at = 0;
+	bool m_acks = true;
+
+	CPU::StopReason m_reason = CPU::BUDGET_EXHAUSTED;
+	// Set when the debugger interrupted the last resume
+	bool m_interrupted = false;
+	bool m_exited = false;
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// The R828 instruction set, written down once. The emulator's decoder and
+// RASM's lexer, encoder and disassembler are all generated from these tables
+// at compile time, so the two cannot disagree about an encoding.
+
+// X(name, code, unknown mode byte: FAULT or IGNORE)
+#define R828_OPCODES(X) \
+	X(LR0,	0xA0, FAULT) \
+	X(LR1,	0xA1, FAULT) \
+	X(LR2,	0xA2, FAULT) \
+	X(LR3,	0xA3, FAULT) \
+	X(LB0,	0xA4, FAULT) \
+	X(LB1,	0xA5, FAULT) \
+	X(LB2,	0xA6, FAULT) \
+	X(LB3,	0xA7, FAULT) \
+	X(LDA,	0xA8, FAULT) \
+	X(LDI,	0xA9, FAULT) \
+	X(PUSH,	0xAA, FAULT) \
+	X(POP,	0xAB, FAULT) \
+	X(STB,	0xAC, IGNORE) \
+	X(STW,	0xAD, IGNORE) \
+	X(LDB,	0xAE, FAULT) \
+	X(LDW,	0xAF, FAULT) \
+	X(ADD,	0xB1, FAULT) \
+	X(ADC,	0xB2, FAULT) \
+	X(SUB,	0xB3, FAULT) \
+	X(SBB,	0xB4, FAULT) \
+	X(MUL,	0xB5, FAULT) \
+	X(DIV,	0xB6, FAULT) \
+	X(ADDB,	0xB7, FAULT) \
+	X(ADCB,	0xB8, FAULT) \
+	X(SUBB,	0xB9, FAULT) \
+	X(SBBB,	0xBA, FAULT) \
+	X(MULB,	0xBB, FAULT) \
+	X(DIVB,	0xBC, FAULT) \
+	X(EQU,	0xC0, FAULT) \
+	X(JZ,	0xC1, FAULT) \
+	X(JNZ,	0xC2, FAULT) \
+	X(JMP,	0xC3, FAULT) \
+	X(RTI,	0xC4, FAULT) \
+	X(AND,	0xE0, IGNORE) \
+	X(OR,	0xE1, IGNORE) \
+	X(XOR,	0xE2, IGNORE) \
+	X(NOT,	0xE3, IGNORE) \
+	X(SHL,	0xE4, IGNORE) \
+	X(SHR,	0xE5, IGNORE) \
+	X(HLT,	0xFF, FAULT)
+
+// X(name, code, width, index into CPU::reg_u16/CPU::reg_u8)
+#define R828_REGISTERS(X) \
+	X(R0,	0xA0, REG16, 0) \
+	X(R1,	0xA1, REG16, 1) \
+	X(R2,	0xA2, REG16, 2) \
+	X(R3,	0xA3, REG16, 3) \
+	X(RA,	0xA4, REG16, 4) \
+	X(RI,	0xA5, REG16, 5) \
+	X(B0,	0xB5, REG8, 0) \
+	X(B1,	0xB6, REG8, 1) \
+	X(B2,	0xB7, REG8, 2) \
+	X(B3,	0xB8, REG8, 3)
+
+// One row per encoding: X(opcode, mode byte, operands before the mode byte,
+// operand kinds, extra cycles, register fixed by the opcode, CPU handler).
+//
+// Operands are encoded in order after the opcode, with the mode byte (0 for
+// none) in front of operand `mode at`. Register and DATA16 bytes fill the
+// DecodedInst slots a, b, c in order after any fixed register; IMM8 and
+// IMM16 go to imm. IMM16 is one big-endian word fetch, DATA16 two single
+// byte fetches. An instruction costs a cycle for the opcode, the mode byte
+// and every fetch, plus its extra cycles.
+#define R828_FORMS(X) \
+	X(LR0,	0,		0, IMM16,	NONE,	NONE,	0, 0,		H_LOAD_U16) \
+	X(LR1,	0,		0, IMM16,	NONE,	NONE,	0, 1,		H_LOAD_U16) \
+	X(LR2,	0,		0, IMM16,	NONE,	NONE,	0, 2,		H_LOAD_U16) \
+	X(LR3,	0,		0, IMM16,	NONE,	NONE,	0, 3,		H_LOAD_U16) \
+	X(LB0,	0,		0, IMM8,	NONE,	NONE,	0, 0,		H_LOAD_U8) \
+	X(LB1,	0,		0, IMM8,	NONE,	NONE,	0, 1,		H_LOAD_U8) \
+	X(LB2,	0,		0, IMM8,	NONE,	NONE,	0, 2,		H_LOAD_U8) \
+	X(LB3,	0,		0, IMM8,	NONE,	NONE,	0, 3,		H_LOAD_U8) \
+	X(LDA,	0,		0, IMM16,	NONE,	NONE,	0, 4,		H_LOAD_U16) \
+	X(LDI,	0,		0, IMM16,	NONE,	NONE,	0, 5,		H_LOAD_U16) \
+	X(PUSH,	0xA0,	0, IMM8,	NONE,	NONE,	1, NO_REG,	H_PUSH_BYTE) \
+	X(PUSH,	0xA1,	0, DATA16,	NONE,	NONE,	1, NO_REG,	H_PUSH_WORD) \
+	X(POP,	0xA0,	0, REG8,	NONE,	NONE,	0, NO_REG,	H_POP_BYTE) \
+	X(POP,	0xA1,	0, REG16,	NONE,	NONE,	0, NO_REG,	H_POP_WORD) \
+	X(STB,	0xA0,	1, REG16,	IMM8,	NONE,	1, NO_REG,	H_STB_IMM) \
+	X(STB,	0xA1,	1, REG16,	REG8,	NONE,	1, NO_REG,	H_STB_REG) \
+	X(STW,	0xA0,	1, REG16,	DATA16,	NONE,	1, NO_REG,	H_STW_IMM) \
+	X(STW,	0xA1,	1, REG16,	REG16,	NONE,	1, NO_REG,	H_STW_REG) \
+	X(LDB,	0,		0, REG8,	REG16,	NONE,	0, NO_REG,	H_LDB) \
+	X(LDW,	0,		0, REG16,	REG16,	NONE,	0, NO_REG,	H_LDW) \
+	X(ADD,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_ADD) \
+	X(ADC,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_ADC) \
+	X(SUB,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_SUB) \
+	X(SBB,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_SBB) \
+	X(MUL,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_MUL) \
+	X(DIV,	0,		0, REG16,	REG16,	REG16,	0, NO_REG,	H_DIV) \
+	X(ADDB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_ADDB) \
+	X(ADCB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_ADCB) \
+	X(SUBB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_SUBB) \
+	X(SBBB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_SBBB) \
+	X(MULB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_MULB) \
+	X(DIVB,	0,		0, REG8,	REG8,	REG8,	0, NO_REG,	H_DIVB) \
+	X(EQU,	0,		0, REG16,	REG16,	NONE,	0, NO_REG,	H_EQU) \
+	X(JZ,	0,		0, IMM16,	NONE,	NONE,	0, NO_REG,	H_JZ) \
+	X(JNZ,	0,		0, IMM16,	NONE,	NONE,	0, NO_REG,	H_JNZ) \
+	X(JMP,	0,		0, IMM16,	NONE,	NONE,	0, NO_REG,	H_JMP) \
+	X(RTI,	0,		0, NONE,	NONE,	NONE,	0, NO_REG,	H_RTI) \
+	X(AND,	0xA0,	0, REG8,	REG8,	REG8,	0, NO_REG,	H_AND_U8) \
+	X(AND,	0xA1,	0, REG16,	REG16,	REG16,	0, NO_REG,	H_AND_U16) \
+	X(OR,	0xA0,	0, REG8,	REG8,	REG8,	0, NO_REG,	H_OR_U8) \
+	X(OR,	0xA1,	0, REG16,	REG16,	REG16,	0, NO_REG,	H_OR_U16) \
+	X(XOR,	0xA0,	0, REG8,	REG8,	REG8,	0, NO_REG,	H_XOR_U8) \
+	X(XOR,	0xA1,	0, REG16,	REG16,	REG16,	0, NO_REG,	H_XOR_U16) \
+	X(NOT,	0xA0,	0, REG8,	REG8,	NONE,	0, NO_REG,	H_NOT_U8) \
+	X(NOT,	0xA1,	0, REG16,	REG16,	NONE,	0, NO_REG,	H_NOT_U16) \
+	X(SHL,	0xA0,	0, REG8,	REG8,	REG8,	0, NO_REG,	H_SHL_U8) \
+	X(SHL,	0xA1,	0, REG16,	REG16,	REG16,	0, NO_REG,	H_SHL_U16) \
+	X(SHR,	0xA0,	0, REG8,	REG8,	REG8,	0, NO_REG,	H_SHR_U8) \
+	X(SHR,	0xA1,	0, REG16,	REG16,	REG16,	0, NO_REG,	H_SHR_U16) \
+	X(HLT,	0,		0, NONE,	NONE,	NONE,	0, NO_REG,	H_HLT)
+
+namespace ISA {
+
+	enum Opcode : uint8_t {
+#define X(name, code, bad_mode) name = code,
+		R828_OPCODES(X)
+#undef X
+	};
+
+	enum OperandKind : uint8_t {
+		OPERAND_NONE,
+		OPERAND_REG8,
+		OPERAND_REG16,
+		OPERAND_IMM8,
+		OPERAND_IMM16,
+		OPERAND_DATA16,
+	};
+
+	enum BadMode : uint8_t {
+		// H_INVALID_MODE
+		BAD_MODE_FAULT,
+		// H_NOP: the operands are skipped and nothing happens
+		BAD_MODE_IGNORE,
+	};
+
+	constexpr uint8_t NO_MODE = 0x00;
+	constexpr uint8_t NO_REG = 0xFF;
+
+	struct Register {
+		std::string_view name;
+		uint8_t code;
+		OperandKind kind;
+		uint8_t index;
+	};
+
+	inline constexpr Register REGISTERS[] = {
+#define X(name, code, kind, index) { #name, code, OPERAND_##kind, index },
+		R828_REGISTERS(X)
+#undef X
+	};
+
+	struct Form {
+		std::string_view mnemonic;
+		uint8_t opcode;
+		uint8_t mode;
+		uint8_t mode_at;
+		OperandKind operands[3];
+		uint8_t operand_count;
+		uint8_t implied;
+		uint8_t length;
+		uint8_t cycles;
+		uint8_t extra_cycles;
+	};
+
+	// Bytes the operand takes in the encoding
+	constexpr uint8_t OperandLength(OperandKind kind) {
+		switch (kind) {
+		case OPERAND_NONE: return 0;
+		case OPERAND_IMM16:
+		case OPERAND_DATA16: return 2;
+		default: return 1;
+		}
+	}
+
+	constexpr Form MakeForm(std::string_view mnemonic, uint8_t opcode, uint8_t mode, uint8_t mode_at,
+		OperandKind a, OperandKind b, OperandKind c, uint8_t extra_cycles, uint8_t implied) {
+		Form form { mnemonic, opcode, mode, mode_at, { a, b, c }, 0, implied, 1, 1, extra_cycles };
+		if (mode != NO_MODE) {
+			form.length++;
+			form.cycles++;
+		}
+
+		for (OperandKind kind : form.operands) {
+			if (kind == OPERAND_NONE) break;
+
+			form.operand_count++;
+			form.length += OperandLength(kind);
+			form.cycles += kind == OPERAND_DATA16 ? 2 : 1;
+		}
+
+		form.cycles += extra_cycles;
+		return form;
+	}
+
+	inline constexpr Form FORMS[] = {
+#define X(name, mode, mode_at, a, b, c, extra, implied, handler) \
+		MakeForm(#name, name, mode, mode_at, OPERAND_##a, OPERAND_##b, OPERAND_##c, extra, implied),
+		R828_FORMS(X)
+#undef X
+	};
+
+	constexpr size_t FORM_COUNT = std::size(FORMS);
+
+	constexpr size_t MAX_LENGTH = [] {
+		size_t length = 0;
+		for (const Form &form : FORMS) {
+			if (form.length > length) length = form.length;
+		}
+		return length;
+	}();
+
+	// Forms of each opcode byte; count 0 for invalid opcodes
+	struct OpcodeForms {
+		uint8_t first;
+		uint8_t count;
+		BadMode bad_mode;
+	};
+
+	inline constexpr std::array<OpcodeForms, 256> OPCODE_FORMS = [] {
+		std::array<OpcodeForms, 256> table {};
+		for (size_t i = 0; i < FORM_COUNT; i++) {
+			OpcodeForms &entry = table[FORMS[i].opcode];
+			if (entry.count == 0) entry.first = (uint8_t)i;
+			entry.count++;
+		}
+
+#define X(name, code, on_bad_mode) table[code].bad_mode = BAD_MODE_##on_bad_mode;
+		R828_OPCODES(X)
+#undef X
+		return table;
+	}();
+
+	// The decoder and encoder rely on these: an opcode's forms are adjacent,
+	// agree on everything but the mode and the operand kinds after it, and
+	// only opcodes with a mode byte have more than one
+	constexpr bool FormsAreConsistent() {
+		for (size_t i = 0; i < FORM_COUNT; i++) {
+			const Form &form = FORMS[i];
+			const OpcodeForms &entry = OPCODE_FORMS[form.opcode];
+			const Form &first = FORMS[entry.first];
+
+			if (i < entry.first || i >= (size_t)entry.first + entry.count) return false;
+			if (form.mnemonic != first.mnemonic || form.operand_count != first.operand_count) return false;
+			if (form.mode_at != first.mode_at || form.extra_cycles != first.extra_cycles) return false;
+			if ((form.mode == NO_MODE) != (first.mode == NO_MODE)) return false;
+			if (form.mode == NO_MODE && (entry.count != 1 || form.extra_cycles != 0)) return false;
+			if (form.mode != NO_MODE && form.mode_at >= form.operand_count) return false;
+			for (size_t j = 0; j < form.mode_at; j++) {
+				if (form.operands[j] != first.operands[j]) return false;
+			}
+
+			for (size_t j = entry.first; j < i; j++) {
+				if (FORMS[j].mode == form.mode) return false;
+			}
+		}
+
+		return true;
+	}
+
+	static_assert(FormsAreConsistent(), "R828_FORMS rows break an encoding rule");
+
+	// REGISTERS entry by register code, or NO_REG
+	constexpr std::array<uint8_t, 256> RegisterTable(OperandKind kind) {
+		std::array<uint8_t, 256> table {};
+		table.fill(NO_REG);
+		for (size_t i = 0; i < std::size(REGISTERS); i++) {
+			if (REGISTERS[i].kind == kind) table[REGISTERS[i].code] = (uint8_t)i;
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<uint8_t, 256> REG8_CODES = RegisterTable(OPERAND_REG8);
+	inline constexpr std::array<uint8_t, 256> REG16_CODES = RegisterTable(OPERAND_REG16);
+
+	// Disassembles the instruction at `code` in the syntax RASM reads back
+	// into the same bytes: registers by name, IMM8 as two hex digits and
+	// 16-bit operands as four. Returns its length, or 0 if the bytes are not
+	// a valid instruction or run past `size`.
+	inline size_t Disassemble(const uint8_t *code, size_t size, std::string &text) {
+		if (size == 0) return 0;
+
+		const OpcodeForms &entry = OPCODE_FORMS[code[0]];
+		if (entry.count == 0) return 0;
+
+		// A moded opcode's length is only known once its mode byte picks the
+		// form; until then only the bytes up to the mode byte must fit
+		const Form *form = &FORMS[entry.first];
+		size_t needed = form->length;
+		if (form->mode != NO_MODE) {
+			needed = 2;
+			for (uint8_t i = 0; i < form->mode_at; i++) needed += OperandLength(form->operands[i]);
+		}
+		if (size < needed) return 0;
+
+		std::string operands;
+		size_t pos = 1;
+		for (uint8_t i = 0; i < form->operand_count; i++) {
+			if (form->mode != NO_MODE && i == form->mode_at) {
+				uint8_t mode = code[pos++];
+				const Form *match = nullptr;
+				for (uint8_t j = 0; j < entry.count; j++) {
+					if (FORMS[entry.first + j].mode == mode) match = &FORMS[entry.first + j];
+				}
+
+				if (!match || size < match->length) return 0;
+				form = match;
+			}
+
+			char number[8];
+			if (i > 0) operands += ", ";
+			switch (form->operands[i]) {
+			case OPERAND_REG8:
+			case OPERAND_REG16: {
+				const std::array<uint8_t, 256> &codes = form->operands[i] == OPERAND_REG8 ? REG8_CODES : REG16_CODES;
+				uint8_t reg = codes[code[pos++]];
+				if (reg == NO_REG) return 0;
+
+				operands += REGISTERS[reg].name;
+			} break;
+			case OPERAND_IMM8: {
+				std::snprintf(number, sizeof(number), "0x%02X", code[pos]);
+				operands += number;
+				pos++;
+			} break;
+			case OPERAND_IMM16:
+			case OPERAND_DATA16: {
+				std::snprintf(number, sizeof(number), "0x%02X%02X", code[pos], code[pos + 1]);
+				operands += number;
+				pos += 2;
+			} break;
+			case OPERAND_NONE: break;
+			}
+		}
+
+		text = form->mnemonic;
+		if (!operands.empty()) {
+			text += ' ';
+			text += operands;
+		}
+
+		return pos;
+	}
+
+}
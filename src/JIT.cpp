@@ -0,0 +1,426 @@
+#include "JIT.h"
+
+#include <cstring>
+#include <cstddef>
+
+#include "CPU.h"
+
+#if R828_HAS_JIT
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+
+namespace {
+
+	enum HostReg {
+		RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15,
+	};
+
+	enum Cond {
+		CC_B	= 0x2,
+		CC_E	= 0x4,
+		CC_NE	= 0x5,
+		CC_A	= 0x7,
+	};
+
+	// Guest register -> host register. Values are kept zero-extended to 32
+	// bits so they can be read without masking.
+	const u8 s_host_u16[] = { R8, R9, R10, R11, R12, R13 };
+	const u8 s_host_u8[] = { R14, R15, RBX, RBP };
+
+	// The state pointer lives in RDI for the whole block
+	const u8 STATE = RDI;
+
+	constexpr u8 disp(size_t offset) { return (u8)offset; }
+
+	// Just enough of an x86-64 encoder for the translations below. Every
+	// register operand is a full register number; REX prefixes are added as
+	// needed. Memory operands are always [rdi + disp8].
+	class Emitter {
+	public:
+		std::vector<u8> code;
+
+		void byte(u8 value) { code.push_back(value); }
+
+		void imm16(u16 value) {
+			byte(value & 0xFF);
+			byte(value >> 8);
+		}
+
+		void imm32(u32 value) {
+			for (int i = 0; i < 4; i++) byte((value >> (i * 8)) & 0xFF);
+		}
+
+		// `byte_regs` forces a REX prefix so 4..7 mean spl..dil, not ah..bh
+		void rex(bool w, u8 reg, u8 rm, bool byte_regs = false) {
+			u8 value = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+			if (value != 0x40 || (byte_regs && ((reg & 0xF) >= 4 || (rm & 0xF) >= 4))) byte(value);
+		}
+
+		void modrm_reg(u8 reg, u8 rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+		void modrm_state(u8 reg, u8 offset) { byte(0x40 | ((reg & 7) << 3) | (STATE & 7)); byte(offset); }
+
+		// op r/m32, r32 (add 0x01, or 0x09, and 0x21, sub 0x29, xor 0x31, cmp 0x39, test 0x85, mov 0x89)
+		void alu(u8 opcode, u8 dst, u8 src) { rex(false, src, dst); byte(opcode); modrm_reg(src, dst); }
+		void mov(u8 dst, u8 src) { alu(0x89, dst, src); }
+
+		void movzx16(u8 dst, u8 src) { rex(false, dst, src); byte(0x0F); byte(0xB7); modrm_reg(dst, src); }
+		void movzx8(u8 dst, u8 src) { rex(false, dst, src, true); byte(0x0F); byte(0xB6); modrm_reg(dst, src); }
+		void imul(u8 dst, u8 src) { rex(false, dst, src); byte(0x0F); byte(0xAF); modrm_reg(dst, src); }
+
+		// F7 group: not /2, div /6
+		void unary(u8 ext, u8 rm) { rex(false, 0, rm); byte(0xF7); modrm_reg(ext, rm); }
+		// D3 group: shl /4, shr /5
+		void shift_cl(u8 ext, u8 rm) { rex(false, 0, rm); byte(0xD3); modrm_reg(ext, rm); }
+
+		void test_imm(u8 rm, u32 value) { rex(false, 0, rm); byte(0xF7); modrm_reg(0, rm); imm32(value); }
+		void cmp_imm(u8 rm, u32 value) { rex(false, 0, rm); byte(0x81); modrm_reg(7, rm); imm32(value); }
+		void mov_imm(u8 dst, u32 value) { rex(false, 0, dst); byte(0xB8 | (dst & 7)); imm32(value); }
+
+		void setcc(u8 cc, u8 rm) { rex(false, 0, rm, true); byte(0x0F); byte(0x90 | cc); modrm_reg(0, rm); }
+		void setcc_state(u8 cc, u8 offset) { byte(0x0F); byte(0x90 | cc); modrm_state(0, offset); }
+
+		void load8(u8 dst, u8 offset) { rex(false, dst, STATE); byte(0x0F); byte(0xB6); modrm_state(dst, offset); }
+		void load16(u8 dst, u8 offset) { rex(false, dst, STATE); byte(0x0F); byte(0xB7); modrm_state(dst, offset); }
+		void store8(u8 offset, u8 src) { rex(false, src, STATE, true); byte(0x88); modrm_state(src, offset); }
+		void store16(u8 offset, u8 src) { byte(0x66); rex(false, src, STATE); byte(0x89); modrm_state(src, offset); }
+		void store8_imm(u8 offset, u8 value) { byte(0xC6); modrm_state(0, offset); byte(value); }
+		void store16_imm(u8 offset, u16 value) { byte(0x66); byte(0xC7); modrm_state(0, offset); imm16(value); }
+		void cmp8_imm(u8 offset, u8 value) { byte(0x80); modrm_state(7, offset); byte(value); }
+		void cmp64_imm(u8 offset, u32 value) { byte(0x48); byte(0x81); modrm_state(7, offset); imm32(value); }
+		void sub64_imm(u8 offset, u32 value) { byte(0x48); byte(0x81); modrm_state(5, offset); imm32(value); }
+		void add64_imm(u8 offset, u32 value) { byte(0x48); byte(0x81); modrm_state(0, offset); imm32(value); }
+
+		void push(u8 reg) { rex(false, 0, reg); byte(0x50 | (reg & 7)); }
+		void pop(u8 reg) { rex(false, 0, reg); byte(0x58 | (reg & 7)); }
+		void ret() { byte(0xC3); }
+
+		// Jumps return the offset of their rel32 for bind()
+		size_t jcc(u8 cc) { byte(0x0F); byte(0x80 | cc); imm32(0); return code.size() - 4; }
+		size_t jmp() { byte(0xE9); imm32(0); return code.size() - 4; }
+
+		void bind(size_t fixup, size_t target) {
+			u32 rel = (u32)(target - (fixup + 4));
+			std::memcpy(&code[fixup], &rel, sizeof(rel));
+		}
+
+		void jmp_to(size_t target) { bind(jmp(), target); }
+	};
+
+	// Callee-saved registers the translation clobbers
+#ifdef _WIN32
+	const u8 s_saved[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+#else
+	const u8 s_saved[] = { RBX, RBP, R12, R13, R14, R15 };
+#endif
+
+	void EmitFlagsZeroSign(Emitter &e, u8 dest, u32 sign_mask) {
+		e.alu(0x85, dest, dest);
+		e.setcc_state(CC_E, disp(offsetof(JitState, zero)));
+		e.test_imm(dest, sign_mask);
+		e.setcc_state(CC_NE, disp(offsetof(JitState, sign)));
+	}
+
+	// Arithmetic with the interpreter's exact flag rules. Those rules read the
+	// operand registers after the result is written, so when dest aliases an
+	// operand the flags see the new value; reading the host registers back
+	// reproduces that.
+	void EmitArith(Emitter &e, u8 handler, u8 dest, u8 reg1, u8 reg2, bool byte_form) {
+		u32 max = byte_form ? 0xFF : 0xFFFF;
+		u32 sign_mask = byte_form ? 0x80 : 0x8000;
+		u8 carry = disp(offsetof(JitState, carry));
+		u8 overflow = disp(offsetof(JitState, overflow));
+
+		// Handlers are laid out ADD, ADC, SUB, SBB, MUL, DIV for both widths
+		u8 op = handler - (byte_form ? CPU::H_ADDB : CPU::H_ADD);
+
+		e.mov(RAX, reg1);
+		switch (op) {
+		case 0: e.alu(0x01, RAX, reg2); break;
+		case 1: {
+			e.alu(0x01, RAX, reg2);
+			e.load8(RCX, carry);
+			e.alu(0x01, RAX, RCX);
+		} break;
+		case 2: e.alu(0x29, RAX, reg2); break;
+		case 3: {
+			e.alu(0x29, RAX, reg2);
+			e.load8(RCX, carry);
+			e.alu(0x29, RAX, RCX);
+		} break;
+		case 4: e.imul(RAX, reg2); break;
+		case 5: {
+			e.alu(0x31, RDX, RDX);
+			e.mov(RCX, reg2);
+			e.unary(6, RCX);
+		} break;
+		}
+
+		if (byte_form) e.movzx8(dest, RAX);
+		else e.movzx16(dest, RAX);
+
+		EmitFlagsZeroSign(e, dest, sign_mask);
+
+		switch (op) {
+		case 0: {
+			// carry = reg1 > max - reg2
+			e.mov(RAX, reg1);
+			e.alu(0x01, RAX, reg2);
+			e.cmp_imm(RAX, max);
+			e.setcc_state(CC_A, carry);
+		} break;
+		case 1: {
+			// carry = dest < reg1 || dest < reg2 || carry_in
+			e.alu(0x39, dest, reg1);
+			e.setcc(CC_B, RAX);
+			e.movzx8(RAX, RAX);
+			e.alu(0x39, dest, reg2);
+			e.setcc(CC_B, RCX);
+			e.movzx8(RCX, RCX);
+			e.alu(0x09, RAX, RCX);
+			e.load8(RCX, carry);
+			e.alu(0x09, RAX, RCX);
+			e.store8(carry, RAX);
+		} break;
+		case 2: {
+			// carry = reg1 < reg2
+			e.alu(0x39, reg1, reg2);
+			e.setcc_state(CC_B, carry);
+		} break;
+		case 3: {
+			// carry = reg1 < reg2 + carry_in
+			e.load8(RAX, carry);
+			e.alu(0x01, RAX, reg2);
+			e.alu(0x39, reg1, RAX);
+			e.setcc_state(CC_B, carry);
+		} break;
+		case 4:
+		case 5: {
+			e.store8_imm(carry, 0);
+			e.store8_imm(overflow, 0);
+		} return;
+		}
+
+		// Add: same operand signs, result sign differs. Sub: operand signs
+		// differ, result sign differs from reg1.
+		e.mov(RAX, reg1);
+		e.alu(0x31, RAX, reg2);
+		if (op < 2) e.unary(2, RAX);
+		e.mov(RCX, reg1);
+		e.alu(0x31, RCX, dest);
+		e.alu(0x21, RAX, RCX);
+		e.test_imm(RAX, sign_mask);
+		e.setcc_state(CC_NE, overflow);
+	}
+
+	void EmitLogic(Emitter &e, u8 handler, const DecodedInst &inst) {
+		bool wide = (handler - CPU::H_AND_U8) % 2 == 1;
+		u8 op = (handler - CPU::H_AND_U8) / 2;
+		const u8 *host = wide ? s_host_u16 : s_host_u8;
+		u8 dest = host[inst.a];
+		u8 reg1 = host[inst.b];
+
+		switch (op) {
+		case 0: e.mov(RAX, reg1); e.alu(0x21, RAX, host[inst.c]); break;
+		case 1: e.mov(RAX, reg1); e.alu(0x09, RAX, host[inst.c]); break;
+		case 2: e.mov(RAX, reg1); e.alu(0x31, RAX, host[inst.c]); break;
+		case 3: e.mov(RAX, reg1); e.unary(2, RAX); break;
+		case 4:
+		case 5: {
+			// A 32-bit shift by cl uses the count mod 32, the interpreter's
+			// rule
+			e.mov(RCX, host[inst.c]);
+			e.mov(RAX, reg1);
+			e.shift_cl(op == 4 ? 4 : 5, RAX);
+		} break;
+		}
+
+		if (wide) e.movzx16(dest, RAX);
+		else e.movzx8(dest, RAX);
+	}
+
+}
+
+JIT::~JIT() {
+	if (!m_code) return;
+
+#ifdef _WIN32
+	VirtualFree(m_code, 0, MEM_RELEASE);
+#else
+	munmap(m_code, JIT_CODE_SIZE);
+#endif
+}
+
+bool JIT::can_compile(const DecodedInst *insts, u16 count) {
+	for (u16 i = 0; i < count; i++) {
+		u8 handler = insts[i].handler;
+		bool supported = handler == CPU::H_LOAD_U16
+			|| handler == CPU::H_LOAD_U8
+			|| (handler >= CPU::H_ADD && handler <= CPU::H_SHR_U16)
+			|| handler == CPU::H_EQU
+			|| handler == CPU::H_JZ
+			|| handler == CPU::H_JNZ
+			|| handler == CPU::H_JMP
+			|| handler == CPU::H_NOP;
+
+		if (!supported) return false;
+	}
+
+	return true;
+}
+
+JitBlockFn JIT::compile(u16 start, const DecodedInst *insts, u16 count, size_t cycles, bool self_loop) {
+	if (!m_code) {
+#ifdef _WIN32
+		m_code = (u8 *)VirtualAlloc(nullptr, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+		void *mapping = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		m_code = mapping == MAP_FAILED ? nullptr : (u8 *)mapping;
+#endif
+		if (!m_code) return nullptr;
+	}
+
+	Emitter e;
+
+	for (u8 reg : s_saved) e.push(reg);
+#ifdef _WIN32
+	e.mov(RDI, RCX);
+#endif
+
+	for (int i = 0; i < 6; i++) e.load16(s_host_u16[i], disp(offsetof(JitState, regs_u16) + i * 2));
+	for (int i = 0; i < 4; i++) e.load8(s_host_u8[i], disp(offsetof(JitState, regs_u8) + i));
+
+	// Cycles charged up front for instructions i..count-1, refunded when
+	// the block bails out early
+	std::vector<size_t> remaining(count + 1, 0);
+	for (int i = count - 1; i >= 0; i--) remaining[i] = remaining[i + 1] + insts[i].cycles;
+
+	struct Exit {
+		size_t fixup;
+		u16 target;
+		u32 refund;
+		bool bailout;
+	};
+
+	size_t top = e.code.size();
+	std::vector<Exit> exits;
+	u16 pc = start;
+
+	// Exit to the dispatcher with pc = target, or loop if target is the
+	// block start and the budget covers another run
+	auto branch_to = [&](u16 target) {
+		if (self_loop && target == start) {
+			e.cmp64_imm(disp(offsetof(JitState, cycles)), (u32)cycles);
+			exits.push_back({ e.jcc(CC_B), target, 0, false });
+			e.sub64_imm(disp(offsetof(JitState, cycles)), (u32)cycles);
+			e.jmp_to(top);
+		} else {
+			exits.push_back({ e.jmp(), target, 0, false });
+		}
+	};
+
+	bool ended = false;
+	for (u16 i = 0; i < count; i++) {
+		const DecodedInst &inst = insts[i];
+		u16 inst_pc = pc;
+		pc += inst.length;
+
+		// A zero divisor faults, which only the interpreter reports
+		if (inst.handler == CPU::H_DIV || inst.handler == CPU::H_DIVB) {
+			u8 divisor = inst.handler == CPU::H_DIV ? s_host_u16[inst.c] : s_host_u8[inst.c];
+			e.alu(0x85, divisor, divisor);
+			exits.push_back({ e.jcc(CC_E), inst_pc, (u32)remaining[i], true });
+		}
+
+		switch (inst.handler) {
+		case CPU::H_LOAD_U16: e.mov_imm(s_host_u16[inst.a], inst.imm); break;
+		case CPU::H_LOAD_U8: e.mov_imm(s_host_u8[inst.a], inst.imm & 0xFF); break;
+		case CPU::H_ADD:
+		case CPU::H_ADC:
+		case CPU::H_SUB:
+		case CPU::H_SBB:
+		case CPU::H_MUL:
+		case CPU::H_DIV: {
+			EmitArith(e, inst.handler, s_host_u16[inst.a], s_host_u16[inst.b], s_host_u16[inst.c], false);
+		} break;
+		case CPU::H_ADDB:
+		case CPU::H_ADCB:
+		case CPU::H_SUBB:
+		case CPU::H_SBBB:
+		case CPU::H_MULB:
+		case CPU::H_DIVB: {
+			EmitArith(e, inst.handler, s_host_u8[inst.a], s_host_u8[inst.b], s_host_u8[inst.c], true);
+		} break;
+		case CPU::H_EQU: {
+			e.alu(0x39, s_host_u16[inst.a], s_host_u16[inst.b]);
+			e.setcc_state(CC_E, disp(offsetof(JitState, equal)));
+		} break;
+		case CPU::H_JZ:
+		case CPU::H_JNZ: {
+			// JZ is taken while equal == 0, JNZ while it is set
+			e.cmp8_imm(disp(offsetof(JitState, equal)), 0);
+			size_t not_taken = e.jcc(inst.handler == CPU::H_JZ ? CC_NE : CC_E);
+			branch_to(inst.imm);
+			e.bind(not_taken, e.code.size());
+			exits.push_back({ e.jmp(), pc, 0, false });
+			ended = true;
+		} break;
+		case CPU::H_JMP: {
+			branch_to(inst.imm);
+			ended = true;
+		} break;
+		case CPU::H_NOP: break;
+		default: {
+			EmitLogic(e, inst.handler, inst);
+		} break;
+		}
+	}
+
+	if (!ended) {
+		exits.push_back({ e.jmp(), pc, 0, false });
+	}
+
+	// One stub per exit sets pc, then all of them share the epilogue
+	std::vector<size_t> to_epilogue;
+	for (const Exit &exit : exits) {
+		e.bind(exit.fixup, e.code.size());
+		if (exit.refund) e.add64_imm(disp(offsetof(JitState, cycles)), exit.refund);
+		if (exit.bailout) e.store8_imm(disp(offsetof(JitState, bailout)), 1);
+		e.store16_imm(disp(offsetof(JitState, pc)), exit.target);
+		to_epilogue.push_back(e.jmp());
+	}
+
+	for (size_t fixup : to_epilogue) e.bind(fixup, e.code.size());
+	for (int i = 0; i < 6; i++) e.store16(disp(offsetof(JitState, regs_u16) + i * 2), s_host_u16[i]);
+	for (int i = 0; i < 4; i++) e.store8(disp(offsetof(JitState, regs_u8) + i), s_host_u8[i]);
+	for (int i = sizeof(s_saved) - 1; i >= 0; i--) e.pop(s_saved[i]);
+	e.ret();
+
+	if (m_used + e.code.size() > JIT_CODE_SIZE) return nullptr;
+
+	u8 *code = m_code + m_used;
+	std::memcpy(code, e.code.data(), e.code.size());
+	m_used += (e.code.size() + 15) & ~(size_t)15;
+
+	return (JitBlockFn)code;
+}
+
+#else
+
+JIT::~JIT() {}
+
+bool JIT::can_compile(const DecodedInst *, u16) {
+	return false;
+}
+
+JitBlockFn JIT::compile(u16, const DecodedInst *, u16, size_t, bool) {
+	return nullptr;
+}
+
+#endif
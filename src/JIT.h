@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include "Core.h"
+
+// The JIT only emits x86-64 and is opt-in at build time (premake --jit)
+#if defined(R828_JIT) && (defined(__x86_64__) || defined(_M_X64))
+	#define R828_HAS_JIT 1
+#else
+	#define R828_HAS_JIT 0
+#endif
+
+// Blocks are translated after running this many times through the interpreter
+#define JIT_THRESHOLD 16
+
+struct DecodedInst;
+
+// Guest state handed to translated code. Flags are whole bytes here since the
+// layout of CPU's bitfields is up to the compiler.
+struct JitState {
+	size_t cycles;
+	u16 regs_u16[6];
+	u8 regs_u8[4];
+	u8 equal;
+	u8 zero;
+	u8 sign;
+	u8 carry;
+	u8 overflow;
+	// Set when the block stopped in front of an instruction it leaves to
+	// the interpreter (a divide by zero); pc points at that instruction
+	u8 bailout;
+	u16 pc;
+};
+
+typedef void (*JitBlockFn)(JitState *state);
+
+// Translates basic blocks of register-only R828 code into native x86-64.
+// Inside a block the guest registers live in host registers; a block that
+// jumps back to its own start keeps looping natively while state->cycles
+// covers another iteration.
+class JIT {
+public:
+	JIT() = default;
+	~JIT();
+
+	// Translated code is never shared: a copy starts out empty
+	JIT(const JIT &) {}
+	JIT &operator=(const JIT &) { flush(); return *this; }
+
+	// Whether every instruction in the block has a translation (no memory
+	// access, no HLT)
+	static bool can_compile(const DecodedInst *insts, u16 count);
+
+	// Returns nullptr if the code buffer is full. `self_loop` allows a taken
+	// jump back to `start` to loop without returning to the dispatcher.
+	JitBlockFn compile(u16 start, const DecodedInst *insts, u16 count, size_t cycles, bool self_loop);
+
+	// Drops every translation; called whenever the block cache is flushed
+	void flush() { m_used = 0; }
+private:
+	u8 *m_code = nullptr;
+	size_t m_used = 0;
+};
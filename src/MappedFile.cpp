@@ -0,0 +1,98 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+	: m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+	if (this != &other) {
+		close();
+		m_data = std::exchange(other.m_data, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+	}
+
+	return *this;
+}
+
+bool MappedFile::open(const std::string &path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	if (size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			m_data = (const u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+
+		if (!m_data) {
+			CloseHandle(file);
+			return false;
+		}
+	}
+
+	CloseHandle(file);
+	m_size = (size_t)size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		::close(fd);
+		return false;
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	if (info.st_size > 0) {
+		void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+
+		m_data = (const u8 *)mapping;
+	}
+
+	::close(fd);
+	m_size = (size_t)info.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (m_data) {
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<u8 *>(m_data), m_size);
+#endif
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+#include "Core.h"
+
+// A whole file mapped read-only into the address space, so images go from
+// the page cache straight into guest memory without an intermediate buffer.
+// Empty files map to no data.
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(MappedFile &&other) noexcept;
+	MappedFile &operator=(MappedFile &&other) noexcept;
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Returns false if the file cannot be opened or mapped
+	bool open(const std::string &path);
+	void close();
+
+	const u8 *data() const { return m_data; }
+	size_t size() const { return m_size; }
+private:
+	const u8 *m_data = nullptr;
+	size_t m_size = 0;
+};
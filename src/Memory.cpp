@@ -0,0 +1,88 @@
+#include "Memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Shared by every all-zero page of every PagedMemory
+static const std::shared_ptr<MemoryPage> &ZeroPage() {
+	static const std::shared_ptr<MemoryPage> page = std::make_shared<MemoryPage>();
+	return page;
+}
+
+// A page of `value` bytes that the caller may share
+static std::shared_ptr<MemoryPage> FilledPage(u8 value) {
+	if (value == 0) return ZeroPage();
+
+	auto page = std::make_shared<MemoryPage>();
+	std::memset(page->data, value, MEMORY_PAGE_SIZE);
+	return page;
+}
+
+PagedMemory::PagedMemory() {
+	fill(0x00);
+}
+
+PagedMemory::PagedMemory(const Memory &memory) {
+	for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		const u8 *source = memory.data + page * MEMORY_PAGE_SIZE;
+
+		if (std::all_of(source, source + MEMORY_PAGE_SIZE, [](u8 byte) { return byte == 0; })) {
+			set_page(page, ZeroPage());
+		} else {
+			auto copy = std::make_shared<MemoryPage>();
+			std::memcpy(copy->data, source, MEMORY_PAGE_SIZE);
+			set_page(page, std::move(copy));
+		}
+	}
+}
+
+void PagedMemory::write(u16 addr, const u8 *data, size_t size) {
+	size_t pos = addr;
+	size_t end = pos + size;
+
+	while (pos < end) {
+		size_t page = pos / MEMORY_PAGE_SIZE;
+		size_t offset = pos % MEMORY_PAGE_SIZE;
+		size_t length = std::min<size_t>(end - pos, MEMORY_PAGE_SIZE - offset);
+
+		if (m_pages[page].use_count() != 1) {
+			own(page);
+		}
+		std::memcpy(m_data[page] + offset, data, length);
+
+		data += length;
+		pos += length;
+	}
+}
+
+void PagedMemory::fill(size_t addr, size_t count, u8 value) {
+	size_t end = std::min<size_t>(addr + count, MEMORY_CAPACITY);
+	std::shared_ptr<MemoryPage> filled;
+
+	while (addr < end) {
+		size_t page = addr / MEMORY_PAGE_SIZE;
+		size_t offset = addr % MEMORY_PAGE_SIZE;
+		size_t length = std::min<size_t>(end - addr, MEMORY_PAGE_SIZE - offset);
+
+		if (length == MEMORY_PAGE_SIZE) {
+			if (!filled) filled = FilledPage(value);
+			set_page(page, filled);
+		} else {
+			if (m_pages[page].use_count() != 1) {
+				own(page);
+			}
+			std::memset(m_data[page] + offset, value, length);
+		}
+
+		addr += length;
+	}
+}
+
+size_t PagedMemory::private_pages() const {
+	return std::count_if(m_pages.begin(), m_pages.end(), [](const auto &page) { return page.use_count() == 1; });
+}
+
+void PagedMemory::own(size_t page) {
+	auto copy = std::make_shared<MemoryPage>(*m_pages[page]);
+	set_page(page, std::move(copy));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <memory>
+
+#include "Core.h"
+
+#define MEMORY_CAPACITY 1024 * 64
+struct Memory {
+	u8 read(u16 addr) const { return data[addr]; }
+
+	u8 data[MEMORY_CAPACITY];
+};
+
+// Unit of sharing in PagedMemory
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGE_COUNT (MEMORY_CAPACITY / MEMORY_PAGE_SIZE)
+
+struct MemoryPage {
+	u8 data[MEMORY_PAGE_SIZE];
+};
+
+// Guest memory whose pages are shared between copies until one of them
+// writes. Copying only takes a reference to every page, so any number of
+// copies can hold the same warm-up image and pay for the pages they change.
+// Copies may be used from different threads.
+class PagedMemory {
+public:
+	// All zero
+	PagedMemory();
+	explicit PagedMemory(const Memory &memory);
+
+	u8 read(u16 addr) const { return m_data[addr / MEMORY_PAGE_SIZE][addr % MEMORY_PAGE_SIZE]; }
+
+	void write(u16 addr, u8 value) {
+		size_t page = addr / MEMORY_PAGE_SIZE;
+		if (m_pages[page].use_count() != 1) {
+			own(page);
+		}
+
+		m_data[page][addr % MEMORY_PAGE_SIZE] = value;
+	}
+
+	// Copies `size` bytes to `addr` a page at a time; the range must fit in
+	// memory
+	void write(u16 addr, const u8 *data, size_t size);
+
+	// Sets [addr, addr + count) to `value`, clamped to the end of memory.
+	// Whole pages in the range share one copy afterwards.
+	void fill(size_t addr, size_t count, u8 value);
+	void fill(u8 value) { fill(0, MEMORY_CAPACITY, value); }
+
+	// True if both hold the very same page, so its contents are equal. Pages
+	// that compare false may still happen to hold the same bytes.
+	bool shares_page(const PagedMemory &other, size_t page) const { return m_pages[page] == other.m_pages[page]; }
+
+	// Makes the page refer to `other`'s copy
+	void share_page(const PagedMemory &other, size_t page) { set_page(page, other.m_pages[page]); }
+
+	const u8 *page_data(size_t page) const { return m_data[page]; }
+
+	// Pages no other copy refers to
+	size_t private_pages() const;
+private:
+	// Replaces a shared page with a private copy
+	void own(size_t page);
+
+	void set_page(size_t page, std::shared_ptr<MemoryPage> data) {
+		m_data[page] = data->data;
+		m_pages[page] = std::move(data);
+	}
+private:
+	std::array<std::shared_ptr<MemoryPage>, MEMORY_PAGE_COUNT> m_pages;
+	// m_pages[i]->data, so reads never touch a reference count
+	std::array<u8 *, MEMORY_PAGE_COUNT> m_data;
+};
@@ -0,0 +1,92 @@
+#include "ObjectFile.h"
+
+#include <cstring>
+
+#include "Memory.h"
+#include "Object.h"
+
+static u16 Get16(const u8 *in) {
+	return (u16)(in[0] | (in[1] << 8));
+}
+
+static u32 Get32(const u8 *in) {
+	return (u32)in[0] | ((u32)in[1] << 8) | ((u32)in[2] << 16) | ((u32)in[3] << 24);
+}
+
+bool ObjectFile::is_object(const MappedFile &file) {
+	return file.size() >= 4 && std::memcmp(file.data(), OBJECT_MAGIC, 4) == 0;
+}
+
+bool ObjectFile::parse(const MappedFile &file, std::string &error) {
+	const u8 *header = file.data();
+	if (file.size() < OBJECT_HEADER_SIZE || !is_object(file)) {
+		error = "not an R828 object";
+		return false;
+	}
+
+	if (Get16(header + 4) != OBJECT_VERSION) {
+		error = "unsupported object version";
+		return false;
+	}
+
+	if (!(Get16(header + 6) & RASM::OBJECT_EXECUTABLE) || Get16(header + 12) != 0) {
+		error = "object is not linked, run `rasm link` first";
+		return false;
+	}
+
+	u16 count = Get16(header + 8);
+	u16 symbol_count = Get16(header + 10);
+	u16 entry_segment = Get16(header + 14);
+	u16 entry_offset = Get16(header + 16);
+	u32 strings_size = Get32(header + 20);
+
+	size_t symbols_offset = OBJECT_HEADER_SIZE + (size_t)count * OBJECT_SEGMENT_SIZE;
+	size_t strings_offset = symbols_offset + (size_t)symbol_count * OBJECT_SYMBOL_SIZE;
+	if (file.size() < strings_offset + strings_size) {
+		error = "truncated tables";
+		return false;
+	}
+
+	m_segments.clear();
+	for (u16 i = 0; i < count; i++) {
+		const u8 *entry = header + OBJECT_HEADER_SIZE + i * OBJECT_SEGMENT_SIZE;
+		u16 base = Get16(entry + 6);
+		u32 offset = Get32(entry + 8);
+		u32 size = Get32(entry + 12);
+
+		if ((size_t)offset + size > file.size() || base + (size_t)size > MEMORY_CAPACITY) {
+			error = "segment out of bounds";
+			return false;
+		}
+
+		m_segments.push_back({ base, file.data() + offset, size });
+	}
+
+	const char *strings = reinterpret_cast<const char *>(file.data() + strings_offset);
+	m_symbols.clear();
+	for (u16 i = 0; i < symbol_count; i++) {
+		const u8 *entry = header + symbols_offset + i * OBJECT_SYMBOL_SIZE;
+		u32 name = Get32(entry);
+		u16 segment = Get16(entry + 4);
+		u16 offset = Get16(entry + 6);
+
+		const void *name_end = name < strings_size ? std::memchr(strings + name, '\0', strings_size - name) : nullptr;
+		if (!name_end || segment >= count) {
+			error = "bad symbol";
+			return false;
+		}
+
+		m_symbols.push_back({ std::string_view(strings + name, static_cast<const char *>(name_end) - (strings + name)),
+			(u16)(m_segments[segment].base + offset) });
+	}
+
+	if (entry_segment != OBJECT_NONE) {
+		if (entry_segment >= count) {
+			error = "bad entry point";
+			return false;
+		}
+		m_entry = m_segments[entry_segment].base + entry_offset;
+	}
+
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Core.h"
+#include "MappedFile.h"
+
+// Executables written by `rasm link`; the layout is described in
+// libs/RASM/src/Object.h. Segments point into the mapped file, so loading
+// one is a single copy from the page cache into guest memory.
+struct ObjectSegment {
+	u16 base;
+	const u8 *data;
+	size_t size;
+};
+
+// A label and the address it was linked at; the name points into the
+// mapped file
+struct ObjectSymbol {
+	std::string_view name;
+	u16 addr;
+};
+
+class ObjectFile {
+public:
+	// Whether the file starts with the object magic
+	static bool is_object(const MappedFile &file);
+
+	// Returns false with `error` set if the file is malformed or still
+	// needs linking
+	bool parse(const MappedFile &file, std::string &error);
+
+	const std::vector<ObjectSegment> &segments() const { return m_segments; }
+	const std::vector<ObjectSymbol> &symbols() const { return m_symbols; }
+	u16 entry() const { return m_entry; }
+private:
+	std::vector<ObjectSegment> m_segments;
+	std::vector<ObjectSymbol> m_symbols;
+	u16 m_entry = 0xD000;
+};
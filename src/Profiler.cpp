@@ -0,0 +1,102 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+Profiler::Profiler()
+	: m_pcs(MEMORY_CAPACITY), m_branches(MEMORY_CAPACITY), m_blocks(MEMORY_CAPACITY) {}
+
+// Addresses with a nonzero `cycles`, hottest first, at most `top` of them
+template <typename T, typename F>
+static std::vector<u32> Hottest(const std::vector<T> &counts, F cycles, size_t top) {
+	std::vector<u32> hot;
+	for (u32 addr = 0; addr < counts.size(); addr++) {
+		if (cycles(counts[addr]) != 0) hot.push_back(addr);
+	}
+
+	auto hotter = [&](u32 a, u32 b) {
+		return cycles(counts[a]) != cycles(counts[b]) ? cycles(counts[a]) > cycles(counts[b]) : a < b;
+	};
+
+	size_t count = std::min(top, hot.size());
+	std::partial_sort(hot.begin(), hot.begin() + count, hot.end(), hotter);
+	hot.resize(count);
+	return hot;
+}
+
+static double Percent(u64 part, u64 total) {
+	return total == 0 ? 0.0 : 100.0 * (double)part / (double)total;
+}
+
+void Profiler::report(std::ostream &out, const CPU &cpu, const SymbolTable &symbols, size_t top) const {
+	PagedMemory memory = cpu.snapshot().memory;
+	char line[256];
+
+	u64 total_cycles = 0;
+	u64 total_executions = 0;
+	struct OpcodeCounts { u64 executions; u64 cycles; };
+	std::vector<OpcodeCounts> opcodes(256);
+	for (u32 addr = 0; addr < MEMORY_CAPACITY; addr++) {
+		const PcCounts &counts = m_pcs[addr];
+		if (counts.executions == 0) continue;
+
+		total_cycles += counts.cycles;
+		total_executions += counts.executions;
+
+		OpcodeCounts &opcode = opcodes[memory.read((u16)addr)];
+		opcode.executions += counts.executions;
+		opcode.cycles += counts.cycles;
+	}
+
+	std::snprintf(line, sizeof(line), "Profile: %llu instructions, %llu cycles\n",
+		(unsigned long long)total_executions, (unsigned long long)total_cycles);
+	out << line;
+
+	out << "\nHot blocks\n";
+	std::snprintf(line, sizeof(line), "%14s %7s %12s  %-11s %s\n", "cycles", "%", "runs", "block", "label");
+	out << line;
+	for (u32 start : Hottest(m_blocks, [](const BlockCounts &b) { return b.cycles; }, top)) {
+		const BlockCounts &block = m_blocks[start];
+		std::snprintf(line, sizeof(line), "%14llu %6.2f%% %12llu  %04X-%04X  %s\n",
+			(unsigned long long)block.cycles, Percent(block.cycles, total_cycles), (unsigned long long)block.runs,
+			start, (u16)(start + block.length - 1), symbols.describe((u16)start).c_str());
+		out << line;
+	}
+
+	out << "\nHot instructions\n";
+	std::snprintf(line, sizeof(line), "%14s %7s %12s  %-4s  %-22s %-20s %s\n", "cycles", "%", "executions", "pc", "instruction", "label", "taken/not taken");
+	out << line;
+	for (u32 addr : Hottest(m_pcs, [](const PcCounts &p) { return p.cycles; }, top)) {
+		const PcCounts &counts = m_pcs[addr];
+
+		u8 code[MAX_INST_LENGTH];
+		for (size_t i = 0; i < MAX_INST_LENGTH; i++) code[i] = memory.read((u16)(addr + i));
+		std::string text;
+		if (ISA::Disassemble(code, sizeof(code), text) == 0) text = "??";
+
+		std::string branch;
+		const BranchCounts &branches = m_branches[addr];
+		if (branches.taken + branches.not_taken != 0) {
+			branch = std::to_string(branches.taken) + "/" + std::to_string(branches.not_taken);
+		}
+
+		std::snprintf(line, sizeof(line), "%14llu %6.2f%% %12llu  %04X  %-22s %-20s %s\n",
+			(unsigned long long)counts.cycles, Percent(counts.cycles, total_cycles), (unsigned long long)counts.executions,
+			addr, text.c_str(), symbols.describe((u16)addr).c_str(), branch.c_str());
+		out << line;
+	}
+
+	out << "\nOpcodes\n";
+	std::snprintf(line, sizeof(line), "%14s %7s %12s  %s\n", "cycles", "%", "executions", "opcode");
+	out << line;
+	for (u32 opcode : Hottest(opcodes, [](const OpcodeCounts &o) { return o.cycles; }, opcodes.size())) {
+		const ISA::OpcodeForms &forms = ISA::OPCODE_FORMS[opcode];
+		std::string name = forms.count ? std::string(ISA::FORMS[forms.first].mnemonic) : "??";
+
+		std::snprintf(line, sizeof(line), "%14llu %6.2f%% %12llu  %02X %s\n",
+			(unsigned long long)opcodes[opcode].cycles, Percent(opcodes[opcode].cycles, total_cycles),
+			(unsigned long long)opcodes[opcode].executions, opcode, name.c_str());
+		out << line;
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+#include "Core.h"
+#include "CPU.h"
+#include "Symbols.h"
+
+// Profiling policy for CPU::run: counts executions and cycles per
+// instruction address, dispatches and cycles per block, and how often each
+// JZ/JNZ was taken. Counts accumulate over every run it is passed to. The
+// tables cover the whole address space, about 3.5 MB.
+class Profiler {
+public:
+	static constexpr bool enabled = true;
+	static constexpr bool per_instruction = false;
+
+	Profiler();
+
+	void dispatched(u16 start) {
+		m_block = start;
+		m_blocks[start].runs++;
+	}
+
+	// [first, end) ran straight through from `addr`. Only the last of them
+	// can be a branch, and the flags it tested are still in `cpu`.
+	void executed(u16 addr, const DecodedInst *first, const DecodedInst *end, const CPU &cpu) {
+		u64 cycles = 0;
+		const DecodedInst *inst = first;
+		for (; inst + 1 != end; inst++) {
+			count(addr, *inst);
+			cycles += inst->cycles;
+			addr += inst->length;
+		}
+
+		count(addr, *inst);
+		cycles += inst->cycles;
+		if (inst->handler == CPU::H_JZ || inst->handler == CPU::H_JNZ) {
+			bool taken = (inst->handler == CPU::H_JZ) == (cpu.equal == 0);
+			(taken ? m_branches[addr].taken : m_branches[addr].not_taken)++;
+		}
+
+		BlockCounts &block = m_blocks[m_block];
+		block.cycles += cycles;
+		block.length = std::max<u16>(block.length, (u16)(addr + inst->length - m_block));
+	}
+
+	// Hot blocks, instructions and opcodes by the cycles they took, the
+	// first two cut to `top` entries. Instructions are disassembled from the
+	// CPU's memory as it is now and labelled from `symbols`.
+	void report(std::ostream &out, const CPU &cpu, const SymbolTable &symbols, size_t top = 40) const;
+private:
+	void count(u16 addr, const DecodedInst &inst) {
+		m_pcs[addr].executions++;
+		m_pcs[addr].cycles += inst.cycles;
+	}
+private:
+	struct PcCounts {
+		u64 executions;
+		u64 cycles;
+	};
+
+	struct BranchCounts {
+		u64 taken;
+		u64 not_taken;
+	};
+
+	struct BlockCounts {
+		u64 runs;
+		u64 cycles;
+		u16 length;
+	};
+
+	std::vector<PcCounts> m_pcs;
+	std::vector<BranchCounts> m_branches;
+	std::vector<BlockCounts> m_blocks;
+
+	// Start of the block being executed
+	u16 m_block = 0;
+};
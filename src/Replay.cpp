@@ -0,0 +1,397 @@
+#include "Replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+#define REPLAY_HEADER_SIZE 16
+
+namespace {
+	void Put16(std::vector<u8> &out, u16 value) {
+		out.push_back(value & 0xFF);
+		out.push_back(value >> 8);
+	}
+
+	void Put64(std::vector<u8> &out, u64 value) {
+		for (int i = 0; i < 8; i++) out.push_back((value >> (i * 8)) & 0xFF);
+	}
+
+	// Bounds-checked little-endian reads; every read fails once one has
+	struct Cursor {
+		const u8 *at;
+		const u8 *end;
+		bool ok = true;
+
+		bool has(size_t count) {
+			ok = ok && (size_t)(end - at) >= count;
+			return ok;
+		}
+
+		u8 get8() {
+			if (!has(1)) return 0;
+			return *at++;
+		}
+
+		u16 get16() {
+			if (!has(2)) return 0;
+			u16 value = (u16)(at[0] | (at[1] << 8));
+			at += 2;
+			return value;
+		}
+
+		u64 get64() {
+			if (!has(8)) return 0;
+			u64 value = 0;
+			for (int i = 0; i < 8; i++) value |= (u64)at[i] << (i * 8);
+			at += 8;
+			return value;
+		}
+	};
+
+	void PutState(std::vector<u8> &out, const CPU::Snapshot &state) {
+		Put16(out, state.pc);
+		Put16(out, state.sp);
+		Put16(out, state.fbs);
+		for (int i = 0; i < 6; i++) Put16(out, state.regs_u16[i]);
+		for (int i = 0; i < 4; i++) out.push_back(state.regs_u8[i]);
+		out.push_back(state.equal | (state.zero << 1) | (state.decimal << 2) | (state.sign << 3)
+			| (state.carry << 4) | (state.overflow << 5) | (state.interrupt << 6) | (state.breakf << 7));
+		out.push_back(state.irq_pending);
+		Put64(out, state.cycle);
+		Put16(out, state.block_rest);
+	}
+
+	void GetState(Cursor &in, CPU::Snapshot &state) {
+		state.pc = in.get16();
+		state.sp = in.get16();
+		state.fbs = in.get16();
+		for (int i = 0; i < 6; i++) state.regs_u16[i] = in.get16();
+		for (int i = 0; i < 4; i++) state.regs_u8[i] = in.get8();
+
+		u8 flags = in.get8();
+		state.equal = flags & 1;
+		state.zero = (flags >> 1) & 1;
+		state.decimal = (flags >> 2) & 1;
+		state.sign = (flags >> 3) & 1;
+		state.carry = (flags >> 4) & 1;
+		state.overflow = (flags >> 5) & 1;
+		state.interrupt = (flags >> 6) & 1;
+		state.breakf = (flags >> 7) & 1;
+		state.irq_pending = in.get8();
+		state.cycle = in.get64();
+		state.block_rest = in.get16();
+	}
+
+	// Reads the pages of a snapshot entry on top of `memory`
+	void GetPages(Cursor &in, PagedMemory &memory) {
+		u16 count = in.get16();
+		for (u16 i = 0; i < count && in.has(1 + MEMORY_PAGE_SIZE); i++) {
+			u8 page = in.get8();
+			memory.write((u16)(page * MEMORY_PAGE_SIZE), in.at, MEMORY_PAGE_SIZE);
+			in.at += MEMORY_PAGE_SIZE;
+		}
+	}
+
+	bool SameState(const CPU::Snapshot &a, const CPU::Snapshot &b) {
+		if (a.pc != b.pc || a.sp != b.sp || a.fbs != b.fbs
+			|| std::memcmp(a.regs_u16, b.regs_u16, sizeof(a.regs_u16)) != 0
+			|| std::memcmp(a.regs_u8, b.regs_u8, sizeof(a.regs_u8)) != 0
+			|| a.equal != b.equal || a.zero != b.zero || a.decimal != b.decimal || a.sign != b.sign
+			|| a.carry != b.carry || a.overflow != b.overflow || a.interrupt != b.interrupt || a.breakf != b.breakf
+			|| a.irq_pending != b.irq_pending || a.cycle != b.cycle || a.block_rest != b.block_rest) {
+			return false;
+		}
+
+		for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+			if (a.memory.shares_page(b.memory, page)) continue;
+			if (std::memcmp(a.memory.page_data(page), b.memory.page_data(page), MEMORY_PAGE_SIZE) != 0) return false;
+		}
+
+		return true;
+	}
+}
+
+Recorder::Recorder(const std::string &path, u64 interval, ReplayDevices devices)
+	: m_file(path, std::ios::binary), m_interval(std::max<u64>(interval, 1)), m_devices(std::move(devices)),
+	m_memory(CPU::reset_memory()) {
+	if (!m_file) {
+		std::cerr << "Failed to open recording: " << path << std::endl;
+		exit(1);
+	}
+
+	std::vector<u8> header(REPLAY_MAGIC, REPLAY_MAGIC + 4);
+	Put16(header, REPLAY_VERSION);
+	Put16(header, 0);
+	Put64(header, m_interval);
+	m_file.write(reinterpret_cast<const char *>(header.data()), header.size());
+}
+
+CPU::StopReason Recorder::run(CPU &cpu, size_t &cycles) {
+	write_devices(cpu);
+
+	m_file.put('S');
+	write_snapshot(cpu.snapshot());
+
+	// Cycles executed so far, which may pass the budget by one instruction
+	u64 budget = cycles;
+	u64 used = 0;
+
+	CPU::StopReason reason = CPU::BUDGET_EXHAUSTED;
+	while (used < budget) {
+		u64 next = (m_cycle / m_interval + 1) * m_interval;
+		size_t slice = (size_t)std::min(budget - used, next - m_cycle);
+		size_t left = slice;
+		reason = cpu.run(left);
+
+		u64 executed = slice - left + cpu.overshoot();
+		m_cycle += executed;
+		used += executed;
+		if (reason != CPU::BUDGET_EXHAUSTED || used >= budget) break;
+
+		m_file.put('S');
+		write_snapshot(cpu.snapshot());
+	}
+	cycles = (size_t)(budget - std::min(used, budget));
+
+	m_file.put('E');
+	m_file.put((char)reason);
+	m_file.put((char)(reason == CPU::FAULT ? cpu.fault() : CPU::FAULT_NONE));
+	write_snapshot(cpu.snapshot());
+	m_file.flush();
+
+	return reason;
+}
+
+// Interrupt vectors are only known once the CPU is set up, so the device
+// part of the header is written when the run starts
+void Recorder::write_devices(const CPU &cpu) {
+	std::vector<u8> header;
+	header.push_back((u8)m_devices.timers.size());
+	for (const Timer *timer : m_devices.timers) {
+		Put64(header, timer->period());
+		header.push_back(timer->periodic());
+	}
+
+	for (u8 line = 0; line < CPU_IRQ_LINES; line++) {
+		Put16(header, cpu.irq_vector(line));
+	}
+
+	header.push_back(m_devices.framebuffer != nullptr);
+	if (m_devices.framebuffer) {
+		Put16(header, m_devices.framebuffer_addr);
+	}
+
+	m_file.write(reinterpret_cast<const char *>(header.data()), header.size());
+}
+
+void Recorder::write_snapshot(const CPU::Snapshot &state) {
+	std::vector<u8> entry;
+	Put64(entry, m_cycle);
+	PutState(entry, state);
+
+	for (const Timer *timer : m_devices.timers) {
+		Put64(entry, timer->deadline());
+	}
+
+	if (const Framebuffer *framebuffer = m_devices.framebuffer) {
+		const u8 *pixels = framebuffer->pixels();
+		bool changed = m_pixels.empty() || std::memcmp(m_pixels.data(), pixels, FRAMEBUFFER_SIZE) != 0;
+		entry.push_back(changed);
+		if (changed) {
+			m_pixels.assign(pixels, pixels + FRAMEBUFFER_SIZE);
+			entry.insert(entry.end(), pixels, pixels + FRAMEBUFFER_SIZE);
+		}
+	}
+
+	size_t count_at = entry.size();
+	Put16(entry, 0);
+
+	u16 count = 0;
+	for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		if (state.memory.shares_page(m_memory, page)) continue;
+
+		const u8 *data = state.memory.page_data(page);
+		if (std::memcmp(data, m_memory.page_data(page), MEMORY_PAGE_SIZE) != 0) {
+			entry.push_back((u8)page);
+			entry.insert(entry.end(), data, data + MEMORY_PAGE_SIZE);
+			count++;
+		}
+
+		// Holding the CPU's page keeps it shared until the CPU writes it again
+		m_memory.share_page(state.memory, page);
+	}
+
+	entry[count_at] = count & 0xFF;
+	entry[count_at + 1] = count >> 8;
+	m_file.write(reinterpret_cast<const char *>(entry.data()), entry.size());
+}
+
+bool Replay::open(const std::string &path, std::string &error) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		error = "cannot open file";
+		return false;
+	}
+
+	std::vector<u8> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (data.size() < REPLAY_HEADER_SIZE || std::memcmp(data.data(), REPLAY_MAGIC, 4) != 0) {
+		error = "not a recording";
+		return false;
+	}
+
+	Cursor in { data.data() + 4, data.data() + data.size() };
+	u16 version = in.get16();
+	if (version != REPLAY_VERSION) {
+		error = "unsupported recording version " + std::to_string(version);
+		return false;
+	}
+	in.get16();
+	m_interval = in.get64();
+
+	u8 timers = in.get8();
+	if (timers > CPU_IRQ_LINES) {
+		error = "too many timers in recording";
+		return false;
+	}
+	for (u8 i = 0; i < timers; i++) {
+		u64 period = in.get64();
+		m_timer_setup.emplace_back(period, in.get8() != 0);
+	}
+	for (u8 line = 0; line < CPU_IRQ_LINES; line++) {
+		m_irq_vectors[line] = in.get16();
+	}
+	m_has_framebuffer = in.get8() != 0;
+	if (m_has_framebuffer) {
+		m_framebuffer_addr = in.get16();
+	}
+
+	PagedMemory memory = CPU::reset_memory();
+	std::shared_ptr<const std::vector<u8>> pixels;
+	if (m_has_framebuffer) {
+		pixels = std::make_shared<const std::vector<u8>>(FRAMEBUFFER_SIZE, 0xFF);
+	}
+	bool ended = false;
+	while (in.ok && in.at != in.end && !ended) {
+		u8 tag = in.get8();
+		ReplaySnapshot snapshot {};
+		if (tag == 'E') {
+			m_reason = (CPU::StopReason)in.get8();
+			m_fault = (CPU::Fault)in.get8();
+			ended = true;
+		} else if (tag != 'S') {
+			error = "unknown entry in recording";
+			return false;
+		}
+
+		snapshot.cycle = in.get64();
+		GetState(in, snapshot.state);
+
+		for (u8 i = 0; i < timers; i++) {
+			snapshot.timers.push_back(in.get64());
+		}
+
+		if (m_has_framebuffer && in.get8() && in.has(FRAMEBUFFER_SIZE)) {
+			pixels = std::make_shared<const std::vector<u8>>(in.at, in.at + FRAMEBUFFER_SIZE);
+			in.at += FRAMEBUFFER_SIZE;
+		}
+		snapshot.pixels = pixels;
+
+		GetPages(in, memory);
+		snapshot.state.memory = memory;
+
+		if (ended) {
+			m_end = std::move(snapshot);
+		} else {
+			m_snapshots.push_back(std::move(snapshot));
+		}
+	}
+
+	if (!in.ok || !ended || m_snapshots.empty()) {
+		error = "recording is cut short";
+		return false;
+	}
+
+	return true;
+}
+
+CPU::StopReason Replay::seek(CPU &cpu, u64 cycle) {
+	cycle = std::min(cycle, length());
+
+	auto after = std::upper_bound(m_snapshots.begin(), m_snapshots.end(), cycle,
+		[](u64 cycle, const ReplaySnapshot &snapshot) { return cycle < snapshot.cycle; });
+	const ReplaySnapshot &from = after[-1];
+	restore(cpu, from);
+
+	size_t budget = (size_t)(cycle - from.cycle);
+	if (budget == 0) return CPU::BUDGET_EXHAUSTED;
+	return cpu.run(budget);
+}
+
+bool Replay::verify(CPU &cpu, u64 &cycle) {
+	restore(cpu, m_snapshots[0]);
+
+	for (size_t i = 1; i <= m_snapshots.size(); i++) {
+		const ReplaySnapshot &next = i < m_snapshots.size() ? m_snapshots[i] : m_end;
+		size_t budget = (size_t)(next.cycle - m_snapshots[i - 1].cycle);
+
+		CPU::StopReason reason = CPU::BUDGET_EXHAUSTED;
+		if (budget > 0) reason = cpu.run(budget);
+
+		bool same = reproduces(cpu, next);
+		if (&next == &m_end) same = same && reason == m_reason && (reason != CPU::FAULT || cpu.fault() == m_fault);
+		if (!same) {
+			cycle = next.cycle;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Replay::attach(CPU &cpu) {
+	if (m_cpu == &cpu) return;
+
+	// Timers cancel their events as they go, so the scheduler is left empty
+	m_timers.clear();
+	m_framebuffer.reset();
+	m_cpu = &cpu;
+
+	for (u8 line = 0; line < CPU_IRQ_LINES; line++) {
+		cpu.set_irq_vector(line, m_irq_vectors[line]);
+	}
+
+	for (size_t line = 0; line < m_timer_setup.size(); line++) {
+		m_timers.push_back(std::make_unique<Timer>(cpu, m_scheduler, (u8)line));
+	}
+
+	if (m_has_framebuffer) {
+		m_framebuffer = std::make_unique<Framebuffer>();
+		cpu.map_device(m_framebuffer_addr, FRAMEBUFFER_SIZE, *m_framebuffer);
+	}
+
+	cpu.set_scheduler(m_timers.empty() ? nullptr : &m_scheduler);
+}
+
+void Replay::restore(CPU &cpu, const ReplaySnapshot &snapshot) {
+	attach(cpu);
+
+	cpu.restore(snapshot.state);
+	for (size_t i = 0; i < m_timers.size(); i++) {
+		m_timers[i]->start_at(snapshot.timers[i], m_timer_setup[i].first, m_timer_setup[i].second);
+	}
+
+	if (m_framebuffer) {
+		m_framebuffer->load_pixels(snapshot.pixels->data());
+	}
+}
+
+bool Replay::reproduces(const CPU &cpu, const ReplaySnapshot &snapshot) const {
+	if (!SameState(cpu.snapshot(), snapshot.state)) return false;
+
+	for (size_t i = 0; i < m_timers.size(); i++) {
+		if (m_timers[i]->deadline() != snapshot.timers[i]) return false;
+	}
+
+	return !m_framebuffer || std::memcmp(m_framebuffer->pixels(), snapshot.pixels->data(), FRAMEBUFFER_SIZE) == 0;
+}
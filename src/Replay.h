@@ -0,0 +1,137 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Core.h"
+#include "CPU.h"
+#include "Framebuffer.h"
+#include "Scheduler.h"
+#include "Timer.h"
+
+#define REPLAY_MAGIC "R8RP"
+#define REPLAY_VERSION 2
+// Default cycles between snapshots
+#define REPLAY_SNAPSHOT_INTERVAL 1'000'000
+
+// Guest time in a recording is the cycles executed since it started. A
+// snapshot is taken at the first instruction boundary at or after each
+// multiple of the interval, and the state at any cycle is the one at the
+// first boundary at or after it, where run() with that budget stops.
+struct ReplaySnapshot {
+	u64 cycle;
+	CPU::Snapshot state;
+
+	// CPU cycle each timer next expires at, Scheduler::NEVER when stopped
+	std::vector<u64> timers;
+	// Framebuffer contents, shared by snapshots it did not change between;
+	// empty without a framebuffer
+	std::shared_ptr<const std::vector<u8>> pixels;
+};
+
+// Devices attached to the CPU a run is recorded on. Timers are on IRQ lines
+// in order, as `run --timer` sets them up; the framebuffer is mapped at
+// `framebuffer_addr`. None takes host input, so their state in the
+// snapshots is all a replay needs.
+struct ReplayDevices {
+	std::vector<const Timer *> timers;
+	const Framebuffer *framebuffer = nullptr;
+	u16 framebuffer_addr = 0;
+};
+
+// Recording file: REPLAY_MAGIC, u16 version, u16 0, u64 snapshot interval,
+// then the devices: u8 timer count, per timer u64 period and u8 periodic,
+// CPU_IRQ_LINES u16 interrupt vectors, and u8 1 and the u16 address of a
+// framebuffer or u8 0. Then entries, each a tag byte and its fields, all
+// little-endian:
+//   'S' snapshot: u64 cycle, registers and flags, u8 pending interrupt
+//       lines, u64 CPU cycle, u16 instructions left of the current block,
+//       u64 next expiry per timer, then with a
+//       framebuffer u8 1 and FRAMEBUFFER_SIZE bytes of pixels, or u8 0 if
+//       they are as in the previous snapshot. Then u16 page count and
+//       count pages of u8 index and MEMORY_PAGE_SIZE bytes. Pages not listed
+//       are as in the previous snapshot, or CPU::reset_memory() for the first.
+//   'E' end: u8 stop reason, u8 fault, then a snapshot of the final state
+//       laid out like 'S'
+class Recorder {
+public:
+	// Exits if `path` cannot be written. `devices` must stay attached to the
+	// CPU for the whole run.
+	Recorder(const std::string &path, u64 interval = REPLAY_SNAPSHOT_INTERVAL, ReplayDevices devices = {});
+
+	// CPU::run() on `cpu`, snapshotting it every `interval` cycles and at the
+	// end. It executes exactly what one CPU::run() with the same budget
+	// would. A recording holds one run; the file is complete once this
+	// returns.
+	CPU::StopReason run(CPU &cpu, size_t &cycles);
+
+	u64 cycle() const { return m_cycle; }
+private:
+	void write_devices(const CPU &cpu);
+	void write_snapshot(const CPU::Snapshot &state);
+private:
+	std::ofstream m_file;
+	u64 m_interval;
+	u64 m_cycle = 0;
+	ReplayDevices m_devices;
+
+	// What the file says memory and the framebuffer hold, for writing only
+	// what changed since
+	PagedMemory m_memory;
+	std::vector<u8> m_pixels;
+};
+
+// A recording read back whole
+class Replay {
+public:
+	// Returns false with `error` set if the file is missing, not a recording
+	// or cut short
+	bool open(const std::string &path, std::string &error);
+
+	u64 interval() const { return m_interval; }
+	// Cycles the recorded run used
+	u64 length() const { return m_end.cycle; }
+	CPU::StopReason reason() const { return m_reason; }
+	CPU::Fault fault() const { return m_fault; }
+
+	std::span<const ReplaySnapshot> snapshots() const { return m_snapshots; }
+	const ReplaySnapshot &end() const { return m_end; }
+
+	// Both attach copies of the recorded devices to `cpu`, which keeps using
+	// them, so the Replay must outlive its runs. Given another CPU they move
+	// to it, and the first may not run again.
+
+	// Puts `cpu` in its recorded state at `cycle`, at most length(): restores
+	// the nearest snapshot at or before it and runs forward
+	CPU::StopReason seek(CPU &cpu, u64 cycle);
+
+	// Runs the whole recording again from the first snapshot in the same
+	// stretches and checks every snapshot along the way. Returns false with
+	// `cycle` set to the first one the replay does not reproduce.
+	bool verify(CPU &cpu, u64 &cycle);
+private:
+	void attach(CPU &cpu);
+	void restore(CPU &cpu, const ReplaySnapshot &snapshot);
+	bool reproduces(const CPU &cpu, const ReplaySnapshot &snapshot) const;
+private:
+	u64 m_interval = 0;
+	std::vector<ReplaySnapshot> m_snapshots;
+	ReplaySnapshot m_end {};
+	CPU::StopReason m_reason = CPU::HALTED;
+	CPU::Fault m_fault = CPU::FAULT_NONE;
+
+	// The devices as recorded: period and periodic of each timer
+	std::vector<std::pair<u64, bool>> m_timer_setup;
+	u16 m_irq_vectors[CPU_IRQ_LINES] = {};
+	bool m_has_framebuffer = false;
+	u16 m_framebuffer_addr = 0;
+
+	// Rebuilt around the CPU first given to seek() or verify()
+	CPU *m_cpu = nullptr;
+	Scheduler m_scheduler;
+	std::vector<std::unique_ptr<Timer>> m_timers;
+	std::unique_ptr<Framebuffer> m_framebuffer;
+};
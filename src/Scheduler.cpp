@@ -0,0 +1,41 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+
+u64 Scheduler::schedule(u64 cycle, Callback callback) {
+	u64 id = m_next_id++;
+	m_events.push_back({ cycle, id, std::move(callback) });
+	std::push_heap(m_events.begin(), m_events.end(), Later);
+	return id;
+}
+
+void Scheduler::cancel(u64 id) {
+	bool pending = std::any_of(m_events.begin(), m_events.end(), [id](const Event &event) { return event.id == id; });
+	if (pending) {
+		m_cancelled.insert(id);
+		prune();
+	}
+}
+
+u64 Scheduler::next() {
+	prune();
+	return m_events.empty() ? NEVER : m_events.front().cycle;
+}
+
+void Scheduler::run_until(u64 now) {
+	while (next() <= now) {
+		std::pop_heap(m_events.begin(), m_events.end(), Later);
+		Event event = std::move(m_events.back());
+		m_events.pop_back();
+
+		event.callback(event.cycle);
+	}
+}
+
+void Scheduler::prune() {
+	while (!m_events.empty() && m_cancelled.count(m_events.front().id)) {
+		m_cancelled.erase(m_events.front().id);
+		std::pop_heap(m_events.begin(), m_events.end(), Later);
+		m_events.pop_back();
+	}
+}
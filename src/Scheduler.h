@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+#include "Core.h"
+
+// Pending events by the absolute CPU cycle they are due at (see
+// CPU::cycle()). A CPU with a scheduler attached only compares its budget
+// against the next deadline between blocks, so devices cost nothing while
+// none of their events are due; an event fires at the first block boundary
+// at or after its cycle.
+class Scheduler {
+public:
+	// Called with the cycle the event was scheduled for, which may be a
+	// little before the CPU's current cycle
+	using Callback = std::function<void(u64 cycle)>;
+
+	static constexpr u64 NEVER = UINT64_MAX;
+
+	// Events due at the same cycle fire in the order they were scheduled.
+	// Returns an id for cancel().
+	u64 schedule(u64 cycle, Callback callback);
+
+	// Ids of events that already fired or were cancelled are ignored
+	void cancel(u64 id);
+
+	// Cycle of the earliest pending event, or NEVER
+	u64 next();
+
+	// Fires every event due at or before `now`, including ones scheduled by
+	// the callbacks themselves
+	void run_until(u64 now);
+private:
+	struct Event {
+		u64 cycle;
+		u64 id;
+		Callback callback;
+	};
+
+	// Min-heap on (cycle, id)
+	static bool Later(const Event &a, const Event &b) {
+		return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+	}
+
+	// Drops cancelled events off the top of the heap
+	void prune();
+private:
+	std::vector<Event> m_events;
+	std::unordered_set<u64> m_cancelled;
+	u64 m_next_id = 0;
+};
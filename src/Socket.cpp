@@ -0,0 +1,250 @@
+#include "Socket.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#include <afunix.h>
+#else
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <arpa/inet.h>
+	#include <poll.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+	typedef SOCKET Handle;
+
+	void CloseSocket(Handle handle) { closesocket(handle); }
+
+	bool StartSockets() {
+		static const bool started = [] {
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return started;
+	}
+#else
+	typedef int Handle;
+
+	void CloseSocket(Handle handle) { ::close(handle); }
+
+	bool StartSockets() { return true; }
+#endif
+
+	enum PathKind { PATH_MISSING, PATH_SOCKET, PATH_OTHER };
+
+	// What is at `path`; Unix sockets on Windows are reparse points
+	PathKind ClassifyPath(const std::string &path) {
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		if (attributes == INVALID_FILE_ATTRIBUTES) return PATH_MISSING;
+		return attributes & FILE_ATTRIBUTE_REPARSE_POINT ? PATH_SOCKET : PATH_OTHER;
+#else
+		struct stat info;
+		if (lstat(path.c_str(), &info) != 0) return PATH_MISSING;
+		return S_ISSOCK(info.st_mode) ? PATH_SOCKET : PATH_OTHER;
+#endif
+	}
+
+	bool IsPort(const std::string &address) {
+		if (address.empty() || address.size() > 5) return false;
+		for (char c : address) {
+			if (c < '0' || c > '9') return false;
+		}
+		return std::stoul(address) <= 0xFFFF;
+	}
+
+	// Fills `storage` with the address `address` names
+	bool Resolve(const std::string &address, sockaddr_storage &storage, socklen_t &length, std::string &error) {
+		std::memset(&storage, 0, sizeof(storage));
+
+		if (IsPort(address)) {
+			sockaddr_in &in = reinterpret_cast<sockaddr_in &>(storage);
+			in.sin_family = AF_INET;
+			in.sin_port = htons((u16)std::stoul(address));
+			in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			length = sizeof(sockaddr_in);
+			return true;
+		}
+
+		sockaddr_un &un = reinterpret_cast<sockaddr_un &>(storage);
+		if (address.size() >= sizeof(un.sun_path)) {
+			error = "socket path is too long";
+			return false;
+		}
+		un.sun_family = AF_UNIX;
+		std::memcpy(un.sun_path, address.c_str(), address.size() + 1);
+		length = sizeof(sockaddr_un);
+		return true;
+	}
+}
+
+Socket::~Socket() {
+	close();
+}
+
+Socket::Socket(Socket &&other) noexcept
+	: m_handle(std::exchange(other.m_handle, INVALID)), m_unix_path(std::move(other.m_unix_path)) {}
+
+Socket &Socket::operator=(Socket &&other) noexcept {
+	if (this != &other) {
+		close();
+		m_handle = std::exchange(other.m_handle, INVALID);
+		m_unix_path = std::move(other.m_unix_path);
+	}
+
+	return *this;
+}
+
+bool Socket::listen(const std::string &address, std::string &error) {
+	close();
+
+	sockaddr_storage storage;
+	socklen_t length;
+	if (!StartSockets() || !Resolve(address, storage, length, error)) {
+		if (error.empty()) error = "sockets are unavailable";
+		return false;
+	}
+
+	if (storage.ss_family == AF_UNIX) {
+		// Only a socket left behind by an earlier listener is replaced;
+		// anything else at the path is the user's
+		PathKind kind = ClassifyPath(address);
+		if (kind == PATH_OTHER) {
+			error = "address in use: " + address;
+			return false;
+		}
+		if (kind == PATH_SOCKET) {
+			::remove(address.c_str());
+		}
+	}
+
+	Handle handle = socket(storage.ss_family, SOCK_STREAM, 0);
+	if (handle == (Handle)INVALID) {
+		error = "cannot create socket";
+		return false;
+	}
+
+	if (storage.ss_family == AF_INET) {
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+	}
+
+	if (bind(handle, reinterpret_cast<const sockaddr *>(&storage), length) != 0 || ::listen(handle, 16) != 0) {
+		CloseSocket(handle);
+		error = "cannot listen on " + address;
+		return false;
+	}
+
+	m_handle = (intptr_t)handle;
+	if (storage.ss_family == AF_UNIX) {
+		m_unix_path = address;
+	}
+	return true;
+}
+
+bool Socket::connect(const std::string &address, std::string &error) {
+	close();
+
+	sockaddr_storage storage;
+	socklen_t length;
+	if (!StartSockets() || !Resolve(address, storage, length, error)) {
+		if (error.empty()) error = "sockets are unavailable";
+		return false;
+	}
+
+	Handle handle = socket(storage.ss_family, SOCK_STREAM, 0);
+	if (handle == (Handle)INVALID) {
+		error = "cannot create socket";
+		return false;
+	}
+
+	if (::connect(handle, reinterpret_cast<const sockaddr *>(&storage), length) != 0) {
+		CloseSocket(handle);
+		error = "cannot connect to " + address;
+		return false;
+	}
+
+	if (storage.ss_family == AF_INET) {
+		// Requests and replies are small and latency bound
+		int nodelay = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&nodelay), sizeof(nodelay));
+	}
+
+	m_handle = (intptr_t)handle;
+	return true;
+}
+
+bool Socket::accept(Socket &client) {
+	Handle handle = ::accept((Handle)m_handle, nullptr, nullptr);
+	if (handle == (Handle)INVALID) return false;
+
+	int nodelay = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&nodelay), sizeof(nodelay));
+
+	client.close();
+	client.m_handle = (intptr_t)handle;
+	return true;
+}
+
+size_t Socket::receive(u8 *data, size_t size) {
+	while (true) {
+		auto received = recv((Handle)m_handle, reinterpret_cast<char *>(data), (int)size, 0);
+		if (received > 0) return (size_t)received;
+#ifndef _WIN32
+		if (received < 0 && errno == EINTR) continue;
+#endif
+		return 0;
+	}
+}
+
+bool Socket::send(const u8 *data, size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		int sent = ::send((Handle)m_handle, reinterpret_cast<const char *>(data), (int)size, 0);
+#else
+		ssize_t sent = ::send((Handle)m_handle, data, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+#endif
+		if (sent <= 0) return false;
+
+		data += sent;
+		size -= (size_t)sent;
+	}
+
+	return true;
+}
+
+bool Socket::readable(int timeout_ms) {
+#ifdef _WIN32
+	WSAPOLLFD entry { (Handle)m_handle, POLLRDNORM, 0 };
+	return WSAPoll(&entry, 1, timeout_ms) > 0;
+#else
+	pollfd entry { (Handle)m_handle, POLLIN, 0 };
+	return poll(&entry, 1, timeout_ms) > 0;
+#endif
+}
+
+void Socket::close() {
+	if (m_handle != INVALID) {
+		CloseSocket((Handle)m_handle);
+	}
+
+	// The path may have been replaced since listen()
+	if (!m_unix_path.empty() && ClassifyPath(m_unix_path) == PATH_SOCKET) {
+		::remove(m_unix_path.c_str());
+	}
+
+	m_handle = INVALID;
+	m_unix_path.clear();
+}
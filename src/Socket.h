@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+#include "Core.h"
+
+// A blocking stream socket. Addresses are either a port number, meaning TCP
+// on 127.0.0.1, or a path for a Unix domain socket.
+class Socket {
+public:
+	Socket() = default;
+	~Socket();
+
+	Socket(Socket &&other) noexcept;
+	Socket &operator=(Socket &&other) noexcept;
+
+	Socket(const Socket &) = delete;
+	Socket &operator=(const Socket &) = delete;
+
+	// Return false with `error` set on failure. A Unix socket left over at
+	// `address` by an earlier listener is replaced; any other file there
+	// makes listen() fail.
+	bool listen(const std::string &address, std::string &error);
+	bool connect(const std::string &address, std::string &error);
+
+	// Blocks for the next connection to a listening socket
+	bool accept(Socket &client);
+
+	// Blocks until some bytes arrive. Returns 0 once the peer has closed the
+	// connection or it failed.
+	size_t receive(u8 *data, size_t size);
+	// Sends all of `data`; false if the connection failed
+	bool send(const u8 *data, size_t size);
+	bool send(const std::string &data) { return send(reinterpret_cast<const u8 *>(data.data()), data.size()); }
+
+	// Whether receive() would not block, waiting up to `timeout_ms`
+	bool readable(int timeout_ms);
+
+	void close();
+	bool is_open() const { return m_handle != INVALID; }
+private:
+	static constexpr intptr_t INVALID = -1;
+
+	intptr_t m_handle = INVALID;
+	// Unlinked on close by the listener that created it
+	std::string m_unix_path;
+};
@@ -0,0 +1,15 @@
+#include "Symbols.h"
+
+#include <cstdio>
+
+std::string SymbolTable::describe(u16 addr) const {
+	auto it = m_symbols.upper_bound(addr);
+	if (it == m_symbols.begin()) return "";
+	--it;
+
+	if (it->first == addr) return it->second;
+
+	char offset[8];
+	std::snprintf(offset, sizeof(offset), "+0x%X", addr - it->first);
+	return it->second + offset;
+}
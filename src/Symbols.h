@@ -0,0 +1,22 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "Core.h"
+
+// Guest addresses by label, from the symbol tables of RASM objects, for
+// annotating addresses in reports
+class SymbolTable {
+public:
+	// The first label added at an address names it
+	void add(std::string name, u16 addr) { m_symbols.emplace(addr, std::move(name)); }
+
+	bool empty() const { return m_symbols.empty(); }
+
+	// "label" or "label+0x12" for the nearest label at or before `addr`, or
+	// an empty string if there is none
+	std::string describe(u16 addr) const;
+private:
+	std::map<u16, std::string> m_symbols;
+};
@@ -0,0 +1,49 @@
+#include "Timer.h"
+
+Timer::Timer(CPU &cpu, Scheduler &scheduler, u8 irq)
+	: m_cpu(cpu), m_scheduler(scheduler), m_irq(irq) {}
+
+void Timer::start(u64 period, bool periodic) {
+	start_at(period == 0 ? Scheduler::NEVER : m_cpu.cycle() + period, period, periodic);
+}
+
+void Timer::start_at(u64 deadline, u64 period, bool periodic) {
+	stop();
+	m_period = period;
+	m_periodic = periodic;
+	if (period == 0 || deadline == Scheduler::NEVER) return;
+
+	m_running = true;
+	arm(deadline);
+}
+
+void Timer::stop() {
+	if (!m_running) return;
+
+	m_scheduler.cancel(m_event);
+	m_running = false;
+}
+
+u64 Timer::remaining() const {
+	if (!m_running) return 0;
+
+	u64 now = m_cpu.cycle();
+	return m_deadline > now ? m_deadline - now : 0;
+}
+
+void Timer::arm(u64 deadline) {
+	m_deadline = deadline;
+	m_event = m_scheduler.schedule(deadline, [this](u64 cycle) { expire(cycle); });
+	m_cpu.events_changed();
+}
+
+void Timer::expire(u64 cycle) {
+	m_expiries++;
+	m_cpu.raise_irq(m_irq);
+
+	if (m_periodic) {
+		arm(cycle + m_period);
+	} else {
+		m_running = false;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Core.h"
+#include "CPU.h"
+#include "Scheduler.h"
+
+// Counts down CPU cycles on `scheduler` and raises interrupt line `irq` on
+// `cpu` when it expires, once or every `period` cycles. Periodic expiries are
+// scheduled from the previous deadline, so they never drift however late the
+// CPU notices them.
+class Timer {
+public:
+	Timer(CPU &cpu, Scheduler &scheduler, u8 irq);
+	~Timer() { stop(); }
+
+	Timer(const Timer &) = delete;
+	Timer &operator=(const Timer &) = delete;
+
+	// (Re)starts the timer to expire `period` cycles after the CPU's current
+	// cycle; a period of 0 stops it
+	void start(u64 period, bool periodic);
+	// start() with the first expiry at CPU cycle `deadline` instead, as when
+	// restoring a snapshot; Scheduler::NEVER leaves it stopped
+	void start_at(u64 deadline, u64 period, bool periodic);
+	void stop();
+
+	bool running() const { return m_running; }
+	u64 period() const { return m_period; }
+	bool periodic() const { return m_periodic; }
+	// Cycles left until the next expiry, 0 when stopped
+	u64 remaining() const;
+	// CPU cycle of the next expiry, Scheduler::NEVER when stopped
+	u64 deadline() const { return m_running ? m_deadline : Scheduler::NEVER; }
+	// Expiries so far
+	u64 expiries() const { return m_expiries; }
+private:
+	void arm(u64 deadline);
+	void expire(u64 cycle);
+private:
+	CPU &m_cpu;
+	Scheduler &m_scheduler;
+	u8 m_irq;
+
+	bool m_running = false;
+	bool m_periodic = false;
+	u64 m_period = 0;
+	u64 m_deadline = 0;
+	u64 m_event = 0;
+	u64 m_expiries = 0;
+};
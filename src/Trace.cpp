@@ -0,0 +1,228 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Encoded bytes collected before each write to the trace file
+#define TRACE_WRITE_CHUNK (1 << 16)
+
+static u16 CPU::* const s_regs_u16[] = { &CPU::r0, &CPU::r1, &CPU::r2, &CPU::r3, &CPU::ra, &CPU::ri };
+static u8 CPU::* const s_regs_u8[] = { &CPU::b0, &CPU::b1, &CPU::b2, &CPU::b3 };
+
+static const u8 s_reg_codes_u16[] = { CPU::R0, CPU::R1, CPU::R2, CPU::R3, CPU::RA, CPU::RI };
+static const u8 s_reg_codes_u8[] = { CPU::B0, CPU::B1, CPU::B2, CPU::B3 };
+
+enum DestKind : u8 {
+	DEST_NONE,
+	DEST_U16,
+	DEST_U8,
+};
+
+// Register each handler writes, always operand `a` when there is one
+static constexpr u8 s_handler_dests[] = {
+#define X(name) \
+	(CPU::name == CPU::H_LOAD_U16 || CPU::name == CPU::H_POP_WORD || CPU::name == CPU::H_LDW || \
+	 (CPU::name >= CPU::H_ADD && CPU::name <= CPU::H_DIV) || CPU::name == CPU::H_AND_U16 || \
+	 CPU::name == CPU::H_OR_U16 || CPU::name == CPU::H_XOR_U16 || CPU::name == CPU::H_NOT_U16 || \
+	 CPU::name == CPU::H_SHL_U16 || CPU::name == CPU::H_SHR_U16) ? DEST_U16 : \
+	(CPU::name == CPU::H_LOAD_U8 || CPU::name == CPU::H_POP_BYTE || CPU::name == CPU::H_LDB || \
+	 (CPU::name >= CPU::H_ADDB && CPU::name <= CPU::H_DIVB) || CPU::name == CPU::H_AND_U8 || \
+	 CPU::name == CPU::H_OR_U8 || CPU::name == CPU::H_XOR_U8 || CPU::name == CPU::H_NOT_U8 || \
+	 CPU::name == CPU::H_SHL_U8 || CPU::name == CPU::H_SHR_U8) ? DEST_U8 : DEST_NONE,
+	CPU_HANDLERS(X)
+#undef X
+};
+
+static bool IsWide(u8 reg) {
+	return ISA::REG16_CODES[reg] != ISA::NO_REG;
+}
+
+TraceContext::TraceContext()
+	: code(MEMORY_CAPACITY) {}
+
+Tracer::Tracer(const std::string &path)
+	: m_ring(std::make_unique<TraceRing>()), m_file(path, std::ios::binary) {
+	if (!m_file) {
+		std::cerr << "Failed to open trace: " << path << std::endl;
+		exit(1);
+	}
+
+	u8 header[8] = { TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3], TRACE_VERSION & 0xFF, TRACE_VERSION >> 8, 0, 0 };
+	m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+	m_buffer.reserve(TRACE_WRITE_CHUNK + 16);
+	m_drain = std::thread(&Tracer::drain_loop, this);
+}
+
+Tracer::~Tracer() {
+	m_done.store(true, std::memory_order_release);
+	m_drain.join();
+
+	m_file.write(reinterpret_cast<const char *>(m_buffer.data()), m_buffer.size());
+}
+
+void Tracer::executed(u16 addr, const DecodedInst *inst, const DecodedInst *, const CPU &cpu) {
+	TraceRecord record;
+	record.pc = addr;
+	record.sp = cpu.sp;
+	record.flags = (cpu.equal ? TRACE_EQUAL : 0) | (cpu.zero ? TRACE_ZERO : 0) | (cpu.sign ? TRACE_SIGN : 0)
+		| (cpu.carry ? TRACE_CARRY : 0) | (cpu.overflow ? TRACE_OVERFLOW : 0);
+
+	record.length = std::min<u8>(inst->length, MAX_INST_LENGTH);
+	for (u8 i = 0; i < MAX_INST_LENGTH; i++) {
+		record.code[i] = i < record.length ? m_code[i] : 0;
+	}
+	record.pad[0] = record.pad[1] = 0;
+
+	switch (s_handler_dests[inst->handler]) {
+	case DEST_U16:
+		record.reg = s_reg_codes_u16[inst->a];
+		record.value = cpu.*s_regs_u16[inst->a];
+		break;
+	case DEST_U8:
+		record.reg = s_reg_codes_u8[inst->a];
+		record.value = cpu.*s_regs_u8[inst->a];
+		break;
+	default:
+		record.reg = ISA::NO_REG;
+		record.value = 0;
+		break;
+	}
+
+	m_ring->push(record);
+}
+
+void Tracer::drain_loop() {
+	auto consume = [this](const TraceRecord *records, size_t count) { write(records, count); };
+
+	while (true) {
+		// Every record pushed before m_done was set is drained after it is seen
+		bool done = m_done.load(std::memory_order_acquire);
+		if (m_ring->drain(consume) == 0) {
+			if (done) return;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+}
+
+void Tracer::write(const TraceRecord *records, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const TraceRecord &record = records[i];
+		TraceRecord &last = m_context.last;
+		TraceRecord &code = m_context.code[record.pc];
+
+		u8 tag = 0;
+		if (record.pc != (u16)(last.pc + last.length)) tag |= TRACE_TAG_PC;
+		if (record.length != code.length || record.reg != code.reg
+			|| std::memcmp(record.code, code.code, MAX_INST_LENGTH) != 0) tag |= TRACE_TAG_CODE;
+		if (record.flags != last.flags) tag |= TRACE_TAG_FLAGS;
+		if (record.sp != last.sp) tag |= TRACE_TAG_SP;
+
+		m_buffer.push_back(tag);
+		if (tag & TRACE_TAG_PC) {
+			m_buffer.push_back(record.pc & 0xFF);
+			m_buffer.push_back(record.pc >> 8);
+		}
+		if (tag & TRACE_TAG_CODE) {
+			m_buffer.push_back(record.length);
+			m_buffer.insert(m_buffer.end(), record.code, record.code + record.length);
+			m_buffer.push_back(record.reg);
+		}
+		if (tag & TRACE_TAG_FLAGS) m_buffer.push_back(record.flags);
+		if (tag & TRACE_TAG_SP) {
+			m_buffer.push_back(record.sp & 0xFF);
+			m_buffer.push_back(record.sp >> 8);
+		}
+		if (record.reg != ISA::NO_REG) {
+			m_buffer.push_back(record.value & 0xFF);
+			if (IsWide(record.reg)) m_buffer.push_back(record.value >> 8);
+		}
+
+		code = record;
+		last = record;
+
+		if (m_buffer.size() >= TRACE_WRITE_CHUNK) {
+			m_file.write(reinterpret_cast<const char *>(m_buffer.data()), m_buffer.size());
+			m_buffer.clear();
+		}
+	}
+}
+
+bool TraceReader::open(const std::string &path, std::string &error) {
+	m_file.open(path, std::ios::binary);
+	if (!m_file) {
+		error = "cannot open file";
+		return false;
+	}
+
+	u8 header[8];
+	if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header)) || std::memcmp(header, TRACE_MAGIC, 4) != 0) {
+		error = "not a trace file";
+		return false;
+	}
+
+	u16 version = header[4] | (header[5] << 8);
+	if (version != TRACE_VERSION) {
+		error = "unsupported trace version " + std::to_string(version);
+		return false;
+	}
+
+	return true;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+	std::streambuf &in = *m_file.rdbuf();
+	auto byte = [&](u8 &value) {
+		int c = in.sbumpc();
+		value = (u8)c;
+		return c != std::char_traits<char>::eof();
+	};
+	auto word = [&](u16 &value) {
+		u8 lo, hi;
+		if (!byte(lo) || !byte(hi)) return false;
+		value = lo | (hi << 8);
+		return true;
+	};
+
+	TraceRecord &last = m_context.last;
+	u8 tag;
+	if (!byte(tag)) return false;
+
+	record = last;
+	record.pc = (u16)(last.pc + last.length);
+	if ((tag & TRACE_TAG_PC) && !word(record.pc)) return false;
+
+	TraceRecord &code = m_context.code[record.pc];
+	if (tag & TRACE_TAG_CODE) {
+		if (!byte(record.length) || record.length > MAX_INST_LENGTH) return false;
+		std::memset(record.code, 0, MAX_INST_LENGTH);
+		for (u8 i = 0; i < record.length; i++) {
+			if (!byte(record.code[i])) return false;
+		}
+		if (!byte(record.reg)) return false;
+	} else {
+		record.length = code.length;
+		std::memcpy(record.code, code.code, MAX_INST_LENGTH);
+		record.reg = code.reg;
+	}
+
+	if ((tag & TRACE_TAG_FLAGS) && !byte(record.flags)) return false;
+	if ((tag & TRACE_TAG_SP) && !word(record.sp)) return false;
+
+	record.value = 0;
+	if (record.reg != ISA::NO_REG) {
+		u8 lo;
+		if (!byte(lo)) return false;
+		record.value = lo;
+		if (IsWide(record.reg)) {
+			u8 hi;
+			if (!byte(hi)) return false;
+			record.value |= hi << 8;
+		}
+	}
+
+	code = record;
+	last = record;
+	return true;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Core.h"
+#include "CPU.h"
+
+// Records per trace ring; a power of two
+#define TRACE_RING_RECORDS (1 << 16)
+
+#define TRACE_MAGIC "R8TR"
+#define TRACE_VERSION 1
+
+enum TraceFlags : u8 {
+	TRACE_EQUAL		= 1 << 0,
+	TRACE_ZERO		= 1 << 1,
+	TRACE_SIGN		= 1 << 2,
+	TRACE_CARRY		= 1 << 3,
+	TRACE_OVERFLOW	= 1 << 4,
+};
+
+// One executed instruction and the state it left behind. `reg` is the ISA
+// code of the register it wrote, or ISA::NO_REG, and `value` what it wrote.
+struct TraceRecord {
+	u16 pc;
+	u16 sp;
+	u16 value;
+	u8 reg;
+	u8 flags;
+	u8 length;
+	u8 code[MAX_INST_LENGTH];
+	u8 pad[2];
+};
+
+static_assert(sizeof(TraceRecord) == 16);
+
+// Single producer, single consumer queue of records. The two indices sit on
+// their own cache lines and each side caches the other's, so a push or pop
+// only touches shared state when the ring looks full or empty.
+class TraceRing {
+public:
+	// Spins while the ring is full, so no record is ever dropped
+	void push(const TraceRecord &record) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail_cache == TRACE_RING_RECORDS) {
+			while (head - (m_tail_cache = m_tail.load(std::memory_order_acquire)) == TRACE_RING_RECORDS) {
+				m_stalls++;
+				std::this_thread::yield();
+			}
+		}
+
+		m_records[head % TRACE_RING_RECORDS] = record;
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	// Hands the records waiting in the ring to `consume(first, count)` in at
+	// most two contiguous runs and returns how many there were
+	template <typename F>
+	size_t drain(F &&consume) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		size_t head = m_head.load(std::memory_order_acquire);
+		size_t count = head - tail;
+
+		size_t start = tail % TRACE_RING_RECORDS;
+		size_t first = std::min(count, TRACE_RING_RECORDS - start);
+		if (first) consume(&m_records[start], first);
+		if (count > first) consume(&m_records[0], count - first);
+
+		m_tail.store(head, std::memory_order_release);
+		return count;
+	}
+
+	// Times the producer found the ring full
+	size_t stalls() const { return m_stalls; }
+private:
+	alignas(64) TraceRecord m_records[TRACE_RING_RECORDS];
+
+	alignas(64) std::atomic<size_t> m_head = 0;
+	size_t m_tail_cache = 0;
+	size_t m_stalls = 0;
+
+	alignas(64) std::atomic<size_t> m_tail = 0;
+};
+
+// Trace file: TRACE_MAGIC, u16 version, u16 0, then one entry per record, each
+// a tag byte of TRACE_TAG_* bits followed by the fields they name. Fields a
+// tag leaves out repeat what the stream already said: pc follows on from the
+// previous record, instruction bytes and register are those last seen at the
+// same pc, flags and sp those of the previous record. The value written
+// follows whenever there is a register, one byte for 8-bit ones. Integers are
+// little-endian.
+enum TraceTags : u8 {
+	TRACE_TAG_PC	= 1 << 0,
+	TRACE_TAG_CODE	= 1 << 1,
+	TRACE_TAG_FLAGS	= 1 << 2,
+	TRACE_TAG_SP	= 1 << 3,
+};
+
+// The state both sides of the trace encoding track
+struct TraceContext {
+	TraceContext();
+
+	TraceRecord last {};
+	// Instruction bytes and register by pc, as last traced there
+	std::vector<TraceRecord> code;
+};
+
+// Policy for CPU::run that traces every instruction. Runs go through the
+// interpreter one instruction at a time, and a thread of its own drains the
+// records into `path` as the run goes.
+class Tracer {
+public:
+	static constexpr bool enabled = true;
+	static constexpr bool per_instruction = true;
+
+	// Exits if `path` cannot be written
+	explicit Tracer(const std::string &path);
+	// Writes out every record still in the ring
+	~Tracer();
+
+	void dispatched(u16) {}
+	// Keeps the instruction's bytes before a store can overwrite them
+	void executing(u16 addr, const CPU &cpu) {
+		for (u8 i = 0; i < MAX_INST_LENGTH; i++) m_code[i] = cpu.read_addr((u16)(addr + i));
+	}
+	void executed(u16 addr, const DecodedInst *inst, const DecodedInst *, const CPU &cpu);
+
+	size_t stalls() const { return m_ring->stalls(); }
+private:
+	void drain_loop();
+	void write(const TraceRecord *records, size_t count);
+private:
+	std::unique_ptr<TraceRing> m_ring;
+	u8 m_code[MAX_INST_LENGTH] = {};
+	std::ofstream m_file;
+	std::vector<u8> m_buffer;
+	TraceContext m_context;
+
+	std::atomic<bool> m_done = false;
+	std::thread m_drain;
+};
+
+// Decodes a trace file record by record
+class TraceReader {
+public:
+	// Returns false with `error` set if the file is missing or not a trace
+	bool open(const std::string &path, std::string &error);
+
+	// False at the end of the trace or on a truncated record
+	bool next(TraceRecord &record);
+private:
+	std::ifstream m_file;
+	TraceContext m_context;
+};
@@ -0,0 +1,772 @@
+#include "WideCPU.h"
+
+#include <algorithm>
+#include <cstring>
+
+// SSE2 is part of x86-64; AVX2 needs the build to allow it (premake --avx2)
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define R828_WIDE_AVX2 1
+#else
+	#define R828_WIDE_AVX2 0
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define R828_WIDE_SSE 1
+#else
+	#define R828_WIDE_SSE 0
+#endif
+
+namespace {
+
+	// Every kernel works on 16-bit lanes; byte registers are kept widened and
+	// masked to 0xFF. A mask lane is 0xFFFF for lanes in the group.
+	template <size_t COUNT>
+	struct Lanes;
+
+	// Plain scalar lanes where no SIMD is available
+	template <>
+	struct Lanes<1> {
+		static constexpr size_t COUNT = 1;
+
+		static u16 load(const u16 *p) { return *p; }
+		static void store(u16 *p, u16 v) { *p = v; }
+		static u16 set(u16 value) { return value; }
+
+		static u16 add(u16 a, u16 b) { return a + b; }
+		static u16 sub(u16 a, u16 b) { return a - b; }
+		static u16 mul(u16 a, u16 b) { return a * b; }
+		static u16 and_(u16 a, u16 b) { return a & b; }
+		static u16 or_(u16 a, u16 b) { return a | b; }
+		static u16 xor_(u16 a, u16 b) { return a ^ b; }
+		// a & ~b
+		static u16 andnot(u16 a, u16 b) { return a & ~b; }
+
+		static u16 eq(u16 a, u16 b) { return a == b ? 0xFFFF : 0; }
+		// Unsigned a > b
+		static u16 gt(u16 a, u16 b) { return a > b ? 0xFFFF : 0; }
+
+		static u16 select(u16 mask, u16 a, u16 b) { return mask ? a : b; }
+	};
+
+#if R828_WIDE_SSE
+	template <>
+	struct Lanes<8> {
+		static constexpr size_t COUNT = 8;
+
+		static __m128i load(const u16 *p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+		static void store(u16 *p, __m128i v) { _mm_store_si128(reinterpret_cast<__m128i*>(p), v); }
+		static __m128i set(u16 value) { return _mm_set1_epi16((short)value); }
+
+		static __m128i add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+		static __m128i sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+		static __m128i mul(__m128i a, __m128i b) { return _mm_mullo_epi16(a, b); }
+		static __m128i and_(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+		static __m128i or_(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+		static __m128i xor_(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+		static __m128i andnot(__m128i a, __m128i b) { return _mm_andnot_si128(b, a); }
+
+		static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+		static __m128i gt(__m128i a, __m128i b) {
+			__m128i bias = set(0x8000);
+			return _mm_cmpgt_epi16(xor_(a, bias), xor_(b, bias));
+		}
+
+		static __m128i select(__m128i mask, __m128i a, __m128i b) { return or_(and_(mask, a), andnot(b, mask)); }
+	};
+#endif
+
+#if R828_WIDE_AVX2
+	template <>
+	struct Lanes<16> {
+		static constexpr size_t COUNT = 16;
+
+		static __m256i load(const u16 *p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+		static void store(u16 *p, __m256i v) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+		static __m256i set(u16 value) { return _mm256_set1_epi16((short)value); }
+
+		static __m256i add(__m256i a, __m256i b) { return _mm256_add_epi16(a, b); }
+		static __m256i sub(__m256i a, __m256i b) { return _mm256_sub_epi16(a, b); }
+		static __m256i mul(__m256i a, __m256i b) { return _mm256_mullo_epi16(a, b); }
+		static __m256i and_(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+		static __m256i or_(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+		static __m256i xor_(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+		static __m256i andnot(__m256i a, __m256i b) { return _mm256_andnot_si256(b, a); }
+
+		static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(a, b); }
+		static __m256i gt(__m256i a, __m256i b) {
+			__m256i bias = set(0x8000);
+			return _mm256_cmpgt_epi16(xor_(a, bias), xor_(b, bias));
+		}
+
+		static __m256i select(__m256i mask, __m256i a, __m256i b) { return _mm256_blendv_epi8(b, a, mask); }
+	};
+#endif
+
+	// The widest vector that evenly covers N lanes
+	template <size_t N>
+	using Vec = Lanes<R828_WIDE_AVX2 && N % 16 == 0 ? 16 : R828_WIDE_SSE ? 8 : 1>;
+
+	enum ArithOp {
+		OP_ADD,
+		OP_ADC,
+		OP_SUB,
+		OP_SBB,
+		OP_MUL,
+	};
+
+	// ADD/ADC/SUB/SBB/MUL with CPU's flag rules; `max` is 0xFFFF or 0xFF for
+	// the byte forms. Those rules read the operand registers after the
+	// result is stored, so the operands are loaded again for the flags in
+	// case one of them is dest.
+	template <ArithOp OP, size_t N>
+	void Arith(const u16 *mask, u16 max, u16 *dest, const u16 *reg1, const u16 *reg2,
+		u16 *zero, u16 *sign, u16 *carry, u16 *overflow) {
+		using L = Vec<N>;
+
+		const auto vmax = L::set(max);
+		const auto vsign = L::set(max ^ (max >> 1));
+		const auto one = L::set(1);
+		const auto none = L::set(0);
+
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			auto m = L::load(mask + i);
+			auto x = L::load(reg1 + i);
+			auto y = L::load(reg2 + i);
+			auto carry_in = L::eq(L::load(carry + i), one);
+
+			auto result = none;
+			if constexpr (OP == OP_ADD) result = L::add(x, y);
+			if constexpr (OP == OP_ADC) result = L::sub(L::add(x, y), carry_in);
+			if constexpr (OP == OP_SUB) result = L::sub(x, y);
+			if constexpr (OP == OP_SBB) result = L::add(L::sub(x, y), carry_in);
+			if constexpr (OP == OP_MUL) result = L::mul(x, y);
+
+			auto d = L::select(m, L::and_(result, vmax), L::load(dest + i));
+			L::store(dest + i, d);
+
+			x = L::load(reg1 + i);
+			y = L::load(reg2 + i);
+
+			auto c = none;
+			auto o = none;
+			if constexpr (OP == OP_ADD) c = L::gt(x, L::sub(vmax, y));
+			if constexpr (OP == OP_ADC) c = L::or_(L::or_(L::gt(x, d), L::gt(y, d)), carry_in);
+			if constexpr (OP == OP_SUB) c = L::gt(y, x);
+			// x < y + carry_in, without overflowing the lane
+			if constexpr (OP == OP_SBB) c = L::or_(L::gt(y, x), L::and_(carry_in, L::eq(x, y)));
+			if constexpr (OP == OP_ADD || OP == OP_ADC) o = L::andnot(L::xor_(x, d), L::xor_(x, y));
+			if constexpr (OP == OP_SUB || OP == OP_SBB) o = L::and_(L::xor_(x, y), L::xor_(x, d));
+			o = L::eq(L::and_(o, vsign), vsign);
+
+			L::store(zero + i, L::select(m, L::and_(L::eq(d, none), one), L::load(zero + i)));
+			L::store(sign + i, L::select(m, L::and_(L::eq(L::and_(d, vsign), vsign), one), L::load(sign + i)));
+			L::store(carry + i, L::select(m, L::and_(c, one), L::load(carry + i)));
+			L::store(overflow + i, L::select(m, L::and_(o, one), L::load(overflow + i)));
+		}
+	}
+
+	enum LogicOp {
+		OP_AND,
+		OP_OR,
+		OP_XOR,
+		OP_NOT,
+	};
+
+	template <LogicOp OP, size_t N>
+	void Logic(const u16 *mask, u16 max, u16 *dest, const u16 *reg1, const u16 *reg2) {
+		using L = Vec<N>;
+
+		const auto vmax = L::set(max);
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			auto x = L::load(reg1 + i);
+			auto y = L::load(reg2 + i);
+
+			auto result = x;
+			if constexpr (OP == OP_AND) result = L::and_(x, y);
+			if constexpr (OP == OP_OR) result = L::or_(x, y);
+			if constexpr (OP == OP_XOR) result = L::xor_(x, y);
+			if constexpr (OP == OP_NOT) result = L::xor_(x, vmax);
+
+			L::store(dest + i, L::select(L::load(mask + i), result, L::load(dest + i)));
+		}
+	}
+
+	// There is no per-lane 16-bit shift before AVX-512, so shifts stay
+	// scalar. Counts are taken mod 32, as the interpreter's handlers define.
+	template <bool LEFT, size_t N>
+	void Shift(const u16 *mask, u16 max, u16 *dest, const u16 *reg1, const u16 *reg2) {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			u32 value = LEFT ? (u32)reg1[i] << (reg2[i] & 31) : (u32)reg1[i] >> (reg2[i] & 31);
+			dest[i] = value & max;
+		}
+	}
+
+	template <size_t N>
+	void Fill(const u16 *mask, u16 *dest, u16 value) {
+		using L = Vec<N>;
+
+		const auto v = L::set(value);
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			L::store(dest + i, L::select(L::load(mask + i), v, L::load(dest + i)));
+		}
+	}
+
+	// dest += value in the lanes of `mask`
+	template <size_t N>
+	void Advance(const u16 *mask, u16 *dest, u16 value) {
+		using L = Vec<N>;
+
+		const auto v = L::set(value);
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			auto old = L::load(dest + i);
+			L::store(dest + i, L::select(L::load(mask + i), L::add(old, v), old));
+		}
+	}
+
+	// JZ (`taken_if_equal` false) and JNZ
+	template <size_t N>
+	void Branch(const u16 *mask, u16 *pc, const u16 *equal, u16 target, bool taken_if_equal) {
+		using L = Vec<N>;
+
+		const auto v = L::set(target);
+		const auto none = L::set(0);
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			auto not_equal = L::eq(L::load(equal + i), none);
+			auto taken = taken_if_equal ? L::andnot(L::load(mask + i), not_equal) : L::and_(L::load(mask + i), not_equal);
+			L::store(pc + i, L::select(taken, v, L::load(pc + i)));
+		}
+	}
+
+	template <size_t N>
+	void Equal(const u16 *mask, u16 *equal, const u16 *reg1, const u16 *reg2) {
+		using L = Vec<N>;
+
+		const auto one = L::set(1);
+		for (size_t i = 0; i < N; i += L::COUNT) {
+			auto result = L::and_(L::eq(L::load(reg1 + i), L::load(reg2 + i)), one);
+			L::store(equal + i, L::select(L::load(mask + i), result, L::load(equal + i)));
+		}
+	}
+
+	bool EndsBlock(u8 handler) {
+		return handler == CPU::H_JZ
+			|| handler == CPU::H_JNZ
+			|| handler == CPU::H_JMP
+			|| handler == CPU::H_RTI
+			|| handler == CPU::H_HLT
+			|| handler >= CPU::H_INVALID_INST;
+	}
+
+}
+
+template <size_t N>
+WideCPU<N>::WideCPU()
+	: m_memory(N), m_decoded(MEMORY_CAPACITY) {
+	// Nothing holds the reset contents yet
+	m_dirty_pages.set();
+}
+
+template <size_t N>
+void WideCPU<N>::reset() {
+	for (size_t i = 0; i < N; i++) {
+		pc[i] = 0xD000;
+		sp[i] = 0xB000;
+		fbs[i] = 0x8000;
+	}
+
+	std::memset(regs_u16, 0, sizeof(regs_u16));
+	std::memset(regs_u8, 0, sizeof(regs_u8));
+	std::memset(equal, 0, sizeof(equal));
+	std::memset(zero, 0, sizeof(zero));
+	std::memset(sign, 0, sizeof(sign));
+	std::memset(carry, 0, sizeof(carry));
+	std::memset(overflow, 0, sizeof(overflow));
+
+	std::fill(std::begin(m_fault), std::end(m_fault), CPU::FAULT_NONE);
+
+	// Same contents as CPU::reset, copied only into pages written since
+	const PagedMemory &image = CPU::reset_memory();
+	for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		if (!m_dirty_pages[page]) continue;
+
+		for (Memory &memory : m_memory) {
+			std::memcpy(memory.data + page * MEMORY_PAGE_SIZE, image.page_data(page), MEMORY_PAGE_SIZE);
+		}
+
+		u16 start = (u16)(page * MEMORY_PAGE_SIZE);
+		for (u16 i = 0; i < MEMORY_PAGE_SIZE; i++) {
+			if (m_code_bytes[(u16)(start + i)]) {
+				invalidate_code(start + i);
+				m_code_bytes[(u16)(start + i)] = false;
+			}
+		}
+	}
+
+	m_dirty_pages.reset();
+	m_written_pages.reset();
+}
+
+template <size_t N>
+void WideCPU<N>::load_addr(u16 addr, u8 byte_value) {
+	// Every lane gets the same byte, so the page stays shared
+	for (Memory &memory : m_memory) {
+		memory.data[addr] = byte_value;
+	}
+	m_dirty_pages[addr / MEMORY_PAGE_SIZE] = true;
+
+	if (m_code_bytes[addr]) {
+		invalidate_code(addr);
+	}
+}
+
+template <size_t N>
+void WideCPU<N>::load(u16 addr, const u8 *data, size_t size) {
+	for (Memory &memory : m_memory) {
+		std::memcpy(memory.data + addr, data, size);
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		m_dirty_pages[(addr + i) / MEMORY_PAGE_SIZE] = true;
+		if (m_code_bytes[addr + i]) {
+			invalidate_code(addr + i);
+		}
+	}
+}
+
+template <size_t N>
+void WideCPU<N>::run(size_t (&cycles)[N], CPU::StopReason (&reasons)[N]) {
+	m_live = 0;
+	for (size_t i = 0; i < N; i++) {
+		m_fault[i] = CPU::FAULT_NONE;
+		m_reason[i] = CPU::BUDGET_EXHAUSTED;
+		m_running[i] = cycles[i] > 0 ? 0xFFFF : 0;
+		m_live += cycles[i] > 0;
+	}
+
+	while (m_live > 0) {
+		// The lowest pc goes first so lanes that left a loop early wait at
+		// its exit for the others
+		u16 group_pc = 0xFFFF;
+		for (size_t i = 0; i < N; i++) {
+			group_pc = std::min<u16>(group_pc, pc[i] | (u16)~m_running[i]);
+		}
+
+		for (size_t i = 0; i < N; i++) {
+			m_mask[i] = m_running[i] & (pc[i] == group_pc ? 0xFFFF : 0);
+		}
+
+		dispatch(cycles);
+	}
+
+	std::copy(std::begin(m_reason), std::end(m_reason), std::begin(reasons));
+}
+
+template <size_t N>
+void WideCPU<N>::dispatch(size_t (&cycles)[N]) {
+	if (m_code_written) {
+		flush_blocks();
+	}
+	m_stop_block = false;
+
+	size_t lead = first_lane();
+	u16 start = pc[lead];
+
+	const DecodedInst *inst;
+	const DecodedInst *end;
+	size_t block_cycles = 0;
+
+	// Blocks are shared only while every lane holds the same bytes; code
+	// that may have been stored to is decoded from this group's first lane
+	// and the lanes that disagree wait for a later dispatch
+	if (!may_differ(start)) {
+		Block &block = lookup_block(start);
+		inst = &m_blocks.insts[block.first];
+		end = inst + block.count;
+		block_cycles = block.cycles;
+	} else {
+		m_scratch.clear();
+		u16 pos = start;
+		for (size_t count = 0; count < MAX_BLOCK_INSTS; count++) {
+			DecodedInst decoded;
+			CPU::decode_at(m_memory[lead], pos, decoded);
+			for (u16 i = 0; i < decoded.length; i++) {
+				m_code_bytes[(u16)(pos + i)] = true;
+			}
+
+			m_scratch.push_back(decoded);
+			block_cycles += decoded.cycles;
+			pos += decoded.length;
+
+			if (EndsBlock(decoded.handler)) break;
+		}
+
+		match_code(start, (u16)(pos - start));
+		inst = m_scratch.data();
+		end = inst + m_scratch.size();
+	}
+
+	bool short_budget = false;
+	for (size_t i = 0; i < N; i++) {
+		short_budget |= m_mask[i] && cycles[i] < block_cycles;
+	}
+
+	if (short_budget) {
+		// Like the tail of CPU::run: charge and check one instruction at a
+		// time so each lane stops exactly where its own budget runs out
+		for (; inst != end; inst++) {
+			for (size_t i = 0; i < N; i++) {
+				if (m_mask[i]) cycles[i] = inst->cycles < cycles[i] ? cycles[i] - inst->cycles : 0;
+			}
+
+			exec(*inst, cycles, 0);
+
+			bool any = false;
+			for (size_t i = 0; i < N; i++) {
+				if (!m_mask[i]) continue;
+
+				if (inst->handler == CPU::H_HLT) {
+					stop_lane(i, CPU::HALTED);
+				} else if (cycles[i] == 0) {
+					stop_lane(i, CPU::BUDGET_EXHAUSTED);
+				} else {
+					any = true;
+				}
+			}
+
+			if (!any || m_stop_block) break;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < N; i++) {
+		cycles[i] -= m_mask[i] ? block_cycles : 0;
+	}
+
+	size_t rest = block_cycles;
+	for (; inst != end; inst++) {
+		rest -= inst->cycles;
+		exec(*inst, cycles, rest);
+
+		if (m_stop_block) {
+			// A store hit decoded code; give back what the block did not run
+			for (size_t i = 0; i < N; i++) {
+				cycles[i] += m_mask[i] ? rest : 0;
+			}
+			break;
+		}
+	}
+
+	bool halted = inst == end && end[-1].handler == CPU::H_HLT;
+	for (size_t i = 0; i < N; i++) {
+		if (!m_mask[i]) continue;
+
+		if (halted) {
+			stop_lane(i, CPU::HALTED);
+		} else if (cycles[i] == 0) {
+			stop_lane(i, CPU::BUDGET_EXHAUSTED);
+		}
+	}
+}
+
+template <size_t N>
+void WideCPU<N>::exec(const DecodedInst &inst, size_t (&cycles)[N], size_t refund) {
+	const u16 *mask = m_mask;
+
+	Advance<N>(mask, pc, inst.length);
+
+	u16 *r16a = regs_u16[inst.a % 6];
+	u16 *r16b = regs_u16[inst.b % 6];
+	u16 *r16c = regs_u16[inst.c % 6];
+	u16 *r8a = regs_u8[inst.a % 4];
+	u16 *r8b = regs_u8[inst.b % 4];
+	u16 *r8c = regs_u8[inst.c % 4];
+
+	switch (inst.handler) {
+	case CPU::H_LOAD_U16: Fill<N>(mask, r16a, inst.imm); break;
+	case CPU::H_LOAD_U8: Fill<N>(mask, r8a, inst.imm & 0xFF); break;
+
+	case CPU::H_PUSH_BYTE: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			write_byte(i, sp[i], (u8)inst.imm);
+			sp[i]++;
+		}
+	} break;
+	case CPU::H_PUSH_WORD: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			write_byte(i, sp[i], inst.a);
+			write_byte(i, sp[i] + 1, inst.b);
+			sp[i] += 2;
+		}
+	} break;
+	case CPU::H_POP_BYTE: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			r8a[i] = m_memory[i].data[(u16)(sp[i] - 1)];
+			write_byte(i, sp[i] - 1, 0x00);
+			sp[i]--;
+		}
+	} break;
+	case CPU::H_POP_WORD: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			const u8 *data = m_memory[i].data;
+			r16a[i] = ((u16)data[(u16)(sp[i] - 2)] << 8) | (u16)data[(u16)(sp[i] - 1)];
+			write_byte(i, sp[i] - 2, 0x00);
+			write_byte(i, sp[i] - 1, 0x00);
+			sp[i] -= 2;
+		}
+	} break;
+	case CPU::H_STB_IMM: {
+		for (size_t i = 0; i < N; i++) {
+			if (mask[i]) write_byte(i, r16a[i], (u8)inst.imm);
+		}
+	} break;
+	case CPU::H_STB_REG: {
+		for (size_t i = 0; i < N; i++) {
+			if (mask[i]) write_byte(i, r16a[i], r8b[i]);
+		}
+	} break;
+	case CPU::H_STW_IMM: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			write_byte(i, r16a[i], inst.b);
+			write_byte(i, r16a[i] + 1, inst.c);
+		}
+	} break;
+	case CPU::H_STW_REG: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			u16 memory_addr = r16a[i];
+			u16 value = r16b[i];
+			write_byte(i, memory_addr, value & 0xFF);
+			write_byte(i, memory_addr + 1, (value >> 8) & 0xFF);
+		}
+	} break;
+	case CPU::H_LDB: {
+		for (size_t i = 0; i < N; i++) {
+			if (mask[i]) r8a[i] = m_memory[i].data[r16b[i]];
+		}
+	} break;
+	case CPU::H_LDW: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			u16 addr = r16b[i];
+			r16a[i] = ((u16)m_memory[i].data[addr] << 8) | (u16)m_memory[i].data[(u16)(addr + 1)];
+		}
+	} break;
+
+	case CPU::H_ADD: Arith<OP_ADD, N>(mask, 0xFFFF, r16a, r16b, r16c, zero, sign, carry, overflow); break;
+	case CPU::H_ADC: Arith<OP_ADC, N>(mask, 0xFFFF, r16a, r16b, r16c, zero, sign, carry, overflow); break;
+	case CPU::H_SUB: Arith<OP_SUB, N>(mask, 0xFFFF, r16a, r16b, r16c, zero, sign, carry, overflow); break;
+	case CPU::H_SBB: Arith<OP_SBB, N>(mask, 0xFFFF, r16a, r16b, r16c, zero, sign, carry, overflow); break;
+	case CPU::H_MUL: Arith<OP_MUL, N>(mask, 0xFFFF, r16a, r16b, r16c, zero, sign, carry, overflow); break;
+	case CPU::H_ADDB: Arith<OP_ADD, N>(mask, 0xFF, r8a, r8b, r8c, zero, sign, carry, overflow); break;
+	case CPU::H_ADCB: Arith<OP_ADC, N>(mask, 0xFF, r8a, r8b, r8c, zero, sign, carry, overflow); break;
+	case CPU::H_SUBB: Arith<OP_SUB, N>(mask, 0xFF, r8a, r8b, r8c, zero, sign, carry, overflow); break;
+	case CPU::H_SBBB: Arith<OP_SBB, N>(mask, 0xFF, r8a, r8b, r8c, zero, sign, carry, overflow); break;
+	case CPU::H_MULB: Arith<OP_MUL, N>(mask, 0xFF, r8a, r8b, r8c, zero, sign, carry, overflow); break;
+
+	// No vector divide; lanes dividing by zero fault and leave the group
+	case CPU::H_DIV: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			if (r16c[i] == 0) {
+				raise_fault(i, CPU::FAULT_DIVIDE_BY_ZERO, cycles, refund);
+				continue;
+			}
+
+			r16a[i] = r16b[i] / r16c[i];
+			zero[i] = r16a[i] == 0;
+			sign[i] = (r16a[i] & 0x8000) != 0;
+			carry[i] = 0;
+			overflow[i] = 0;
+		}
+	} break;
+	case CPU::H_DIVB: {
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			if (r8c[i] == 0) {
+				raise_fault(i, CPU::FAULT_DIVIDE_BY_ZERO, cycles, refund);
+				continue;
+			}
+
+			r8a[i] = r8b[i] / r8c[i];
+			zero[i] = r8a[i] == 0;
+			sign[i] = (r8a[i] & 0x80) != 0;
+			carry[i] = 0;
+			overflow[i] = 0;
+		}
+	} break;
+
+	case CPU::H_AND_U8: Logic<OP_AND, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_AND_U16: Logic<OP_AND, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+	case CPU::H_OR_U8: Logic<OP_OR, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_OR_U16: Logic<OP_OR, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+	case CPU::H_XOR_U8: Logic<OP_XOR, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_XOR_U16: Logic<OP_XOR, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+	case CPU::H_NOT_U8: Logic<OP_NOT, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_NOT_U16: Logic<OP_NOT, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+	case CPU::H_SHL_U8: Shift<true, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_SHL_U16: Shift<true, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+	case CPU::H_SHR_U8: Shift<false, N>(mask, 0xFF, r8a, r8b, r8c); break;
+	case CPU::H_SHR_U16: Shift<false, N>(mask, 0xFFFF, r16a, r16b, r16c); break;
+
+	case CPU::H_EQU: Equal<N>(mask, equal, r16a, r16b); break;
+	case CPU::H_JZ: Branch<N>(mask, pc, equal, inst.imm, false); break;
+	case CPU::H_JNZ: Branch<N>(mask, pc, equal, inst.imm, true); break;
+	case CPU::H_JMP: Fill<N>(mask, pc, inst.imm); break;
+	case CPU::H_RTI: {
+		// Batch jobs never take interrupts, so there is no flag to clear
+		for (size_t i = 0; i < N; i++) {
+			if (!mask[i]) continue;
+			const u8 *data = m_memory[i].data;
+			u8 flags = data[(u16)(sp[i] - 1)];
+			pc[i] = ((u16)data[(u16)(sp[i] - 3)] << 8) | (u16)data[(u16)(sp[i] - 2)];
+			write_byte(i, sp[i] - 3, 0x00);
+			write_byte(i, sp[i] - 2, 0x00);
+			write_byte(i, sp[i] - 1, 0x00);
+			sp[i] -= 3;
+
+			equal[i] = flags & 1;
+			zero[i] = (flags >> 1) & 1;
+			sign[i] = (flags >> 2) & 1;
+			carry[i] = (flags >> 3) & 1;
+			overflow[i] = (flags >> 4) & 1;
+		}
+	} break;
+
+	case CPU::H_HLT:
+	case CPU::H_NOP: break;
+
+	case CPU::H_INVALID_REG:
+	case CPU::H_INVALID_MODE:
+	default: {
+		CPU::Fault fault = inst.handler == CPU::H_INVALID_REG ? CPU::FAULT_INVALID_REG
+			: inst.handler == CPU::H_INVALID_MODE ? CPU::FAULT_INVALID_MODE
+			: CPU::FAULT_INVALID_INST;
+
+		for (size_t i = 0; i < N; i++) {
+			if (mask[i]) raise_fault(i, fault, cycles, refund);
+		}
+	} break;
+	}
+}
+
+template <size_t N>
+void WideCPU<N>::raise_fault(size_t lane, CPU::Fault fault, size_t (&cycles)[N], size_t refund) {
+	m_fault[lane] = fault;
+	cycles[lane] += refund;
+	stop_lane(lane, CPU::FAULT);
+}
+
+template <size_t N>
+size_t WideCPU<N>::first_lane() const {
+	size_t lane = 0;
+	while (!m_mask[lane]) lane++;
+	return lane;
+}
+
+template <size_t N>
+bool WideCPU<N>::may_differ(u16 start) const {
+	if (m_written_pages.none()) return false;
+
+	// Every page a block starting here could reach
+	const u32 reach = MAX_BLOCK_INSTS * MAX_INST_LENGTH;
+	for (u32 offset = 0; offset < reach + WIDE_PAGE_SIZE; offset += WIDE_PAGE_SIZE) {
+		if (m_written_pages[(u16)(start + std::min(offset, reach - 1)) / WIDE_PAGE_SIZE]) return true;
+	}
+
+	return false;
+}
+
+template <size_t N>
+void WideCPU<N>::match_code(u16 start, size_t length) {
+	size_t lead = first_lane();
+	const u8 *code = m_memory[lead].data;
+
+	for (size_t i = lead + 1; i < N; i++) {
+		if (!m_mask[i]) continue;
+
+		const u8 *data = m_memory[i].data;
+		for (size_t offset = 0; offset < length; offset++) {
+			if (data[(u16)(start + offset)] != code[(u16)(start + offset)]) {
+				m_mask[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
+template <size_t N>
+Block &WideCPU<N>::lookup_block(u16 addr) {
+	if (m_blocks.index.empty()) {
+		m_blocks.index.resize(MEMORY_CAPACITY);
+	}
+
+	u32 index = m_blocks.index[addr];
+	if (index >= m_blocks.blocks.size() || m_blocks.blocks[index].start != addr) {
+		build_block(addr);
+		index = m_blocks.index[addr];
+	}
+
+	return m_blocks.blocks[index];
+}
+
+template <size_t N>
+void WideCPU<N>::build_block(u16 addr) {
+	Block block {
+		.start = addr,
+		.count = 0,
+		.first = (u32)m_blocks.insts.size(),
+		.cycles = 0,
+		.hits = 0,
+		.jit = nullptr,
+	};
+
+	// Only called for code no lane has stored to, so any lane will do
+	u16 pos = addr;
+	while (block.count < MAX_BLOCK_INSTS) {
+		DecodedInst &inst = m_decoded[pos];
+		if (inst.handler == CPU::H_UNDECODED) {
+			CPU::decode_at(m_memory[0], pos, inst);
+			for (u16 i = 0; i < inst.length; i++) {
+				m_code_bytes[(u16)(pos + i)] = true;
+			}
+		}
+
+		m_blocks.insts.push_back(inst);
+		block.count++;
+		block.cycles += inst.cycles;
+		pos += inst.length;
+
+		if (EndsBlock(inst.handler)) break;
+	}
+
+	m_blocks.index[addr] = (u32)m_blocks.blocks.size();
+	m_blocks.blocks.push_back(block);
+}
+
+template <size_t N>
+void WideCPU<N>::flush_blocks() {
+	m_blocks.clear();
+	m_code_written = false;
+}
+
+template <size_t N>
+void WideCPU<N>::invalidate_code(u16 addr) {
+	for (u16 i = 0; i < MAX_INST_LENGTH; i++) {
+		m_decoded[(u16)(addr - i)].handler = CPU::H_UNDECODED;
+	}
+
+	m_code_written = true;
+	m_stop_block = true;
+}
+
+template class WideCPU<8>;
+template class WideCPU<16>;
+template class WideCPU<32>;
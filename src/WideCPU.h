@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <bitset>
+
+#include "Core.h"
+#include "Memory.h"
+#include "CPU.h"
+
+// Pages of WideCPU memory that any lane has stored to; only code in these
+// pages can differ between lanes
+#define WIDE_PAGE_SIZE 256
+
+// N copies of the R828 machine in structure-of-arrays form, one lane per
+// guest. Lanes that share a pc run as a group: each instruction is decoded
+// once and applied to every lane of the group with SSE2 kernels, or AVX2
+// ones when the build allows it (premake --avx2). Lanes whose JZ/JNZ go
+// different ways simply end up at different pcs and are scheduled as
+// separate groups until they meet again.
+//
+// Every lane behaves exactly like CPU::run on the same state and budget.
+// Breakpoints and the JIT are not supported. Instantiated for 8, 16 and 32
+// lanes.
+template <size_t N>
+class WideCPU {
+public:
+	WideCPU();
+
+	// Resets every lane like CPU::reset, rewriting only the pages stored to
+	// since the last reset
+	void reset();
+
+	// Writes the byte into every lane's memory
+	void load_addr(u16 addr, u8 byte_value);
+
+	// Copies `size` bytes to `addr` in every lane; the range must fit in
+	// memory
+	void load(u16 addr, const u8 *data, size_t size);
+
+	u8 read_byte(size_t lane, u16 addr) const { return m_memory[lane].data[addr]; }
+
+	// Runs every lane until it halts, faults or spends its own budget in
+	// `cycles`. Lanes given a budget of 0 stop with BUDGET_EXHAUSTED.
+	void run(size_t (&cycles)[N], CPU::StopReason (&reasons)[N]);
+
+	CPU::Fault fault(size_t lane) const { return m_fault[lane]; }
+private:
+	void dispatch(size_t (&cycles)[N]);
+
+	// Applies the instruction to every lane in m_mask. `refund` is what a
+	// faulting lane gets back: the cycles charged for the rest of its block.
+	void exec(const DecodedInst &inst, size_t (&cycles)[N], size_t refund);
+
+	void raise_fault(size_t lane, CPU::Fault fault, size_t (&cycles)[N], size_t refund);
+
+	void stop_lane(size_t lane, CPU::StopReason reason) {
+		m_reason[lane] = reason;
+		m_running[lane] = 0;
+		m_mask[lane] = 0;
+		m_live--;
+	}
+
+	size_t first_lane() const;
+	// Whether code starting at `start` may differ between lanes
+	bool may_differ(u16 start) const;
+	// Drops lanes from m_mask whose copy of [start, start + length) differs
+	// from the first lane's
+	void match_code(u16 start, size_t length);
+
+	Block &lookup_block(u16 addr);
+	void build_block(u16 addr);
+	void flush_blocks();
+
+	void write_byte(size_t lane, u16 addr, u8 value) {
+		m_memory[lane].data[addr] = value;
+		m_written_pages[addr / WIDE_PAGE_SIZE] = true;
+		m_dirty_pages[addr / MEMORY_PAGE_SIZE] = true;
+		if (m_code_bytes[addr]) {
+			invalidate_code(addr);
+		}
+	}
+
+	void invalidate_code(u16 addr);
+public:
+	alignas(32) u16 pc[N];
+	alignas(32) u16 sp[N];
+	alignas(32) u16 fbs[N];
+
+	// r0, r1, r2, r3, ra, ri and b0-b3, in CPU::reg_u16/reg_u8 order. Byte
+	// registers are widened so every kernel works on 16-bit lanes; their
+	// values never exceed 0xFF.
+	alignas(32) u16 regs_u16[6][N];
+	alignas(32) u16 regs_u8[4][N];
+
+	// 0 or 1 per lane
+	alignas(32) u16 equal[N];
+	alignas(32) u16 zero[N];
+	alignas(32) u16 sign[N];
+	alignas(32) u16 carry[N];
+	alignas(32) u16 overflow[N];
+private:
+	std::vector<Memory> m_memory;
+
+	// Lanes still running and the lanes of the group being executed, 0xFFFF
+	// in each lane that is
+	alignas(32) u16 m_running[N];
+	alignas(32) u16 m_mask[N];
+	size_t m_live = 0;
+
+	CPU::StopReason m_reason[N];
+	CPU::Fault m_fault[N];
+
+	// Shared decode state, built from the first lane of each group. Code in
+	// m_written_pages is checked against the other lanes before it runs.
+	std::vector<DecodedInst> m_decoded;
+	std::bitset<MEMORY_CAPACITY> m_code_bytes;
+	std::bitset<MEMORY_CAPACITY / WIDE_PAGE_SIZE> m_written_pages;
+	// Pages that differ from CPU::reset_memory() in some lane
+	std::bitset<MEMORY_PAGE_COUNT> m_dirty_pages;
+	bool m_code_written = false;
+	bool m_stop_block = false;
+
+	BlockCache m_blocks;
+	// The block being run when it came from m_written_pages
+	std::vector<DecodedInst> m_scratch;
+};
@@ -1,680 +1,1069 @@
 #include <iostream>
 #include <vector>
-#include <assert.h>
-#include <functional>
-#include <thread>
-#include <span>
 #include <fstream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
-typedef uint8_t u8;
-typedef uint16_t u16;
-typedef int8_t i8;
-typedef int16_t i16;
-
-#define MEMORY_CAPACITY 1024 * 64
-struct Memory {
-	u8 data[MEMORY_CAPACITY];
+#include "CPU.h"
+#include "Batch.h"
+#include "Daemon.h"
+#include "MappedFile.h"
+#include "ObjectFile.h"
+#include "Profiler.h"
+#include "RASM.h"
+#include "Replay.h"
+#include "Scheduler.h"
+#include "Timer.h"
+#include "Framebuffer.h"
+#include "GdbStub.h"
+#include "Trace.h"
+
+// A `run` image argument: `length` bytes from `offset` in the file, copied to
+// `addr`. Linked objects place their own segments and take no address;
+// assembly sources are assembled and linked in-process from `addr`.
+struct Segment {
+	std::string path;
+	bool placed;
+	u16 addr;
+	size_t offset;
+	size_t length;
 };
 
-struct CPU {
-public:
-	CPU(Memory mem)
-		: memory(mem) {}
-
-	void reset() {
-		pc = 0xD000;
-		sp = 0xB000;
-		fbs = 0x8000;
-
-		r0 = 0x0000;
-		r1 = 0x0000;
-		r2 = 0x0000;
-		r3 = 0x0000;
-
-		ra = 0x0000;
-		ri = 0x0000;
-
-		b0 = 0x00;
-		b1 = 0x00;
-		b2 = 0x00;
-		b3 = 0x00;
-
-		equal		= 0;
-		zero		= 0;
-		decimal		= 0;
-		sign		= 0;
-		carry		= 0;
-		overflow	= 0;
-		interrupt	= 0;
-		breakf		= 0;
-
-		std::fill(std::begin(memory.data), std::end(memory.data), 0x00);
-		for (size_t i = 0; i < (64 * 1024) * (64 * 1024) * 3 ; ++i) {
-            memory.data[fbs + i] = 0xFF;
-        }
-	}
-
-	void load_addr(u16 addr, u8 byte_value) {
-		memory.data[addr] = byte_value;
-	}
-
-	void execute(size_t &cycles) {
-		if (cycles > 0) {
-			u8 inst = fetch_byte(cycles);
-
-			switch (inst) {
-			case LR0: {
-				u16 value = fetch_word(cycles);
-				r0 = value;
-			} break;
-			case LR1: {
-				u16 value = fetch_word(cycles);
-				r1 = value;
-			} break;
-			case LR2: {
-				u16 value = fetch_word(cycles);
-				r2 = value;
-			} break;
-			case LR3: {
-				u16 value = fetch_word(cycles);
-				r3 = value;
-			} break;
-			case LB0: {
-				u16 value = fetch_byte(cycles);
-				b0 = value;
-			} break;
-			case LB1: {
-				u16 value = fetch_byte(cycles);
-				b1 = value;
-			} break;
-			case LB2: {
-				u16 value = fetch_byte(cycles);
-				b2 = value;
-			} break;
-			case LB3: {
-				u16 value = fetch_byte(cycles);
-				b3 = value;
-			} break;
-			case LDA: {
-				u16 value = fetch_word(cycles);
-				ra = value;
-			} break;
-			case LDI: {
-				u16 value = fetch_word(cycles);
-				ri = value;
-			} break;
-			case PUSH: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case BYTE: {
-					u8 value = fetch_byte(cycles);
-					memory.data[sp] = value;
-					sp++;
-				} break;
-				case WORD: {
-					u8 low_byte = fetch_byte(cycles);
-					u8 high_byte = fetch_byte(cycles);
-					memory.data[sp] = low_byte;
-					memory.data[sp + 1] = high_byte;
-					sp += 2;
-				} break;
-				default: {
-					std::cerr << "Invalid value mode: "
-						<< "0x" << std::hex << std::uppercase << static_cast<int>(mode) << std::endl;
-					exit(1);
-				} break;
-				}
-
-				cycles--;
-			} break;
-			case POP: {
-				u8 mode = fetch_byte(cycles);
-
-				switch (mode) {
-				case BYTE: {
-					u8 *dest = fetch_register_u8(cycles);
-					*dest = memory.data[sp - 1];
-					memory.data[sp - 1] = 0x00;
-					sp--;
-				} break;
-				case WORD: {
-					u16 *dest = fetch_register_u16(cycles);
-					*dest = ((u16)memory.data[sp - 2] << 8) | (u16)memory.data[sp - 1];
-					memory.data[sp - 2] = 0x00;
-					memory.data[sp - 1] = 0x00;
-					sp -= 2;
-				} break;
-				default: {
-					std::cerr << "Invalid value mode: "
-						<< "0x" << std::hex << std::uppercase << static_cast<int>(mode) << std::endl;
-					exit(1);
-				} break;
-				}
-			} break;
-			case STB: {
-				u16 *memory_addr = fetch_register_u16(cycles);
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 value = fetch_byte(cycles);
-					memory.data[*memory_addr] = value;
-				} break;
-				case 0xA1: {
-					u8 *value = fetch_register_u8(cycles);
-					memory.data[*memory_addr] = *value;
-				} break;
-				}
-
-				cycles--;
-			} break;
-			case STW: {
-				u16 *memory_addr = fetch_register_u16(cycles);
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 low_byte = fetch_byte(cycles);
-					u8 high_byte = fetch_byte(cycles);
-					memory.data[*memory_addr] = low_byte;
-					memory.data[*memory_addr + 1] = high_byte;
-				} break;
-				case 0xA1: {
-					u16 *value = fetch_register_u16(cycles);
-					memory.data[*memory_addr] = *value & 0xFF;
-					memory.data[*memory_addr + 1] = (*value >> 8) & 0xFF;
-				} break;
-				}
-
-				cycles--;
-			} break;
-			case LDB: {
-				u8 *dest = fetch_register_u8(cycles);
-				u16 *addr = fetch_register_u16(cycles);
-
-				*dest = memory.data[*addr];
-			} break;
-			case LDW: {
-				u16 *dest = fetch_register_u16(cycles);
-				u16 *addr = fetch_register_u16(cycles);
-
-				*dest = ((u16)memory.data[*addr] << 8) | (u16)memory.data[*addr + 1];
-			} break;
-			case ADD: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                *dest = *reg1 + *reg2;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = (*reg1 > 0xFFFF - *reg2);
-                overflow = (((*reg1 ^ *reg2) & 0x8000) == 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
-            } break;
-            case ADC: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                u16 carry_in = carry ? 1 : 0;
-
-                *dest = *reg1 + *reg2 + carry_in;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = (*dest < *reg1 || *dest < *reg2 || carry_in);
-                overflow = (((*reg1 ^ *reg2) & 0x8000) == 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
-            } break;
-            case SUB: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                *dest = *reg1 - *reg2;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = (*reg1 < *reg2);
-                overflow = (((*reg1 ^ *reg2) & 0x8000) != 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
-            } break;
-            case SBB: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                u16 carry_in = carry ? 1 : 0;
-
-                *dest = *reg1 - *reg2 - carry_in;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = (*reg1 < *reg2 + carry_in);
-                overflow = (((*reg1 ^ *reg2) & 0x8000) != 0) && (((*reg1 ^ *dest) & 0x8000) != 0);
-            } break;
-            case MUL: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                *dest = *reg1 * *reg2;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = false;
-                overflow = carry;
-            } break;
-            case DIV: {
-                u16 *dest = fetch_register_u16(cycles);
-                u16 *reg1 = fetch_register_u16(cycles);
-                u16 *reg2 = fetch_register_u16(cycles);
-                *dest = *reg1 / *reg2;
-
-                zero = (*dest == 0);
-                sign = (static_cast<i16>(*dest) < 0);
-                carry = false;
-                overflow = false;
-            } break;
-			case ADDB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                *dest = *reg1 + *reg2;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = (*reg1 > 0xFF - *reg2);
-                overflow = (((*reg1 ^ *reg2) & 0x80) == 0) && (((*reg1 ^ *dest) & 0x80) != 0);
-            } break;
-            case ADCB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                u8 carry_in = carry ? 1 : 0;
-
-                *dest = *reg1 + *reg2 + carry_in;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = (*dest < *reg1 || *dest < *reg2 || carry_in);
-                overflow = (((*reg1 ^ *reg2) & 0x80) == 0) && (((*reg1 ^ *dest) & 0x80) != 0);
-            } break;
-            case SUBB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                *dest = *reg1 - *reg2;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = (*reg1 < *reg2);
-                overflow = (((*reg1 ^ *reg2) & 0x80) != 0) && (((*reg1 ^ *dest) & 0x80) != 0);
-            } break;
-            case SBBB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                u8 carry_in = carry ? 1 : 0;
-
-                *dest = *reg1 - *reg2 - carry_in;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = (*reg1 < *reg2 + carry_in);
-                overflow = (((*reg1 ^ *reg2) & 0x80) != 0) && (((*reg1 ^ *dest) & 0x80) != 0);
-            } break;
-            case MULB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                *dest = *reg1 * *reg2;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = false;
-                overflow = carry;
-            } break;
-            case DIVB: {
-                u8 *dest = fetch_register_u8(cycles);
-                u8 *reg1 = fetch_register_u8(cycles);
-                u8 *reg2 = fetch_register_u8(cycles);
-                *dest = *reg1 / *reg2;
-
-                zero = (*dest == 0);
-                sign = (*dest & 0x80) != 0;
-                carry = false;
-                overflow = false;
-            } break;
-			case AND: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					u8 *reg2 = fetch_register_u8(cycles);
-					*dest = *reg1 & *reg2;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					u16 *reg2 = fetch_register_u16(cycles);
-					*dest = *reg1 & *reg2;
-				} break;
-				}
-			} break;
-			case OR: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					u8 *reg2 = fetch_register_u8(cycles);
-					*dest = *reg1 | *reg2;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					u16 *reg2 = fetch_register_u16(cycles);
-					*dest = *reg1 | *reg2;
-				} break;
-				}
-			} break;
-			case XOR: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					u8 *reg2 = fetch_register_u8(cycles);
-					*dest = *reg1 ^ *reg2;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					u16 *reg2 = fetch_register_u16(cycles);
-					*dest = *reg1 ^ *reg2;
-				} break;
-				}
-			} break;
-			case NOT: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					*dest = ~*reg1;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					*dest = ~*reg1;
-				} break;
-				}
-			} break;
-			case SHL: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					u8 *reg2 = fetch_register_u8(cycles);
-					*dest = *reg1 << *reg2;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					u16 *reg2 = fetch_register_u16(cycles);
-					*dest = *reg1 << *reg2;
-				} break;
-				}
-			} break;
-			case SHR: {
-				u8 mode = fetch_byte(cycles);
-				switch (mode) {
-				case 0xA0: {
-					u8 *dest = fetch_register_u8(cycles);
-					u8 *reg1 = fetch_register_u8(cycles);
-					u8 *reg2 = fetch_register_u8(cycles);
-					*dest = *reg1 >> *reg2;
-				} break;
-				case 0xA1: {
-					u16 *dest = fetch_register_u16(cycles);
-					u16 *reg1 = fetch_register_u16(cycles);
-					u16 *reg2 = fetch_register_u16(cycles);
-					*dest = *reg1 >> *reg2;
-				} break;
-				}
-			} break;
-			case EQU: {
-				equal = *fetch_register_u16(cycles) == *fetch_register_u16(cycles);
-			} break;
-			case JZ: {
-				u16 value = fetch_word(cycles);
-				if (equal == 0) {
-					pc = value;
-				}
-			} break;
-			case JNZ: {
-				u16 value = fetch_word(cycles);
-				if (equal != 0) {
-					pc = value;
-				}
-			} break;
-			case JMP: {
-				u16 value = fetch_word(cycles);
-				pc = value;
-			} break;
-			case HLT: {
-				cycles = 0;
-			} break;
-			default: {
-				std::cerr << "Invalid CPU instruction: "
-					<< "0x" << std::hex << std::uppercase << static_cast<int>(inst) << std::endl;
+static void Usage(char *programFile) {
+	std::cerr << "Usage: " << programFile << " [SUBCOMMAND] [ARGS]" << std::endl;
+	std::cerr << "    run <image>[@<addr>[:<offset>[:<length>]]]|<executable>|<source>.asm[@<base>]... [--pc <n>] [--sp <n>] [--cycles <n>] [--format text|json] [--profile <report>] [--trace <file>] [--record <file> [--snapshot-every <cycles>]] [--timer <period>@<vector>]... [--framebuffer <file> [--frame-every <cycles>]] [--break <addr>]... [--watch <addr>[:<length>]]... [--watch-read <addr>[:<length>]]... [--gdb <port>|<socket path>] [--symbols <executable>] [--jit off|on|differential]" << std::endl;
+	std::cerr << "    replay <recording> [--to <cycle>]" << std::endl;
+	std::cerr << "    trace <file> [--pc <from>:<to>] [--reg <name>]" << std::endl;
+	std::cerr << "    frames <file> [--ppm <prefix>]" << std::endl;
+	std::cerr << "    batch <jobs> [--out <file>] [--binary] [--threads <n>] [--lanes 8|16|32] [--cycles <n>] [--jit off|on|differential]" << std::endl;
+	std::cerr << "    serve <port>|<socket path> [--threads <n>]" << std::endl;
+	std::cerr << "    submit <port>|<socket path> [<jobs>] [--cycles <n>] [--window <n>] [--stats] [--shutdown]" << std::endl;
+	std::cerr << "    loadgen <port>|<socket path> <image> [--jobs <n>] [--connections <n>] [--window <n>] [--load <addr>] [--pc <addr>] [--cycles <n>]" << std::endl;
+}
+
+static bool IsSource(const std::string &path) {
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".asm") == 0;
+}
+
+static char *Shift(int &argc, char ***argv) {
+	char *result = **argv;
+	argc -= 1;
+	*argv += 1;
+	return result;
+}
+
+static size_t ParseCount(char *program, const char *flag, const char *text) {
+	char *end;
+	unsigned long long value = std::strtoull(text, &end, 0);
+	if (*text == '\0' || *text == '-' || *end != '\0') {
+		Usage(program);
+		std::cerr << "Invalid value for " << flag << ": " << text << std::endl;
+		exit(1);
+	}
+
+	return value;
+}
+
+static u16 ParseAddress(char *program, const char *flag, const char *text) {
+	size_t value = ParseCount(program, flag, text);
+	if (value > 0xFFFF) {
+		Usage(program);
+		std::cerr << "Invalid value for " << flag << ": " << text << std::endl;
+		exit(1);
+	}
+
+	return (u16)value;
+}
+
+// Builds without the JIT only accept `off`
+static CPU::JitMode ParseJitMode(char *program, const std::string &text) {
+	CPU::JitMode mode;
+	if (text == "off") {
+		mode = CPU::JIT_OFF;
+	} else if (text == "on") {
+		mode = CPU::JIT_ON;
+	} else if (text == "differential") {
+		mode = CPU::JIT_DIFFERENTIAL;
+	} else {
+		Usage(program);
+		std::cerr << "--jit must be off, on or differential" << std::endl;
+		exit(1);
+	}
+
+	if (!R828_HAS_JIT && mode != CPU::JIT_OFF) {
+		std::cerr << "This build has no JIT (premake --jit, x86-64 only)" << std::endl;
+		exit(1);
+	}
+
+	return mode;
+}
+
+// Splits `<path>[@<addr>[:<offset>[:<length>]]]` at its last '@', so paths
+// may contain ':' but not '@' followed by a number
+static Segment ParseSegment(char *program, const std::string &text) {
+	Segment segment { text, false, 0xD000, 0, std::numeric_limits<size_t>::max() };
+
+	size_t at = text.rfind('@');
+	if (at == std::string::npos) return segment;
+	segment.path = text.substr(0, at);
+	segment.placed = true;
+
+	std::string fields[3];
+	size_t count = 0;
+	for (size_t start = at + 1; count < 3; count++) {
+		size_t colon = text.find(':', start);
+		fields[count] = text.substr(start, colon - start);
+		if (colon == std::string::npos) {
+			count++;
+			break;
+		}
+		start = colon + 1;
+	}
+
+	segment.addr = ParseAddress(program, "image address", fields[0].c_str());
+	if (count > 1) segment.offset = ParseCount(program, "image offset", fields[1].c_str());
+	if (count > 2) segment.length = ParseCount(program, "image length", fields[2].c_str());
+	return segment;
+}
+
+static void PrintRegisters(const CPU &cpu) {
+	std::cout << "R0: " << static_cast<i16>(cpu.r0) << std::endl;
+	std::cout << "R1: " << static_cast<i16>(cpu.r1) << std::endl;
+	std::cout << "R2: " << static_cast<i16>(cpu.r2) << std::endl;
+	std::cout << "R3: " << static_cast<i16>(cpu.r3) << std::endl;
+	std::cout << "RA: " << static_cast<i16>(cpu.ra) << std::endl;
+	std::cout << "RI: " << static_cast<i16>(cpu.ri) << std::endl;
+	std::cout << "B0: " << static_cast<i16>(cpu.b0) << std::endl;
+	std::cout << "B1: " << static_cast<i16>(cpu.b1) << std::endl;
+	std::cout << "B2: " << static_cast<i16>(cpu.b2) << std::endl;
+	std::cout << "B3: " << static_cast<i16>(cpu.b3) << std::endl;
+	std::cout << "EQUAL: " << static_cast<u16>(cpu.equal) << std::endl;
+}
+
+// Waits for one debugger on `address` and lets it drive the CPU. A detached
+// program runs on to the end of its budget; a killed one ends the emulator.
+static CPU::StopReason DebugProgram(CPU &cpu, const std::string &address, size_t &remaining) {
+	Socket listener;
+	std::string error;
+	if (!listener.listen(address, error)) {
+		std::cerr << "Cannot serve GDB: " << error << std::endl;
+		exit(1);
+	}
+
+	std::cerr << "Waiting for GDB on " << address << std::endl;
+	Socket connection;
+	if (!listener.accept(connection)) {
+		std::cerr << "Cannot accept GDB connection on " << address << std::endl;
+		exit(1);
+	}
+	listener.close();
+
+	GdbStub stub(cpu, connection, remaining);
+	GdbStub::Outcome outcome = stub.serve();
+	remaining = stub.remaining();
+
+	switch (outcome) {
+	case GdbStub::DETACHED: return remaining > 0 ? cpu.run(remaining) : CPU::BUDGET_EXHAUSTED;
+	case GdbStub::KILLED: exit(0);
+	case GdbStub::STOPPED: break;
+	}
+
+	return stub.reason();
+}
+
+static int RunProgram(char *program, int argc, char **argv) {
+	std::vector<Segment> segments;
+	bool has_pc = false;
+	u16 pc = 0;
+	bool has_sp = false;
+	u16 sp = 0;
+	size_t cycles = std::numeric_limits<size_t>::max();
+	bool json = false;
+	std::string profile_path;
+	std::string trace_path;
+	std::string record_path;
+	std::string gdb_address;
+	u64 snapshot_interval = REPLAY_SNAPSHOT_INTERVAL;
+	// Periods and vectors of periodic timers, on IRQ lines in order
+	std::vector<std::pair<u64, u16>> timers;
+	std::string framebuffer_path;
+	u64 frame_interval = FRAMEBUFFER_FRAME_INTERVAL;
+	std::vector<u16> breakpoints;
+	// Start, length and WatchAccess mask of each watchpoint
+	struct Watch {
+		u16 addr;
+		size_t length;
+		u8 access;
+	};
+	std::vector<Watch> watches;
+	std::vector<std::string> symbol_paths;
+	bool has_jit = false;
+	CPU::JitMode jit = CPU::JIT_OFF;
+
+	while (argc > 0) {
+		std::string arg = Shift(argc, &argv);
+		if (argc > 0 && arg == "--profile") {
+			profile_path = Shift(argc, &argv);
+		} else if (argc > 0 && arg == "--trace") {
+			trace_path = Shift(argc, &argv);
+		} else if (argc > 0 && arg == "--gdb") {
+			gdb_address = Shift(argc, &argv);
+		} else if (argc > 0 && arg == "--record") {
+			record_path = Shift(argc, &argv);
+		} else if (argc > 0 && arg == "--snapshot-every") {
+			snapshot_interval = ParseCount(program, "--snapshot-every", Shift(argc, &argv));
+			if (snapshot_interval == 0) {
+				Usage(program);
+				std::cerr << "--snapshot-every must be at least 1" << std::endl;
+				exit(1);
+			}
+		} else if (argc > 0 && arg == "--symbols") {
+			symbol_paths.push_back(Shift(argc, &argv));
+		} else if (argc > 0 && arg == "--timer") {
+			std::string timer = Shift(argc, &argv);
+			size_t at = timer.find('@');
+			if (at == std::string::npos || timers.size() == CPU_IRQ_LINES) {
+				Usage(program);
+				std::cerr << (at == std::string::npos ? "--timer takes <period>@<vector>" : "Too many timers") << std::endl;
+				exit(1);
+			}
+			u64 period = ParseCount(program, "--timer", timer.substr(0, at).c_str());
+			u16 vector = ParseAddress(program, "--timer", timer.substr(at + 1).c_str());
+			timers.emplace_back(period, vector);
+		} else if (argc > 0 && arg == "--framebuffer") {
+			framebuffer_path = Shift(argc, &argv);
+		} else if (argc > 0 && arg == "--frame-every") {
+			frame_interval = ParseCount(program, "--frame-every", Shift(argc, &argv));
+			if (frame_interval == 0) {
+				Usage(program);
+				std::cerr << "--frame-every must be at least 1" << std::endl;
 				exit(1);
-			} break;
 			}
+		} else if (argc > 0 && arg == "--break") {
+			breakpoints.push_back(ParseAddress(program, "--break", Shift(argc, &argv)));
+		} else if (argc > 0 && (arg == "--watch" || arg == "--watch-read")) {
+			std::string range = Shift(argc, &argv);
+			size_t colon = range.find(':');
+			Watch watch { ParseAddress(program, arg.c_str(), range.substr(0, colon).c_str()), 1, CPU::WATCH_WRITE };
+			if (colon != std::string::npos) {
+				watch.length = ParseCount(program, arg.c_str(), range.substr(colon + 1).c_str());
+			}
+			if (arg == "--watch-read") {
+				watch.access = CPU::WATCH_READ;
+			}
+			watches.push_back(watch);
+		} else if (argc > 0 && arg == "--pc") {
+			pc = ParseAddress(program, "--pc", Shift(argc, &argv));
+			has_pc = true;
+		} else if (argc > 0 && arg == "--sp") {
+			sp = ParseAddress(program, "--sp", Shift(argc, &argv));
+			has_sp = true;
+		} else if (argc > 0 && arg == "--cycles") {
+			cycles = ParseCount(program, "--cycles", Shift(argc, &argv));
+		} else if (argc > 0 && arg == "--jit") {
+			jit = ParseJitMode(program, Shift(argc, &argv));
+			has_jit = true;
+		} else if (argc > 0 && arg == "--format") {
+			std::string format = Shift(argc, &argv);
+			if (format != "text" && format != "json") {
+				Usage(program);
+				std::cerr << "--format must be text or json" << std::endl;
+				exit(1);
+			}
+			json = format == "json";
+		} else if (arg.rfind("--", 0) == 0) {
+			Usage(program);
+			std::cerr << "Invalid run argument: " << arg << std::endl;
+			exit(1);
+		} else {
+			segments.push_back(ParseSegment(program, arg));
 		}
 	}
-private:
-	u8 fetch_byte(size_t &cycles) {
-		u8 byte = memory.data[pc];
-		pc++;
 
-		cycles--;
-		return byte;
+	if (segments.empty()) {
+		Usage(program);
+		std::cerr << "Missing image!" << std::endl;
+		exit(1);
+	}
+
+	if (!profile_path.empty() + !trace_path.empty() + !record_path.empty() + !gdb_address.empty() > 1) {
+		Usage(program);
+		std::cerr << "Only one of --profile, --trace, --record and --gdb can be given" << std::endl;
+		exit(1);
+	}
+
+	CPU cpu;
+	cpu.reset();
+	if (has_jit) {
+		cpu.set_jit_mode(jit);
 	}
 
-	u16 fetch_word(size_t &cycles) {
-		u8 low_byte = memory.data[pc];
+	// Each file is mapped once however many segments it provides
+	std::unordered_map<std::string, MappedFile> files;
+	auto map = [&](const std::string &path) -> MappedFile & {
+		MappedFile &file = files[path];
+		if (!file.data() && !file.open(path)) {
+			std::cerr << "Failed to open image: " << path << std::endl;
+			exit(1);
+		}
+		return file;
+	};
+
+	// All sources are linked into one program, loaded where the first is
+	// listed and placed from its address
+	std::vector<std::string_view> sources;
+	const Segment *first_source = nullptr;
+	for (const Segment &segment : segments) {
+		if (!IsSource(segment.path)) continue;
 
-		u8 high_byte = memory.data[pc +  1];
-		pc += 2;
+		if (first_source && segment.placed) {
+			std::cerr << "Cannot place " << segment.path << ": only the first source takes an address" << std::endl;
+			exit(1);
+		}
 
-		cycles--;
-		return ((u16)low_byte << 8) | (u16)high_byte;
+		MappedFile &file = map(segment.path);
+		sources.emplace_back(reinterpret_cast<const char *>(file.data()), file.size());
+		if (!first_source) first_source = &segment;
 	}
 
-	u16 *fetch_register_u16(size_t &cycles) {
-		u8 code = memory.data[pc];
-		pc++;
-		cycles--;
-		
-		switch (code) {
-		case R0: return &r0;
-		case R1: return &r1;
-		case R2: return &r2;
-		case R3: return &r3;
-		case RA: return &ra;
-		case RI: return &ri;
-		default: {
-			std::cerr << "Register code does not exist: " << code << std::endl;
+	// Labels for the profile, from every program loaded and --symbols
+	SymbolTable symbols;
+	for (const std::string &path : symbol_paths) {
+		ObjectFile object;
+		std::string error;
+		if (!object.parse(map(path), error)) {
+			std::cerr << "Cannot read symbols from " << path << ": " << error << std::endl;
 			exit(1);
 		}
+
+		for (const ObjectSymbol &symbol : object.symbols()) {
+			symbols.add(std::string(symbol.name), symbol.addr);
 		}
 	}
 
-	u8 *fetch_register_u8(size_t &cycles) {
-		u8 code = memory.data[pc];
-		pc++;
-		cycles--;
-		
-		switch (code) {
-		case B0: return &b0;
-		case B1: return &b1;
-		case B2: return &b2;
-		case B3: return &b3;
-		default: {
-			std::cerr << "Register code does not exist: " << code << std::endl;
+	u16 entry = segments[0].addr;
+	for (const Segment &segment : segments) {
+		MappedFile &file = map(segment.path);
+
+		if (IsSource(segment.path)) {
+			if (&segment != first_source) continue;
+
+			RASM::Object linked;
+			try {
+				linked = RASM::AssembleProgram(sources, segment.addr);
+			} catch (const RASM::Error &error) {
+				// Positions in the message are within the source that failed,
+				// which is only known when there is one
+				std::cerr << "Cannot assemble " << (sources.size() == 1 ? segment.path : std::string("sources")) << ": " << error.what() << std::endl;
+				exit(1);
+			}
+
+			for (const RASM::Segment &part : linked.segments) {
+				cpu.load(part.base, part.data.data(), part.data.size());
+			}
+
+			for (const RASM::Symbol &symbol : linked.symbols) {
+				symbols.add(symbol.name, linked.segments[symbol.segment].base + symbol.offset);
+			}
+
+			u16 start = RASM::ProgramEntry(linked, segment.addr);
+			if (&segment == &segments[0]) {
+				entry = start;
+			}
+			continue;
+		}
+
+		if (ObjectFile::is_object(file)) {
+			ObjectFile object;
+			std::string error;
+			if (segment.placed || !object.parse(file, error)) {
+				std::cerr << "Cannot load object " << segment.path << ": "
+					<< (segment.placed ? "objects take no load address" : error) << std::endl;
+				exit(1);
+			}
+
+			for (const ObjectSegment &part : object.segments()) {
+				cpu.load(part.base, part.data, part.size);
+			}
+
+			for (const ObjectSymbol &symbol : object.symbols()) {
+				symbols.add(std::string(symbol.name), symbol.addr);
+			}
+
+			if (&segment == &segments[0]) {
+				entry = object.entry();
+			}
+			continue;
+		}
+
+		if (segment.offset > file.size()) {
+			std::cerr << "Offset is past the end of image: " << segment.path << std::endl;
 			exit(1);
 		}
+
+		size_t length = std::min(segment.length, file.size() - segment.offset);
+		if (segment.addr + length > MEMORY_CAPACITY) {
+			std::cerr << "Image does not fit at load address: " << segment.path << std::endl;
+			exit(1);
 		}
+
+		cpu.load(segment.addr, file.data() + segment.offset, length);
 	}
-public:
-	enum Inst {
-		LR0		= 0xA0,
-		LR1		= 0xA1,
-		LR2		= 0xA2,
-		LR3		= 0xA3,
-
-		LB0		= 0xA4,
-		LB1		= 0xA5,
-		LB2		= 0xA6,
-		LB3		= 0xA7,
-
-		LDA		= 0xA8,
-		LDI		= 0xA9,
-
-		PUSH	= 0xAA,
-		POP		= 0xAB,
-
-		STB		= 0xAC,
-		STW		= 0xAD,
-		LDB		= 0xAE,
-		LDW		= 0xAF,
-		
-		ADD		= 0xB1,
-		ADC		= 0xB2,
-		SUB		= 0xB3,
-		SBB		= 0xB4,
-		MUL		= 0xB5,
-		DIV		= 0xB6,
-		
-		ADDB	= 0xB7,
-		ADCB	= 0xB8,
-		SUBB	= 0xB9,
-		SBBB	= 0xBA,
-		MULB	= 0xBB,
-		DIVB	= 0xBC,
-
-		EQU		= 0xC0,
-		JZ		= 0xC1,
-		JNZ		= 0xC2,
-		JMP		= 0xC3,
-
-		AND		= 0xE0,
-		OR		= 0xE1,
-		XOR		= 0xE2,
-		NOT		= 0xE3,
-		SHL		= 0xE4,
-		SHR		= 0xE5,
-
-		HLT		= 0xFF,
-	};
 
-	enum RegCode {
-		R0		= 0xA0,
-		R1		= 0xA1,
-		R2		= 0xA2,
-		R3		= 0xA3,
-
-		RA		= 0xA4,
-		RI		= 0xA5,
-		
-		B0		= 0xB5,
-		B1		= 0xB6,
-		B2		= 0xB7,
-		B3		= 0xB8
-	};
+	cpu.pc = has_pc ? pc : entry;
+	if (has_sp) {
+		cpu.sp = sp;
+	}
 
-	enum ValueCode {
-		BYTE	= 0xA0,
-		WORD	= 0xA1,
-	};
-public:
-	u16 pc;
-	u16 sp;
-	u16 fbs;
-	
-	// 16-bit registers
-	u16 r0;
-	u16 r1;
-	u16 r2;
-	u16 r3;
-
-	// Special Purpose Accumulator Register
-	u16 ra;
-
-	// Special Purpose All-Intermediate Register
-	// Typically recommended for memory addresses
-	u16 ri;
-	
-	// 8-bit registers
-	u8 b0;
-	u8 b1;
-	u8 b2;
-	u8 b3;
-
-	u8 equal		: 1;
-
-	u8 zero			: 1;
-	u8 decimal		: 1;
-	u8 sign			: 1;
-	u8 carry		: 1;
-	u8 overflow		: 1;
-	u8 interrupt	: 1;
-	u8 breakf		: 1;
-private:
-	Memory memory;
-};
+	for (u16 addr : breakpoints) {
+		cpu.set_breakpoint(addr);
+	}
+	for (const Watch &watch : watches) {
+		cpu.set_watchpoint(watch.addr, watch.length, watch.access);
+	}
+
+	Scheduler scheduler;
+	std::vector<std::unique_ptr<Timer>> devices;
+	for (size_t line = 0; line < timers.size(); line++) {
+		cpu.set_irq_vector((u8)line, timers[line].second);
+		devices.push_back(std::make_unique<Timer>(cpu, scheduler, (u8)line));
+		devices.back()->start(timers[line].first, true);
+	}
+
+	// Mapped once the image is loaded, which still writes the framebuffer's
+	// RAM underneath
+	std::unique_ptr<Framebuffer> framebuffer;
+	if (!framebuffer_path.empty()) {
+		framebuffer = std::make_unique<Framebuffer>(framebuffer_path);
+		cpu.map_device(cpu.fbs, FRAMEBUFFER_SIZE, *framebuffer);
+		framebuffer->stream(cpu, scheduler, frame_interval);
+	}
+
+	if (!devices.empty() || framebuffer) {
+		cpu.set_scheduler(&scheduler);
+	}
 
-int main() {
-	Memory memory {};
-	CPU cpu(memory);
+	size_t remaining = cycles;
+	CPU::StopReason reason;
+	if (!record_path.empty()) {
+		ReplayDevices recorded;
+		for (const std::unique_ptr<Timer> &timer : devices) {
+			recorded.timers.push_back(timer.get());
+		}
+		recorded.framebuffer = framebuffer.get();
+		recorded.framebuffer_addr = cpu.fbs;
+
+		Recorder recorder(record_path, snapshot_interval, std::move(recorded));
+		reason = recorder.run(cpu, remaining);
+	} else if (!gdb_address.empty()) {
+		reason = DebugProgram(cpu, gdb_address, remaining);
+	} else if (!trace_path.empty()) {
+		Tracer tracer(trace_path);
+		reason = cpu.run(remaining, tracer);
+	} else if (profile_path.empty()) {
+		reason = cpu.run(remaining);
+	} else {
+		std::unique_ptr<Profiler> profiler = std::make_unique<Profiler>();
+		reason = cpu.run(remaining, *profiler);
+
+		std::ofstream out(profile_path);
+		if (!out) {
+			std::cerr << "Failed to open profile: " << profile_path << std::endl;
+			exit(1);
+		}
+		profiler->report(out, cpu, symbols);
+	}
+
+	if (framebuffer) {
+		framebuffer->emit(cpu.cycle());
+	}
+
+	if (json) {
+		BatchResult result {};
+		result.reason = reason;
+		result.fault = cpu.fault();
+		result.cycles_used = cycles - remaining;
+		Batch::read_state(cpu, result);
+		Batch::write_result(std::cout, BATCH_JSONL, 0, result);
+
+		return reason == CPU::FAULT ? 1 : 0;
+	}
+
+	if (reason == CPU::FAULT) {
+		std::cerr << cpu.fault_message() << std::endl;
+		exit(1);
+	}
+
+	if (reason == CPU::BREAKPOINT) {
+		std::cerr << "Breakpoint at 0x" << std::hex << std::uppercase << cpu.pc << std::dec << std::endl;
+	} else if (reason == CPU::WATCHPOINT) {
+		const CPU::WatchHit &hit = cpu.watch_hit();
+		std::cerr << std::hex << std::uppercase << "Watchpoint: " << (hit.access == CPU::WATCH_READ ? "read 0x" : "wrote 0x")
+			<< static_cast<int>(hit.value) << (hit.access == CPU::WATCH_READ ? " from 0x" : " to 0x") << hit.addr
+			<< " (pc 0x" << cpu.pc << ")" << std::dec << std::endl;
+	}
+
+	PrintRegisters(cpu);
+	return 0;
+}
+
+// Reruns a recording from its snapshots, either to the end, checking that it
+// reproduces every snapshot, or to one cycle
+static int ReplayRecording(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing recording!" << std::endl;
+		exit(1);
+	}
+
+	std::string path = Shift(argc, &argv);
+	bool has_to = false;
+	u64 to = 0;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (argc > 0 && flag == "--to") {
+			to = ParseCount(program, "--to", Shift(argc, &argv));
+			has_to = true;
+		} else {
+			Usage(program);
+			std::cerr << "Invalid replay argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	Replay replay;
+	std::string error;
+	if (!replay.open(path, error)) {
+		std::cerr << "Cannot read recording " << path << ": " << error << std::endl;
+		exit(1);
+	}
+
+	CPU cpu;
 	cpu.reset();
 
-	std::vector<u8> program;
-	std::ifstream file("C:\\Dev\\R828em\\output.bin", std::ios::binary);
-	if (!file) {
-		std::cerr << "Failed to open file!" << std::endl;
+	if (has_to) {
+		if (to > replay.length()) {
+			std::cerr << "Recording ends at cycle " << replay.length() << std::endl;
+			exit(1);
+		}
+
+		if (replay.seek(cpu, to) == CPU::FAULT) {
+			std::cerr << cpu.fault_message() << std::endl;
+			exit(1);
+		}
+		std::cout << "Cycle " << to << std::endl;
+	} else {
+		u64 diverged;
+		if (!replay.verify(cpu, diverged)) {
+			std::cerr << "Replay diverged from the recording by cycle " << diverged << std::endl;
+			exit(1);
+		}
+		std::cout << "Replayed " << replay.length() << " cycles, " << replay.snapshots().size() << " snapshots" << std::endl;
+	}
+
+	PrintRegisters(cpu);
+	return 0;
+}
+
+// Prints the records of a trace file, optionally only those with a pc in
+// [from, to] or that wrote one register
+static int PrintTrace(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing trace file!" << std::endl;
+		exit(1);
+	}
+
+	std::string path = Shift(argc, &argv);
+	u16 from = 0x0000;
+	u16 to = 0xFFFF;
+	u8 reg = ISA::NO_REG;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (argc > 0 && flag == "--pc") {
+			std::string range = Shift(argc, &argv);
+			size_t colon = range.find(':');
+			if (colon == std::string::npos) {
+				Usage(program);
+				std::cerr << "--pc takes <from>:<to>" << std::endl;
+				exit(1);
+			}
+			from = ParseAddress(program, "--pc", range.substr(0, colon).c_str());
+			to = ParseAddress(program, "--pc", range.substr(colon + 1).c_str());
+		} else if (argc > 0 && flag == "--reg") {
+			std::string name = Shift(argc, &argv);
+			for (char &c : name) c = (char)std::toupper((unsigned char)c);
+			for (const ISA::Register &candidate : ISA::REGISTERS) {
+				if (candidate.name == name) reg = candidate.code;
+			}
+			if (reg == ISA::NO_REG) {
+				Usage(program);
+				std::cerr << "Unknown register for --reg: " << name << std::endl;
+				exit(1);
+			}
+		} else {
+			Usage(program);
+			std::cerr << "Invalid trace argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	TraceReader reader;
+	std::string error;
+	if (!reader.open(path, error)) {
+		std::cerr << "Cannot read trace " << path << ": " << error << std::endl;
 		exit(1);
 	}
 
-	file.seekg(0, std::ios::end);
-	std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+	TraceRecord record;
+	char line[128];
+	for (u64 index = 0; reader.next(record); index++) {
+		if (record.pc < from || record.pc > to) continue;
+		if (reg != ISA::NO_REG && record.reg != reg) continue;
+
+		std::string text;
+		if (ISA::Disassemble(record.code, record.length, text) == 0) text = "??";
+
+		std::string written;
+		if (record.reg != ISA::NO_REG) {
+			bool wide = ISA::REG16_CODES[record.reg] != ISA::NO_REG;
+			const ISA::Register &target = ISA::REGISTERS[wide ? ISA::REG16_CODES[record.reg] : ISA::REG8_CODES[record.reg]];
+			std::snprintf(line, sizeof(line), wide ? "%s=%04X" : "%s=%02X", std::string(target.name).c_str(), record.value);
+			written = line;
+		}
 
-	program.resize(fileSize);
+		std::snprintf(line, sizeof(line), "%10llu  %04X  %-22s %-8s SP=%04X %c%c%c%c%c\n",
+			(unsigned long long)index, record.pc, text.c_str(), written.c_str(), record.sp,
+			record.flags & TRACE_EQUAL ? 'E' : '-', record.flags & TRACE_ZERO ? 'Z' : '-',
+			record.flags & TRACE_SIGN ? 'S' : '-', record.flags & TRACE_CARRY ? 'C' : '-',
+			record.flags & TRACE_OVERFLOW ? 'V' : '-');
+		std::cout << line;
+	}
 
-	if (!file.read(reinterpret_cast<char*>(program.data()), fileSize)) {
-        std::cerr << "Failed to read file" << std::endl;
-        exit(1);
-    }
+	return 0;
+}
 
-	file.close();
+static int RunBatch(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing job file!" << std::endl;
+		exit(1);
+	}
 
-	for (int i = 0; i < program.size(); i++) {
-		cpu.load_addr(cpu.pc + i, program[i]);
+	std::string jobs = Shift(argc, &argv);
+	std::string out_path;
+	BatchFormat format = BATCH_JSONL;
+	unsigned threads = 0;
+	unsigned lanes = 0;
+	size_t cycles = 100'000'000;
+	bool has_jit = false;
+	CPU::JitMode jit = CPU::JIT_OFF;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (flag == "--binary") {
+			format = BATCH_BINARY;
+		} else if (argc > 0 && flag == "--out") {
+			out_path = Shift(argc, &argv);
+		} else if (argc > 0 && flag == "--threads") {
+			threads = (unsigned)ParseCount(program, "--threads", Shift(argc, &argv));
+		} else if (argc > 0 && flag == "--lanes") {
+			lanes = (unsigned)ParseCount(program, "--lanes", Shift(argc, &argv));
+			if (lanes != 8 && lanes != 16 && lanes != 32) {
+				Usage(program);
+				std::cerr << "--lanes must be 8, 16 or 32" << std::endl;
+				exit(1);
+			}
+		} else if (argc > 0 && flag == "--cycles") {
+			cycles = ParseCount(program, "--cycles", Shift(argc, &argv));
+		} else if (argc > 0 && flag == "--jit") {
+			jit = ParseJitMode(program, Shift(argc, &argv));
+			has_jit = true;
+		} else {
+			Usage(program);
+			std::cerr << "Invalid batch argument: " << flag << std::endl;
+			exit(1);
+		}
 	}
 
-	size_t cycles = std::numeric_limits<double>::infinity();
-	while (cycles > 0) {
-		cpu.execute(cycles);
+	Batch batch;
+	batch.load_jobs(jobs, cycles);
+	if (has_jit) {
+		batch.set_jit_mode(jit);
 	}
 
-	std::cout << "R0: " << static_cast<i16>(cpu.r0) << std::endl;
-	std::cout << "R1: " << static_cast<i16>(cpu.r1) << std::endl;
-	std::cout << "R2: " << static_cast<i16>(cpu.r2) << std::endl;
-	std::cout << "R3: " << static_cast<i16>(cpu.r3) << std::endl;
-	std::cout << "RA: " << static_cast<i16>(cpu.ra) << std::endl;
-	std::cout << "RI: " << static_cast<i16>(cpu.ri) << std::endl;
-	std::cout << "B0: " << static_cast<i16>(cpu.b0) << std::endl;
-	std::cout << "B1: " << static_cast<i16>(cpu.b1) << std::endl;
-	std::cout << "B2: " << static_cast<i16>(cpu.b2) << std::endl;
-	std::cout << "B3: " << static_cast<i16>(cpu.b3) << std::endl;
-	std::cout << "EQUAL: " << static_cast<u16>(cpu.equal) << std::endl;
+	if (out_path.empty()) {
+		batch.run(threads, lanes, std::cout, format);
+	} else {
+		std::ofstream out(out_path, std::ios::binary);
+		if (!out) {
+			std::cerr << "Failed to open output file: " << out_path << std::endl;
+			exit(1);
+		}
+		batch.run(threads, lanes, out, format);
+	}
+
+	return 0;
+}
+
+static int ServeJobs(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing daemon address!" << std::endl;
+		exit(1);
+	}
+
+	std::string address = Shift(argc, &argv);
+	unsigned threads = 0;
 
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (argc > 0 && flag == "--threads") {
+			threads = (unsigned)ParseCount(program, "--threads", Shift(argc, &argv));
+		} else {
+			Usage(program);
+			std::cerr << "Invalid serve argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	Daemon daemon(threads);
+	std::cerr << "Serving jobs on " << address << std::endl;
+
+	std::string error;
+	if (!daemon.serve(address, error)) {
+		std::cerr << "Cannot serve jobs: " << error << std::endl;
+		exit(1);
+	}
+
+	std::cerr << daemon.stats() << std::endl;
 	return 0;
-}
\ No newline at end of file
+}
+
+// Sends a job file to a daemon, keeping up to `window` jobs in flight, and
+// prints results as JSON lines in the order they finish
+static int SubmitJobs(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing daemon address!" << std::endl;
+		exit(1);
+	}
+
+	std::string address = Shift(argc, &argv);
+	std::string jobs_path;
+	size_t cycles = 100'000'000;
+	size_t window = 1024;
+	bool stats = false;
+	bool shutdown = false;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (flag == "--stats") {
+			stats = true;
+		} else if (flag == "--shutdown") {
+			shutdown = true;
+		} else if (argc > 0 && flag == "--cycles") {
+			cycles = ParseCount(program, "--cycles", Shift(argc, &argv));
+		} else if (argc > 0 && flag == "--window") {
+			window = std::max<size_t>(1, ParseCount(program, "--window", Shift(argc, &argv)));
+		} else if (jobs_path.empty() && flag.compare(0, 2, "--") != 0) {
+			jobs_path = flag;
+		} else {
+			Usage(program);
+			std::cerr << "Invalid submit argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	Batch batch;
+	if (!jobs_path.empty()) {
+		batch.load_jobs(jobs_path, cycles);
+	}
+
+	DaemonClient client;
+	std::string error;
+	if (!client.connect(address, error)) {
+		std::cerr << "Cannot connect to daemon: " << error << std::endl;
+		exit(1);
+	}
+
+	for (u32 i = 0; i < batch.image_count(); i++) {
+		client.send_image(i, batch.image(i).data(), batch.image(i).size());
+	}
+
+	const std::vector<BatchJob> &jobs = batch.jobs();
+	size_t sent = 0;
+	size_t failed = 0;
+	DaemonClient::Reply reply;
+	for (size_t received = 0; received < jobs.size(); received++) {
+		for (; sent < jobs.size() && sent - received < window; sent++) {
+			client.send_job((u32)sent, jobs[sent]);
+		}
+
+		if (!client.flush() || !client.receive(reply)) {
+			std::cerr << "Lost connection to daemon" << std::endl;
+			exit(1);
+		}
+
+		if (reply.type == DAEMON_ERROR) {
+			std::cerr << "Job " << reply.id << ": " << reply.text << std::endl;
+			failed++;
+		} else {
+			Batch::write_result(std::cout, BATCH_JSONL, reply.id, reply.result);
+		}
+	}
+	std::cout.flush();
+
+	if (stats) {
+		client.send_stats();
+		if (!client.flush() || !client.receive(reply)) {
+			std::cerr << "Lost connection to daemon" << std::endl;
+			exit(1);
+		}
+		std::cerr << reply.text << std::endl;
+	}
+
+	if (shutdown) {
+		client.send_shutdown();
+		client.flush();
+	}
+
+	return failed == 0 ? 0 : 1;
+}
+
+// Keeps `window` copies of one job in flight on each of `connections`
+// connections and reports throughput and round trip latency percentiles
+static int GenerateLoad(char *program, int argc, char **argv) {
+	if (argc < 2) {
+		Usage(program);
+		std::cerr << "Missing daemon address or image!" << std::endl;
+		exit(1);
+	}
+
+	std::string address = Shift(argc, &argv);
+	std::string image_path = Shift(argc, &argv);
+	size_t jobs = 100'000;
+	size_t connections = 1;
+	size_t window = 64;
+
+	BatchJob job {};
+	job.load = 0xD000;
+	job.sp = 0xB000;
+	job.cycles = 100'000'000;
+	bool has_pc = false;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (argc > 0 && flag == "--jobs") {
+			jobs = ParseCount(program, "--jobs", Shift(argc, &argv));
+		} else if (argc > 0 && flag == "--connections") {
+			connections = std::max<size_t>(1, ParseCount(program, "--connections", Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--window") {
+			window = std::max<size_t>(1, ParseCount(program, "--window", Shift(argc, &argv)));
+		} else if (argc > 0 && flag == "--load") {
+			job.load = ParseAddress(program, "--load", Shift(argc, &argv));
+		} else if (argc > 0 && flag == "--pc") {
+			job.pc = ParseAddress(program, "--pc", Shift(argc, &argv));
+			has_pc = true;
+		} else if (argc > 0 && flag == "--cycles") {
+			job.cycles = ParseCount(program, "--cycles", Shift(argc, &argv));
+		} else {
+			Usage(program);
+			std::cerr << "Invalid loadgen argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	if (!has_pc) {
+		job.pc = job.load;
+	}
+
+	MappedFile image;
+	if (!image.open(image_path)) {
+		std::cerr << "Failed to open image: " << image_path << std::endl;
+		exit(1);
+	}
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Each connection runs its share of the jobs and records the latency of
+	// every one
+	std::vector<std::vector<u64>> latencies(connections);
+	std::vector<size_t> failures(connections, 0);
+
+	auto drive = [&](size_t index) {
+		size_t count = jobs / connections + (index < jobs % connections ? 1 : 0);
+
+		DaemonClient client;
+		std::string error;
+		if (!client.connect(address, error)) {
+			std::cerr << "Cannot connect to daemon: " << error << std::endl;
+			exit(1);
+		}
+		client.send_image(0, image.data(), image.size());
+
+		std::vector<Clock::time_point> started(count);
+		latencies[index].reserve(count);
+
+		size_t sent = 0;
+		DaemonClient::Reply reply;
+		for (size_t received = 0; received < count; received++) {
+			for (; sent < count && sent - received < window; sent++) {
+				started[sent] = Clock::now();
+				client.send_job((u32)sent, job);
+			}
+
+			if (!client.flush() || !client.receive(reply) || reply.id >= count) {
+				std::cerr << "Lost connection to daemon" << std::endl;
+				exit(1);
+			}
+
+			if (reply.type == DAEMON_ERROR) {
+				failures[index]++;
+			}
+			latencies[index].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started[reply.id]).count());
+		}
+	};
+
+	auto start = Clock::now();
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < connections; i++) {
+		threads.emplace_back(drive, i);
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<u64> all;
+	size_t failed = 0;
+	for (size_t i = 0; i < connections; i++) {
+		all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+		failed += failures[i];
+	}
+	std::sort(all.begin(), all.end());
+
+	auto percentile = [&](double fraction) {
+		if (all.empty()) return 0.0;
+		size_t rank = std::clamp<size_t>((size_t)(fraction * all.size() + 0.999999), 1, all.size());
+		return all[rank - 1] / 1000.0;
+	};
+
+	char line[160];
+	std::snprintf(line, sizeof(line), "%zu jobs in %.3f s: %.0f jobs/s, %zu failed\n", all.size(), seconds, all.size() / seconds, failed);
+	std::cout << line;
+	std::snprintf(line, sizeof(line), "latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+		percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), all.empty() ? 0.0 : all.back() / 1000.0);
+	std::cout << line;
+
+	DaemonClient client;
+	std::string error;
+	DaemonClient::Reply reply;
+	if (client.connect(address, error)) {
+		client.send_stats();
+		if (client.flush() && client.receive(reply)) {
+			std::cout << "daemon: " << reply.text << std::endl;
+		}
+	}
+
+	return failed == 0 ? 0 : 1;
+}
+
+// Lists the frames of a frame file, optionally writing each as a PPM image
+static int PrintFrames(char *program, int argc, char **argv) {
+	if (argc < 1) {
+		Usage(program);
+		std::cerr << "Missing frame file!" << std::endl;
+		exit(1);
+	}
+
+	std::string path = Shift(argc, &argv);
+	std::string ppm_prefix;
+
+	while (argc > 0) {
+		std::string flag = Shift(argc, &argv);
+		if (argc > 0 && flag == "--ppm") {
+			ppm_prefix = Shift(argc, &argv);
+		} else {
+			Usage(program);
+			std::cerr << "Invalid frames argument: " << flag << std::endl;
+			exit(1);
+		}
+	}
+
+	FrameReader reader;
+	std::string error;
+	if (!reader.open(path, error)) {
+		std::cerr << "Cannot read frames " << path << ": " << error << std::endl;
+		exit(1);
+	}
+
+	char line[64];
+	for (u64 index = 0; reader.next(); index++) {
+		std::snprintf(line, sizeof(line), "%6llu  cycle %12llu  %2zu rows\n",
+			(unsigned long long)index, (unsigned long long)reader.cycle(), reader.rows_changed());
+		std::cout << line;
+
+		if (ppm_prefix.empty()) continue;
+
+		std::snprintf(line, sizeof(line), "%06llu.ppm", (unsigned long long)index);
+		std::string image_path = ppm_prefix + line;
+		std::ofstream image(image_path, std::ios::binary);
+		if (!image) {
+			std::cerr << "Failed to open image: " << image_path << std::endl;
+			exit(1);
+		}
+		image << "P6\n" << FRAMEBUFFER_WIDTH << " " << FRAMEBUFFER_HEIGHT << "\n255\n";
+		image.write(reinterpret_cast<const char *>(reader.pixels()), FRAMEBUFFER_SIZE);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *programFile = Shift(argc, &argv);
+	if (argc < 1) {
+		Usage(programFile);
+		std::cerr << "Missing subcommand!" << std::endl;
+		exit(1);
+	}
+
+	std::string subcommand = Shift(argc, &argv);
+	if (subcommand == "run") {
+		return RunProgram(programFile, argc, argv);
+	}
+	if (subcommand == "replay") {
+		return ReplayRecording(programFile, argc, argv);
+	}
+	if (subcommand == "trace") {
+		return PrintTrace(programFile, argc, argv);
+	}
+	if (subcommand == "frames") {
+		return PrintFrames(programFile, argc, argv);
+	}
+	if (subcommand == "batch") {
+		return RunBatch(programFile, argc, argv);
+	}
+	if (subcommand == "serve") {
+		return ServeJobs(programFile, argc, argv);
+	}
+	if (subcommand == "submit") {
+		return SubmitJobs(programFile, argc, argv);
+	}
+	if (subcommand == "loadgen") {
+		return GenerateLoad(programFile, argc, argv);
+	}
+
+	Usage(programFile);
+	std::cerr << "Invalid subcommand: " << subcommand << std::endl;
+	exit(1);
+}